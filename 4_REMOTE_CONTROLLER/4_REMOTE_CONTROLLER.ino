@@ -108,7 +108,7 @@ void setup() {
   
   espNow.begin();
   espNow.onDataReceived(onDataRecv);
-  esp_now_register_send_cb(onDataSent);
+  espNow.onDataSent(onDataSent); // Il callback della libreria fa avanzare la coda TX
 
   // --- SAFETY CHECK FOR STUCK BUTTONS AT BOOT ---
   // If a button is held down during boot (e.g. after a reset), wait for it to be released
@@ -166,6 +166,9 @@ void loop() {
     return; // SKIP ALL OTHER LOGIC IN CONFIG MODE
   }
 
+  // Coda di trasmissione ESP-NOW (ACK e ritrasmissioni)
+  espNow.loop();
+
   // Check Buttons (TTP223 Active High: Pressed = HIGH)
   int pressedBtn = -1;
   
@@ -378,7 +381,7 @@ void enterSleep() {
   
   espNow.begin();
   espNow.onDataReceived(onDataRecv);
-  esp_now_register_send_cb(onDataSent);
+  espNow.onDataSent(onDataSent);
 }
 
 void handleButtonPress(int btnIndex) {
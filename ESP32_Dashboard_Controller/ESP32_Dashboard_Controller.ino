@@ -474,7 +474,7 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length) {
                  String evt = doc["eventType"].as<String>();
                  String msg = doc.containsKey("message") ? doc["message"].as<String>() : "";
                  
-                 if (evt.startsWith("ota_") || evt == "error" || evt == "peer_removed") {
+                 if (evt.startsWith("ota_") || evt == "error" || evt == "peer_removed" || evt == "command_failed") {
                     DevLog.printf("[GW-EVENT] %s: %s - %s\n", gwId.c_str(), evt.c_str(), msg.c_str());
                 }
                 
@@ -482,6 +482,7 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length) {
                 else if (evt == "ota_success") gw.mqttStatus = "OTA Success!";
                 else if (evt == "ota_failed") gw.mqttStatus = "OTA Failed";
                 else if (evt == "error") gw.mqttStatus = "Error: " + msg;
+                else if (evt == "command_failed") gw.mqttStatus = "Command Failed: " + msg;
                 else if (evt == "peer_removed") {
                      gw.mqttStatus = "Peer Removed";
                      // Gestione Rimozione Peer
@@ -612,6 +613,22 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length) {
             saveNetworkState();
         }
     }
+    // 2b. Stato retained per nodo: <prefix>/nodo/<nodeId>/state (solo attributi)
+    else if (topicStr.endsWith("/state") && topicStr.indexOf("/nodo/") > 0) {
+        int nodeStart = topicStr.indexOf("/nodo/") + 6;
+        String nodeId = topicStr.substring(nodeStart, topicStr.length() - 6);
+
+        if (nodeId.length() > 0 && doc.containsKey("attributes")) {
+            // Nodo sconosciuto: arriverà con LIST_PEERS, qui si aggiorna solo lo stato
+            for (auto& kv : peers) {
+                if (kv.second.nodeId == nodeId) {
+                    kv.second.attributes = doc["attributes"].as<String>();
+                    saveNetworkState();
+                    break;
+                }
+            }
+        }
+    }
     // 4. Dashboard Discovery Request
     else if (topicStr.endsWith("/dashboard/discovery")) {
         DevLog.println("[MQTT] Ricevuta richiesta discovery dashboard");
@@ -702,12 +719,14 @@ void connectMQTT() {
         DevLog.println("Connesso!");
         String subGateway = "+/gateway/status"; 
         String subNode = "+/nodo/status";       
+        String subNodeState = "+/nodo/+/state";
         String subReport = "+/gateway/report";
         String subResponse = "+/gateway/response";
         String subDiscovery = "+/dashboard/discovery";
         
         mqttClient.subscribe(subGateway.c_str());
         mqttClient.subscribe(subNode.c_str());
+        mqttClient.subscribe(subNodeState.c_str());
         mqttClient.subscribe(subReport.c_str());
         mqttClient.subscribe(subResponse.c_str());
         mqttClient.subscribe(subDiscovery.c_str());
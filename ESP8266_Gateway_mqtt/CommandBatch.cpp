@@ -0,0 +1,266 @@
+#include "CommandBatch.h"
+#include "PeerHandler.h"
+#include "MqttHandler.h"
+#include "MqttJsonWriter.h"
+#include "MqttTopics.h"
+#include "WebLog.h"
+#include <ArduinoJson.h>
+
+uint32_t batchesReceived = 0;
+uint32_t batchesRejected = 0;
+uint32_t batchTargetsSent = 0;
+
+enum BatchTargetState : uint8_t {
+    TARGET_PENDING = 0,   // Da inviare
+    TARGET_SENT,          // In attesa di risposta
+    TARGET_OK,
+    TARGET_FAILED,        // Nessuna risposta dopo i tentativi di CommandTracker
+    TARGET_UNTRACKED,     // Inviato con pool comandi pieno: esito sconosciuto
+    TARGET_TIMEOUT,       // Ancora aperto alla scadenza del batch
+    TARGET_OFFLINE,
+    TARGET_INVALID
+};
+
+// Stesso ordine di BatchTargetState
+static const char* const targetStateNames[] = {
+    "pending", "sent", "ok", "failed", "untracked", "timeout", "offline", "invalid"
+};
+
+struct BatchTarget {
+    char node[sizeof(Peer::nodeId)];   // Per nome: gli indici dei peer possono spostarsi
+    char entity[24];
+    char action[12];
+    const char* command;               // Comando firmware (stringa costante)
+    uint8_t state;
+};
+
+static struct {
+    bool active;
+    uint8_t generation;                // Nel tag: scarta gli esiti di batch precedenti
+    char id[BATCH_ID_MAX];
+    uint8_t count;
+    uint8_t toSend;
+    uint8_t open;                      // Target da inviare o in attesa di esito
+    int lastPeer;
+    unsigned long startedAt;
+    unsigned long lastSendAt;
+    BatchTarget targets[BATCH_MAX_TARGETS];
+} batch;
+
+// Documento per il batch più grande: oggetto radice {batch, targets}, array dei target
+// e un oggetto (o array) da 3 campi per target; le stringhe restano nel payload
+#define BATCH_JSON_CAPACITY \
+    (JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(BATCH_MAX_TARGETS) + BATCH_MAX_TARGETS * JSON_OBJECT_SIZE(3))
+static_assert(JSON_OBJECT_SIZE(3) == JSON_ARRAY_SIZE(3), "Target in forma compatta più grande della forma a oggetto");
+static_assert(BATCH_JSON_CAPACITY <= 2048, "Documento del batch troppo grande per lo stack");
+
+// tag = generazione (3 bit) | indice target + 1 (5 bit); mai 0
+static uint8_t targetTag(uint8_t index) {
+    return (batch.generation << 5) | (index + 1);
+}
+
+bool commandBatchActive() {
+    return batch.active;
+}
+
+static void copyField(char* dest, size_t size, const char* src) {
+    strncpy(dest, src ? src : "", size - 1);
+    dest[size - 1] = '\0';
+}
+
+// --- RISULTATO --- //
+static void publishBatchRejected(const char* id, const char* error) {
+    batchesRejected++;
+    DevLog.printf("⚠️ Batch %s rifiutato: %s\n", id, error);
+    mqttPublishJson(mqttTopic(TOPIC_NODE_BATCH_RESULT), false, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("batch", id);
+        json.add("error", error);
+        json.endObject();
+    });
+}
+
+static void finishBatch() {
+    uint8_t ok = 0, failed = 0, unconfirmed = 0;
+    for (uint8_t k = 0; k < batch.count; k++) {
+        BatchTarget& target = batch.targets[k];
+        if (target.state == TARGET_SENT) target.state = TARGET_TIMEOUT;
+        if (target.state == TARGET_OK) ok++;
+        else if (target.state == TARGET_UNTRACKED) unconfirmed++;
+        else failed++;
+    }
+    unsigned long duration = millis() - batch.startedAt;
+
+    DevLog.printf("📦 Batch %s concluso in %lu ms: %u ok, %u falliti, %u non confermati\n",
+                  batch.id, duration, ok, failed, unconfirmed);
+    mqttPublishJson(mqttTopic(TOPIC_NODE_BATCH_RESULT), false, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("batch", batch.id);
+        json.add("ok", (unsigned int) ok);
+        json.add("failed", (unsigned int) failed);
+        json.add("unconfirmed", (unsigned int) unconfirmed);
+        json.add("durationMs", duration);
+        json.beginArray("targets");
+        for (uint8_t k = 0; k < batch.count; k++) {
+            const BatchTarget& target = batch.targets[k];
+            json.beginObject();
+            json.add("node", target.node);
+            json.add("entity", target.entity);
+            json.add("action", target.action);
+            json.add("result", targetStateNames[target.state]);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+    });
+    batch.active = false;
+}
+
+// --- VALIDAZIONE --- //
+static uint8_t validateTarget(uint8_t index) {
+    BatchTarget& target = batch.targets[index];
+    target.command = NULL;
+
+    int i = findPeerByNodeId(target.node);
+    if (i < 0) return TARGET_INVALID;
+
+    target.command = resolveEntityCommand(i, target.entity, target.action);
+    if (target.command == NULL) return TARGET_INVALID;
+
+    // Due azioni sulla stessa entità nello stesso batch: vale solo la prima
+    for (uint8_t k = 0; k < index; k++) {
+        const BatchTarget& other = batch.targets[k];
+        if (other.state != TARGET_INVALID && strcmp(other.node, target.node) == 0 &&
+            strcmp(other.entity, target.entity) == 0) {
+            return TARGET_INVALID;
+        }
+    }
+
+    return peerList[i].isOnline ? TARGET_PENDING : TARGET_OFFLINE;
+}
+
+void processNodeBatch(byte* payload, unsigned int length) {
+    batchesReceived++;
+
+    // Parsing in place: le stringhe puntano nel buffer MQTT e vengono copiate nel batch
+    // prima di uscire, così il documento contiene solo la struttura
+    StaticJsonDocument<BATCH_JSON_CAPACITY> doc;
+    DeserializationError error = deserializeJson(doc, (char*) payload, length);
+    if (error) {
+        // Un batch completo oltre BATCH_MAX_TARGETS finisce qui (NoMemory): chi lo ha
+        // inviato riceve comunque un risultato
+        DevLog.printf("Errore parsing JSON batch: %s\n", error.c_str());
+        publishBatchRejected("", "invalid_json");
+        return;
+    }
+
+    char id[BATCH_ID_MAX];
+    copyField(id, sizeof(id), doc["batch"] | "");
+    JsonArray targets = doc["targets"];
+
+    if (batch.active) {
+        publishBatchRejected(id, "busy");
+        return;
+    }
+    if (targets.isNull() || targets.size() == 0) {
+        publishBatchRejected(id, "no_targets");
+        return;
+    }
+    // Target con meno campi occupano meno del previsto e possono superare il massimo
+    if (targets.size() > BATCH_MAX_TARGETS) {
+        publishBatchRejected(id, "too_many_targets");
+        return;
+    }
+
+    memcpy(batch.id, id, sizeof(batch.id));
+    batch.count = 0;
+    batch.toSend = 0;
+    for (JsonVariant t : targets) {
+        BatchTarget& target = batch.targets[batch.count];
+        if (t.is<JsonArray>()) {
+            copyField(target.node, sizeof(target.node), t[0] | "");
+            copyField(target.entity, sizeof(target.entity), t[1] | "");
+            copyField(target.action, sizeof(target.action), t[2] | "");
+        } else {
+            copyField(target.node, sizeof(target.node), t["node"] | "");
+            copyField(target.entity, sizeof(target.entity), t["entity"] | "");
+            copyField(target.action, sizeof(target.action), t["action"] | "");
+        }
+        target.state = validateTarget(batch.count);
+        if (target.state == TARGET_PENDING) batch.toSend++;
+        batch.count++;
+    }
+
+    batch.generation = (batch.generation + 1) & 0x07;
+    batch.open = batch.toSend;
+    batch.lastPeer = -1;
+    batch.startedAt = millis();
+    batch.lastSendAt = batch.startedAt - BATCH_PACE_MS;
+    batch.active = true;
+
+    DevLog.printf("📦 Batch %s: %u target, %u da inviare\n", batch.id, batch.count, batch.toSend);
+    if (batch.open == 0) finishBatch();
+}
+
+// --- INVIO CADENZATO --- //
+// Primo target da inviare su un nodo diverso dall'ultimo (i frame per lo stesso peer
+// verrebbero comunque serializzati dalla coda radio), altrimenti il primo in attesa
+static int nextTarget() {
+    int fallback = -1;
+    for (uint8_t k = 0; k < batch.count; k++) {
+        if (batch.targets[k].state != TARGET_PENDING) continue;
+        int i = findPeerByNodeId(batch.targets[k].node);
+        if (i != batch.lastPeer) return k;
+        if (fallback < 0) fallback = k;
+    }
+    return fallback;
+}
+
+static void sendTarget(uint8_t index) {
+    BatchTarget& target = batch.targets[index];
+    batch.toSend--;
+
+    // Il peer potrebbe essere stato rimosso o andato offline dopo la validazione
+    int i = findPeerByNodeId(target.node);
+    if (i < 0 || !peerList[i].isOnline) {
+        target.state = (i < 0) ? TARGET_INVALID : TARGET_OFFLINE;
+        batch.open--;
+        return;
+    }
+
+    batch.lastPeer = i;
+    batchTargetsSent++;
+    if (sendEntityCommand(i, target.entity, target.command, targetTag(index)) >= 0) {
+        target.state = TARGET_SENT;
+    } else {
+        target.state = TARGET_UNTRACKED;
+        batch.open--;
+    }
+}
+
+void commandBatchLoop() {
+    if (!batch.active) return;
+    unsigned long now = millis();
+
+    if (batch.toSend > 0 && now - batch.lastSendAt >= BATCH_PACE_MS &&
+        DomoticaEspNow::txQueueCount() < DOMOTICA_TX_QUEUE / 2) {
+        int k = nextTarget();
+        if (k >= 0) sendTarget(k);
+        batch.lastSendAt = now;
+    }
+
+    if (batch.open == 0 || (batch.toSend == 0 && now - batch.lastSendAt >= BATCH_TIMEOUT_MS)) {
+        finishBatch();
+    }
+}
+
+void commandBatchOutcome(uint8_t tag, bool delivered) {
+    if (!batch.active || (tag >> 5) != batch.generation) return;
+    uint8_t index = (tag & 0x1F) - 1;
+    if (index >= batch.count) return;
+
+    BatchTarget& target = batch.targets[index];
+    if (target.state != TARGET_SENT) return;
+    target.state = delivered ? TARGET_OK : TARGET_FAILED;
+    batch.open--;
+}
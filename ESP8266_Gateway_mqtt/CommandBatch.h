@@ -0,0 +1,38 @@
+#ifndef COMMAND_BATCH_H
+#define COMMAND_BATCH_H
+
+#include <Arduino.h>
+
+// --- COMANDI BATCH (SCENE) --- //
+// Un solo messaggio su <prefix>/nodo/batch elenca molte tuple (nodo, entità, azione):
+//   {"batch":"sera","targets":[{"node":"SALA","entity":"relay_1","action":"OFF"}, ...]}
+// oppure in forma compatta: {"batch":"sera","targets":[["SALA","relay_1","OFF"], ...]}
+// Il batch viene validato una volta sola; gli invii radio partono dal loop, uno ogni
+// BATCH_PACE_MS e solo con spazio nella coda ESP-NOW, alternando i nodi. L'esito di ogni
+// target arriva da CommandTracker; a batch concluso un unico messaggio su
+// <prefix>/nodo/batch/result riporta il risultato per target.
+// Un batch alla volta: quello che arriva mentre un altro è in corso viene rifiutato ("busy").
+// JSON non valido o oltre la capacità del documento (dimensionato su BATCH_MAX_TARGETS
+// target da 3 campi) producono comunque un risultato, con "error":"invalid_json".
+
+#define BATCH_MAX_TARGETS  16
+#define BATCH_PACE_MS      25
+#define BATCH_TIMEOUT_MS   20000   // Dall'ultimo invio: i target ancora aperti vanno in "timeout"
+#define BATCH_ID_MAX       24
+
+// Payload dal callback MQTT (modificabile: il parsing avviene in place)
+void processNodeBatch(byte* payload, unsigned int length);
+
+// Invii cadenzati e chiusura del batch (chiamata dal loop)
+void commandBatchLoop();
+
+// Esito di un comando tracciato con tag di batch (chiamata da CommandTracker)
+void commandBatchOutcome(uint8_t tag, bool delivered);
+
+bool commandBatchActive();
+
+extern uint32_t batchesReceived;
+extern uint32_t batchesRejected;
+extern uint32_t batchTargetsSent;
+
+#endif
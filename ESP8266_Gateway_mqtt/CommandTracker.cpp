@@ -0,0 +1,368 @@
+#include "CommandTracker.h"
+#include "PeerHandler.h"
+#include "EspNowHandler.h"
+#include "MqttHandler.h"
+#include "NodeTypeManager.h"
+#include "CommandBatch.h"
+#include "HashUtils.h"
+#include "WebLog.h"
+
+#define CMD_NONE      0xFF
+#define ENTITY_OTHER  0xFF   // Topic senza entità (CONTROL, ...): confrontato per nome
+
+uint32_t commandsTracked = 0;
+uint32_t commandsResolved = 0;
+uint32_t commandTimeouts = 0;
+uint32_t commandRetries = 0;
+uint32_t commandsFailed = 0;
+uint32_t commandPoolExhausted = 0;
+uint8_t commandPoolHighWater = 0;
+
+struct TrackedCommand {
+    unsigned long deadline;
+    unsigned long sentAt;    // Ultima trasmissione
+    uint8_t mac[6];          // Chiave del peer: resta valida quando gli indici di peerList si spostano
+    uint8_t entity;
+    uint8_t wheelSlot;
+    uint8_t wheelPrev;
+    uint8_t wheelNext;
+    uint8_t bucketNext;      // Catena hash, oppure lista libera
+    uint8_t attempts;        // Ritrasmissioni già fatte
+    uint8_t tag;             // Target di batch (0 = nessuno)
+    bool retry;              // Idempotente: si può ritrasmettere
+    char topic[24];          // Per ENTITY_OTHER, le ritrasmissioni e il log
+    char command[6];         // "1" / "0", maschera di un comando GROUP
+    char status[DOMOTICA_GROUP_MAX_CHANNELS + 1];
+};
+
+static TrackedCommand pool[COMMAND_POOL_SIZE];
+static uint8_t freeHead = CMD_NONE;
+static uint8_t buckets[COMMAND_HASH_BUCKETS];
+static uint8_t wheel[COMMAND_WHEEL_SLOTS];
+static uint8_t pendingCount = 0;
+static unsigned long wheelTick = 0;
+static bool initialized = false;
+
+static void resetPool() {
+    for (uint8_t i = 0; i < COMMAND_POOL_SIZE; i++) {
+        pool[i].bucketNext = (i + 1 < COMMAND_POOL_SIZE) ? i + 1 : CMD_NONE;
+    }
+    freeHead = 0;
+    memset(buckets, CMD_NONE, sizeof(buckets));
+    memset(wheel, CMD_NONE, sizeof(wheel));
+    pendingCount = 0;
+    wheelTick = millis() / COMMAND_WHEEL_TICK;
+    initialized = true;
+}
+
+uint8_t commandTrackerPending() {
+    return pendingCount;
+}
+
+// --- CHIAVI --- //
+// Indice dell'entità nel tipo del nodo; "relay_N" fuori registro (come nel percorso comandi)
+// dopo gli indici del registro, così non si sovrappone a un'altra entità
+static uint8_t entityKey(int peerIndex, const char* topic) {
+    int count = 0;
+    const NodeEntity* entities = NodeTypeManager::getEntities(peerList[peerIndex].nodeType, &count);
+    for (int k = 0; k < count; k++) {
+        if (strcmp(topic, entities[k].suffix) == 0) return k;
+    }
+    if (strncmp(topic, "relay_", 6) == 0) {
+        int n = atoi(topic + 6);
+        if (n >= 1 && n <= NODETYPE_MAX_PER_TYPE) return NODETYPE_MAX_PER_TYPE + n - 1;
+    }
+    return ENTITY_OTHER;
+}
+
+static uint8_t bucketOf(const uint8_t* mac, uint8_t entity) {
+    return fnv1a(mac, 6, FNV1A_OFFSET ^ entity) & (COMMAND_HASH_BUCKETS - 1);
+}
+
+static uint8_t findCommand(const uint8_t* mac, uint8_t entity, const char* topic, uint8_t* prev) {
+    *prev = CMD_NONE;
+    for (uint8_t i = buckets[bucketOf(mac, entity)]; i != CMD_NONE; i = pool[i].bucketNext) {
+        const TrackedCommand& cmd = pool[i];
+        if (cmd.entity == entity && memcmp(cmd.mac, mac, 6) == 0 &&
+            (entity != ENTITY_OTHER || strcmp(cmd.topic, topic) == 0)) {
+            return i;
+        }
+        *prev = i;
+    }
+    return CMD_NONE;
+}
+
+// --- TIMER WHEEL --- //
+static void wheelLink(uint8_t i) {
+    TrackedCommand& cmd = pool[i];
+    // Slot del tick in cui la scadenza è già passata (arrotondato per eccesso)
+    cmd.wheelSlot = ((cmd.deadline + COMMAND_WHEEL_TICK - 1) / COMMAND_WHEEL_TICK) & (COMMAND_WHEEL_SLOTS - 1);
+    cmd.wheelPrev = CMD_NONE;
+    cmd.wheelNext = wheel[cmd.wheelSlot];
+    if (cmd.wheelNext != CMD_NONE) pool[cmd.wheelNext].wheelPrev = i;
+    wheel[cmd.wheelSlot] = i;
+}
+
+static void wheelUnlink(uint8_t i) {
+    TrackedCommand& cmd = pool[i];
+    if (cmd.wheelPrev != CMD_NONE) {
+        pool[cmd.wheelPrev].wheelNext = cmd.wheelNext;
+    } else {
+        wheel[cmd.wheelSlot] = cmd.wheelNext;
+    }
+    if (cmd.wheelNext != CMD_NONE) pool[cmd.wheelNext].wheelPrev = cmd.wheelPrev;
+}
+
+static void release(uint8_t i, uint8_t bucketPrev) {
+    TrackedCommand& cmd = pool[i];
+    wheelUnlink(i);
+    if (bucketPrev != CMD_NONE) {
+        pool[bucketPrev].bucketNext = cmd.bucketNext;
+    } else {
+        buckets[bucketOf(cmd.mac, cmd.entity)] = cmd.bucketNext;
+    }
+    cmd.bucketNext = freeHead;
+    freeHead = i;
+    pendingCount--;
+}
+
+// Chiude un comando senza risposta: command_failed su MQTT ed esito del target di batch
+static void failCommand(uint8_t i, const char* message) {
+    TrackedCommand& cmd = pool[i];
+    publishGatewayStatus("command_failed", message, "NODE_COMMAND");
+    commandsFailed++;
+
+    uint8_t tag = cmd.tag;
+    uint8_t prev;
+    findCommand(cmd.mac, cmd.entity, cmd.topic, &prev);
+    release(i, prev);
+    if (tag != 0) commandBatchOutcome(tag, false);
+}
+
+// Comandi del peer con questo MAC (NULL = tutti) chiusi come falliti. Si scorrono le
+// liste della wheel: ogni comando in attesa è in esattamente una di esse.
+static void failPending(const uint8_t* mac, const char* reason) {
+    for (uint8_t slot = 0; slot < COMMAND_WHEEL_SLOTS && pendingCount > 0; slot++) {
+        uint8_t i = wheel[slot];
+        while (i != CMD_NONE) {
+            uint8_t next = pool[i].wheelNext;
+            TrackedCommand& cmd = pool[i];
+            if (mac == NULL || memcmp(cmd.mac, mac, 6) == 0) {
+                int p = findPeerByMac(cmd.mac);
+                char message[96];
+                snprintf(message, sizeof(message), "%s: command %s/%s dropped",
+                         reason, p >= 0 ? peerList[p].nodeId : macToString(cmd.mac).c_str(), cmd.topic);
+                DevLog.printf("⚠️ %s\n", message);
+                failCommand(i, message);
+            }
+            i = next;
+        }
+    }
+}
+
+void commandTrackerDropPeer(const uint8_t* mac) {
+    if (!initialized || pendingCount == 0) return;
+    failPending(mac, "Node removed");
+}
+
+void commandTrackerClear() {
+    if (initialized && pendingCount > 0) failPending(NULL, "Peer table cleared");
+    resetPool();
+}
+
+// --- STIMA RTT --- //
+static void rttSample(Peer& peer, unsigned long elapsed) {
+    PeerRtt& rtt = peer.rtt;
+    int32_t m = elapsed > 0 ? (elapsed < 0xFFFF ? elapsed : 0xFFFF) : 1;
+
+    if (rtt.srtt8 == 0) {
+        rtt.srtt8 = min(m << 3, (int32_t) 0xFFFF);
+        rtt.rttvar4 = min(m << 1, (int32_t) 0xFFFF);
+    } else {
+        // SRTT += err/8, RTTVAR += (|err| - RTTVAR)/4 nelle rispettive scale
+        int32_t err = m - (rtt.srtt8 >> 3);
+        int32_t srtt8 = rtt.srtt8 + err;
+        if (err < 0) err = -err;
+        int32_t rttvar4 = rtt.rttvar4 + err - (rtt.rttvar4 >> 2);
+        rtt.srtt8 = constrain(srtt8, (int32_t) 8, (int32_t) 0xFFFF);
+        rtt.rttvar4 = constrain(rttvar4, (int32_t) 0, (int32_t) 0xFFFF);
+    }
+
+    rtt.samples[rtt.sampleNext] = m;
+    rtt.sampleNext = (rtt.sampleNext + 1) % PEER_RTT_SAMPLES;
+    if (rtt.sampleCount < PEER_RTT_SAMPLES) rtt.sampleCount++;
+}
+
+uint16_t commandTrackerRto(int peerIndex) {
+    if (peerIndex < 0 || peerIndex >= peerCount) return COMMAND_RTO_INITIAL_MS;
+    const PeerRtt& rtt = peerList[peerIndex].rtt;
+    if (rtt.srtt8 == 0) return COMMAND_RTO_INITIAL_MS;
+
+    // RTO = SRTT + max(G, 4*RTTVAR), G = granularità della wheel
+    uint32_t rto = (rtt.srtt8 >> 3) + max((uint32_t) COMMAND_WHEEL_TICK, (uint32_t) rtt.rttvar4);
+    return constrain(rto, (uint32_t) COMMAND_RTO_MIN_MS, (uint32_t) COMMAND_RTO_MAX_MS);
+}
+
+void commandTrackerPercentiles(int peerIndex, uint16_t* p50, uint16_t* p95) {
+    *p50 = *p95 = 0;
+    if (peerIndex < 0 || peerIndex >= peerCount) return;
+    const PeerRtt& rtt = peerList[peerIndex].rtt;
+    uint8_t n = rtt.sampleCount;
+    if (n == 0) return;
+
+    // Insertion sort di al massimo PEER_RTT_SAMPLES valori, percentile nearest-rank
+    uint16_t sorted[PEER_RTT_SAMPLES];
+    for (uint8_t k = 0; k < n; k++) {
+        uint16_t v = rtt.samples[k];
+        int8_t j = k - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    *p50 = sorted[(n + 1) / 2 - 1];
+    *p95 = sorted[(n * 95 + 99) / 100 - 1];
+}
+
+// --- API --- //
+int commandTrackerAdd(int peerIndex, const char* topic, const char* command, const char* status, bool retry, uint8_t tag) {
+    if (!initialized) resetPool();
+    if (peerIndex < 0 || peerIndex >= peerCount) return -1;
+
+    const uint8_t* mac = peerList[peerIndex].mac;
+    uint8_t entity = entityKey(peerIndex, topic);
+    uint8_t prev;
+    uint8_t i = findCommand(mac, entity, topic, &prev);
+
+    if (i != CMD_NONE) {
+        // Stesso comando ripetuto: si rinnova la scadenza. Un target di batch sostituito
+        // da un altro target si chiude come non confermato; un comando singolo lo eredita.
+        wheelUnlink(i);
+        if (tag == 0) {
+            tag = pool[i].tag;
+        } else if (pool[i].tag != 0 && pool[i].tag != tag) {
+            commandBatchOutcome(pool[i].tag, false);
+        }
+    } else {
+        if (freeHead == CMD_NONE) {
+            commandPoolExhausted++;
+            DevLog.printf("⚠️ Pool comandi pieno: %s/%s non tracciato\n", peerList[peerIndex].nodeId, topic);
+            return -1;
+        }
+        i = freeHead;
+        freeHead = pool[i].bucketNext;
+
+        TrackedCommand& cmd = pool[i];
+        memcpy(cmd.mac, mac, 6);
+        cmd.entity = entity;
+        strncpy(cmd.topic, topic, sizeof(cmd.topic) - 1);
+        cmd.topic[sizeof(cmd.topic) - 1] = '\0';
+        uint8_t bucket = bucketOf(mac, entity);
+        cmd.bucketNext = buckets[bucket];
+        buckets[bucket] = i;
+
+        pendingCount++;
+        if (pendingCount > commandPoolHighWater) commandPoolHighWater = pendingCount;
+    }
+
+    TrackedCommand& cmd = pool[i];
+    // Si ritrasmette solo ciò che entra intero nell'entry
+    cmd.retry = retry && command != NULL && strlen(topic) < sizeof(cmd.topic) &&
+                strlen(command) < sizeof(cmd.command) &&
+                (status == NULL || strlen(status) < sizeof(cmd.status));
+    if (cmd.retry) {
+        strcpy(cmd.command, command);
+        strcpy(cmd.status, status ? status : "");
+    }
+    cmd.attempts = 0;
+    cmd.tag = tag;
+    cmd.sentAt = millis();
+    cmd.deadline = cmd.sentAt + commandTrackerRto(peerIndex);
+    wheelLink(i);
+    commandsTracked++;
+    return i;
+}
+
+bool commandTrackerResolve(int peerIndex, const char* topic) {
+    if (!initialized || pendingCount == 0) return false;
+    if (peerIndex < 0 || peerIndex >= peerCount) return false;
+
+    uint8_t prev;
+    uint8_t i = findCommand(peerList[peerIndex].mac, entityKey(peerIndex, topic), topic, &prev);
+    if (i == CMD_NONE) return false;
+
+    // Karn: dopo una ritrasmissione non si sa a quale invio risponde il nodo
+    if (pool[i].attempts == 0) {
+        rttSample(peerList[peerIndex], millis() - pool[i].sentAt);
+    }
+    uint8_t tag = pool[i].tag;
+    release(i, prev);
+    commandsResolved++;
+    if (tag != 0) commandBatchOutcome(tag, true);
+    return true;
+}
+
+// Ritrasmette un comando idempotente scaduto. false se i tentativi sono esauriti.
+static bool retransmit(uint8_t i, int peerIndex, unsigned long now) {
+    TrackedCommand& cmd = pool[i];
+    if (!cmd.retry || cmd.attempts >= COMMAND_MAX_RETRIES || peerIndex < 0) return false;
+    Peer& peer = peerList[peerIndex];
+    if (!peer.isOnline) return false;
+
+    espNow.sendReliable(peer.mac, peer.nodeId, cmd.topic, cmd.command, cmd.status, "COMMAND", gateway_id);
+    cmd.attempts++;
+    commandRetries++;
+
+    // Backoff esponenziale sull'RTO del peer
+    uint32_t rto = (uint32_t) commandTrackerRto(peerIndex) << cmd.attempts;
+    wheelUnlink(i);
+    cmd.sentAt = now;
+    cmd.deadline = now + min(rto, (uint32_t) COMMAND_RTO_MAX_MS);
+    wheelLink(i);
+
+    DevLog.printf("🔁 Ritrasmissione %u/%d comando %s -> %s/%s\n",
+                  cmd.attempts, COMMAND_MAX_RETRIES, cmd.command, peer.nodeId, cmd.topic);
+    return true;
+}
+
+static void expireSlot(uint8_t slot, unsigned long now) {
+    uint8_t i = wheel[slot];
+    while (i != CMD_NONE) {
+        uint8_t next = pool[i].wheelNext;
+        TrackedCommand& cmd = pool[i];
+        if ((long) (now - cmd.deadline) >= 0) {
+            commandTimeouts++;
+            int p = findPeerByMac(cmd.mac);
+            // Il nuovo deadline cade in uno slot successivo: next resta valido
+            if (!retransmit(i, p, now)) {
+                // FIX: Non marcare offline su timeout comando singolo.
+                // Lascia che sia il heartbeat o il ping a decidere se è offline.
+                const char* nodeId = p >= 0 ? peerList[p].nodeId : "?";
+                DevLog.printf("TIMEOUT comando per nodo %s (Topic: %s) dopo %u tentativi - Command discarded (Node status preserved)\n",
+                              nodeId, cmd.topic, cmd.attempts + 1);
+
+                char message[96];
+                snprintf(message, sizeof(message), "No feedback from %s/%s after %u attempts",
+                         nodeId, cmd.topic, cmd.attempts + 1);
+                failCommand(i, message);
+            }
+        }
+        i = next;
+    }
+}
+
+void commandTrackerExpire() {
+    if (!initialized) return;
+    unsigned long now = millis();
+    unsigned long nowTick = now / COMMAND_WHEEL_TICK;
+
+    // Solo i tick conclusi; dopo un blocco lungo del loop al massimo un giro completo
+    uint8_t steps = 0;
+    while (wheelTick != nowTick && steps < COMMAND_WHEEL_SLOTS) {
+        if (pendingCount > 0) expireSlot(wheelTick & (COMMAND_WHEEL_SLOTS - 1), now);
+        wheelTick++;
+        steps++;
+    }
+    wheelTick = nowTick;
+}
@@ -0,0 +1,62 @@
+#ifndef COMMAND_TRACKER_H
+#define COMMAND_TRACKER_H
+
+#include <Arduino.h>
+#include "GatewayTypes.h"
+
+// --- COMANDI IN ATTESA DI FEEDBACK --- //
+// Pool a capacità fissa (nessuna String, nessuno spostamento di elementi). Ogni comando
+// è identificato da (MAC del peer, indice entità): la risposta del nodo lo ritrova con una
+// tabella hash a catene, la scadenza è gestita da una timer wheel per cui il loop
+// visita solo lo slot del tick corrente.
+// La chiave è il MAC e non l'indice in peerList, quindi rimuovere un peer tocca solo i
+// suoi comandi (commandTrackerDropPeer): gli altri restano in attesa.
+//
+// Il timeout non è fisso: ogni peer ha SRTT e RTTVAR misurati sulle risposte (Peer::rtt)
+// e RTO = SRTT + 4*RTTVAR. I comandi idempotenti (ON/OFF espliciti) scaduti vengono
+// ritrasmessi con RTO raddoppiato; le risposte a un comando ritrasmesso non producono
+// campioni (algoritmo di Karn). Il fallimento definitivo va su <prefix>/gateway/status
+// con eventType "command_failed".
+
+#define COMMAND_POOL_SIZE      MAX_PENDING_COMMANDS
+#define COMMAND_RTO_INITIAL_MS 1500    // Peer senza campioni
+#define COMMAND_RTO_MIN_MS     200
+#define COMMAND_RTO_MAX_MS     5000    // Il vecchio timeout fisso
+#define COMMAND_MAX_RETRIES    2
+#define COMMAND_WHEEL_SLOTS    64      // Potenza di 2
+#define COMMAND_WHEEL_TICK     100     // ms per slot: la wheel copre 6,4 s, oltre l'RTO massimo
+#define COMMAND_HASH_BUCKETS   32      // Potenza di 2
+
+// Registra un comando inviato (sostituisce quello già in attesa sulla stessa entità).
+// retry: comando idempotente, ritrasmesso come {topic, command, status, "COMMAND"}.
+// tag: se diverso da 0 l'esito (risposta o fallimento definitivo) va a commandBatchOutcome().
+// Ritorna l'handle o -1 se il pool è pieno.
+int commandTrackerAdd(int peerIndex, const char* topic, const char* command, const char* status, bool retry, uint8_t tag = 0);
+
+// Risposta del nodo: chiude il comando in attesa su (peer, topic). false se non c'era.
+bool commandTrackerResolve(int peerIndex, const char* topic);
+
+// Scade i comandi dei tick trascorsi (chiamata dal loop): ritrasmette o dichiara fallito
+void commandTrackerExpire();
+
+// Timeout corrente del peer e percentili degli ultimi PEER_RTT_SAMPLES round-trip (ms)
+uint16_t commandTrackerRto(int peerIndex);
+void commandTrackerPercentiles(int peerIndex, uint16_t* p50, uint16_t* p95);
+
+// Peer rimosso: i suoi comandi in attesa si chiudono come falliti (command_failed ed
+// esito negativo del target di batch)
+void commandTrackerDropPeer(const uint8_t* mac);
+
+// Tabella peer svuotata: tutti i comandi in attesa si chiudono come falliti
+void commandTrackerClear();
+uint8_t commandTrackerPending();
+
+extern uint32_t commandsTracked;
+extern uint32_t commandsResolved;
+extern uint32_t commandTimeouts;         // Scadenze (incluse quelle seguite da ritrasmissione)
+extern uint32_t commandRetries;
+extern uint32_t commandsFailed;          // Nessuna risposta dopo tutti i tentativi
+extern uint32_t commandPoolExhausted;   // Comandi non tracciati per pool pieno
+extern uint8_t commandPoolHighWater;
+
+#endif
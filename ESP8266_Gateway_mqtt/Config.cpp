@@ -35,6 +35,16 @@ bool auto_reboot_enabled = false;
 int auto_reboot_hour = 3;
 int auto_reboot_minute = 0;
 
+// Coalescenza status peer
+unsigned long status_coalesce_ms = 1000;
+
+// Store-and-forward MQTT (spill su flash disattivato di default)
+bool outbox_spill = false;
+
+// Stato per nodo (disattivato di default: resta solo lo stream condiviso /nodo/status)
+bool node_state_topics = false;
+bool legacy_node_status = true;
+
 void loadConfigFromLittleFS() {
     if (!LittleFS.exists("/config.json")) {
         return;
@@ -96,6 +106,11 @@ void loadConfigFromLittleFS() {
     if (doc.containsKey("auto_reboot_hour")) auto_reboot_hour = doc["auto_reboot_hour"];
     if (doc.containsKey("auto_reboot_minute")) auto_reboot_minute = doc["auto_reboot_minute"];
 
+    if (doc.containsKey("status_coalesce_ms")) status_coalesce_ms = doc["status_coalesce_ms"];
+    if (doc.containsKey("outbox_spill")) outbox_spill = doc["outbox_spill"];
+    if (doc.containsKey("node_state_topics")) node_state_topics = doc["node_state_topics"];
+    if (doc.containsKey("legacy_node_status")) legacy_node_status = doc["legacy_node_status"];
+
     // Carica le credenziali WiFi se presenti
     if (doc["wifi_ssid"] && doc["wifi_password"]) {
         strncpy(saved_wifi_ssid, doc["wifi_ssid"], sizeof(saved_wifi_ssid) - 1);
@@ -130,6 +145,11 @@ void saveConfigToLittleFS() {
     doc["auto_reboot_hour"] = auto_reboot_hour;
     doc["auto_reboot_minute"] = auto_reboot_minute;
 
+    doc["status_coalesce_ms"] = status_coalesce_ms;
+    doc["outbox_spill"] = outbox_spill;
+    doc["node_state_topics"] = node_state_topics;
+    doc["legacy_node_status"] = legacy_node_status;
+
     // Salva valori IP solo se modalità statica, altrimenti azzera
     if (strcmp(network_mode, "static") == 0) {
         doc["static_ip"] = static_ip;
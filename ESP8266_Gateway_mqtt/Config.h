@@ -43,6 +43,16 @@ extern bool auto_reboot_enabled;
 extern int auto_reboot_hour;
 extern int auto_reboot_minute;
 
+// --- MQTT STATUS COALESCING --- //
+extern unsigned long status_coalesce_ms; // Finestra minima tra due /nodo/status dello stesso peer
+
+// --- MQTT STORE-AND-FORWARD --- //
+extern bool outbox_spill;               // Eventi oltre la coda in RAM salvati su LittleFS
+
+// --- MQTT STATO PER NODO --- //
+extern bool node_state_topics;          // Stato retained su <prefix>/nodo/<id>/state (HA punta lì)
+extern bool legacy_node_status;         // Con node_state_topics: mantiene anche lo stream condiviso /nodo/status
+
 // --- TIMEOUT CONFIGURATION --- //
 const unsigned long NETWORK_DISCOVERY_TIMEOUT = 5000;  // Increased to 5s
 const unsigned long PING_RESPONSE_TIMEOUT = 10000;     // Increased to 10s (was 3s)
@@ -21,6 +21,15 @@
 #include "HaDiscovery.h"
 #include "NodeTypeManager.h"
 #include "WebLog.h"
+#include "StatusCoalescer.h"
+#include "MqttTopics.h"
+#include "MqttRepublish.h"
+#include "MqttSession.h"
+#include "MqttOutbox.h"
+#include "PeerStore.h"
+#include "CommandTracker.h"
+#include "CommandBatch.h"
+#include "NodeFanout.h"
 
 const char* BUILD_DATE = __DATE__;
 const char* BUILD_TIME = __TIME__;
@@ -35,11 +44,9 @@ ESP8266WebServer configServer(80);
 DNSServer dnsServer;
 
 struct_message myData; // For sending
-struct_message receivedData; // For receiving
 DomoticaEspNow espNow;
 
 // --- FLAGS --- //
-volatile bool newEspNowData = false;
 volatile bool sendPeerListFlag = false;  // Flag per inviare lista peer nel loop principale
 bool configExists = false;  // Flag per indicare se esiste configurazione in LittleFS
 bool otaRunning = false;    // Flag per indicare se è in corso un aggiornamento OTA
@@ -105,10 +112,65 @@ void printGatewayStatus() {
     DevLog.printf("\n📡 ESP-NOW:\n");
     DevLog.printf("   Peer registrati: %d/%d\n", peerCount, MAX_PEERS);
     DevLog.printf("   Modalità rete: %s\n", network_mode);
+    const DomoticaStats& radioStats = DomoticaEspNow::getStats();
+    DevLog.printf("   Frame TX: %lu compatti, %lu legacy (%lu bytes, %lu risparmiati)\n",
+                  (unsigned long)radioStats.framesSentCompact, (unsigned long)radioStats.framesSentLegacy,
+                  (unsigned long)radioStats.bytesSent, (unsigned long)radioStats.bytesSaved);
+    DevLog.printf("   Frame RX: %lu compatti, %lu legacy, %lu non validi\n",
+                  (unsigned long)radioStats.framesRecvCompact, (unsigned long)radioStats.framesRecvLegacy,
+                  (unsigned long)radioStats.framesInvalid);
+    DevLog.printf("   Coda TX: %u/%d (max %u), %lu scartati, %lu pause congestione\n",
+                  DomoticaEspNow::txQueueCount(), DOMOTICA_TX_QUEUE, radioStats.txQueueHighWater,
+                  (unsigned long)radioStats.txDropped, (unsigned long)radioStats.txBackoffs);
+    DevLog.printf("   Slot radio: %u/%d (hit %lu, miss %lu, sfratti %lu)\n",
+                  DomoticaEspNow::peerSlotCount(), DOMOTICA_PEER_SLOTS, (unsigned long)radioStats.peerHits,
+                  (unsigned long)radioStats.peerMisses, (unsigned long)radioStats.peerEvictions);
+    DevLog.printf("   Frammenti: %lu inviati, %lu messaggi ricomposti, %lu incompleti scartati\n",
+                  (unsigned long)radioStats.fragmentsSent, (unsigned long)radioStats.messagesReassembled,
+                  (unsigned long)radioStats.reassemblyDropped);
     
     // Statistiche coda messaggi
     DevLog.printf("\n📊 CODA MESSAGGI:\n");
     printQueueStatus();
+    DevLog.printf("   Status MQTT peer: %lu pubblicati, %lu coalescenti (finestra %lu ms)\n",
+                  (unsigned long)statusPublished, (unsigned long)statusSuppressed, status_coalesce_ms);
+    DevLog.printf("   Sessione MQTT: %lu tentativi, %lu falliti, %lu cadute, backoff %lu ms\n",
+                  (unsigned long)mqttConnectAttempts, (unsigned long)mqttConnectFailures,
+                  (unsigned long)mqttSessionDrops, mqttBackoffMs);
+    DevLog.printf("   Outbox MQTT: %u in attesa (max RAM %u/%d), %lu accodati, %lu consegnati, %lu su flash, %lu persi\n",
+                  outboxPending(), outboxHighWater, OUTBOX_SLOTS, (unsigned long)outboxQueued,
+                  (unsigned long)outboxDelivered, (unsigned long)outboxSpilled, (unsigned long)outboxDropped);
+    DevLog.printf("   Ripubblicazione: %s, %lu messaggi, %lu rinvii per buffer TCP pieno\n",
+                  republishActive() ? "in corso" : "inattiva",
+                  (unsigned long)republishMessages, (unsigned long)republishDeferrals);
+    DevLog.printf("   Discovery HA: %lu config inviate, %lu peer invariati saltati\n",
+                  (unsigned long)haDiscoveryPublished, (unsigned long)haDiscoverySkipped);
+    DevLog.printf("   Latenza comandi MQTT->radio: JSON %lu (media %lu us, max %lu us), diretti %lu (media %lu us, max %lu us)\n",
+                  (unsigned long)jsonCommandLatency.count,
+                  jsonCommandLatency.count ? (unsigned long)(jsonCommandLatency.totalUs / jsonCommandLatency.count) : 0UL,
+                  (unsigned long)jsonCommandLatency.maxUs,
+                  (unsigned long)directCommandLatency.count,
+                  directCommandLatency.count ? (unsigned long)(directCommandLatency.totalUs / directCommandLatency.count) : 0UL,
+                  (unsigned long)directCommandLatency.maxUs);
+    DevLog.printf("   Comandi in attesa: %u/%d (max %u), %lu tracciati, %lu confermati, %lu timeout, %lu ritrasmessi, %lu falliti, %lu non tracciati\n",
+                  commandTrackerPending(), COMMAND_POOL_SIZE, commandPoolHighWater,
+                  (unsigned long)commandsTracked, (unsigned long)commandsResolved,
+                  (unsigned long)commandTimeouts, (unsigned long)commandRetries,
+                  (unsigned long)commandsFailed, (unsigned long)commandPoolExhausted);
+    DevLog.printf("   Comandi di gruppo: %lu frame GROUP, %lu frame risparmiati\n",
+                  (unsigned long)groupCommandsSent, (unsigned long)groupFramesSaved);
+    DevLog.printf("   Comandi batch: %lu ricevuti, %lu rifiutati, %lu target inviati%s\n",
+                  (unsigned long)batchesReceived, (unsigned long)batchesRejected,
+                  (unsigned long)batchTargetsSent, commandBatchActive() ? " (batch in corso)" : "");
+    DevLog.printf("   Invii a tutti i nodi: %lu frame, %lu rimandati per coda radio piena%s\n",
+                  (unsigned long)fanoutFramesSent, (unsigned long)fanoutDeferrals,
+                  nodeFanoutActive() ? " (in corso)" : "");
+    DevLog.printf("   Peer su flash: %lu scritture, %lu byte (%lu byte/h), journal %u/%d record, %lu compattazioni\n",
+                  (unsigned long)peerStoreWrites, (unsigned long)peerStoreBytes, (unsigned long)peerStoreBytesPerHour(),
+                  peerStoreJournalRecords, PEERSTORE_JOURNAL_MAX, (unsigned long)peerStoreCompactions);
+    DevLog.printf("   Stato per nodo: %s, %lu /state inviati, stream condiviso %s\n",
+                  node_state_topics ? "attivo" : "disattivato", (unsigned long)nodeStatePublished,
+                  (!node_state_topics || legacy_node_status) ? "attivo" : "disattivato");
     
     DevLog.println("=================================");
 }
@@ -125,6 +187,7 @@ void handleSerialCommands() {
             resetWiFiConfig();
         } else if (command == "restart") {
             DevLog.println("🔄 Riavvio gateway richiesto via seriale...");
+            forceSavePeers();
             delay(1000);
             ESP.restart();
         } else if (command == "totalreset") {
@@ -264,6 +327,7 @@ void setup() {
         ESP.restart();
     }
     DevLog.println("✅ LittleFS inizializzato");
+    outboxBegin();
 
     // Inizializza NodeTypeManager
     if (!NodeTypeManager::begin()) {
@@ -319,6 +383,7 @@ void setup() {
     
     DevLog.printf("🔧 ID Attivo: %s\n", gateway_id);
     DevLog.printf("📡 Topic Prefix: %s\n", mqtt_topic_prefix);
+    rebuildMqttTopics();
 
     // Controllo pulsante reset all'avvio (richiede pressione prolungata di 5 secondi)
     if (digitalRead(RESET_BUTTON_PIN) == LOW) {
@@ -480,14 +545,9 @@ void setup() {
     }
 #endif
 
-    // Setup MQTT
+    // Setup MQTT (la connessione parte dal loop tramite MqttSession)
     setupMQTT();
     
-    // Tentativo connessione immediata se WiFi è connesso
-    if (WiFi.status() == WL_CONNECTED) {
-        connectToMQTT();
-    }
-    
     // Setup ESP-NOW
     espNow.begin(true); // Initialize as Master/Controller
     // Force COMBO role to ensure we can both SEND and RECEIVE
@@ -502,8 +562,11 @@ void setup() {
     // Carica peer salvati
     loadPeersFromLittleFS();
     
-    // Registra callback ESP-NOW
+    // Registra callback ESP-NOW (frame grezzi: decodificati direttamente nel ring RX)
+    DomoticaEspNow::setRawFrames(true);
     espNow.onDataReceived(OnDataRecv);
+    DomoticaEspNow::onDataSent(OnDataSent);
+    DomoticaEspNow::onDeliveryFailed(onReliableDeliveryFailed);
     
     // Configura OTA
     ArduinoOTA.setHostname(gateway_id);
@@ -515,6 +578,7 @@ void setup() {
             type = "filesystem";
         }
         DevLog.println("Start updating " + type);
+        forceSavePeers(); // Prima che un update del filesystem smonti LittleFS
         otaRunning = true;
     });
     ArduinoOTA.onEnd([]() {
@@ -560,6 +624,9 @@ void loop() {
     // SEMPRE gestire le richieste web (per OTA manager e config)
     configServer.handleClient();
 
+    // Scrittura differita della tabella peer (journal/snapshot su LittleFS)
+    checkAndSavePeers();
+
     // Gestione web server in modalità configurazione
     if (!wifi_credentials_loaded || WiFi.status() != WL_CONNECTED) {
         stationWebServerActive = false; // Reset flag se disconnesso
@@ -580,45 +647,38 @@ void loop() {
         }
 
         // Solo se le credenziali sono caricate e WiFi connesso, procedi con MQTT
-        // Gestione MQTT
-        if (!mqttConnected) {
-            unsigned long currentTime = millis();
-            if (currentTime - lastMqttReconnectAttempt >= MQTT_RECONNECT_INTERVAL) {
-                lastMqttReconnectAttempt = currentTime;
-                connectToMQTT();
-            }
-        } else {
-            // Esegui il loop MQTT e verifica lo stato della connessione
-            if (!mqttClient.loop()) {
-                DevLog.println("❌ Connessione MQTT persa");
-                mqttConnected = false;
-            } else {
-                // Se MQTT risulta connesso ma il client non riceve traffico da tempo, forza ping
-                static unsigned long lastMqttPing = 0;
-                const unsigned long MQTT_PING_INTERVAL = 60000; // 60s
-                unsigned long now = millis();
-                if (now - lastMqttPing >= MQTT_PING_INTERVAL) {
-                    // Pubblica heartbeat availability del gateway per tenere viva la sessione
-                    mqttClient.publish((String(mqtt_topic_prefix)+"/gateway/availability").c_str(), "online", true);
-                    lastMqttPing = now;
-                }
-            }
-        }
+        // Gestione MQTT: sessione con backoff, loop del client e keepalive
+        mqttSessionLoop();
         
-        // Processa coda messaggi ESP-NOW
+        // Processa coda messaggi ESP-NOW (pubblica anche su MQTT)
         processMessageQueue();
 
-        // Processa dati ESP-NOW pronti per invio MQTT
-        processEspNowData();
+        // ACK e ritrasmissioni dei frame affidabili
+        espNow.loop();
         
         // Gestione ping network
         processPingLogic();
         
         // Gestione timeout comandi
         processNodeCommandTimeout();
+
+        // Invii cadenzati dei comandi batch
+        commandBatchLoop();
+
+        // PING/RESTART verso tutti i nodi, a passi
+        processNodeFanout();
         
         // Gestione nodi offline - Controllo Heartbeat
         processOfflineCheck();
+
+        // Publish consolidati di /nodo/status (uno per peer per finestra)
+        flushPeerStatus();
+
+        // Eventi accodati durante l'assenza del broker, in ordine (budget per giro)
+        processOutbox();
+
+        // Ripubblicazione discovery/stato dopo riconnessione (budget per giro)
+        processRepublish();
         
         // Gestione network discovery
         processNetworkDiscovery();
@@ -685,6 +745,7 @@ void loop() {
                     if (millis() > 120000) {
                         DevLog.printf("🔄 AUTO REBOOT TRIGGERED at %02d:%02d\n", timeinfo->tm_hour, timeinfo->tm_min);
                         publishGatewayStatus("auto_reboot", "Scheduled daily reboot triggered", "REBOOT");
+                        forceSavePeers();
                         delay(1000);
                         ESP.restart();
                     }
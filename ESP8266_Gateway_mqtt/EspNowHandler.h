@@ -8,34 +8,34 @@
 #include "PeerHandler.h"
 #include "MqttHandler.h"
 
-// Constants
-#define MESSAGE_QUEUE_SIZE 20
-extern const unsigned long MESSAGE_PROCESS_INTERVAL;
+// --- RING RX ESP-NOW --- //
+// Coda lock-free single-producer (callback Wi-Fi) / single-consumer (loop) di frame grezzi.
+// Il callback scrive il frame direttamente nello slot; il loop lo legge in place e lo
+// rilascia con rxRingPop(). Gli indici sono contatori liberi: usati = tail - head.
+#define RX_RING_SIZE 16 // Deve essere una potenza di 2
 
-// Structure for queued messages
-struct QueuedMessage {
+// Status della DISCOVERY RESPONSE: "AVAILABLE" più il token del formato compatto.
+// I nodi recenti registrano il gateway come peer compatto, i vecchi ignorano lo status.
+#define GATEWAY_DISCOVERY_STATUS "AVAILABLE|" DOMOTICA_PROTO_TOKEN
+
+struct RxFrame {
     uint8_t mac[6];
-    char node[20];
-    char topic[20];
-    char command[20];
-    char status[100];
-    char type[20];
-    char gateway_id[20];
-    unsigned long timestamp;
-    bool valid;
+    unsigned long timestamp;  // millis() alla ricezione
+    struct_message data;      // Campi sempre terminati da '\0'
 };
 
 // Global variables (extern)
-extern volatile bool newEspNowData;
-extern struct_message receivedData;
 extern DomoticaEspNow espNow;
 extern char receivedMacStr[18];
 
 // Function prototypes
-bool addToMessageQueue(const uint8_t* mac, const struct_message& data);
+const RxFrame* rxRingPeek();
+void rxRingPop();
+uint8_t rxRingCount();
 void processMessageQueue();
-void processEspNowData();
-void trackEspNowSendResult(uint8_t *mac_addr, uint8_t status);
+void processEspNowData(const struct_message& data);
+void OnDataSent(uint8_t *mac_addr, uint8_t status);
+void onReliableDeliveryFailed(const uint8_t* mac, uint16_t seq);
 void printQueueStatus();
 void processPingLogic();
 void OnDataRecv(uint8_t * mac, uint8_t *incomingData, uint8_t len);
@@ -44,15 +44,12 @@ void OnDataRecv(uint8_t * mac, uint8_t *incomingData, uint8_t len);
 extern unsigned long espNowSendSuccess;
 extern unsigned long espNowSendFailures;
 extern unsigned long totalMessagesProcessed;
-extern unsigned long totalMessagesDropped;
-extern unsigned long maxQueueUsage;
 extern unsigned long avgProcessingTime;
-
-extern int queueCount;
-extern int queueHead;
-extern int queueTail;
-extern unsigned long lastMessageProcessTime;
-extern bool messageProcessingActive;
+extern uint8_t rxRingHighWater;                 // Massima occupazione osservata
+extern volatile unsigned long rxRingOverflows;  // Frame scartati a ring pieno
+extern volatile unsigned long rxCallbackCount;   // Tempo trascorso in OnDataRecv
+extern volatile unsigned long rxCallbackTotalUs;
+extern volatile unsigned long rxCallbackMaxUs;
 
 // Network Discovery & Management
 extern bool networkDiscoveryActive;
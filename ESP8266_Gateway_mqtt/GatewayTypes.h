@@ -3,7 +3,22 @@
 
 #include <Arduino.h>
 
-#define MAX_PEERS 20
+// Peer logici gestiti dal gateway. Lo stack ESP-NOW ne registra al massimo 20 alla volta:
+// la libreria DomoticaEspNow assegna gli slot radio al momento dell'invio (LRU).
+// build_opt.h porta DOMOTICA_PROTO_PEERS allo stesso valore: caps e finestre anti-duplicati
+// della libreria restano disponibili per tutti i peer.
+#define MAX_PEERS 100
+#define MAX_PENDING_COMMANDS 20 // Comandi in attesa di feedback
+#define PEER_RTT_SAMPLES 8      // Ultimi RTT per nodo (percentili nel heartbeat)
+
+// Round-trip comando -> risposta del nodo, stimato come in TCP (Jacobson/Karels)
+struct PeerRtt {
+    uint16_t srtt8;    // RTT medio in ms, scalato x8 (0 = nessun campione)
+    uint16_t rttvar4;  // Variazione media in ms, scalata x4
+    uint16_t samples[PEER_RTT_SAMPLES]; // Buffer circolare dei campioni (ms)
+    uint8_t sampleNext;
+    uint8_t sampleCount;
+};
 
 struct Peer {
     uint8_t mac[6];
@@ -13,14 +28,12 @@ struct Peer {
     char attributes[50]; // Attributi del nodo (stato relè, sensori, etc.)
     unsigned long lastSeen; // Timestamp ultimo contatto
     bool isOnline; // Stato online/offline
-};
-
-struct NodeCommand {
-    String nodeId;
-    String topic;
-    String command;
-    unsigned long sentTime;
-    bool waitingResponse;
+    uint8_t statusDirty; // Motivi di ripubblicazione in attesa (PEER_DIRTY_*, vedi StatusCoalescer.h)
+    unsigned long statusPublishedAt; // Ultimo publish su /nodo/status
+    uint32_t stateHash; // Impronta degli attributi pubblicati su /nodo/<id>/state (0 = da pubblicare)
+    uint32_t discoveryHash; // Impronta dell'ultima discovery HA pubblicata (0 = mai pubblicata, vedi HaDiscovery)
+    bool storeDirty; // Da scrivere nel journal di PeerStore (write-behind)
+    PeerRtt rtt; // Timeout adattivo dei comandi (vedi CommandTracker), non persistito
 };
 
 #endif
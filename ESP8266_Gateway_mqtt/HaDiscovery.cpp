@@ -1,29 +1,90 @@
 #include "HaDiscovery.h"
 #include "WebLog.h"
+#include "HashUtils.h"
+#include "MqttJsonWriter.h"
+#include "MqttTopics.h"
 
-void HaDiscovery::publishDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, bool resetFirst) {
-    if (strlen(peer.nodeId) == 0 || strcmp(peer.nodeId, "null") == 0) {
+uint32_t haDiscoveryPublished = 0;
+uint32_t haDiscoverySkipped = 0;
+
+bool HaDiscovery::isPublishable(const Peer& peer) {
+    return strlen(peer.nodeId) > 0 && strcmp(peer.nodeId, "null") != 0;
+}
+
+// --- IMPRONTA --- //
+static uint32_t hashField(const char* s, uint32_t h) {
+    // Il terminatore separa i campi: "AB"+"C" e "A"+"BC" danno impronte diverse
+    return fnv1a(s, strlen(s) + 1, h);
+}
+
+uint32_t HaDiscovery::fingerprint(const Peer& peer, const char* topicPrefix) {
+    uint32_t format = HA_DISCOVERY_FORMAT;
+    uint32_t h = fnv1a(&format, sizeof(format));
+    h = hashField(topicPrefix, h);
+    h = hashField(peer.nodeId, h);
+    h = hashField(peer.nodeType, h);
+    h = hashField(peer.firmwareVersion, h);
+    h = hashField(node_state_topics ? "state" : "status", h);
+
+    int count = 0;
+    const NodeEntity* entities = NodeTypeManager::getEntities(peer.nodeType, &count);
+    for (int i = 0; i < count; i++) {
+        h = hashField(entities[i].suffix, h);
+        h = hashField(entities[i].name, h);
+        h = hashField(entities[i].component, h);
+        h = hashField(entities[i].deviceClass, h);
+        h = hashField(entities[i].icon, h);
+        h = fnv1a(&entities[i].attributeIndex, sizeof(entities[i].attributeIndex), h);
+    }
+    // 0 è riservato a "mai pubblicata"
+    return h != 0 ? h : 1;
+}
+
+bool HaDiscovery::isCurrent(const Peer& peer, const char* topicPrefix) {
+    return peer.discoveryHash != 0 && peer.discoveryHash == fingerprint(peer, topicPrefix);
+}
+
+bool HaDiscovery::refreshDiscovery(PubSubClient& client, Peer& peer, const char* topicPrefix, bool force) {
+    if (!isPublishable(peer)) return false;
+
+    uint32_t hash = fingerprint(peer, topicPrefix);
+    if (!force && peer.discoveryHash == hash) {
+        haDiscoverySkipped++;
+        return false;
+    }
+
+    bool sent = publishDiscovery(client, peer, topicPrefix);
+    sent = publishDashboardConfig(client, peer, topicPrefix) && sent;
+    // Publish fallito: l'impronta resta quella vecchia e il prossimo tentativo riprova
+    if (!sent || peer.discoveryHash == hash) return false;
+
+    peer.discoveryHash = hash;
+    return true;
+}
+
+bool HaDiscovery::publishDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, bool resetFirst) {
+    if (!isPublishable(peer)) {
         DevLog.println("⚠️ HaDiscovery: Ignorato peer con ID vuoto o nullo");
-        return;
+        return false;
     }
 
-    NodeEntity entities[8]; // Buffer for entities
-    int count = NodeTypeManager::getNodeConfig(peer.nodeType, entities, 8);
+    int count = 0;
+    const NodeEntity* entities = NodeTypeManager::getEntities(peer.nodeType, &count);
 
     if (count > 0) {
-        publishGenericDiscovery(client, peer, topicPrefix, entities, count, resetFirst);
-    } else {
-        DevLog.printf("⚠️ HaDiscovery: Tipo nodo non supportato per discovery: %s (ID: %s)\n", peer.nodeType, peer.nodeId);
+        return publishGenericDiscovery(client, peer, topicPrefix, entities, count, resetFirst);
     }
+    DevLog.printf("⚠️ HaDiscovery: Tipo nodo non supportato per discovery: %s (ID: %s)\n", peer.nodeType, peer.nodeId);
+    return true; // Nessuna entità: nulla da pubblicare
 }
 
-void HaDiscovery::publishDashboardConfig(PubSubClient& client, const Peer& peer, const char* topicPrefix) {
-    if (strlen(peer.nodeId) == 0 || strcmp(peer.nodeId, "null") == 0) {
-        return;
+bool HaDiscovery::publishDashboardConfig(PubSubClient& client, const Peer& peer, const char* topicPrefix) {
+    if (!isPublishable(peer)) {
+        return false;
     }
 
-    NodeEntity entities[8];
-    int count = NodeTypeManager::getNodeConfig(peer.nodeType, entities, 8);
+    int count = 0;
+    const NodeEntity* entities = NodeTypeManager::getEntities(peer.nodeType, &count);
 
     if (count > 0) {
         String nodeIdStr = String(peer.nodeId);
@@ -45,116 +106,170 @@ void HaDiscovery::publishDashboardConfig(PubSubClient& client, const Peer& peer,
         
         String payload;
         serializeJson(doc, payload);
-        client.publish(topic.c_str(), payload.c_str(), true);
+        return client.publish(topic.c_str(), payload.c_str(), true);
     }
+    return true;
 }
 
-void HaDiscovery::publishGenericDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, NodeEntity* entities, int count, bool resetFirst) {
-    String nodeIdStr = String(peer.nodeId);
-    
-    // Configurazione comune
-    DynamicJsonDocument doc(1024);
-    
-    // Device Configuration - Use explicit object creation for safety
-    JsonObject device = doc.createNestedObject("device");
-    JsonArray identifiers = device.createNestedArray("identifiers");
-    identifiers.add(String("domoriky_") + nodeIdStr);
-    
-    device["name"] = nodeIdStr;
-    device["model"] = String(peer.nodeType);
-    device["manufacturer"] = "Domoriky";
-    if (strlen(peer.firmwareVersion) > 0) {
-        device["sw_version"] = String(peer.firmwareVersion);
-    }
-    
-    doc["state_topic"] = String(topicPrefix) + String("/nodo/status");
-    
-    // Availability configuration
-    JsonArray avail = doc.createNestedArray("availability");
-    JsonObject a1 = avail.createNestedObject();
-    a1["topic"] = String(topicPrefix) + String("/nodo/") + nodeIdStr + String("/availability");
-    a1["payload_available"] = String("online");
-    a1["payload_not_available"] = String("offline");
-    
-    JsonObject a2 = avail.createNestedObject();
-    a2["topic"] = String(topicPrefix) + String("/gateway/availability");
-    a2["payload_available"] = String("online");
-    a2["payload_not_available"] = String("offline");
-    
-    doc["command_topic"] = String(topicPrefix) + String("/nodo/command");
-    
+bool HaDiscovery::publishGenericDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, const NodeEntity* entities, int count, bool resetFirst) {
+    bool allSent = true;
     for (int i = 0; i < count; i++) {
         client.loop(); // Mantieni viva la connessione e svuota i buffer
         
-        DynamicJsonDocument c(1024);
-        // Copia configurazione base
-        for (JsonPair kv : doc.as<JsonObject>()) { c[kv.key()] = kv.value(); }
-        
-        c["name"] = nodeIdStr + String(" ") + entities[i].name;
-        c["unique_id"] = String("domoriky_") + nodeIdStr + String("_") + entities[i].suffix;
-        c["icon"] = entities[i].icon;
-        c["device_class"] = entities[i].deviceClass;
-        
-        // Component specific config
-        if (strcmp(entities[i].component, "switch") == 0) {
-            c["payload_on"] = "ON";
-            c["payload_off"] = "OFF";
-            c["state_on"] = "1";
-            c["state_off"] = "0";
-        } else if (strcmp(entities[i].component, "cover") == 0) {
-            c["payload_open"] = "OPEN";
-            c["payload_close"] = "CLOSE";
-            c["payload_stop"] = "STOP";
-            c["state_open"] = "1";
-            c["state_closed"] = "0";
-            c["optimistic"] = false;
-        }
-
-        c["command_template"] = getCommandTemplate(nodeIdStr, entities[i].suffix, entities[i].component);
-        c["value_template"] = getValueTemplate(nodeIdStr, entities[i].attributeIndex, entities[i].component);
-        
-        String cfgTopic = String("homeassistant/") + entities[i].component + "/" + nodeIdStr + "_" + entities[i].suffix + "/config";
-        
         // SE richiesto reset, invia prima payload vuoto per forzare rimozione su HA
         if (resetFirst) {
-            DevLog.printf("🔄 Resetting HA config for: %s\n", cfgTopic.c_str());
-            client.publish(cfgTopic.c_str(), "", true);
-            delay(20);
-            client.loop();
+            publishEntityReset(client, peer, entities[i]);
         }
-
-        String payload;
-        serializeJson(c, payload);
-        
-        if (client.publish(cfgTopic.c_str(), payload.c_str(), true)) {
-            DevLog.printf("✅ Discovery Sent: %s (Topic: %s)\n", entities[i].name, cfgTopic.c_str());
-        } else {
-            DevLog.printf("❌ Discovery FAILED: %s (Topic: %s)\n", entities[i].name, cfgTopic.c_str());
+        if (!publishEntityDiscovery(client, peer, topicPrefix, entities[i], i == 0)) {
+            allSent = false;
         }
-        delay(20); // Piccolo ritardo per non saturare
     }
     
     // Pubblica availability corrente del nodo (retained) sul topic dedicato
-    if (client.connected()) {
-        String availTopic = String(topicPrefix) + String("/nodo/") + nodeIdStr + String("/availability");
+    char availTopic[MQTT_TOPIC_MAX];
+    if (client.connected() && mqttNodeTopic(availTopic, sizeof(availTopic), peer.nodeId, "availability") > 0) {
         const char* availPayload = peer.isOnline ? "online" : "offline";
-        client.publish(availTopic.c_str(), availPayload, true);
+        client.publish(availTopic, availPayload, true);
     }
+    return allSent;
 }
 
-String HaDiscovery::getCommandTemplate(const String& nodeId, const String& topic, const char* component) {
-    if (strcmp(component, "cover") == 0) {
-         // Cover Template: Maps HA OPEN/CLOSE/STOP to Firmware UP/DOWN/STOP
-         String json = "{\"Node\":\"" + nodeId + "\",\"Topic\":\"" + topic;
-         json += "\",\"Command\":\"{{ 'UP' if value == 'OPEN' else 'DOWN' if value == 'CLOSE' else 'STOP' }}\",\"Status\":\"\",\"Type\":\"COMMAND\"}";
-         return json;
-    }
-    // Default to Switch: Maps HA ON/OFF to Firmware 1/0
-    String json = "{\"Node\":\"" + nodeId + "\",\"Topic\":\"" + topic;
-    json += "\",\"Command\":\"{{ '1' if value in ['ON','1', true] else '0' }}\",\"Status\":\"\",\"Type\":\"COMMAND\"}";
-    return json;
+bool HaDiscovery::configTopic(char* buf, size_t size, const Peer& peer, const NodeEntity& entity) {
+    int len = snprintf(buf, size, "homeassistant/%s/%s_%s/config", entity.component, peer.nodeId, entity.suffix);
+    return len > 0 && (size_t)len < size;
 }
 
-String HaDiscovery::getValueTemplate(const String& nodeId, int attrIndex, const char* component) {
-    return String("{% if value_json.Node == '") + nodeId + String("' and value_json.attributes is defined %}{{ value_json.attributes[") + String(attrIndex) + String("] }}{% endif %}");
+bool HaDiscovery::publishEntityReset(PubSubClient& client, const Peer& peer, const NodeEntity& entity) {
+    char cfgTopic[MQTT_TOPIC_MAX];
+    if (!configTopic(cfgTopic, sizeof(cfgTopic), peer, entity)) return false;
+    DevLog.printf("🔄 Resetting HA config for: %s\n", cfgTopic);
+    return client.publish(cfgTopic, "", true);
+}
+
+// --- PAYLOAD DISCOVERY --- //
+// Chiavi abbreviate di Home Assistant e topic base "~" (= prefisso MQTT): i topic
+// ripetuti in ogni entità si riducono a "~/...". Il blocco device completo viaggia solo
+// con la prima entità del nodo, le altre lo richiamano con i soli identificatori
+// (HA unisce le informazioni del dispositivo per identificatore).
+bool HaDiscovery::publishEntityDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, const NodeEntity& entity, bool withDevice) {
+    char cfgTopic[MQTT_TOPIC_MAX];
+    if (!configTopic(cfgTopic, sizeof(cfgTopic), peer, entity)) {
+        DevLog.printf("❌ Discovery FAILED: %s (topic troppo lungo)\n", entity.name);
+        return false;
+    }
+
+    bool isCover = strcmp(entity.component, "cover") == 0;
+    bool isSwitch = strcmp(entity.component, "switch") == 0;
+
+    bool sent = mqttPublishJson(client, cfgTopic, true, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("~", topicPrefix);
+
+        json.beginString("name");
+        json.appendString(peer.nodeId);
+        json.appendString(" ");
+        json.appendString(entity.name);
+        json.endString();
+
+        json.beginString("uniq_id");
+        json.appendString("domoriky_");
+        json.appendString(peer.nodeId);
+        json.appendString("_");
+        json.appendString(entity.suffix);
+        json.endString();
+
+        json.beginObject("dev");
+        json.beginArray("ids");
+        json.beginString(NULL);
+        json.appendString("domoriky_");
+        json.appendString(peer.nodeId);
+        json.endString();
+        json.endArray();
+        if (withDevice) {
+            json.add("name", peer.nodeId);
+            json.add("mdl", peer.nodeType);
+            json.add("mf", "Domoriky");
+            if (peer.firmwareVersion[0] != '\0') {
+                json.add("sw", peer.firmwareVersion);
+            }
+        }
+        json.endObject();
+
+        // Stato per nodo se abilitato, altrimenti lo stream condiviso filtrato dal template
+        if (node_state_topics) {
+            json.beginString("stat_t");
+            json.appendString("~/nodo/");
+            json.appendString(peer.nodeId);
+            json.appendString("/state");
+            json.endString();
+        } else {
+            json.add("stat_t", "~/nodo/status");
+        }
+        // Comando diretto per entità: HA invia pl_on/pl_off/pl_open... così come sono
+        json.beginString("cmd_t");
+        json.appendString("~/nodo/");
+        json.appendString(peer.nodeId);
+        json.appendString("/");
+        json.appendString(entity.suffix);
+        json.appendString("/set");
+        json.endString();
+
+        // Availability: payload predefiniti di HA ("online"/"offline")
+        json.beginArray("avty");
+        json.beginObject();
+        json.beginString("t");
+        json.appendString("~/nodo/");
+        json.appendString(peer.nodeId);
+        json.appendString("/availability");
+        json.endString();
+        json.endObject();
+        json.beginObject();
+        json.add("t", "~/gateway/availability");
+        json.endObject();
+        json.endArray();
+
+        if (entity.icon[0] != '\0') json.add("ic", entity.icon);
+        if (entity.deviceClass[0] != '\0') json.add("dev_cla", entity.deviceClass);
+
+        // Component specific config
+        if (isSwitch) {
+            json.add("pl_on", "ON");
+            json.add("pl_off", "OFF");
+            json.add("stat_on", "1");
+            json.add("stat_off", "0");
+        } else if (isCover) {
+            json.add("pl_open", "OPEN");
+            json.add("pl_cls", "CLOSE");
+            json.add("pl_stop", "STOP");
+            json.add("stat_open", "1");
+            json.add("stat_clsd", "0");
+            json.add("opt", false);
+        }
+
+        char attrIndex[12];
+        snprintf(attrIndex, sizeof(attrIndex), "%d", entity.attributeIndex);
+        json.beginString("val_tpl");
+        if (node_state_topics) {
+            json.appendString("{{ value_json.attributes[");
+            json.appendString(attrIndex);
+            json.appendString("] }}");
+        } else {
+            json.appendString("{% if value_json.Node == '");
+            json.appendString(peer.nodeId);
+            json.appendString("' and value_json.attributes is defined %}{{ value_json.attributes[");
+            json.appendString(attrIndex);
+            json.appendString("] }}{% endif %}");
+        }
+        json.endString();
+
+        json.endObject();
+    });
+
+    if (sent) {
+        haDiscoveryPublished++;
+        DevLog.printf("✅ Discovery Sent: %s (Topic: %s)\n", entity.name, cfgTopic);
+    } else {
+        DevLog.printf("❌ Discovery FAILED: %s (Topic: %s)\n", entity.name, cfgTopic);
+    }
+    return sent;
 }
@@ -7,15 +7,36 @@
 #include "PeerHandler.h"
 #include "NodeTypeManager.h"
 
+// --- IMPRONTA DISCOVERY --- //
+// Le config HA e dashboard sono retained: vanno ripubblicate solo quando cambia qualcosa
+// che contengono. L'impronta (FNV-1a di nodeId, nodeType, firmware, entità, prefisso e
+// formato) è salvata in Peer::discoveryHash e nel file peer. Si ripubblica quando
+// differisce, su richiesta esplicita o al birth message di Home Assistant.
+#define HA_DISCOVERY_FORMAT 3 // Da incrementare quando cambia il payload delle config (3: comandi diretti /set)
+
+extern uint32_t haDiscoveryPublished; // Config HA inviate
+extern uint32_t haDiscoverySkipped;   // Peer non ripubblicati perché l'impronta era invariata
+
 class HaDiscovery {
 public:
-    static void publishDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, bool resetFirst = false);
-    static void publishDashboardConfig(PubSubClient& client, const Peer& peer, const char* topicPrefix);
+    static bool publishDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, bool resetFirst = false);
+    static bool publishDashboardConfig(PubSubClient& client, const Peer& peer, const char* topicPrefix);
+
+    static uint32_t fingerprint(const Peer& peer, const char* topicPrefix);
+    static bool isCurrent(const Peer& peer, const char* topicPrefix);
+    // Config HA + dashboard se l'impronta è cambiata (sempre con force). Ritorna true se
+    // peer.discoveryHash è stato aggiornato: il chiamante deve salvare i peer.
+    static bool refreshDiscovery(PubSubClient& client, Peer& peer, const char* topicPrefix, bool force);
+
+    // Pubblicazione a passi (job di ripubblicazione): peer con ID valido e un'entità per volta
+    static bool isPublishable(const Peer& peer);
+    static bool publishEntityReset(PubSubClient& client, const Peer& peer, const NodeEntity& entity);
+    // withDevice: blocco device completo (prima entità del nodo), altrimenti solo gli identificatori
+    static bool publishEntityDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, const NodeEntity& entity, bool withDevice);
 
 private:
-    static void publishGenericDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, NodeEntity* entities, int count, bool resetFirst);
-    static String getCommandTemplate(const String& nodeId, const String& topic, const char* component);
-    static String getValueTemplate(const String& nodeId, int attrIndex, const char* component);
+    static bool publishGenericDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, const NodeEntity* entities, int count, bool resetFirst);
+    static bool configTopic(char* buf, size_t size, const Peer& peer, const NodeEntity& entity);
 };
 
 #endif
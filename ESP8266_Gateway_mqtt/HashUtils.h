@@ -0,0 +1,50 @@
+#ifndef HASH_UTILS_H
+#define HASH_UTILS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// --- FNV-1a 32 bit --- //
+// Hash leggero usato per gli indici in RAM (tipi nodo, peer, keyword).
+// Non è crittografico: ogni lookup conferma sempre con un confronto completo.
+
+#define FNV1A_OFFSET 2166136261u
+#define FNV1A_PRIME  16777619u
+
+// Versione constexpr per costanti calcolate a compile-time
+constexpr uint32_t fnv1aConst(const char* s, uint32_t h = FNV1A_OFFSET) {
+    return *s ? fnv1aConst(s + 1, (h ^ (uint8_t)*s) * FNV1A_PRIME) : h;
+}
+
+inline uint32_t fnv1a(const char* s) {
+    uint32_t h = FNV1A_OFFSET;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * FNV1A_PRIME;
+    }
+    return h;
+}
+
+inline uint32_t fnv1a(const void* data, size_t len, uint32_t h = FNV1A_OFFSET) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * FNV1A_PRIME;
+    }
+    return h;
+}
+
+// --- CRC-32 (IEEE, riflesso) --- //
+// Integrità dei record persistiti su flash (PeerStore). Versione bit a bit: niente
+// tabella da 1 KB in RAM, i record sono pochi e corti.
+inline uint32_t crc32(const void* data, size_t len, uint32_t crc = 0) {
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "MessageDispatch.h"
+#include "HashUtils.h"
+
+#define KEYWORD_SLOTS 128        // Potenza di 2, circa 4x il numero di keyword
+#define KEYWORD_SEED_LIMIT 65536 // Limite ricerca del seed a compile-time
+#define KEYWORD_NO_SEED 0xFFFFFFFFu
+
+static constexpr const char* KEYWORD_NAMES[KW_COUNT] = {
+    "",
+#define MSG_KEYWORD_NAME(name) #name,
+    MSG_KEYWORDS(MSG_KEYWORD_NAME)
+#undef MSG_KEYWORD_NAME
+};
+
+// FNV-1a con offset perturbato dal seed; usato identico a compile-time e a runtime
+static constexpr uint32_t keywordHash(const char* s, uint32_t seed) {
+    uint32_t h = FNV1A_OFFSET ^ (seed * FNV1A_PRIME);
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * FNV1A_PRIME;
+    }
+    return h;
+}
+
+struct KeywordTable {
+    uint32_t seed;
+    uint8_t slots[KEYWORD_SLOTS]; // MsgKeyword, KW_UNKNOWN = slot vuoto
+};
+
+// Cerca il primo seed per cui tutte le keyword cadono in slot distinti
+static constexpr KeywordTable buildKeywordTable() {
+    KeywordTable table = {};
+    for (uint32_t seed = 0; seed < KEYWORD_SEED_LIMIT; seed++) {
+        for (int i = 0; i < KEYWORD_SLOTS; i++) table.slots[i] = KW_UNKNOWN;
+
+        bool perfect = true;
+        for (int kw = 1; kw < KW_COUNT && perfect; kw++) {
+            uint32_t slot = keywordHash(KEYWORD_NAMES[kw], seed) & (KEYWORD_SLOTS - 1);
+            if (table.slots[slot] != KW_UNKNOWN) {
+                perfect = false;
+            } else {
+                table.slots[slot] = kw;
+            }
+        }
+
+        if (perfect) {
+            table.seed = seed;
+            return table;
+        }
+    }
+    table.seed = KEYWORD_NO_SEED;
+    return table;
+}
+
+static constexpr KeywordTable KEYWORD_TABLE = buildKeywordTable();
+static_assert(KEYWORD_TABLE.seed != KEYWORD_NO_SEED, "Nessun hash perfetto per MSG_KEYWORDS: aumentare KEYWORD_SLOTS");
+static_assert(KW_COUNT <= KEYWORD_SLOTS / 2, "Troppe keyword per KEYWORD_SLOTS");
+
+MsgKeyword lookupKeyword(const char* s) {
+    if (s == NULL || s[0] == '\0') return KW_UNKNOWN;
+
+    uint8_t kw = KEYWORD_TABLE.slots[keywordHash(s, KEYWORD_TABLE.seed) & (KEYWORD_SLOTS - 1)];
+    if (kw != KW_UNKNOWN && strcmp(KEYWORD_NAMES[kw], s) == 0) {
+        return (MsgKeyword)kw;
+    }
+    return KW_UNKNOWN;
+}
+
+const char* keywordName(MsgKeyword kw) {
+    return (kw < KW_COUNT) ? KEYWORD_NAMES[kw] : "";
+}
@@ -0,0 +1,55 @@
+#ifndef MESSAGE_DISPATCH_H
+#define MESSAGE_DISPATCH_H
+
+#include <Arduino.h>
+
+// --- DISPATCH MESSAGGI --- //
+// Le stringhe type/topic/command (ESP-NOW) e "command" (MQTT) vengono mappate una
+// sola volta in un enum tramite hash perfetto generato a compile-time.
+// I gestori sono poi selezionati con tabelle indicizzate dall'enum.
+
+// Elenco keyword: l'ordine definisce i valori dell'enum (KW_<nome>)
+#define MSG_KEYWORDS(X) \
+    X(REGISTER) \
+    X(REQUEST) \
+    X(RESPONSE) \
+    X(FEEDBACK) \
+    X(CONTROL) \
+    X(STATUS) \
+    X(PONG) \
+    X(HEARTBEAT) \
+    X(DISCOVERY_RESPONSE) \
+    /* Keyword condivise: comandi MQTT del gateway (da qui in poi) */ \
+    X(OTA_UPDATE) \
+    X(REMOVE_PEER) \
+    X(DISCOVERY) \
+    X(GET_VERSION) \
+    X(LIST_PEERS) \
+    X(RESET_WIFI_CONFIG) \
+    X(GATEWAY_HEARTBEAT) \
+    X(NODE_FACTORY_RESET) \
+    X(NETWORK_REBOOT) \
+    X(CLEAR_PEERS) \
+    X(RESET_TO_AP) \
+    X(CLEANUP_OFFLINE_PEERS) \
+    X(RESTART) \
+    X(NETWORK_DISCOVERY) \
+    X(PING_NETWORK)
+
+enum MsgKeyword : uint8_t {
+    KW_UNKNOWN = 0,
+#define MSG_KEYWORD_ENUM(name) KW_##name,
+    MSG_KEYWORDS(MSG_KEYWORD_ENUM)
+#undef MSG_KEYWORD_ENUM
+    KW_COUNT
+};
+
+// Primo comando MQTT del gateway: le tabelle dei comandi sono indicizzate da qui
+#define KW_FIRST_GATEWAY_COMMAND KW_OTA_UPDATE
+#define GATEWAY_COMMAND_COUNT (KW_COUNT - KW_FIRST_GATEWAY_COMMAND)
+
+// Restituisce la keyword corrispondente oppure KW_UNKNOWN (stringa confermata con strcmp)
+MsgKeyword lookupKeyword(const char* s);
+const char* keywordName(MsgKeyword kw);
+
+#endif
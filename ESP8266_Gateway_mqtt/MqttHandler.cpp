@@ -5,13 +5,23 @@
 #include "version.h"
 #include "HaDiscovery.h"
 #include "WebLog.h"
+#include "MessageDispatch.h"
+#include "StatusCoalescer.h"
+#include "MqttJsonWriter.h"
+#include "MqttTopics.h"
+#include "MqttRepublish.h"
+#include "MqttSession.h"
+#include "MqttOutbox.h"
+#include "HashUtils.h"
+#include "PeerStore.h"
+#include "CommandTracker.h"
+#include "CommandBatch.h"
+#include "NodeFanout.h"
 #include <ESP8266WiFi.h>
 #include <ESP8266httpUpdate.h>
 
 // Global variables definition
 bool mqttConnected = false;
-unsigned long lastMqttReconnectAttempt = 0;
-const unsigned long MQTT_RECONNECT_INTERVAL = 5000;
 
 // External globals
 extern const char* BUILD_DATE;
@@ -23,60 +33,56 @@ WiFiClient wifiClient;
 PubSubClient mqttClient(wifiClient);
 
 // --- GESTIONE MQTT --- //
+#define HA_BIRTH_GRACE_MS 3000 // Birth HA ignorato subito dopo la sottoscrizione (messaggio retained)
+
+static unsigned long haStatusSubscribedAt = 0;
+
 void onMqttConnect() {
     mqttConnected = true;
     
     DevLog.println("✅ MQTT: Connected Callback Triggered");
     
     // Sottoscrivi ai 4 topic richiesti
-    String gatewayCommandTopic = String(mqtt_topic_prefix) + "/gateway/command";
-    String nodeCommandTopic = String(mqtt_topic_prefix) + "/nodo/command";
-    
-    DevLog.printf("📡 Subscribing to: %s\n", gatewayCommandTopic.c_str());
-    if (mqttClient.subscribe(gatewayCommandTopic.c_str())) {
+    DevLog.printf("📡 Subscribing to: %s\n", mqttTopic(TOPIC_GATEWAY_COMMAND));
+    if (mqttClient.subscribe(mqttTopic(TOPIC_GATEWAY_COMMAND))) {
         DevLog.println("   -> Subscription SUCCESS");
     } else {
         DevLog.println("   -> Subscription FAILED");
     }
     
-    DevLog.printf("📡 Subscribing to: %s\n", nodeCommandTopic.c_str());
-    if (mqttClient.subscribe(nodeCommandTopic.c_str())) {
+    DevLog.printf("📡 Subscribing to: %s\n", mqttTopic(TOPIC_NODE_COMMAND));
+    if (mqttClient.subscribe(mqttTopic(TOPIC_NODE_COMMAND))) {
         DevLog.println("   -> Subscription SUCCESS");
     } else {
         DevLog.println("   -> Subscription FAILED");
     }
 
     // NEW: Subscribe to Dashboard Status for Auto-Discovery
-    String dashboardStatusTopic = String(mqtt_topic_prefix) + "/dashboard/status";
-    DevLog.printf("📡 Subscribing to: %s\n", dashboardStatusTopic.c_str());
-    mqttClient.subscribe(dashboardStatusTopic.c_str());
+    DevLog.printf("📡 Subscribing to: %s\n", mqttTopic(TOPIC_DASHBOARD_STATUS));
+    mqttClient.subscribe(mqttTopic(TOPIC_DASHBOARD_STATUS));
 
-    // NEW: Send Discovery Request to force Dashboard to announce itself
-    String dashboardDiscoveryTopic = String(mqtt_topic_prefix) + "/dashboard/discovery";
-    mqttClient.publish(dashboardDiscoveryTopic.c_str(), "{\"command\":\"DISCOVER\"}");
-    DevLog.printf("📡 Sent Dashboard Discovery Request to: %s\n", dashboardDiscoveryTopic.c_str());
+    // Comandi diretti per entità: payload grezzo, nessun JSON
+    DevLog.printf("📡 Subscribing to: %s\n", mqttTopic(TOPIC_NODE_SET_FILTER));
+    mqttClient.subscribe(mqttTopic(TOPIC_NODE_SET_FILTER));
 
-    delay(200); // Small delay to ensure stability before sending heartbeat
+    // Comandi batch (scene): molti target in un solo messaggio
+    DevLog.printf("📡 Subscribing to: %s\n", mqttTopic(TOPIC_NODE_BATCH));
+    mqttClient.subscribe(mqttTopic(TOPIC_NODE_BATCH));
+
+    // Birth message di Home Assistant: al suo riavvio le config vanno ripubblicate
+    DevLog.printf("📡 Subscribing to: %s\n", mqttTopic(TOPIC_HA_STATUS));
+    mqttClient.subscribe(mqttTopic(TOPIC_HA_STATUS));
+    haStatusSubscribedAt = millis();
+
+    // NEW: Send Discovery Request to force Dashboard to announce itself
+    mqttClient.publish(mqttTopic(TOPIC_DASHBOARD_DISCOVERY), "{\"command\":\"DISCOVER\"}");
+    DevLog.printf("📡 Sent Dashboard Discovery Request to: %s\n", mqttTopic(TOPIC_DASHBOARD_DISCOVERY));
 
     // NEW: Send Gateway Heartbeat immediately to announce version and status
     sendGatewayHeartbeat();
 
-    // Pubblica discovery per tutti i peer conosciuti
-    for (int i = 0; i < peerCount; i++) {
-        // 1. Configurazione Home Assistant
-        HaDiscovery::publishDiscovery(mqttClient, peerList[i], mqtt_topic_prefix);
-        HaDiscovery::publishDashboardConfig(mqttClient, peerList[i], mqtt_topic_prefix);
-        
-        // 2. Forza Availability ONLINE (Fondamentale al riavvio)
-        String availTopic = String(mqtt_topic_prefix) + "/nodo/" + String(peerList[i].nodeId) + "/availability";
-        mqttClient.publish(availTopic.c_str(), "online", true);
-
-        // 3. Pubblica stato attuale
-        publishPeerStatus(i, "HEARTBEAT"); 
-        
-        // Piccolo delay per evitare buffer overflow durante l'invio massivo
-        delay(50);
-    }
+    // Availability e stato di tutti i peer (config HA solo se cambiate): job a passi dal loop
+    startRepublish("HEARTBEAT", REPUBLISH_DISCOVERY_CHANGED);
 }
 
 void onMqttDisconnect() {
@@ -85,152 +91,236 @@ void onMqttDisconnect() {
 
 // Callback per messaggi MQTT ricevuti
 void onMqttMessage(char* topic, byte* payload, unsigned int length) {
-    // Converte payload in stringa in modo efficiente per evitare frammentazione
-    String message;
-    if (length > 0) {
-        message.reserve(length);
-        for (unsigned int i = 0; i < length; i++) {
-            message += (char)payload[i];
+    // Routing sulla tabella topic: nessuna copia di topic o payload
+    switch (matchMqttTopic(topic)) {
+        case TOPIC_GATEWAY_COMMAND:
+            processMqttCommand(payload, length);
+            break;
+        case TOPIC_NODE_COMMAND:
+            processNodeCommand(payload, length);
+            break;
+        case TOPIC_NODE_BATCH:
+            processNodeBatch(payload, length);
+            break;
+        case TOPIC_DASHBOARD_STATUS: {
+            // Handle Dashboard Discovery & Status
+            StaticJsonDocument<256> doc;
+            DeserializationError error = deserializeJson(doc, (const byte*) payload, length);
+            if (!error) {
+                if (doc.containsKey("status") && doc["status"] == "offline") {
+                     discoveredDashboardIP = ""; // Clear IP to signal offline
+                     DevLog.println("🖥️ Dashboard went OFFLINE (LWT)");
+                } else if (doc.containsKey("ip")) {
+                    discoveredDashboardIP = doc["ip"].as<const char*>();
+                    lastDashboardSeen = millis();
+                    DevLog.printf("🖥️ Dashboard rilevata: %s\n", discoveredDashboardIP.c_str());
+                }
+            }
+            break;
         }
-    }
-    
-    String topicStr = String(topic);
-    String gatewayCommandTopic = String(mqtt_topic_prefix) + "/gateway/command";
-    String nodeCommandTopic = String(mqtt_topic_prefix) + "/nodo/command";
-    String dashboardStatusTopic = String(mqtt_topic_prefix) + "/dashboard/status";
-    
-    if (topicStr == gatewayCommandTopic) {
-        processMqttCommand(message);
-    } else if (topicStr == nodeCommandTopic) {
-        processNodeCommand(message);
-    } else if (topicStr == dashboardStatusTopic) {
-        // Handle Dashboard Discovery & Status
-        DynamicJsonDocument doc(512);
-        DeserializationError error = deserializeJson(doc, message);
-        if (!error) {
-            if (doc.containsKey("status") && doc["status"] == "offline") {
-                 discoveredDashboardIP = ""; // Clear IP to signal offline
-                 DevLog.println("🖥️ Dashboard went OFFLINE (LWT)");
-            } else if (doc.containsKey("ip")) {
-                discoveredDashboardIP = doc["ip"].as<String>();
-                lastDashboardSeen = millis();
-                DevLog.printf("🖥️ Dashboard rilevata: %s\n", discoveredDashboardIP.c_str());
+        case TOPIC_HA_STATUS:
+            // Un birth retained arriva subito dopo la sottoscrizione: non è un riavvio di HA
+            if (length == 6 && memcmp(payload, "online", 6) == 0 &&
+                millis() - haStatusSubscribedAt > HA_BIRTH_GRACE_MS) {
+                DevLog.println("🏠 Home Assistant online: ripubblicazione discovery");
+                startRepublish("HEARTBEAT", REPUBLISH_DISCOVERY_FORCE);
+            }
+            break;
+        default: {
+            // <prefix>/nodo/<nodeId>/<entity>/set: instradato dal solo topic
+            char nodeId[sizeof(Peer::nodeId)];
+            char entity[sizeof(NodeEntity::suffix)];
+            if (parseNodeSetTopic(topic, nodeId, sizeof(nodeId), entity, sizeof(entity))) {
+                processEntityCommand(nodeId, entity, payload, length);
             }
+            break;
         }
     }
 }
 
 // --- FUNZIONI MQTT DI BASE --- //
+uint32_t nodeStatePublished = 0;
+
+// Stream condiviso /nodo/status: sempre senza stato per nodo, altrimenti a scelta
+static bool sharedNodeStatus() {
+    return !node_state_topics || legacy_node_status;
+}
+
+// gatewayId mai vuoto o "null" nei payload pubblicati
+static const char* publishedGatewayId() {
+    if (gateway_id[0] == '\0' || strcmp(gateway_id, "null") == 0) {
+        return "GATEWAY_02"; // Fallback to default
+    }
+    return gateway_id;
+}
+
+// Copia troncata in un campo a dimensione fissa (NULL -> stringa vuota)
+static void copyOutboxField(char* dest, size_t size, const char* src) {
+    strncpy(dest, src ? src : "", size - 1);
+    dest[size - 1] = '\0';
+}
+
 // Funzione per pubblicare stato del gateway: domoriky/gateway/status
-void publishGatewayStatus(const String& eventType, const String& message, const String& command, const String& ip) {
-    if (!mqttClient.connected()) {
+// Se MQTT non è disponibile (o ci sono eventi più vecchi in attesa) l'evento va nell'outbox.
+void publishGatewayStatus(const char* eventType, const char* message, const char* command, const char* ip) {
+    unsigned long timestamp = millis();
+    if (outboxEmpty() && sendGatewayStatus(timestamp, eventType, message, command, ip)) {
         return;
     }
     
-    // Topic unico per status del gateway: domoriky/gateway/status
-    String topic = String(mqtt_topic_prefix) + "/gateway/status";
-    
-    // Crea il payload JSON
-    DynamicJsonDocument doc(512);
-    doc["eventType"] = eventType;
-    doc["gatewayId"] = gateway_id;
-    doc["message"] = message;
-    doc["timestamp"] = millis();
-    doc["MAC"] = WiFi.macAddress(); // Aggiungi MAC address del gateway
-    doc["version"] = FIRMWARE_VERSION;
-    doc["buildDate"] = String(BUILD_DATE) + " " + String(BUILD_TIME);
-    
-    // Aggiungi il campo command se specificato
-    if (command.length() > 0) {
-        doc["command"] = command;
-    }
-    
-    // Aggiungi IP se specificato
-    if (ip.length() > 0) {
-        doc["ip"] = ip;
+    OutboxEvent event;
+    event.kind = OUTBOX_GATEWAY_STATUS;
+    event.timestamp = timestamp;
+    copyOutboxField(event.gateway.eventType, sizeof(event.gateway.eventType), eventType);
+    copyOutboxField(event.gateway.message, sizeof(event.gateway.message), message);
+    copyOutboxField(event.gateway.command, sizeof(event.gateway.command), command);
+    copyOutboxField(event.gateway.ip, sizeof(event.gateway.ip), ip);
+    outboxPush(event);
+}
+
+bool sendGatewayStatus(unsigned long timestamp, const char* eventType, const char* message, const char* command, const char* ip) {
+    if (!mqttClient.connected()) {
+        return false;
     }
     
-    // Safety check: ensure gatewayId is never null or empty
-    if (!doc["gatewayId"] || String(gateway_id).length() == 0 || String(gateway_id) == "null") {
-        doc["gatewayId"] = "GATEWAY_02"; // Fallback to default
+    // Topic unico per status del gateway: domoriky/gateway/status
+    const char* topic = mqttTopic(TOPIC_GATEWAY_STATUS);
+    
+    uint8_t mac[6];
+    WiFi.macAddress(mac); // MAC address del gateway
+    
+    return mqttPublishJson(topic, false, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("eventType", eventType);
+        json.add("gatewayId", publishedGatewayId());
+        json.add("message", message);
+        json.add("timestamp", timestamp);
+        json.addMac("MAC", mac);
+        json.add("version", FIRMWARE_VERSION);
+        json.beginString("buildDate");
+        json.appendString(BUILD_DATE);
+        json.appendString(" ");
+        json.appendString(BUILD_TIME);
+        json.endString();
+        
+        // Campi opzionali solo se specificati
+        if (command != NULL && command[0] != '\0') {
+            json.add("command", command);
+        }
+        if (ip != NULL && ip[0] != '\0') {
+            json.add("ip", ip);
+        }
+        json.endObject();
+    });
+}
+
+// Funzione per pubblicare dati nodi: domoriky/nodo/status (outbox come publishGatewayStatus)
+void publishNodeStatus(const char* nodeId, const char* topic_name, const char* command, const char* status, const char* type) {
+    unsigned long timestamp = millis();
+    if (outboxEmpty() && sendNodeStatus(timestamp, nodeId, topic_name, command, status, type)) {
+        return;
     }
     
-    String payload;
-    serializeJson(doc, payload);
-    
-    // Pubblica sul topic
-    mqttClient.publish(topic.c_str(), payload.c_str());
+    OutboxEvent event;
+    event.kind = OUTBOX_NODE_STATUS;
+    event.timestamp = timestamp;
+    copyOutboxField(event.node.node, sizeof(event.node.node), nodeId);
+    copyOutboxField(event.node.topic, sizeof(event.node.topic), topic_name);
+    copyOutboxField(event.node.command, sizeof(event.node.command), command);
+    copyOutboxField(event.node.status, sizeof(event.node.status), status);
+    copyOutboxField(event.node.type, sizeof(event.node.type), type);
+    outboxPush(event);
 }
 
-// Funzione per pubblicare dati nodi: domoriky/nodo/status
-void publishNodeStatus(const String& nodeId, const String& topic_name, const String& command, const String& status, const String& type) {
+bool sendNodeStatus(unsigned long timestamp, const char* nodeId, const char* topic_name, const char* command, const char* status, const char* type) {
     if (!mqttClient.connected()) {
-        return;
+        return false;
     }
     
     // Topic unico per status dei nodi: domoriky/nodo/status
-    String topic = String(mqtt_topic_prefix) + "/nodo/status";
-    
-    // Crea il payload JSON
-    DynamicJsonDocument doc(512);
-    doc["Node"] = nodeId;
-    doc["Topic"] = topic_name;
-    doc["Command"] = command;
-    doc["Status"] = status;
-    doc["Type"] = type;
-    doc["gatewayId"] = gateway_id;
-    doc["timestamp"] = millis();
-    
-    // Aggiungi MAC address del nodo se disponibile
-    for (int i = 0; i < peerCount; i++) {
-        if (String(peerList[i].nodeId) == nodeId) {
-            char macStr[18];
-            snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
-                    peerList[i].mac[0], peerList[i].mac[1], peerList[i].mac[2],
-                    peerList[i].mac[3], peerList[i].mac[4], peerList[i].mac[5]);
-            doc["MAC"] = macStr;
+    const char* topic = mqttTopic(TOPIC_NODE_STATUS);
+    
+    int i = findPeerByNodeId(nodeId);
+
+    // Stato per nodo (deduplicato); lo stream condiviso solo se ancora abilitato
+    if (i >= 0) publishNodeState(i, false);
+    if (!sharedNodeStatus()) {
+        return true;
+    }
+    
+    return mqttPublishJson(topic, false, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("Node", nodeId);
+        json.add("Topic", topic_name);
+        json.add("Command", command);
+        json.add("Status", status);
+        json.add("Type", type);
+        json.add("gatewayId", gateway_id);
+        json.add("timestamp", timestamp);
+        
+        // Aggiungi MAC address del nodo se disponibile
+        if (i >= 0) {
+            json.addMac("MAC", peerList[i].mac);
             
             // Include current attributes state for value_template
             if (strlen(peerList[i].attributes) > 0) {
-                doc["attributes"] = peerList[i].attributes;
+                json.add("attributes", peerList[i].attributes);
             }
-            
-            break;
         }
+        json.endObject();
+    });
+}
+
+bool publishNodeState(int i, bool force) {
+    if (!node_state_topics) return true;
+    if (!mqttClient.connected()) return false;
+
+    Peer& peer = peerList[i];
+    if (!HaDiscovery::isPublishable(peer)) return true;
+
+    uint32_t hash = fnv1a(peer.attributes);
+    if (hash == 0) hash = 1; // 0 è riservato a "da pubblicare"
+    if (!force && peer.stateHash == hash) return true;
+
+    char topic[MQTT_TOPIC_MAX];
+    if (mqttNodeTopic(topic, sizeof(topic), peer.nodeId, "state") == 0) return false;
+
+    // Payload compatto e retained: chi si sottoscrive riceve subito lo stato attuale
+    bool sent = mqttPublishJson(topic, true, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("attributes", peer.attributes);
+        json.endObject();
+    });
+    if (sent) {
+        peer.stateHash = hash;
+        nodeStatePublished++;
     }
-    
-    String payload;
-    serializeJson(doc, payload);
-    
-    // Pubblica sul topic
-    mqttClient.publish(topic.c_str(), payload.c_str());
+    return sent;
 }
 
-void publishNodeAvailability(const String& nodeId, const char* availability) {
+void publishNodeAvailability(const char* nodeId, const char* availability) {
     if (!mqttClient.connected()) {
         return;
     }
-    String topic = String(mqtt_topic_prefix) + String("/nodo/") + nodeId + String("/availability");
-    mqttClient.publish(topic.c_str(), availability, true);
+    char topic[MQTT_TOPIC_MAX];
+    if (mqttNodeTopic(topic, sizeof(topic), nodeId, "availability") == 0) return;
+    mqttClient.publish(topic, availability, true);
 }
 
-void publishToMQTT(const String& subtopic, const String& eventType, const String& message) {
+void publishToMQTT(const String&, const String& eventType, const String& message) {
     // Reindirizza alla nuova funzione gateway
-    publishGatewayStatus(eventType, message);
+    publishGatewayStatus(eventType.c_str(), message.c_str());
 }
 
+// Singolo tentativo di connessione (server e timeout impostati da MqttSession)
 bool connectToMQTT() {
     if (mqttConnected) {
         return true;
     }
     
-    mqttClient.setServer(mqtt_server, mqtt_port);
-    mqttClient.setCallback(onMqttMessage);
-    mqttClient.setKeepAlive(30);
-    mqttClient.setSocketTimeout(5);
-    
-    String clientId = "ESP8266Gateway_" + String(gateway_id);
-    String willTopic = String(mqtt_topic_prefix) + String("/gateway/availability");
+    char clientId[72];
+    snprintf(clientId, sizeof(clientId), "ESP8266Gateway_%s", gateway_id);
+    const char* willTopic = mqttTopic(TOPIC_GATEWAY_AVAILABILITY);
     const char* willMsg = "offline";
     
     bool connected = false;
@@ -242,17 +332,17 @@ bool connectToMQTT() {
     
     if (strlen(mqtt_user) > 0 && strlen(mqtt_password) > 0) {
         DevLog.println("   Uso autenticazione user/pass");
-        connected = mqttClient.connect(clientId.c_str(), mqtt_user, mqtt_password,
-                                      willTopic.c_str(), 0, true, willMsg);
+        connected = mqttClient.connect(clientId, mqtt_user, mqtt_password,
+                                      willTopic, 0, true, willMsg);
     } else {
         DevLog.println("   Connessione anonima");
-        connected = mqttClient.connect(clientId.c_str(), willTopic.c_str(), 0, true, willMsg);
+        connected = mqttClient.connect(clientId, willTopic, 0, true, willMsg);
     }
     
     if (connected) {
         DevLog.println("✅ MQTT Connesso!");
         // Birth message per availability gateway
-        mqttClient.publish(willTopic.c_str(), "online", true);
+        mqttClient.publish(willTopic, "online", true);
         onMqttConnect();
         return true;
     } else {
@@ -273,120 +363,90 @@ bool connectToMQTT() {
     }
 }
 
-void reconnectMQTT() {
-    unsigned long currentTime = millis();
-    
-    if (mqttConnected || (currentTime - lastMqttReconnectAttempt < MQTT_RECONNECT_INTERVAL)) {
-        return;
-    }
-    
-    lastMqttReconnectAttempt = currentTime;
-    // Ri-crea il client WiFi per resilienza
-    wifiClient.stop();
-    delay(50);
-    connectToMQTT();
-}
-
 void setupMQTT() {
     // IMPORTANTE: setBufferSize DEVE essere chiamato PRIMA di setServer
     mqttClient.setBufferSize(MQTT_MAX_PACKET_SIZE);
     mqttClient.setKeepAlive(30); // seconds
-    mqttClient.setSocketTimeout(5); // seconds
+    mqttClient.setSocketTimeout(MQTT_CONNACK_TIMEOUT_S); // seconds
     mqttClient.setServer(mqtt_server, mqtt_port);
     mqttClient.setCallback(onMqttMessage);
 }
 
 void publishPeerStatus(int i, const char* command) {
     if (!mqttClient.connected()) return;
+
+    // Le risposte a LIST_PEERS restano sullo stream condiviso anche quando è disattivato
+    publishNodeState(i, false);
+    if (!sharedNodeStatus() && strcmp(command, "LIST_PEER_ITEM") != 0) return;
     
     unsigned long currentTime = millis();
-    DynamicJsonDocument peerDoc(512);
-    peerDoc["command"] = command;
-    
-    // Safety check for gatewayId
-    if (String(gateway_id).length() == 0 || String(gateway_id) == "null") {
-        peerDoc["gatewayId"] = "GATEWAY_02"; // Fallback
-    } else {
-        peerDoc["gatewayId"] = gateway_id;
-    }
-    
-    peerDoc["timestamp"] = currentTime;
-    peerDoc["index"] = i;
-    peerDoc["totalNodes"] = peerCount;
+    const Peer& peer = peerList[i];
     
     // Calcola nodi online per allineamento con PING_NETWORK_REPORT
     int onlineNodes = 0;
     for(int j=0; j<peerCount; j++) {
         if(peerList[j].isOnline) onlineNodes++;
     }
-    peerDoc["onlineNodes"] = onlineNodes;
     
     char macStr[18];
     snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
-             peerList[i].mac[0], peerList[i].mac[1], peerList[i].mac[2], 
-             peerList[i].mac[3], peerList[i].mac[4], peerList[i].mac[5]);
-    
-    peerDoc["mac"] = macStr;
-    peerDoc["nodeId"] = strlen(peerList[i].nodeId) > 0 ? peerList[i].nodeId : macStr;
-    
-    // --- HA COMPATIBILITY FIELDS ---
-    // HaDiscovery expects "Node" (PascalCase) matching nodeId
-    peerDoc["Node"] = peerDoc["nodeId"]; 
-    // -------------------------------
-
-    peerDoc["nodeType"] = strlen(peerList[i].nodeType) > 0 ? peerList[i].nodeType : "UNKNOWN";
-    peerDoc["firmwareVersion"] = strlen(peerList[i].firmwareVersion) > 0 ? peerList[i].firmwareVersion : "UNKNOWN";
-    peerDoc["attributes"] = strlen(peerList[i].attributes) > 0 ? peerList[i].attributes : "";
-    peerDoc["status"] = peerList[i].isOnline ? "online" : "offline";
-    
-    // Aggiungi informazioni aggiuntive se disponibili
-    if (peerList[i].lastSeen > 0) {
-        unsigned long lastSeenAgo = currentTime - peerList[i].lastSeen;
-        peerDoc["lastSeenMs"] = lastSeenAgo;
-        peerDoc["lastSeen"] = String(lastSeenAgo / 1000) + "s fa";
+             peer.mac[0], peer.mac[1], peer.mac[2], 
+             peer.mac[3], peer.mac[4], peer.mac[5]);
+    const char* nodeId = strlen(peer.nodeId) > 0 ? peer.nodeId : macStr;
+    
+    char lastSeen[24]; // "%lus fa" con unsigned long a 64 bit (host)
+    unsigned long lastSeenAgo = currentTime - peer.lastSeen;
+    if (peer.lastSeen > 0) {
+        snprintf(lastSeen, sizeof(lastSeen), "%lus fa", lastSeenAgo / 1000);
     } else {
-         peerDoc["lastSeenMs"] = -1;
-         peerDoc["lastSeen"] = "MAI";
+        strcpy(lastSeen, "MAI");
     }
-
-    String peerResponse;
-    serializeJson(peerDoc, peerResponse);
     
     // Topic unico per invio lista nodi e status updates
-    String topic = String(mqtt_topic_prefix) + "/nodo/status";
-    mqttClient.publish(topic.c_str(), peerResponse.c_str());
+    const char* topic = mqttTopic(TOPIC_NODE_STATUS);
+    
+    mqttPublishJson(topic, false, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("command", command);
+        json.add("gatewayId", publishedGatewayId());
+        json.add("timestamp", currentTime);
+        json.add("index", i);
+        json.add("totalNodes", peerCount);
+        json.add("onlineNodes", onlineNodes);
+        json.add("mac", macStr);
+        json.add("nodeId", nodeId);
+        
+        // --- HA COMPATIBILITY FIELDS ---
+        // HaDiscovery expects "Node" (PascalCase) matching nodeId
+        json.add("Node", nodeId);
+        // -------------------------------
+
+        json.add("nodeType", strlen(peer.nodeType) > 0 ? peer.nodeType : "UNKNOWN");
+        json.add("firmwareVersion", strlen(peer.firmwareVersion) > 0 ? peer.firmwareVersion : "UNKNOWN");
+        json.add("attributes", peer.attributes);
+        json.add("status", peer.isOnline ? "online" : "offline");
+        
+        // Aggiungi informazioni aggiuntive se disponibili
+        if (peer.lastSeen > 0) {
+            json.add("lastSeenMs", lastSeenAgo);
+        } else {
+            json.add("lastSeenMs", -1);
+        }
+        json.add("lastSeen", lastSeen);
+        json.endObject();
+    });
 }
 
 void sendGatewayHeartbeat() {
     unsigned long currentTime = millis();
     
-    // Crea JSON per il heartbeat del gateway (ridotto buffer a 1024 bytes se possibile, ma 2048 è sicuro per molti peer)
-    // Ottimizzazione: Usiamo 1536 che è un buon compromesso
-    DynamicJsonDocument gatewayHeartbeatDoc(1536);
-    gatewayHeartbeatDoc["command"] = "GATEWAY_HEARTBEAT";
-    gatewayHeartbeatDoc["gatewayId"] = gateway_id;
-    gatewayHeartbeatDoc["mac"] = WiFi.macAddress();
-    gatewayHeartbeatDoc["status"] = "ALIVE";
-    gatewayHeartbeatDoc["timestamp"] = currentTime;
-    gatewayHeartbeatDoc["uptime"] = currentTime;
-    gatewayHeartbeatDoc["freeHeap"] = ESP.getFreeHeap();
-    gatewayHeartbeatDoc["wifiRSSI"] = WiFi.RSSI();
-    gatewayHeartbeatDoc["peerCount"] = peerCount;
-    
-    // Aggiungi Versione Firmware
-    gatewayHeartbeatDoc["version"] = FIRMWARE_VERSION;
-    gatewayHeartbeatDoc["buildDate"] = String(BUILD_DATE) + " " + String(BUILD_TIME);
-    
-    // Aggiungi IP del gateway
-    gatewayHeartbeatDoc["ip"] = WiFi.localIP().toString();
-    
-    // Aggiungi informazioni rete
-    gatewayHeartbeatDoc["modalita_rete"] = network_mode;
-    
-    // Aggiungi informazioni peer (semplificato)
-    JsonObject peerInfo = gatewayHeartbeatDoc.createNestedObject("peer");
-    peerInfo["registrati"] = peerCount;
-    peerInfo["massimo"] = MAX_PEERS;
+    // Valori letti una sola volta: il JSON viene generato due volte (conteggio + invio)
+    uint32_t freeHeap = ESP.getFreeHeap();
+    int32_t rssi = WiFi.RSSI();
+    IPAddress localIp = WiFi.localIP();
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    bool connected = mqttClient.connected();
     
     // Conta nodi online
     int onlineCount = 0;
@@ -395,23 +455,134 @@ void sendGatewayHeartbeat() {
             onlineCount++;
         }
     }
-    peerInfo["online"] = onlineCount;
-    
-    // Aggiungi informazioni MQTT
-    JsonObject mqttInfo = gatewayHeartbeatDoc.createNestedObject("mqtt");
-    mqttInfo["server"] = String(mqtt_server) + ":" + String(mqtt_port);
-    mqttInfo["connected"] = mqttClient.connected();
     
-    String heartbeatOutput;
-    serializeJson(gatewayHeartbeatDoc, heartbeatOutput);
+    DomoticaStats radio = DomoticaEspNow::getStats();
+    uint8_t slotsUsed = DomoticaEspNow::peerSlotCount();
+    uint32_t rxHighWater = rxRingHighWater;
+    uint32_t rxOverflows = rxRingOverflows;
+    uint32_t cbAvgUs = rxCallbackCount ? rxCallbackTotalUs / rxCallbackCount : 0;
+    uint32_t cbMaxUs = rxCallbackMaxUs;
+    uint16_t outboxPendingNow = outboxPending();
+    uint8_t commandsPendingNow = commandTrackerPending();
     
     // Topic unificato per status del gateway
-    String topic = String(mqtt_topic_prefix) + "/gateway/status";
+    const char* topic = mqttTopic(TOPIC_GATEWAY_STATUS);
     
     // Pubblica sul topic unificato del gateway (RETAINED = true per persistenza stato)
-    if (mqttClient.connected() && mqttClient.publish(topic.c_str(), heartbeatOutput.c_str(), true)) {
-        DevLog.printf("Heartbeat gateway inviato al topic: %s\n", topic.c_str());
-        // DevLog.println(heartbeatOutput); // Risparmia log
+    bool sent = mqttPublishJson(topic, true, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("command", "GATEWAY_HEARTBEAT");
+        json.add("gatewayId", gateway_id);
+        json.addMac("mac", mac);
+        json.add("status", "ALIVE");
+        json.add("timestamp", currentTime);
+        json.add("uptime", currentTime);
+        json.add("freeHeap", freeHeap);
+        json.add("wifiRSSI", rssi);
+        json.add("peerCount", peerCount);
+        
+        // Aggiungi Versione Firmware
+        json.add("version", FIRMWARE_VERSION);
+        json.beginString("buildDate");
+        json.appendString(BUILD_DATE);
+        json.appendString(" ");
+        json.appendString(BUILD_TIME);
+        json.endString();
+        
+        // Aggiungi IP del gateway
+        json.addIp("ip", localIp);
+        
+        // Aggiungi informazioni rete
+        json.add("modalita_rete", network_mode);
+        
+        // Aggiungi informazioni peer (semplificato)
+        json.beginObject("peer");
+        json.add("registrati", peerCount);
+        json.add("massimo", MAX_PEERS);
+        json.add("online", onlineCount);
+        json.add("statusPublished", statusPublished);
+        json.add("statusSuppressed", statusSuppressed);
+
+        // Slot radio ESP-NOW (LRU gestito dalla libreria)
+        json.beginObject("slotRadio");
+        json.add("usati", slotsUsed);
+        json.add("capacity", DOMOTICA_PEER_SLOTS);
+        json.add("hits", radio.peerHits);
+        json.add("misses", radio.peerMisses);
+        json.add("evictions", radio.peerEvictions);
+        json.endObject();
+        json.endObject();
+
+        // Statistiche ring di ricezione ESP-NOW
+        json.beginObject("espnow_rx");
+        json.add("capacity", RX_RING_SIZE);
+        json.add("highWater", rxHighWater);
+        json.add("overflows", rxOverflows);
+        json.add("cbAvgUs", cbAvgUs);
+        json.add("cbMaxUs", cbMaxUs);
+        json.endObject();
+
+        json.beginObject("espnow_tx");
+        json.add("capacity", DOMOTICA_TX_QUEUE);
+        json.add("highWater", radio.txQueueHighWater);
+        json.add("dropped", radio.txDropped);
+        json.add("backoffs", radio.txBackoffs);
+        json.endObject();
+
+        // Store-and-forward MQTT
+        json.beginObject("outbox");
+        json.add("pending", outboxPendingNow);
+        json.add("highWater", outboxHighWater);
+        json.add("delivered", outboxDelivered);
+        json.add("spilled", outboxSpilled);
+        json.add("dropped", outboxDropped);
+        json.endObject();
+
+        // Comandi in attesa di feedback dai nodi
+        json.beginObject("commands");
+        json.add("pending", commandsPendingNow);
+        json.add("highWater", commandPoolHighWater);
+        json.add("timeouts", commandTimeouts);
+        json.add("retries", commandRetries);
+        json.add("failed", commandsFailed);
+        json.add("untracked", commandPoolExhausted);
+        json.endObject();
+
+        // Round-trip comandi per nodo (ms): solo i nodi con almeno un campione
+        json.beginArray("rtt");
+        for (int i = 0; i < peerCount; i++) {
+            const PeerRtt& rtt = peerList[i].rtt;
+            if (rtt.sampleCount == 0) continue;
+            uint16_t p50, p95;
+            commandTrackerPercentiles(i, &p50, &p95);
+            json.beginObject();
+            json.add("node", peerList[i].nodeId);
+            json.add("srtt", (unsigned int) (rtt.srtt8 >> 3));
+            json.add("rttvar", (unsigned int) (rtt.rttvar4 >> 2));
+            json.add("rto", (unsigned int) commandTrackerRto(i));
+            json.add("p50", (unsigned int) p50);
+            json.add("p95", (unsigned int) p95);
+            json.add("samples", (unsigned int) rtt.sampleCount);
+            json.endObject();
+        }
+        json.endArray();
+        
+        // Aggiungi informazioni MQTT
+        char port[8];
+        snprintf(port, sizeof(port), "%d", mqtt_port);
+        json.beginObject("mqtt");
+        json.beginString("server");
+        json.appendString(mqtt_server);
+        json.appendString(":");
+        json.appendString(port);
+        json.endString();
+        json.add("connected", connected);
+        json.endObject();
+        json.endObject();
+    });
+    
+    if (sent) {
+        DevLog.printf("Heartbeat gateway inviato al topic: %s\n", topic);
     } else {
         DevLog.println("Errore invio heartbeat gateway");
     }
@@ -422,9 +593,8 @@ void sendDashboardDiscovery() {
         DevLog.println("❌ Cannot send discovery: MQTT not connected");
         return;
     }
-    String dashboardDiscoveryTopic = String(mqtt_topic_prefix) + "/dashboard/discovery";
-    mqttClient.publish(dashboardDiscoveryTopic.c_str(), "{\"command\":\"DISCOVER\"}");
-    DevLog.printf("📡 Manual Dashboard Discovery sent to: %s\n", dashboardDiscoveryTopic.c_str());
+    mqttClient.publish(mqttTopic(TOPIC_DASHBOARD_DISCOVERY), "{\"command\":\"DISCOVER\"}");
+    DevLog.printf("📡 Manual Dashboard Discovery sent to: %s\n", mqttTopic(TOPIC_DASHBOARD_DISCOVERY));
 }
 
 void triggerGlobalDiscovery() {
@@ -436,26 +606,8 @@ void triggerGlobalDiscovery() {
     // 2. Announce Dashboard
     sendDashboardDiscovery();
     
-    // 3. Publish Discovery for all Peers
-    if (mqttClient.connected()) {
-        for (int i = 0; i < peerCount; i++) {
-            // HA Discovery (Force Reset)
-            HaDiscovery::publishDiscovery(mqttClient, peerList[i], mqtt_topic_prefix, true); 
-            
-            // Dashboard Config
-            HaDiscovery::publishDashboardConfig(mqttClient, peerList[i], mqtt_topic_prefix);
-            
-            // Peer Status (Attributes, etc)
-            publishPeerStatus(i, "DISCOVERY_TRIGGERED");
-            
-            // Availability
-            String availTopic = String(mqtt_topic_prefix) + "/nodo/" + String(peerList[i].nodeId) + "/availability";
-            mqttClient.publish(availTopic.c_str(), "online", true);
-            
-            // Small delay to prevent buffer overflow
-            delay(50);
-        }
-    }
+    // 3. Publish Discovery for all Peers (HA Force Reset, job a passi dal loop)
+    startRepublish("DISCOVERY_TRIGGERED", REPUBLISH_DISCOVERY_RESET);
 
     // 4. Broadcast Discovery Request (ESP-NOW) to find new nodes
     uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -471,7 +623,7 @@ void triggerGlobalDiscovery() {
 
 void performOTA(String url) {
     DevLog.println("Avvio OTA Update da: " + url);
-    publishGatewayStatus("ota_start", "Starting OTA update from " + url, "OTA_UPDATE");
+    publishGatewayStatus("ota_start", ("Starting OTA update from " + url).c_str(), "OTA_UPDATE");
     
     // Assicura che il messaggio MQTT venga inviato prima di bloccare tutto
     mqttClient.loop();
@@ -484,13 +636,16 @@ void performOTA(String url) {
     // Disabilita interrupts/watchdogs se necessario, ma ESPhttpUpdate gestisce molto da solo.
     ESPhttpUpdate.setLedPin(LED_BUILTIN, LOW); 
     
+    // Peer in attesa di scrittura salvati prima del riavvio dell'update
+    forceSavePeers();
+
     // Importante: usare updateClient separato
     t_httpUpdate_return ret = ESPhttpUpdate.update(updateClient, url);
 
     switch (ret) {
         case HTTP_UPDATE_FAILED:
             DevLog.printf("HTTP_UPDATE_FAILED Error (%d): %s\n", ESPhttpUpdate.getLastError(), ESPhttpUpdate.getLastErrorString().c_str());
-            publishGatewayStatus("ota_failed", "Error: " + ESPhttpUpdate.getLastErrorString(), "OTA_UPDATE");
+            publishGatewayStatus("ota_failed", ("Error: " + ESPhttpUpdate.getLastErrorString()).c_str(), "OTA_UPDATE");
             break;
 
         case HTTP_UPDATE_NO_UPDATES:
@@ -505,343 +660,305 @@ void performOTA(String url) {
     }
 }
 
-void processMqttCommand(const String& msgStr) {
-    DevLog.print("RICEVUTO - MQTT Command: ");
-    DevLog.println(msgStr);
+// --- COMANDI GATEWAY (MQTT) --- //
+// Un gestore per comando; la tabella gatewayCommands è indicizzata dalla keyword
+// (MessageDispatch) a partire da KW_FIRST_GATEWAY_COMMAND.
+// NOTA: Il comando NODE_REBOOT è gestito in processNodeCommand (topic <prefix>/nodo/command)
 
-    // Variabile per tracciare se il comando è stato gestito
-    bool commandHandled = false;
+typedef void (*GatewayCommandHandler)(JsonDocument& doc);
 
-    // Parsing JSON per la nuova struttura semplificata
-    DynamicJsonDocument doc(512);
-    DeserializationError parseError = deserializeJson(doc, msgStr);
+// Comando OTA_UPDATE
+static void cmdOtaUpdate(JsonDocument& doc) {
+    DevLog.println("--- COMMAND: OTA_UPDATE RECEIVED ---");
     
-    if (parseError) {
-        DevLog.println("Errore parsing JSON");
-        publishGatewayStatus("error", "Invalid JSON format");
-        return;
+    // Verifica che il comando sia per questo gateway specifico
+    if (doc.containsKey("gatewayId")) {
+        String targetId = doc["gatewayId"].as<String>();
+        DevLog.printf("Target Gateway ID: %s (My ID: %s)\n", targetId.c_str(), gateway_id);
+        
+        if (targetId != String(gateway_id)) {
+            DevLog.println("Ignored: Command not for me.");
+            return; 
+        }
+    } else {
+        DevLog.println("Warning: No gatewayId in command, proceeding anyway (broadcast?)");
     }
-    
-    // Comandi per il GATEWAY - Struttura: {"command": "PING_NETWORK"}
-    String command = "";
-    if (doc.containsKey("command")) {
-        command = doc["command"].as<String>();
-    } else if (doc.containsKey("Command")) {
-        command = doc["Command"].as<String>();
+
+    if (doc.containsKey("url")) {
+        String url = doc["url"].as<String>();
+        performOTA(url);
+    } else {
+        DevLog.println("Error: Missing URL");
+        publishGatewayStatus("error", "Missing URL for OTA_UPDATE", "OTA_UPDATE");
     }
-    
-    if (command.length() > 0) {
-        
-        DevLog.printf("Comando per GATEWAY - Command: %s\n", command.c_str());
+}
 
-        // Comando OTA_UPDATE
-        if (command == "OTA_UPDATE") {
-            DevLog.println("--- COMMAND: OTA_UPDATE RECEIVED ---");
-            
-            // Verifica che il comando sia per questo gateway specifico
-            if (doc.containsKey("gatewayId")) {
-                String targetId = doc["gatewayId"].as<String>();
-                DevLog.printf("Target Gateway ID: %s (My ID: %s)\n", targetId.c_str(), gateway_id);
-                
-                if (targetId != String(gateway_id)) {
-                    DevLog.println("Ignored: Command not for me.");
-                    return; 
-                }
-            } else {
-                DevLog.println("Warning: No gatewayId in command, proceeding anyway (broadcast?)");
-            }
+// Comando GET_VERSION
+static void cmdGetVersion(JsonDocument&) {
+    char message[96];
+    snprintf(message, sizeof(message), "Version: %s, Build: %s %s", FIRMWARE_VERSION, BUILD_DATE, BUILD_TIME);
+    publishGatewayStatus("version_info", message, "GET_VERSION");
+}
 
-            if (doc.containsKey("url")) {
-                String url = doc["url"].as<String>();
-                performOTA(url);
-            } else {
-                DevLog.println("Error: Missing URL");
-                publishGatewayStatus("error", "Missing URL for OTA_UPDATE", "OTA_UPDATE");
-            }
-            return;
-        }
+// Comando LIST_PEERS
+static void cmdListPeers(JsonDocument&) {
+    listPeers();
+}
 
-        // Comando GET_VERSION
-        if (command == "GET_VERSION") {
-            String message = "Version: " + String(FIRMWARE_VERSION) + ", Build: " + String(BUILD_DATE) + " " + String(BUILD_TIME);
-            publishGatewayStatus("version_info", message, "GET_VERSION");
-            return;
-        }
-        
-        // Comando LIST_PEERS
-        if (command == "LIST_PEERS") {
-            listPeers();
-            return;
-        }
+// Comando RESET_WIFI_CONFIG
+static void cmdResetWifiConfig(JsonDocument&) {
+    DevLog.println("Comando RESET_WIFI_CONFIG ricevuto via MQTT. Eseguo reset WiFi...");
+    publishGatewayStatus("wifi_reset", "Resetting WiFi configuration and rebooting...", "RESET_WIFI_CONFIG");
+    // Piccolo delay per permettere l'invio del messaggio MQTT
+    delay(1000);
+    resetWiFiConfig();
+}
 
-        // Comando RESET_WIFI_CONFIG
-        if (command == "RESET_WIFI_CONFIG") {
-            DevLog.println("Comando RESET_WIFI_CONFIG ricevuto via MQTT. Eseguo reset WiFi...");
-            publishGatewayStatus("wifi_reset", "Resetting WiFi configuration and rebooting...", "RESET_WIFI_CONFIG");
-            // Piccolo delay per permettere l'invio del messaggio MQTT
-            delay(1000);
-            resetWiFiConfig();
-            return;
-        }
-        
+// Comando GATEWAY_HEARTBEAT
+static void cmdGatewayHeartbeat(JsonDocument&) {
+    sendGatewayHeartbeat();
+}
 
-        // Comando GATEWAY_HEARTBEAT
-        if (command == "GATEWAY_HEARTBEAT") {
-            sendGatewayHeartbeat();
-            return;
-        }
-        
-        // NOTA: Il comando NODE_REBOOT è ora gestito nella funzione processNodeCommand
-        // per essere inviato al topic corretto: domoriky/nodo/command
+// Comando NODE_FACTORY_RESET - Factory reset di un nodo specifico
+static void cmdNodeFactoryReset(JsonDocument& doc) {
+    if (doc.containsKey("nodeId")) {
+        String targetNodeId = doc["nodeId"].as<String>();
         
-        // Comando NODE_FACTORY_RESET - Factory reset di un nodo specifico
-        if (command == "NODE_FACTORY_RESET") {
-            if (doc.containsKey("nodeId")) {
-                String targetNodeId = doc["nodeId"].as<String>();
-                
-                // Cerca il nodo nella lista dei peer
-                bool nodeFound = false;
-                for (int i = 0; i < peerCount; i++) {
-                    if (String(peerList[i].nodeId) == targetNodeId) {
-                        // Invia comando FACTORY_RESET al nodo specifico
-                        espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "FACTORY_RESET", "", "COMMAND", gateway_id);
-                        
-                        // Invia conferma via WebSocket (o MQTT se necessario)
-                        // In questo caso loggiamo solo
-                        DevLog.printf("Factory reset sent to node %s\n", targetNodeId.c_str());
-                        
-                        nodeFound = true;
-                        break;
-                    }
-                }
-                
-                if (!nodeFound) {
-                    // Nodo non trovato nella lista peer - nessun messaggio MQTT
-                }
-            } else {
-                // Parametro nodeId mancante - nessun messaggio MQTT
-            }
-            commandHandled = true;
-            return;
-        }
-        
-        // Comando NETWORK_REBOOT - Riavvia tutti i nodi nella rete
-        if (command == "NETWORK_REBOOT") {
-            DynamicJsonDocument responseDoc(512);
-            responseDoc["command"] = "NETWORK_REBOOT";
-            responseDoc["timestamp"] = millis();
-            responseDoc["total_nodes"] = peerCount;
-            
-            if (peerCount > 0) {
-                JsonArray rebootedNodes = responseDoc.createNestedArray("rebooted_nodes");
-                int nodesSent = 0;
-                
-                // Invia comando RESTART individualmente a ciascun nodo (come sequenza di NODE_REBOOT)
-                for (int i = 0; i < peerCount; i++) {
-                    if (peerList[i].isOnline) {
-                        // Invia comando RESTART al nodo specifico (come NODE_REBOOT)
-                        espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESTART", "REQUEST", "COMMAND", gateway_id);
-                        
-                        // Aggiungi il nodo alla lista dei nodi riavviati
-                        rebootedNodes.add(peerList[i].nodeId);
-                        nodesSent++;
-                        
-                        // Piccolo delay tra un invio e l'altro
-                        delay(50);
-                    }
-                }
-                
-                responseDoc["nodes_sent"] = nodesSent;
-                
-                DevLog.printf("Network Reboot initiated: %d nodes targeted\n", nodesSent);
+        // Cerca il nodo nella lista dei peer
+        bool nodeFound = false;
+        int i = findPeerByNodeId(targetNodeId.c_str());
+        if (i >= 0) {
+            // Invia comando FACTORY_RESET al nodo specifico
+            // In questo caso loggiamo solo (anche il rifiuto per coda radio piena)
+            if (espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "FACTORY_RESET", "", "COMMAND", gateway_id)) {
+                DevLog.printf("Factory reset sent to node %s\n", targetNodeId.c_str());
             } else {
-                responseDoc["error"] = "No peers found";
-                DevLog.println("Network Reboot failed: No peers");
+                DevLog.printf("⚠️ Factory reset for node %s dropped: radio queue full\n", targetNodeId.c_str());
             }
             
-            commandHandled = true;
-            return;
+            nodeFound = true;
         }
         
-        // Comando REMOVE_PEER con formato JSON
-        if (command == "REMOVE_PEER") {
-            if (doc.containsKey("gatewayId")) {
-                String requestedGatewayId = doc["gatewayId"];
-                if (requestedGatewayId == gateway_id) {
-                    if (doc.containsKey("mac")) {
-                        String macAddress = doc["mac"];
-                        removePeer(macAddress.c_str());
-                    } else {
-                        publishGatewayStatus("missing_parameter", "MAC address required for REMOVE_PEER command", "REMOVE_PEER");
-                    }
-                }
-            }
-            commandHandled = true;
-            return;
+        if (!nodeFound) {
+            // Nodo non trovato nella lista peer - nessun messaggio MQTT
         }
-        
-        // Comando CLEAR_PEERS con formato JSON
-        if (command == "CLEAR_PEERS") {
-            if (doc.containsKey("gatewayId")) {
-                String requestedGatewayId = doc["gatewayId"];
-                if (requestedGatewayId == gateway_id) {
-                    clearAllPeers();
-                }
-                // Se gatewayId diverso, ignora silenziosamente
+    } else {
+        // Parametro nodeId mancante - nessun messaggio MQTT
+    }
+}
+
+// Comando NETWORK_REBOOT - Riavvia tutti i nodi nella rete
+static void cmdNetworkReboot(JsonDocument&) {
+    // Nessun report MQTT: l'esito resta nel log
+    if (peerCount > 0) {
+        // RESTART individuale a ciascun nodo online (come sequenza di NODE_REBOOT), a passi dal loop
+        int nodesTargeted = startNetworkReboot();
+        DevLog.printf("Network Reboot initiated: %d nodes targeted\n", nodesTargeted);
+    } else {
+        DevLog.println("Network Reboot failed: No peers");
+    }
+}
+
+// Comando REMOVE_PEER con formato JSON
+static void cmdRemovePeer(JsonDocument& doc) {
+    if (doc.containsKey("gatewayId")) {
+        String requestedGatewayId = doc["gatewayId"];
+        if (requestedGatewayId == gateway_id) {
+            if (doc.containsKey("mac")) {
+                String macAddress = doc["mac"];
+                removePeer(macAddress.c_str());
             } else {
-                // Parametro gatewayId mancante - nessun messaggio MQTT
+                publishGatewayStatus("missing_parameter", "MAC address required for REMOVE_PEER command", "REMOVE_PEER");
             }
-            commandHandled = true;
-            return;
         }
-        
-        // Comando RESET_TO_AP con formato JSON
-        if (command == "RESET_TO_AP") {
-            resetWiFiConfig();
-            commandHandled = true;
-            return;
+    }
+}
+
+// Comando CLEAR_PEERS con formato JSON
+static void cmdClearPeers(JsonDocument& doc) {
+    if (doc.containsKey("gatewayId")) {
+        String requestedGatewayId = doc["gatewayId"];
+        if (requestedGatewayId == gateway_id) {
+            clearAllPeers();
+        }
+        // Se gatewayId diverso, ignora silenziosamente
+    } else {
+        // Parametro gatewayId mancante - nessun messaggio MQTT
+    }
+}
+
+// Comando RESET_TO_AP con formato JSON
+static void cmdResetToAp(JsonDocument&) {
+    resetWiFiConfig();
+}
+
+// Comando CLEANUP_OFFLINE_PEERS - Rimuove tutti i peer offline
+static void cmdCleanupOfflinePeers(JsonDocument&) {
+    DevLog.println("RICEVUTO - Comando: CLEANUP_OFFLINE_PEERS");
+    
+    int offlineCount = 0;
+    
+    // Conta i peer offline e crea lista temporanea
+    for (int i = 0; i < peerCount; i++) {
+        if (!peerList[i].isOnline) {
+            offlineCount++;
         }
+    }
+    
+    if (offlineCount > 0) {
+        DevLog.print("Trovati ");
+        DevLog.print(offlineCount);
+        DevLog.println(" peer offline da rimuovere");
         
-        // Comando CLEANUP_OFFLINE_PEERS - Rimuove tutti i peer offline
-        if (command == "CLEANUP_OFFLINE_PEERS") {
-            DevLog.println("RICEVUTO - Comando: CLEANUP_OFFLINE_PEERS");
-            
-            int offlineCount = 0;
-            int totalCount = peerCount;
-            
-            // Conta i peer offline e crea lista temporanea
-            for (int i = 0; i < peerCount; i++) {
-                if (!peerList[i].isOnline) {
-                    offlineCount++;
-                }
-            }
-            
-            if (offlineCount > 0) {
-                DevLog.print("Trovati ");
-                DevLog.print(offlineCount);
-                DevLog.println(" peer offline da rimuovere");
-                
-                // Rimuove i peer offline spostando i peer online all'inizio
-                int newPeerCount = 0;
-                for (int i = 0; i < peerCount; i++) {
-                    if (peerList[i].isOnline) {
-                        // Copia peer online nella nuova posizione
-                        if (i != newPeerCount) {
-                            memcpy(&peerList[newPeerCount], &peerList[i], sizeof(Peer));
-                        }
-                        newPeerCount++;
-                    } else {
-                        // Log rimozione peer offline
-                        DevLog.print("Rimosso peer offline: ");
-                        DevLog.println(peerList[i].nodeId);
-                    }
+        // Rimuove i peer offline spostando i peer online all'inizio
+        int newPeerCount = 0;
+        for (int i = 0; i < peerCount; i++) {
+            if (peerList[i].isOnline) {
+                // Copia peer online nella nuova posizione
+                if (i != newPeerCount) {
+                    memcpy(&peerList[newPeerCount], &peerList[i], sizeof(Peer));
                 }
-                
-                peerCount = newPeerCount;
-                
-                // Salva la lista aggiornata
-                savePeersToLittleFS();
-                
-                DevLog.print("Cleanup completato: rimossi ");
-                DevLog.print(offlineCount);
-                DevLog.print(" peer, rimasti ");
-                DevLog.println(peerCount);
-                
+                newPeerCount++;
             } else {
-                // Nessun peer offline da rimuovere
-                DevLog.println("Nessun peer offline da rimuovere");
+                // Libera anche l'eventuale slot radio e i comandi in attesa del nodo
+                espNow.removePeer(peerList[i].mac);
+                commandTrackerDropPeer(peerList[i].mac);
+                DevLog.print("Rimosso peer offline: ");
+                DevLog.println(peerList[i].nodeId);
             }
-            
-            commandHandled = true;
-            return;
         }
         
-        // Comando RESTART con formato JSON
-        if (command == "RESTART") {
-            DevLog.println("RICEVUTO - Comando: RESTART");
-            
-            // Verifica gatewayId se specificato
-            if (doc.containsKey("gatewayId")) {
-                String targetGatewayId = doc["gatewayId"].as<String>();
-                if (targetGatewayId != String(gateway_id)) {
-                    return; // Ignora silenziosamente se gatewayId diverso
-                }
-            }
-            
-            // Disconnetti MQTT
-            mqttClient.disconnect();
-            mqttConnected = false;
-            
-            DevLog.println("Restarting ESP8266...");
-            delay(1000);
-            
-            // Riavvia l'ESP8266 senza resettare la configurazione
-            ESP.restart();
-            commandHandled = true;
-            return;
-        }
+        peerCount = newPeerCount;
+        rebuildPeerIndex();
         
-        // Comando NETWORK_DISCOVERY / DISCOVERY con formato JSON
-        if (command == "NETWORK_DISCOVERY" || command == "DISCOVERY") {
-            DevLog.println("RICEVUTO - Comando: DISCOVERY / NETWORK_DISCOVERY");
-            triggerGlobalDiscovery();
-            commandHandled = true;
-            return;
-        }
+        // Salva la lista aggiornata
+        peerStoreMarkRemoved();
         
-        // Comando PING_NETWORK - Invia PING individualmente a tutti i nodi online
-        if (command == "PING_NETWORK") {
-            DevLog.println("RICEVUTO - Comando: PING_NETWORK");
-            
-            int nodesSent = 0;
-            String pingedNodesStr = "[";
-            
-            if (peerCount > 0) {
-                // Resetta lo stato delle risposte
-                memset(pingResponseReceived, 0, sizeof(pingResponseReceived));
-                
-                // Invia comando PING individualmente a TUTTI i nodi nella lista
-                for (int i = 0; i < peerCount; i++) {
-                    // Salva il MAC del nodo pingato usando l'indice corretto
-                    memcpy(pingedNodesMac[i], peerList[i].mac, 6);
-                    pingResponseReceived[i] = false;
-                    
-                    // Invia comando PING al nodo specifico
-                    espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "PING", "REQUEST", "COMMAND", gateway_id);
-                    
-                    // Aggiungi ID nodo alla lista stringa (più leggero di JSON object completo)
-                    if (nodesSent > 0) pingedNodesStr += ",";
-                    pingedNodesStr += "\"" + String(peerList[i].nodeId) + "\"";
-                    
-                    nodesSent++;
-                    
-                    // Piccolo delay tra un invio e l'altro per evitare sovraccarico
-                    delay(10);
-                }
-                
-                // Avvia il processo di attesa risposte
-                pingNetworkActive = true;
-                pingNetworkStartTime = millis();
-                pingResponseCount = peerCount; 
-            }
-            pingedNodesStr += "]";
-            
-            // Costruisci JSON manualmente per risparmiare RAM (evita DynamicJsonDocument 2KB)
-            String responseOutput = "{";
-            responseOutput += "\"command\":\"PING_NETWORK\",";
-            responseOutput += "\"timestamp\":" + String(millis()) + ",";
-            responseOutput += "\"total_nodes\":" + String(peerCount) + ",";
-            responseOutput += "\"nodes_sent\":" + String(nodesSent) + ",";
-            responseOutput += "\"result\":\"" + String(nodesSent > 0 ? "success" : "no_nodes") + "\",";
-            responseOutput += "\"pinged_nodes\":" + pingedNodesStr;
-            responseOutput += "}";
-            
-            // Pubblica report iniziale
-            String topic = String(mqtt_topic_prefix) + "/gateway/status";
-            mqttClient.publish(topic.c_str(), responseOutput.c_str());
-            
-            commandHandled = true;
-            return;
+        DevLog.print("Cleanup completato: rimossi ");
+        DevLog.print(offlineCount);
+        DevLog.print(" peer, rimasti ");
+        DevLog.println(peerCount);
+        
+    } else {
+        // Nessun peer offline da rimuovere
+        DevLog.println("Nessun peer offline da rimuovere");
+    }
+}
+
+// Comando RESTART con formato JSON
+static void cmdRestart(JsonDocument& doc) {
+    DevLog.println("RICEVUTO - Comando: RESTART");
+    
+    // Verifica gatewayId se specificato
+    if (doc.containsKey("gatewayId")) {
+        String targetGatewayId = doc["gatewayId"].as<String>();
+        if (targetGatewayId != String(gateway_id)) {
+            return; // Ignora silenziosamente se gatewayId diverso
+        }
+    }
+    
+    // Disconnetti MQTT
+    mqttClient.disconnect();
+    mqttConnected = false;
+    
+    forceSavePeers();
+    DevLog.println("Restarting ESP8266...");
+    delay(1000);
+    
+    // Riavvia l'ESP8266 senza resettare la configurazione
+    ESP.restart();
+}
+
+// Comando NETWORK_DISCOVERY / DISCOVERY con formato JSON
+static void cmdNetworkDiscovery(JsonDocument&) {
+    DevLog.println("RICEVUTO - Comando: DISCOVERY / NETWORK_DISCOVERY");
+    triggerGlobalDiscovery();
+}
+
+// Comando PING_NETWORK - Invia PING individualmente a tutti i nodi online
+static void cmdPingNetwork(JsonDocument&) {
+    DevLog.println("RICEVUTO - Comando: PING_NETWORK");
+    
+    // PING individuale a TUTTI i nodi nella lista, accodati a passi dal loop
+    int nodesSent = startPingNetwork();
+    
+    // Pubblica report iniziale (lista ID nodo scritta direttamente nel payload)
+    unsigned long timestamp = millis();
+    const char* topic = mqttTopic(TOPIC_GATEWAY_STATUS);
+    mqttPublishJson(topic, false, [&](MqttJsonWriter& json) {
+        json.beginObject();
+        json.add("command", "PING_NETWORK");
+        json.add("timestamp", timestamp);
+        json.add("total_nodes", peerCount);
+        json.add("nodes_sent", nodesSent);
+        json.add("result", nodesSent > 0 ? "success" : "no_nodes");
+        json.beginArray("pinged_nodes");
+        for (int i = 0; i < nodesSent; i++) {
+            json.add(NULL, peerList[i].nodeId);
         }
+        json.endArray();
+        json.endObject();
+    });
+}
+
+struct GatewayCommandEntry {
+    MsgKeyword keyword;
+    GatewayCommandHandler handler;
+};
+
+// Stesso ordine di MSG_KEYWORDS (verificato a compile-time)
+static constexpr GatewayCommandEntry gatewayCommands[GATEWAY_COMMAND_COUNT] = {
+    { KW_OTA_UPDATE,            cmdOtaUpdate },
+    { KW_REMOVE_PEER,           cmdRemovePeer },
+    { KW_DISCOVERY,             cmdNetworkDiscovery },
+    { KW_GET_VERSION,           cmdGetVersion },
+    { KW_LIST_PEERS,            cmdListPeers },
+    { KW_RESET_WIFI_CONFIG,     cmdResetWifiConfig },
+    { KW_GATEWAY_HEARTBEAT,     cmdGatewayHeartbeat },
+    { KW_NODE_FACTORY_RESET,    cmdNodeFactoryReset },
+    { KW_NETWORK_REBOOT,        cmdNetworkReboot },
+    { KW_CLEAR_PEERS,           cmdClearPeers },
+    { KW_RESET_TO_AP,           cmdResetToAp },
+    { KW_CLEANUP_OFFLINE_PEERS, cmdCleanupOfflinePeers },
+    { KW_RESTART,               cmdRestart },
+    { KW_NETWORK_DISCOVERY,     cmdNetworkDiscovery },
+    { KW_PING_NETWORK,          cmdPingNetwork }
+};
+
+static constexpr bool gatewayCommandsOrdered() {
+    for (int i = 0; i < GATEWAY_COMMAND_COUNT; i++) {
+        if (gatewayCommands[i].keyword != KW_FIRST_GATEWAY_COMMAND + i) return false;
+    }
+    return true;
+}
+static_assert(gatewayCommandsOrdered(), "gatewayCommands non allineata a MSG_KEYWORDS");
+
+void processMqttCommand(const byte* payload, unsigned int length) {
+    DevLog.printf("RICEVUTO - MQTT Command: %.*s\n", (int) length, (const char*) payload);
+
+    // Parsing JSON per la nuova struttura semplificata.
+    // Input in sola lettura: le stringhe vengono copiate nel documento perché gli handler
+    // pubblicano e PubSubClient riusa lo stesso buffer che contiene il payload.
+    StaticJsonDocument<512> doc;
+    DeserializationError parseError = deserializeJson(doc, payload, length);
+    
+    if (parseError) {
+        DevLog.println("Errore parsing JSON");
+        publishGatewayStatus("error", "Invalid JSON format");
+        return;
+    }
+    
+    // Comandi per il GATEWAY - Struttura: {"command": "PING_NETWORK"}
+    const char* command = doc["command"] | "";
+    if (command[0] == '\0') command = doc["Command"] | "";
+    if (command[0] == '\0') return;
+
+    DevLog.printf("Comando per GATEWAY - Command: %s\n", command);
+
+    MsgKeyword kw = lookupKeyword(command);
+    if (kw >= KW_FIRST_GATEWAY_COMMAND && kw < KW_COUNT) {
+        gatewayCommands[kw - KW_FIRST_GATEWAY_COMMAND].handler(doc);
+    } else {
+        DevLog.printf("Comando gateway sconosciuto: %s\n", command);
     }
 }
@@ -13,29 +13,34 @@
 #include "GatewayTypes.h"
 
 // External globals
+extern WiFiClient wifiClient;
 extern PubSubClient mqttClient;
 extern bool mqttConnected;
-extern unsigned long lastMqttReconnectAttempt;
-extern const unsigned long MQTT_RECONNECT_INTERVAL;
+extern uint32_t nodeStatePublished; // Messaggi /nodo/<id>/state inviati
 
 // Function prototypes
 void setupMQTT();
 bool connectToMQTT();
-void reconnectMQTT();
 void onMqttConnect();
 void onMqttDisconnect();
 void onMqttMessage(char* topic, byte* payload, unsigned int length);
-void publishGatewayStatus(const String& eventType, const String& message, const String& command = "", const String& ip = "");
-void publishNodeStatus(const String& nodeId, const String& topic_name, const String& command, const String& status, const String& type);
+void publishGatewayStatus(const char* eventType, const char* message, const char* command = NULL, const char* ip = NULL);
+void publishNodeStatus(const char* nodeId, const char* topic_name, const char* command, const char* status, const char* type);
+// Invio diretto con il timestamp originale (usati anche per svuotare l'outbox)
+bool sendGatewayStatus(unsigned long timestamp, const char* eventType, const char* message, const char* command, const char* ip);
+bool sendNodeStatus(unsigned long timestamp, const char* nodeId, const char* topic_name, const char* command, const char* status, const char* type);
 void publishPeerStatus(int i, const char* command);
-void publishNodeAvailability(const String& nodeId, const char* availability);
+// Stato retained del peer su <prefix>/nodo/<id>/state (solo con node_state_topics).
+// Senza force pubblica solo se gli attributi sono cambiati dall'ultimo invio.
+bool publishNodeState(int i, bool force);
+void publishNodeAvailability(const char* nodeId, const char* availability);
 void publishToMQTT(const String& subtopic, const String& eventType, const String& message);
 void sendGatewayHeartbeat();
 void sendDashboardDiscovery();
 void triggerGlobalDiscovery();
 
 // External command processor
-void processMqttCommand(const String& msgStr);
+void processMqttCommand(const byte* payload, unsigned int length);
 void performOTA(String url);
 
 #endif
@@ -0,0 +1,162 @@
+#include "MqttJsonWriter.h"
+
+MqttJsonWriter::MqttJsonWriter(Print* out, size_t limit)
+    : _out(out), _limit(limit), _length(0), _depth(0), _chunkLen(0) {
+    _needComma[0] = false;
+}
+
+// --- PRIMITIVE --- //
+void MqttJsonWriter::flushChunk() {
+    if (_chunkLen == 0) return;
+    _out->write((const uint8_t*) _chunk, _chunkLen);
+    _chunkLen = 0;
+}
+
+void MqttJsonWriter::raw(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        rawChar(s[i]);
+    }
+}
+
+void MqttJsonWriter::rawChar(char c) {
+    _length++;
+    if (_out == NULL) return;
+    // Oltre la lunghezza annunciata non si scrive: il pacchetto MQTT resta coerente
+    if (_limit > 0 && _length > _limit) return;
+
+    _chunk[_chunkLen++] = c;
+    if (_chunkLen == MQTT_JSON_CHUNK) flushChunk();
+}
+
+// Caratteri della stringa con escape, senza virgolette
+void MqttJsonWriter::escaped(const char* s) {
+    for (; s != NULL && *s; s++) {
+        char c = *s;
+        switch (c) {
+            case '"':  raw("\\\"", 2); break;
+            case '\\': raw("\\\\", 2); break;
+            case '\b': raw("\\b", 2); break;
+            case '\f': raw("\\f", 2); break;
+            case '\n': raw("\\n", 2); break;
+            case '\r': raw("\\r", 2); break;
+            case '\t': raw("\\t", 2); break;
+            default:
+                if ((uint8_t) c < 0x20) {
+                    char hex[7];
+                    snprintf(hex, sizeof(hex), "\\u%04x", (uint8_t) c);
+                    raw(hex, 6);
+                } else {
+                    rawChar(c);
+                }
+                break;
+        }
+    }
+}
+
+void MqttJsonWriter::quoted(const char* s) {
+    rawChar('"');
+    escaped(s);
+    rawChar('"');
+}
+
+void MqttJsonWriter::key(const char* name) {
+    if (_needComma[_depth]) rawChar(',');
+    _needComma[_depth] = true;
+    if (name != NULL) {
+        quoted(name);
+        rawChar(':');
+    }
+}
+
+// --- STRUTTURA --- //
+void MqttJsonWriter::beginObject(const char* name) {
+    if (_depth > 0) key(name);
+    rawChar('{');
+    if (_depth < MQTT_JSON_MAX_DEPTH) _depth++;
+    _needComma[_depth] = false;
+}
+
+void MqttJsonWriter::endObject() {
+    rawChar('}');
+    if (_depth > 0) _depth--;
+}
+
+void MqttJsonWriter::beginArray(const char* name) {
+    if (_depth > 0) key(name);
+    rawChar('[');
+    if (_depth < MQTT_JSON_MAX_DEPTH) _depth++;
+    _needComma[_depth] = false;
+}
+
+void MqttJsonWriter::endArray() {
+    rawChar(']');
+    if (_depth > 0) _depth--;
+}
+
+// --- VALORI --- //
+void MqttJsonWriter::add(const char* name, const char* value) {
+    key(name);
+    if (value == NULL) {
+        raw("null", 4);
+    } else {
+        quoted(value);
+    }
+}
+
+void MqttJsonWriter::add(const char* name, long value) {
+    char num[21];
+    int len = snprintf(num, sizeof(num), "%ld", value);
+    key(name);
+    raw(num, len);
+}
+
+void MqttJsonWriter::add(const char* name, unsigned long value) {
+    char num[21];
+    int len = snprintf(num, sizeof(num), "%lu", value);
+    key(name);
+    raw(num, len);
+}
+
+void MqttJsonWriter::add(const char* name, bool value) {
+    key(name);
+    if (value) {
+        raw("true", 4);
+    } else {
+        raw("false", 5);
+    }
+}
+
+void MqttJsonWriter::addMac(const char* name, const uint8_t* mac) {
+    char macStr[18];
+    snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    add(name, (const char*) macStr);
+}
+
+void MqttJsonWriter::addIp(const char* name, const IPAddress& ip) {
+    char ipStr[16];
+    snprintf(ipStr, sizeof(ipStr), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    add(name, (const char*) ipStr);
+}
+
+void MqttJsonWriter::beginString(const char* name) {
+    key(name);
+    rawChar('"');
+}
+
+void MqttJsonWriter::appendString(const char* part) {
+    escaped(part);
+}
+
+void MqttJsonWriter::endString() {
+    rawChar('"');
+}
+
+void MqttJsonWriter::finish() {
+    if (_out == NULL) return;
+    // Seconda passata più corta del conteggio: spazi finali, il JSON resta valido
+    while (_limit > 0 && _length < _limit) {
+        rawChar(' ');
+    }
+    flushChunk();
+}
@@ -0,0 +1,91 @@
+#ifndef MQTT_JSON_WRITER_H
+#define MQTT_JSON_WRITER_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+
+// --- JSON IN STREAMING PER MQTT --- //
+// Scrive il JSON direttamente nel client MQTT senza documento né String intermedie.
+// Il payload viene generato due volte: la prima solo per contarne i byte (serve a
+// beginPublish), la seconda verso la rete a blocchi di MQTT_JSON_CHUNK byte.
+// Il builder deve quindi produrre lo stesso output in entrambe le passate: i valori
+// che cambiano nel tempo (millis, heap, RSSI) vanno letti prima, fuori dal builder.
+
+#define MQTT_JSON_MAX_DEPTH  4
+#define MQTT_JSON_CHUNK      64
+
+class MqttJsonWriter {
+public:
+    // out NULL: passata di conteggio. limit: byte massimi da inviare (0 = nessun limite)
+    explicit MqttJsonWriter(Print* out, size_t limit = 0);
+
+    void beginObject(const char* key = NULL);
+    void endObject();
+    void beginArray(const char* key = NULL);
+    void endArray();
+
+    // key NULL per gli elementi di un array
+    void add(const char* key, const char* value);
+    void add(const char* key, long value);
+    void add(const char* key, unsigned long value);
+    void add(const char* key, int value) { add(key, (long) value); }
+    void add(const char* key, unsigned int value) { add(key, (unsigned long) value); }
+    void add(const char* key, bool value);
+    void addMac(const char* key, const uint8_t* mac);
+    void addIp(const char* key, const IPAddress& ip);
+
+    // Stringa composta da più pezzi (es. "data ora", "server:porta")
+    void beginString(const char* key);
+    void appendString(const char* part);
+    void endString();
+
+    // Completa l'invio: svuota il buffer e, se la seconda passata è risultata più corta,
+    // riempie con spazi (JSON valido) fino a limit
+    void finish();
+
+    size_t length() const { return _length; }
+
+private:
+    void key(const char* name);
+    void raw(const char* s, size_t len);
+    void rawChar(char c);
+    void escaped(const char* s);
+    void quoted(const char* s);
+    void flushChunk();
+
+    Print* _out;
+    size_t _limit;
+    size_t _length;
+    uint8_t _depth;
+    bool _needComma[MQTT_JSON_MAX_DEPTH + 1];
+    char _chunk[MQTT_JSON_CHUNK];
+    uint8_t _chunkLen;
+};
+
+extern PubSubClient mqttClient;
+
+// Pubblica il JSON prodotto da build(MqttJsonWriter&) senza allocazioni sullo heap.
+// Ritorna false se il client non è connesso o se le due passate non coincidono.
+template<typename Builder>
+bool mqttPublishJson(PubSubClient& client, const char* topic, bool retained, Builder build) {
+    if (!client.connected()) return false;
+
+    MqttJsonWriter counter(NULL);
+    build(counter);
+    size_t length = counter.length();
+
+    if (!client.beginPublish(topic, length, retained)) return false;
+    MqttJsonWriter writer(&client, length);
+    build(writer);
+    writer.finish();
+    bool sent = client.endPublish() == 1;
+    return sent && writer.length() == length;
+}
+
+template<typename Builder>
+bool mqttPublishJson(const char* topic, bool retained, Builder build) {
+    return mqttPublishJson(mqttClient, topic, retained, build);
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "MqttOutbox.h"
+#include "MqttHandler.h"
+#include "Config.h"
+#include "WebLog.h"
+#include <LittleFS.h>
+
+uint32_t outboxQueued = 0;
+uint32_t outboxDelivered = 0;
+uint32_t outboxSpilled = 0;
+uint32_t outboxDropped = 0;
+uint8_t outboxHighWater = 0;
+
+static OutboxEvent ring[OUTBOX_SLOTS];
+static uint8_t ringHead = 0;
+static uint8_t ringCount = 0;
+
+// Spill su LittleFS: record a dimensione fissa, letti in ordine da spillRead
+static uint16_t spillWritten = 0;
+static uint16_t spillRead = 0;
+
+void outboxBegin() {
+    if (LittleFS.exists(OUTBOX_SPILL_FILE)) {
+        LittleFS.remove(OUTBOX_SPILL_FILE);
+    }
+    spillWritten = 0;
+    spillRead = 0;
+}
+
+bool outboxEmpty() {
+    return ringCount == 0 && spillRead == spillWritten;
+}
+
+uint16_t outboxPending() {
+    return ringCount + (spillWritten - spillRead);
+}
+
+static bool spillAppend(const OutboxEvent& event) {
+    if (!outbox_spill || spillWritten >= OUTBOX_SPILL_MAX) return false;
+
+    File f = LittleFS.open(OUTBOX_SPILL_FILE, "a");
+    if (!f) return false;
+    bool ok = f.write((const uint8_t*) &event, sizeof(event)) == sizeof(event);
+    f.close();
+    if (ok) {
+        spillWritten++;
+        outboxSpilled++;
+    }
+    return ok;
+}
+
+static bool spillPeek(OutboxEvent* event) {
+    File f = LittleFS.open(OUTBOX_SPILL_FILE, "r");
+    if (!f) return false;
+    bool ok = f.seek((uint32_t) spillRead * sizeof(OutboxEvent)) &&
+              f.read((uint8_t*) event, sizeof(OutboxEvent)) == sizeof(OutboxEvent);
+    f.close();
+    return ok;
+}
+
+static void spillClear() {
+    LittleFS.remove(OUTBOX_SPILL_FILE);
+    spillWritten = 0;
+    spillRead = 0;
+}
+
+void outboxPush(const OutboxEvent& event) {
+    // Con record già su flash i nuovi vanno in coda al file, per mantenere l'ordine
+    bool spilling = spillRead != spillWritten;
+
+    if (!spilling && ringCount < OUTBOX_SLOTS) {
+        ring[(ringHead + ringCount) % OUTBOX_SLOTS] = event;
+        ringCount++;
+        if (ringCount > outboxHighWater) outboxHighWater = ringCount;
+        outboxQueued++;
+        return;
+    }
+
+    if (spillAppend(event)) {
+        outboxQueued++;
+        return;
+    }
+
+    outboxDropped++;
+}
+
+static bool deliver(const OutboxEvent& event) {
+    switch (event.kind) {
+        case OUTBOX_NODE_STATUS:
+            return sendNodeStatus(event.timestamp, event.node.node, event.node.topic, event.node.command,
+                                  event.node.status, event.node.type);
+        case OUTBOX_GATEWAY_STATUS:
+            return sendGatewayStatus(event.timestamp, event.gateway.eventType, event.gateway.message,
+                                     event.gateway.command, event.gateway.ip);
+    }
+    return true; // Tipo sconosciuto: scartato
+}
+
+void processOutbox() {
+    if (outboxEmpty() || !mqttClient.connected()) return;
+
+    for (int sent = 0; sent < OUTBOX_DRAIN_PER_LOOP; sent++) {
+        if (wifiClient.availableForWrite() < OUTBOX_TX_HEADROOM) return;
+
+        if (ringCount > 0) {
+            if (!deliver(ring[ringHead])) return; // Riprova al prossimo giro
+            ringHead = (ringHead + 1) % OUTBOX_SLOTS;
+            ringCount--;
+        } else if (spillRead != spillWritten) {
+            OutboxEvent event;
+            bool readable = spillPeek(&event);
+            if (readable && !deliver(event)) return;
+            if (++spillRead == spillWritten) spillClear();
+            if (!readable) {
+                outboxDropped++; // Record illeggibile: saltato
+                continue;
+            }
+        } else {
+            return;
+        }
+        outboxDelivered++;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef MQTT_OUTBOX_H
+#define MQTT_OUTBOX_H
+
+#include <Arduino.h>
+
+// --- STORE-AND-FORWARD MQTT --- //
+// Eventi "one-shot" (status dei nodi come feedback/OTA, eventi del gateway) che non
+// possono essere pubblicati subito finiscono in una coda FIFO in RAM di OUTBOX_SLOTS
+// record; con outbox_spill attivo i successivi vanno in coda su LittleFS. Lo stato
+// per peer non passa di qui: restano i flag di StatusCoalescer (uno per peer, non
+// cresce con la frequenza degli eventi) e l'availability ripubblicata alla riconnessione.
+// Dopo la riconnessione processOutbox() svuota in ordine, al massimo
+// OUTBOX_DRAIN_PER_LOOP messaggi per giro. A coda piena il nuovo evento è scartato.
+
+#define OUTBOX_SLOTS           8
+#define OUTBOX_SPILL_MAX       32               // Record massimi nel file di spill
+#define OUTBOX_SPILL_FILE      "/outbox.bin"
+#define OUTBOX_DRAIN_PER_LOOP  2
+#define OUTBOX_TX_HEADROOM     512              // Spazio libero minimo nel buffer TCP
+
+enum OutboxKind : uint8_t {
+    OUTBOX_NODE_STATUS = 1,     // publishNodeStatus
+    OUTBOX_GATEWAY_STATUS       // publishGatewayStatus
+};
+
+struct OutboxEvent {
+    uint8_t kind;
+    uint32_t timestamp;         // millis() dell'evento originale
+    union {
+        struct {
+            char node[20];
+            char topic[20];
+            char command[20];
+            char type[20];
+            char status[100];
+        } node;
+        struct {
+            char eventType[32];
+            char command[24];
+            char ip[16];
+            char message[108];
+        } gateway;
+    };
+};
+
+// Da chiamare dopo LittleFS.begin(): uno spill di un avvio precedente ha timestamp non validi
+void outboxBegin();
+
+bool outboxEmpty();
+uint16_t outboxPending();   // Record in attesa (RAM + flash)
+void outboxPush(const OutboxEvent& event);
+void processOutbox();
+
+extern uint32_t outboxQueued;       // Eventi accodati
+extern uint32_t outboxDelivered;    // Eventi pubblicati dalla coda
+extern uint32_t outboxSpilled;      // Eventi scritti su LittleFS
+extern uint32_t outboxDropped;      // Eventi persi a coda piena
+extern uint8_t outboxHighWater;     // Massimo di record in RAM
+
+#endif
@@ -0,0 +1,142 @@
+#include "MqttRepublish.h"
+#include "MqttHandler.h"
+#include "MqttTopics.h"
+#include "PeerHandler.h"
+#include "HaDiscovery.h"
+#include "NodeTypeManager.h"
+#include "WebLog.h"
+#include "PeerStore.h"
+
+uint32_t republishMessages = 0;
+uint32_t republishDeferrals = 0;
+
+// Passi per ciascun peer, in ordine
+enum RepublishStep : uint8_t {
+    REPUB_ENTITY = 0,       // Config HA, un'entità per passo (reset + config se richiesto)
+    REPUB_DASHBOARD,
+    REPUB_AVAILABILITY,
+    REPUB_STATUS
+};
+
+static bool active = false;
+static RepublishDiscovery discoveryMode = REPUBLISH_DISCOVERY_CHANGED;
+static bool entityFailed = false;    // Una config del peer corrente non è partita
+static bool resetSent = false;       // Reset dell'entità corrente già inviato
+static const char* statusCommand = "HEARTBEAT";
+static int peerIndex = 0;
+static int entityIndex = 0;
+static RepublishStep step = REPUB_ENTITY;
+
+void startRepublish(const char* command, RepublishDiscovery discovery) {
+    // Una richiesta più forte non ancora completata non viene persa da un riavvio semplice
+    if (!active || discovery > discoveryMode) {
+        discoveryMode = discovery;
+    }
+    statusCommand = command;
+    peerIndex = 0;
+    entityIndex = 0;
+    resetSent = false;
+    entityFailed = false;
+    step = REPUB_ENTITY;
+    active = true;
+    DevLog.printf("📤 Ripubblicazione MQTT avviata (%d peer)\n", peerCount);
+}
+
+bool republishActive() {
+    return active;
+}
+
+static void nextPeer() {
+    peerIndex++;
+    entityIndex = 0;
+    resetSent = false;
+    entityFailed = false;
+    step = REPUB_ENTITY;
+}
+
+// Esegue un passo del peer corrente. Ritorna true se ha pubblicato un messaggio.
+static bool runStep(Peer& peer) {
+    switch (step) {
+        case REPUB_ENTITY: {
+            int count = 0;
+            const NodeEntity* entities = NodeTypeManager::getEntities(peer.nodeType, &count);
+            if (entityIndex >= count) {
+                step = REPUB_DASHBOARD;
+                return false;
+            }
+            if (discoveryMode == REPUBLISH_DISCOVERY_RESET && !resetSent) {
+                HaDiscovery::publishEntityReset(mqttClient, peer, entities[entityIndex]);
+                resetSent = true;
+                return true;
+            }
+            if (!HaDiscovery::publishEntityDiscovery(mqttClient, peer, mqtt_topic_prefix, entities[entityIndex], entityIndex == 0)) {
+                entityFailed = true;
+            }
+            entityIndex++;
+            resetSent = false;
+            return true;
+        }
+        case REPUB_DASHBOARD: {
+            bool sent = HaDiscovery::publishDashboardConfig(mqttClient, peer, mqtt_topic_prefix);
+            // Impronta registrata solo se tutte le config del peer sono partite
+            uint32_t hash = HaDiscovery::fingerprint(peer, mqtt_topic_prefix);
+            if (sent && !entityFailed && peer.discoveryHash != hash) {
+                peer.discoveryHash = hash;
+                peerStoreMarkDirty(peerIndex);
+            }
+            step = REPUB_AVAILABILITY;
+            return true;
+        }
+        case REPUB_AVAILABILITY:
+            // Availability attuale: al riavvio i peer caricati risultano online, dopo
+            // un'interruzione del broker riporta le transizioni avvenute nel frattempo
+            publishNodeAvailability(peer.nodeId, peer.isOnline ? "online" : "offline");
+            step = REPUB_STATUS;
+            return true;
+        case REPUB_STATUS:
+            // Stato retained forzato: il broker potrebbe averlo perso
+            publishNodeState(peerIndex, true);
+            publishPeerStatus(peerIndex, statusCommand);
+            nextPeer();
+            return true;
+    }
+    return false;
+}
+
+void processRepublish() {
+    if (!active) return;
+    // Da disconnessi il job resta fermo: onMqttConnect() lo riavvia da capo
+    if (!mqttClient.connected()) return;
+
+    int sent = 0;
+    while (sent < REPUBLISH_BUDGET) {
+        if (peerIndex >= peerCount) {
+            active = false;
+            discoveryMode = REPUBLISH_DISCOVERY_CHANGED;
+            DevLog.println("📤 Ripubblicazione MQTT completata");
+            return;
+        }
+
+        // Peer senza ID valido: nessuna config HA/dashboard, solo availability e status.
+        // Config già sul broker (impronta invariata): niente retained ripetuti.
+        if (step == REPUB_ENTITY && entityIndex == 0 && !resetSent) {
+            const Peer& peer = peerList[peerIndex];
+            if (!HaDiscovery::isPublishable(peer)) {
+                step = REPUB_AVAILABILITY;
+            } else if (discoveryMode == REPUBLISH_DISCOVERY_CHANGED && HaDiscovery::isCurrent(peer, mqtt_topic_prefix)) {
+                haDiscoverySkipped++;
+                step = REPUB_AVAILABILITY;
+            }
+        }
+
+        if (wifiClient.availableForWrite() < REPUBLISH_TX_HEADROOM) {
+            republishDeferrals++;
+            return;
+        }
+
+        if (runStep(peerList[peerIndex])) {
+            sent++;
+            republishMessages++;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef MQTT_REPUBLISH_H
+#define MQTT_REPUBLISH_H
+
+#include <Arduino.h>
+
+// --- RIPUBBLICAZIONE A PASSI --- //
+// Alla riconnessione MQTT (e nella discovery globale) ogni peer richiede availability e
+// status, più config HA per entità e config dashboard se la sua impronta è cambiata. Invece di un ciclo con delay() il
+// lavoro è un job ripreso dal loop: a ogni giro parte al massimo REPUBLISH_BUDGET
+// messaggi e solo finché il buffer TCP ha spazio, così la coda ESP-NOW continua a
+// essere svuotata anche durante una tempesta di riconnessioni.
+
+#define REPUBLISH_BUDGET      4      // Messaggi massimi per giro di loop
+#define REPUBLISH_TX_HEADROOM 1024   // Spazio libero minimo nel buffer TCP per pubblicare
+
+// Config HA/dashboard nel job: di norma solo per i peer con impronta cambiata (HaDiscovery)
+enum RepublishDiscovery : uint8_t {
+    REPUBLISH_DISCOVERY_CHANGED = 0, // Riconnessione: le config retained sono già sul broker
+    REPUBLISH_DISCOVERY_FORCE,       // Richiesta esplicita o riavvio di Home Assistant
+    REPUBLISH_DISCOVERY_RESET        // Svuota prima ogni config HA (forza la ricreazione)
+};
+
+// Avvia (o riavvia da capo) il job. statusCommand: command del publishPeerStatus finale
+// (stringa costante).
+void startRepublish(const char* statusCommand, RepublishDiscovery discovery);
+
+void processRepublish();
+bool republishActive();
+
+extern uint32_t republishMessages;   // Messaggi inviati dal job
+extern uint32_t republishDeferrals;  // Giri interrotti per buffer TCP pieno
+
+#endif
@@ -0,0 +1,216 @@
+#include "MqttSession.h"
+#include "MqttHandler.h"
+#include "MqttTopics.h"
+#include "WebLog.h"
+#include <lwip/dns.h>
+#include <lwip/tcp.h>
+
+MqttSessionState mqttSessionState = MQTT_SESSION_BACKOFF;
+uint32_t mqttConnectAttempts = 0;
+uint32_t mqttConnectFailures = 0;
+uint32_t mqttSessionDrops = 0;
+unsigned long mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+
+static unsigned long nextAttemptAt = 0;     // 0 = tentativo al primo giro utile
+static unsigned long lastKeepalive = 0;
+static uint8_t consecutiveFailures = 0;
+
+static IPAddress brokerIp;
+static bool brokerResolved = false;
+static unsigned long stageStartedAt = 0;
+
+// Esito delle operazioni asincrone di lwIP. I callback si limitano ad aggiornare
+// questi flag: tutto il resto avviene nel loop.
+enum AsyncResult : uint8_t {
+    ASYNC_PENDING = 0,
+    ASYNC_OK,
+    ASYNC_FAILED
+};
+
+static volatile AsyncResult dnsResult = ASYNC_PENDING;
+static volatile AsyncResult probeResult = ASYNC_PENDING;
+static struct tcp_pcb* probePcb = NULL;
+static ip_addr_t dnsAddr;
+
+// Attesa con jitter nella metà superiore dell'intervallo: i gateway che perdono il
+// broker insieme non si ripresentano tutti nello stesso istante
+static void scheduleRetry() {
+    unsigned long wait = random(mqttBackoffMs / 2, mqttBackoffMs + 1);
+    nextAttemptAt = millis() + wait;
+    if (nextAttemptAt == 0) nextAttemptAt = 1;
+
+    mqttBackoffMs *= 2;
+    if (mqttBackoffMs > MQTT_BACKOFF_MAX_MS) mqttBackoffMs = MQTT_BACKOFF_MAX_MS;
+    DevLog.printf("⏳ MQTT: prossimo tentativo tra %lu ms\n", wait);
+}
+
+static void failAttempt(const char* reason) {
+    DevLog.printf("❌ MQTT: %s\n", reason);
+    mqttConnectFailures++;
+    // Il broker potrebbe aver cambiato indirizzo: dopo qualche fallimento si rifà il DNS
+    if (++consecutiveFailures >= MQTT_DNS_RETRY_FAILURES) {
+        brokerResolved = false;
+        consecutiveFailures = 0;
+    }
+    mqttSessionState = MQTT_SESSION_BACKOFF;
+    scheduleRetry();
+}
+
+// --- DNS ASINCRONO --- //
+static void onDnsFound(const char*, const ip_addr_t* addr, void*) {
+    if (addr != NULL) dnsAddr = *addr;
+    dnsResult = (addr != NULL) ? ASYNC_OK : ASYNC_FAILED;
+}
+
+// --- SONDA TCP --- //
+// Connect TCP raw di lwIP: nessuna attesa, l'esito arriva dai callback. Appena il broker
+// risponde la sonda viene chiusa con RST e la sessione vera parte da WiFiClient.
+static err_t onProbeConnected(void*, struct tcp_pcb* pcb, err_t) {
+    probePcb = NULL;
+    probeResult = ASYNC_OK;
+    tcp_err(pcb, NULL); // tcp_abort chiama il callback di errore
+    tcp_abort(pcb);
+    return ERR_ABRT;
+}
+
+// RST, host irraggiungibile o timeout di lwIP: il pcb è già stato liberato
+static void onProbeError(void*, err_t) {
+    probePcb = NULL;
+    probeResult = ASYNC_FAILED;
+}
+
+static void cancelProbe() {
+    if (probePcb == NULL) return;
+    tcp_err(probePcb, NULL);
+    tcp_abort(probePcb);
+    probePcb = NULL;
+}
+
+static void startProbe() {
+    probeResult = ASYNC_PENDING;
+    probePcb = tcp_new();
+    if (probePcb == NULL) {
+        failAttempt("memoria lwIP esaurita per la sonda TCP");
+        return;
+    }
+    tcp_err(probePcb, onProbeError);
+
+    ip_addr_t addr = brokerIp;
+    if (tcp_connect(probePcb, &addr, mqtt_port, onProbeConnected) != ERR_OK) {
+        cancelProbe();
+        failAttempt("connect TCP rifiutata da lwIP");
+        return;
+    }
+    mqttSessionState = MQTT_SESSION_PROBING;
+    stageStartedAt = millis();
+}
+
+static void brokerFound(const IPAddress& ip) {
+    brokerIp = ip;
+    brokerResolved = true;
+    mqttClient.setServer(brokerIp, mqtt_port);
+    startProbe();
+}
+
+static void startResolve() {
+    // Indirizzo letterale: nessuna richiesta DNS
+    IPAddress ip;
+    if (ip.fromString(mqtt_server)) {
+        brokerFound(ip);
+        return;
+    }
+
+    dnsResult = ASYNC_PENDING;
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(mqtt_server, &addr, onDnsFound, NULL);
+    if (err == ERR_OK) {
+        brokerFound(IPAddress(addr)); // Già nella cache di lwIP
+    } else if (err == ERR_INPROGRESS) {
+        mqttSessionState = MQTT_SESSION_RESOLVING;
+        stageStartedAt = millis();
+    } else {
+        failAttempt("risoluzione DNS non avviata");
+    }
+}
+
+static void startAttempt() {
+    mqttConnectAttempts++;
+    // Socket precedente chiuso senza attese: il tentativo riparte da un client pulito
+    wifiClient.stop();
+
+    if (brokerResolved) {
+        startProbe();
+    } else {
+        startResolve();
+    }
+}
+
+// Broker appena raggiunto dalla sonda: la connect di WiFiClient si chiude in un RTT
+// e l'attesa vera è il CONNACK, limitata da MQTT_CONNACK_TIMEOUT_S
+static void openSession() {
+    wifiClient.setTimeout(MQTT_SESSION_CONNECT_MS);
+    mqttClient.setSocketTimeout(MQTT_CONNACK_TIMEOUT_S);
+
+    if (!connectToMQTT()) {
+        failAttempt("CONNECT rifiutato o senza risposta");
+        return;
+    }
+    mqttSessionState = MQTT_SESSION_CONNECTED;
+    mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+    consecutiveFailures = 0;
+    lastKeepalive = millis();
+}
+
+void mqttSessionLoop() {
+    unsigned long now = millis();
+
+    switch (mqttSessionState) {
+        case MQTT_SESSION_BACKOFF:
+            if (nextAttemptAt != 0 && (long)(now - nextAttemptAt) < 0) return;
+            startAttempt();
+            break;
+
+        case MQTT_SESSION_RESOLVING:
+            if (dnsResult == ASYNC_OK) {
+                brokerFound(IPAddress(dnsAddr));
+            } else if (dnsResult == ASYNC_FAILED || now - stageStartedAt >= MQTT_DNS_TIMEOUT_MS) {
+                // Una risposta tardiva trova dnsResult azzerato dal tentativo successivo
+                char reason[32 + sizeof(mqtt_server)];
+                snprintf(reason, sizeof(reason), "risoluzione DNS fallita per %s", mqtt_server);
+                failAttempt(reason);
+            }
+            break;
+
+        case MQTT_SESSION_PROBING:
+            if (probeResult == ASYNC_OK) {
+                openSession();
+            } else if (probeResult == ASYNC_FAILED) {
+                failAttempt("broker non raggiungibile");
+            } else if (now - stageStartedAt >= MQTT_CONNECT_TIMEOUT_MS) {
+                cancelProbe();
+                failAttempt("nessuna risposta TCP dal broker");
+            }
+            break;
+
+        case MQTT_SESSION_CONNECTED:
+            // Esegui il loop MQTT (consegna anche i messaggi in ingresso) e verifica lo stato
+            if (!mqttClient.loop()) {
+                DevLog.println("❌ Connessione MQTT persa");
+                mqttSessionDrops++;
+                onMqttDisconnect();
+                wifiClient.stop();
+                mqttSessionState = MQTT_SESSION_BACKOFF;
+                // Prima riconnessione rapida (con jitter), poi backoff crescente
+                mqttBackoffMs = MQTT_BACKOFF_MIN_MS;
+                scheduleRetry();
+                return;
+            }
+
+            // Pubblica heartbeat availability del gateway per tenere viva la sessione
+            if (now - lastKeepalive >= MQTT_KEEPALIVE_PUBLISH_MS) {
+                mqttClient.publish(mqttTopic(TOPIC_GATEWAY_AVAILABILITY), "online", true);
+                lastKeepalive = now;
+            }
+            break;
+    }
+}
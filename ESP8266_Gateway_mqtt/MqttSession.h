@@ -0,0 +1,50 @@
+#ifndef MQTT_SESSION_H
+#define MQTT_SESSION_H
+
+#include <Arduino.h>
+
+// --- SESSIONE MQTT --- //
+// Macchina a stati della connessione al broker, chiamata dal loop a ogni giro.
+// Nessun tentativo a intervallo fisso: dopo ogni fallimento l'attesa raddoppia
+// (da MQTT_BACKOFF_MIN_MS a MQTT_BACKOFF_MAX_MS) con jitter, così un broker
+// irraggiungibile costa un tentativo breve ogni tanto invece di uno ogni 5 s.
+// Il tentativo è diviso in fasi su più giri del loop, senza attese:
+//   RESOLVING  DNS asincrono di lwIP (nome in cache dopo il primo successo)
+//   PROBING    connect TCP asincrona di lwIP verso il broker, chiusa appena riesce
+//   CONNECTED  sessione PubSubClient aperta subito dopo una sonda riuscita
+// Un broker spento, irraggiungibile o un DNS muto non bloccano quindi mai il loop:
+// ESP-NOW, web e watchdog continuano a girare. Resta sincrono solo il CONNECT MQTT
+// verso un broker che ha appena accettato la sonda: connect di WiFiClient entro
+// MQTT_SESSION_CONNECT_MS più il CONNACK entro MQTT_CONNACK_TIMEOUT_S. Un broker che
+// accetta il TCP ma non risponde al CONNECT ferma quindi il loop al più ~1,5 s per
+// tentativo, e i tentativi seguono il backoff.
+// Il costo è una seconda connessione TCP per tentativo (sonda + sessione): PubSubClient
+// vuole un Client già suo e la sonda raw di lwIP non può diventarlo.
+// I messaggi in ingresso arrivano tramite mqttClient.loop(), quindi sempre dal loop e
+// mai da un contesto di interrupt.
+
+#define MQTT_BACKOFF_MIN_MS        1000
+#define MQTT_BACKOFF_MAX_MS        60000
+#define MQTT_CONNECT_TIMEOUT_MS    1500    // Timeout della sonda TCP (asincrona)
+#define MQTT_SESSION_CONNECT_MS    500     // Connect di WiFiClient (bloccante) dopo una sonda riuscita
+#define MQTT_CONNACK_TIMEOUT_S     1       // Timeout PubSubClient (socket) per il CONNACK, bloccante
+#define MQTT_DNS_TIMEOUT_MS        1000
+#define MQTT_DNS_RETRY_FAILURES    3       // Dopo N fallimenti consecutivi si risolve di nuovo il nome
+#define MQTT_KEEPALIVE_PUBLISH_MS  60000   // Availability del gateway per tenere viva la sessione
+
+enum MqttSessionState : uint8_t {
+    MQTT_SESSION_BACKOFF = 0,   // In attesa del prossimo tentativo
+    MQTT_SESSION_RESOLVING,     // Risposta DNS attesa
+    MQTT_SESSION_PROBING,       // SYN inviato, in attesa di SYN/ACK o errore
+    MQTT_SESSION_CONNECTED
+};
+
+void mqttSessionLoop();
+
+extern MqttSessionState mqttSessionState;
+extern uint32_t mqttConnectAttempts;
+extern uint32_t mqttConnectFailures;
+extern uint32_t mqttSessionDrops;       // Sessioni cadute dopo essere state stabilite
+extern unsigned long mqttBackoffMs;     // Attesa corrente prima del prossimo tentativo
+
+#endif
@@ -0,0 +1,89 @@
+#include "MqttTopics.h"
+#include "HashUtils.h"
+
+// Stesso ordine di MqttTopicId
+static const char* const topicSuffixes[MQTT_TOPIC_COUNT] = {
+    "/gateway/command",
+    "/nodo/command",
+    "/dashboard/status",
+    "/dashboard/discovery",
+    "/gateway/status",
+    "/gateway/availability",
+    "/gateway/discovery",
+    "/nodo/status",
+    "homeassistant/status",         // Senza '/' iniziale: topic assoluto, non prefissato
+    "/nodo/+/+/set",
+    "/nodo/batch",
+    "/nodo/batch/result"
+};
+
+struct MqttTopicEntry {
+    char name[MQTT_FIXED_TOPIC_MAX];
+    uint16_t length;
+    uint32_t hash;
+};
+
+static MqttTopicEntry topicTable[MQTT_TOPIC_COUNT];
+
+void rebuildMqttTopics() {
+    for (uint8_t id = 0; id < MQTT_TOPIC_COUNT; id++) {
+        MqttTopicEntry& entry = topicTable[id];
+        const char* suffix = topicSuffixes[id];
+        const char* prefix = (suffix[0] == '/') ? mqtt_topic_prefix : "";
+        int len = snprintf(entry.name, sizeof(entry.name), "%s%s", prefix, suffix);
+        entry.length = (len < (int)sizeof(entry.name)) ? len : sizeof(entry.name) - 1;
+        entry.hash = fnv1a(entry.name);
+    }
+}
+
+const char* mqttTopic(MqttTopicId id) {
+    return topicTable[id].name;
+}
+
+int matchMqttTopic(const char* topic) {
+    // Lunghezza e hash in un solo passaggio
+    uint32_t hash = FNV1A_OFFSET;
+    size_t length = 0;
+    for (const char* p = topic; *p; p++, length++) {
+        hash = (hash ^ (uint8_t)*p) * FNV1A_PRIME;
+    }
+
+    for (uint8_t id = 0; id < MQTT_TOPIC_COUNT; id++) {
+        const MqttTopicEntry& entry = topicTable[id];
+        if (entry.length == length && entry.hash == hash && strcmp(entry.name, topic) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Copia il segmento fino al prossimo '/' (escluso). Ritorna il puntatore al '/' o NULL.
+static const char* copySegment(const char* p, char* out, size_t size) {
+    size_t len = 0;
+    while (p[len] && p[len] != '/') {
+        if (len + 1 >= size) return NULL;
+        out[len] = p[len];
+        len++;
+    }
+    out[len] = '\0';
+    return (len > 0 && p[len] == '/') ? p + len : NULL;
+}
+
+bool parseNodeSetTopic(const char* topic, char* nodeId, size_t nodeIdSize, char* entity, size_t entitySize) {
+    size_t prefixLen = strlen(mqtt_topic_prefix);
+    if (strncmp(topic, mqtt_topic_prefix, prefixLen) != 0) return false;
+    const char* p = topic + prefixLen;
+    if (strncmp(p, "/nodo/", 6) != 0) return false;
+
+    p = copySegment(p + 6, nodeId, nodeIdSize);
+    if (p == NULL) return false;
+    p = copySegment(p + 1, entity, entitySize);
+    if (p == NULL) return false;
+    return strcmp(p, "/set") == 0;
+}
+
+size_t mqttNodeTopic(char* buf, size_t size, const char* nodeId, const char* suffix) {
+    int len = snprintf(buf, size, "%s/nodo/%s/%s", mqtt_topic_prefix, nodeId, suffix);
+    if (len < 0 || (size_t)len >= size) return 0;
+    return len;
+}
@@ -0,0 +1,48 @@
+#ifndef MQTT_TOPICS_H
+#define MQTT_TOPICS_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// --- TABELLA TOPIC MQTT --- //
+// I topic fissi del gateway vengono composti una sola volta da mqtt_topic_prefix
+// (rebuildMqttTopics() dopo il caricamento o la modifica del prefisso).
+// Il routing dei messaggi in ingresso confronta lunghezza e hash FNV-1a con la
+// tabella e conferma con strcmp: nessuna String per messaggio.
+
+enum MqttTopicId : uint8_t {
+    TOPIC_GATEWAY_COMMAND = 0,      // <prefix>/gateway/command     (sottoscritto)
+    TOPIC_NODE_COMMAND,             // <prefix>/nodo/command        (sottoscritto)
+    TOPIC_DASHBOARD_STATUS,         // <prefix>/dashboard/status    (sottoscritto)
+    TOPIC_DASHBOARD_DISCOVERY,      // <prefix>/dashboard/discovery
+    TOPIC_GATEWAY_STATUS,           // <prefix>/gateway/status
+    TOPIC_GATEWAY_AVAILABILITY,     // <prefix>/gateway/availability
+    TOPIC_GATEWAY_DISCOVERY,        // <prefix>/gateway/discovery
+    TOPIC_NODE_STATUS,              // <prefix>/nodo/status
+    TOPIC_HA_STATUS,                // homeassistant/status         (sottoscritto, birth/LWT di HA)
+    TOPIC_NODE_SET_FILTER,          // <prefix>/nodo/+/+/set        (filtro sottoscritto, vedi parseNodeSetTopic)
+    TOPIC_NODE_BATCH,               // <prefix>/nodo/batch          (sottoscritto, vedi CommandBatch)
+    TOPIC_NODE_BATCH_RESULT,        // <prefix>/nodo/batch/result
+    MQTT_TOPIC_COUNT
+};
+
+#define MQTT_TOPIC_MAX 128   // Buffer per i topic per nodo (<prefix>/nodo/<id>/...)
+
+// Prefisso (max 49) + suffisso più lungo ("/gateway/availability") + terminatore
+#define MQTT_FIXED_TOPIC_MAX (sizeof(mqtt_topic_prefix) + 24)
+
+void rebuildMqttTopics();
+
+const char* mqttTopic(MqttTopicId id);
+
+// Indice del topic fisso corrispondente oppure -1
+int matchMqttTopic(const char* topic);
+
+// Compone <prefix>/nodo/<nodeId>/<suffix> in buf. Ritorna la lunghezza o 0 se non entra.
+size_t mqttNodeTopic(char* buf, size_t size, const char* nodeId, const char* suffix);
+
+// Comando diretto <prefix>/nodo/<nodeId>/<entity>/set: copia i due segmenti nei buffer.
+// Ritorna false se il topic non ha questa forma o un segmento non entra.
+bool parseNodeSetTopic(const char* topic, char* nodeId, size_t nodeIdSize, char* entity, size_t entitySize);
+
+#endif
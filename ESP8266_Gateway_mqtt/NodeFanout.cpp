@@ -0,0 +1,104 @@
+#include "NodeFanout.h"
+#include "PeerHandler.h"
+#include "EspNowHandler.h"
+#include "WebLog.h"
+
+uint32_t fanoutFramesSent = 0;
+uint32_t fanoutDeferrals = 0;
+
+static int pingNext = -1;      // Indice in pingedNodesMac del prossimo PING (-1: nessuno)
+static int rebootNext = -1;    // Indice in peerList del prossimo RESTART (-1: nessuno)
+static int rebootSent = 0;
+static unsigned long lastSendAt = 0;
+
+int startPingNetwork() {
+    memset(pingResponseReceived, 0, sizeof(pingResponseReceived));
+    for (int i = 0; i < peerCount; i++) {
+        memcpy(pingedNodesMac[i], peerList[i].mac, 6);
+    }
+    pingResponseCount = peerCount;
+    pingNetworkActive = peerCount > 0;
+    pingNetworkStartTime = millis();
+    pingNext = peerCount > 0 ? 0 : -1;
+    DevLog.printf("📡 Ping di %d nodi avviato\n", peerCount);
+    return peerCount;
+}
+
+int startNetworkReboot() {
+    int targets = 0;
+    for (int i = 0; i < peerCount; i++) {
+        if (peerList[i].isOnline) targets++;
+    }
+    rebootNext = targets > 0 ? 0 : -1;
+    rebootSent = 0;
+    return targets;
+}
+
+bool nodeFanoutActive() {
+    return pingNext >= 0 || rebootNext >= 0;
+}
+
+// Esito di un passo del job
+enum FanoutStep : int8_t {
+    FANOUT_REJECTED = -1,   // Coda radio piena: si riprova al giro successivo
+    FANOUT_SKIPPED = 0,     // Nessun frame da inviare per questo target
+    FANOUT_SENT = 1
+};
+
+static FanoutStep sendNextPing() {
+    // Ping concluso in anticipo (tutte le risposte arrivate) o sostituito
+    if (!pingNetworkActive || pingNext >= pingResponseCount) {
+        pingNext = -1;
+        return FANOUT_SKIPPED;
+    }
+
+    FanoutStep result = FANOUT_SKIPPED;
+    int i = findPeerByMac(pingedNodesMac[pingNext]);
+    if (i < 0) {
+        // Peer rimosso durante il ping: nessuna risposta da attendere
+        pingResponseReceived[pingNext] = true;
+    } else {
+        if (!espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "PING", "REQUEST", "COMMAND", gateway_id)) {
+            return FANOUT_REJECTED;
+        }
+        pingNetworkStartTime = millis();
+        result = FANOUT_SENT;
+    }
+
+    if (++pingNext >= pingResponseCount) pingNext = -1;
+    return result;
+}
+
+// RESTART verso il prossimo peer online
+static FanoutStep sendNextReboot() {
+    while (rebootNext < peerCount && !peerList[rebootNext].isOnline) rebootNext++;
+    if (rebootNext >= peerCount) {
+        DevLog.printf("Network Reboot: RESTART inviato a %d nodi\n", rebootSent);
+        rebootNext = -1;
+        return FANOUT_SKIPPED;
+    }
+
+    Peer& peer = peerList[rebootNext];
+    if (!espNow.send(peer.mac, peer.nodeId, "CONTROL", "RESTART", "REQUEST", "COMMAND", gateway_id)) {
+        return FANOUT_REJECTED;
+    }
+    rebootSent++;
+    rebootNext++;
+    return FANOUT_SENT;
+}
+
+void processNodeFanout() {
+    if (!nodeFanoutActive()) return;
+
+    unsigned long now = millis();
+    if (now - lastSendAt < FANOUT_PACE_MS || DomoticaEspNow::txQueueCount() >= DOMOTICA_TX_QUEUE / 2) return;
+    lastSendAt = now;
+
+    // Il ping ha la precedenza: il suo timeout è in corso
+    FanoutStep result = (pingNext >= 0) ? sendNextPing() : sendNextReboot();
+    if (result == FANOUT_SENT) {
+        fanoutFramesSent++;
+    } else if (result == FANOUT_REJECTED) {
+        fanoutDeferrals++;
+    }
+}
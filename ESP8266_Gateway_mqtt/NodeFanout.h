@@ -0,0 +1,28 @@
+#ifndef NODE_FANOUT_H
+#define NODE_FANOUT_H
+
+#include <Arduino.h>
+
+// --- COMANDI A TUTTI I NODI A PASSI --- //
+// PING_NETWORK (MQTT e web) e NETWORK_REBOOT raggiungono ogni peer. Invece di un ciclo
+// di send() dentro il callback MQTT o l'handler web, il lavoro è un job ripreso dal loop:
+// un frame ogni FANOUT_PACE_MS e solo con spazio nella coda ESP-NOW, come CommandBatch.
+// send() non attende mai la radio: un frame rifiutato resta il prossimo da inviare.
+// Il timeout del ping parte dall'ultimo PING effettivamente accodato, quindi un nodo non
+// viene dichiarato offline per un PING che non è mai partito.
+
+#define FANOUT_PACE_MS  25
+
+// Avvia il ping di tutti i peer (sostituisce quello in corso). Ritorna i peer da pingare.
+int startPingNetwork();
+
+// Avvia il RESTART dei peer online. Ritorna i peer da riavviare.
+int startNetworkReboot();
+
+void processNodeFanout();
+bool nodeFanoutActive();
+
+extern uint32_t fanoutFramesSent;
+extern uint32_t fanoutDeferrals;   // Invii rimandati per coda radio piena
+
+#endif
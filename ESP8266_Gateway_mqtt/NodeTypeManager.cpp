@@ -0,0 +1,187 @@
+#include "NodeTypeManager.h"
+
+// --- REGISTRO TIPI NODO --- //
+// nodetypes.json viene letto una sola volta (begin/reload) e compilato in un pool
+// contiguo di NodeEntity. I tipi dinamici (RL_CTRL_ESP8266_XCH) e gli alias di
+// fallback vengono risolti al primo utilizzo e aggiunti al registro.
+
+NodeEntity NodeTypeManager::entityPool[NODETYPE_MAX_ENTITIES];
+NodeTypeManager::NodeTypeEntry NodeTypeManager::types[NODETYPE_MAX_TYPES];
+uint8_t NodeTypeManager::typeSlots[NODETYPE_HASH_SLOTS];
+NodeEntity NodeTypeManager::scratch[NODETYPE_MAX_PER_TYPE];
+int NodeTypeManager::typeCount = 0;
+int NodeTypeManager::entityCount = 0;
+
+static void copyField(char* dest, size_t size, const char* src) {
+    strncpy(dest, src, size - 1);
+    dest[size - 1] = '\0';
+}
+
+void NodeTypeManager::clearRegistry() {
+    memset(typeSlots, 0, sizeof(typeSlots));
+    typeCount = 0;
+    entityCount = 0;
+}
+
+bool NodeTypeManager::reload() {
+    clearRegistry();
+
+    File file = LittleFS.open(NODETYPES_FILE, "r");
+    if (!file) return false;
+
+    DynamicJsonDocument doc(2048);
+    DeserializationError error = deserializeJson(doc, file);
+    file.close();
+
+    if (error) {
+        DevLog.println("Invalid nodetypes.json format");
+        return false;
+    }
+
+    for (JsonPair kv : doc.as<JsonObject>()) {
+        const char* typeName = kv.key().c_str();
+
+        // I tipi RL_CTRL_ESP8266_ sono sempre generati dinamicamente
+        if (strstr(typeName, "RL_CTRL_ESP8266_") != NULL) continue;
+
+        uint16_t first = entityCount;
+        int count = 0;
+
+        JsonArray entitiesJson = kv.value()["entities"];
+        for (JsonObject entity : entitiesJson) {
+            if (count >= NODETYPE_MAX_PER_TYPE) break;
+            if (entityCount >= NODETYPE_MAX_ENTITIES) {
+                DevLog.printf("⚠️ NodeTypes: pool entità pieno, %s troncato\n", typeName);
+                break;
+            }
+
+            NodeEntity& e = entityPool[entityCount];
+            copyField(e.suffix, sizeof(e.suffix), entity["suffix"] | "");
+            copyField(e.name, sizeof(e.name), entity["name"] | "");
+            copyField(e.component, sizeof(e.component), entity["type"] | "switch");
+            copyField(e.deviceClass, sizeof(e.deviceClass), entity["device_class"] | "");
+            copyField(e.icon, sizeof(e.icon), entity["icon"] | "");
+            e.attributeIndex = entity["idx"] | count;
+
+            entityCount++;
+            count++;
+        }
+
+        if (insertType(typeName, fnv1a(typeName), first, count) < 0) {
+            entityCount = first; // Rilascia le entità del tipo non registrato
+        }
+    }
+
+    DevLog.printf("📋 NodeTypes: %d tipi, %d entità compilati\n", typeCount, entityCount);
+    return true;
+}
+
+const NodeEntity* NodeTypeManager::getEntities(const char* nodeType, int* count) {
+    *count = 0;
+    if (nodeType == NULL || nodeType[0] == '\0') return NULL;
+
+    uint32_t hash = fnv1a(nodeType);
+    int t = findType(nodeType, hash);
+    if (t < 0) {
+        const NodeEntity* span = NULL;
+        resolveType(nodeType, hash, &span, count);
+        return span;
+    }
+
+    *count = types[t].count;
+    return *count > 0 ? &entityPool[types[t].first] : NULL;
+}
+
+int NodeTypeManager::findType(const char* nodeType, uint32_t hash) {
+    uint32_t slot = hash & (NODETYPE_HASH_SLOTS - 1);
+    for (int probe = 0; probe < NODETYPE_HASH_SLOTS; probe++) {
+        uint8_t ref = typeSlots[slot];
+        if (ref == 0) return -1;
+
+        const NodeTypeEntry& e = types[ref - 1];
+        if (e.hash == hash && strcmp(e.name, nodeType) == 0) return ref - 1;
+
+        slot = (slot + 1) & (NODETYPE_HASH_SLOTS - 1);
+    }
+    return -1;
+}
+
+int NodeTypeManager::insertType(const char* nodeType, uint32_t hash, uint16_t first, uint8_t count) {
+    if (typeCount >= NODETYPE_MAX_TYPES) {
+        DevLog.printf("⚠️ NodeTypes: registro pieno, tipo %s non memorizzato\n", nodeType);
+        return -1;
+    }
+    if (strlen(nodeType) >= sizeof(types[0].name)) {
+        DevLog.printf("⚠️ NodeTypes: nome tipo troppo lungo: %s\n", nodeType);
+        return -1;
+    }
+
+    NodeTypeEntry& e = types[typeCount];
+    e.hash = hash;
+    strcpy(e.name, nodeType);
+    e.first = first;
+    e.count = count;
+
+    uint32_t slot = hash & (NODETYPE_HASH_SLOTS - 1);
+    while (typeSlots[slot] != 0) {
+        slot = (slot + 1) & (NODETYPE_HASH_SLOTS - 1);
+    }
+    typeSlots[slot] = typeCount + 1;
+
+    return typeCount++;
+}
+
+// Risolve un tipo non presente nel registro e lo memorizza per i lookup successivi
+int NodeTypeManager::resolveType(const char* nodeType, uint32_t hash, const NodeEntity** span, int* count) {
+    // --- 1. Gestione Dinamica per RL_CTRL_ESP8266_XCH ---
+    if (strstr(nodeType, "RL_CTRL_ESP8266_") != NULL) {
+        const char* lastUnderscore = strrchr(nodeType, '_');
+        int channels = atoi(lastUnderscore + 1); // Parsa il numero dopo '_' (es. "..._3CH")
+        if (channels < 0) channels = 0;
+        if (channels > NODETYPE_MAX_PER_TYPE) channels = NODETYPE_MAX_PER_TYPE;
+
+        if (channels > 0 && entityCount + channels <= NODETYPE_MAX_ENTITIES && typeCount < NODETYPE_MAX_TYPES) {
+            uint16_t first = entityCount;
+            fillRelayEntities(&entityPool[first], channels);
+            int t = insertType(nodeType, hash, first, channels);
+            if (t >= 0) {
+                entityCount += channels;
+                DevLog.printf("Dynamic Config: Generated %d entities for %s\n", channels, nodeType);
+                *span = &entityPool[first];
+                *count = channels;
+                return t;
+            }
+        }
+
+        // Registro pieno: genera nel buffer temporaneo (valido fino alla prossima chiamata)
+        fillRelayEntities(scratch, channels);
+        *span = channels > 0 ? scratch : NULL;
+        *count = channels;
+        return -1;
+    }
+
+    // --- 2. Fallback: tipi "RELAY" sconosciuti usano il 4_RELAY_CONTROLLER ---
+    if (strstr(nodeType, "RELAY") != NULL) {
+        int base = findType("4_RELAY_CONTROLLER", fnv1aConst("4_RELAY_CONTROLLER"));
+        if (base >= 0) {
+            insertType(nodeType, hash, types[base].first, types[base].count);
+            *count = types[base].count;
+            *span = *count > 0 ? &entityPool[types[base].first] : NULL;
+            return base;
+        }
+    }
+
+    // --- 3. Tipo sconosciuto: cache negativa per evitare di ripetere la risoluzione ---
+    return insertType(nodeType, hash, 0, 0);
+}
+
+void NodeTypeManager::fillRelayEntities(NodeEntity* entities, int channels) {
+    for (int i = 0; i < channels; i++) {
+        snprintf(entities[i].suffix, sizeof(entities[i].suffix), "relay_%d", i + 1);
+        snprintf(entities[i].name, sizeof(entities[i].name), "Relay %d", i + 1);
+        copyField(entities[i].component, sizeof(entities[i].component), "switch");
+        copyField(entities[i].deviceClass, sizeof(entities[i].deviceClass), "outlet");
+        copyField(entities[i].icon, sizeof(entities[i].icon), "mdi:power-socket-eu");
+        entities[i].attributeIndex = i;
+    }
+}
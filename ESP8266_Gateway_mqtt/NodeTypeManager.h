@@ -5,9 +5,16 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include "WebLog.h"
+#include "HashUtils.h"
 
 #define NODETYPES_FILE "/nodetypes.json"
 
+// Dimensioni del registro in RAM (nodetypes.json compilato all'avvio)
+#define NODETYPE_MAX_TYPES 16      // Tipi distinti (file + dinamici + alias)
+#define NODETYPE_MAX_ENTITIES 32   // Entità totali nel pool contiguo
+#define NODETYPE_MAX_PER_TYPE 8    // Entità massime per singolo tipo
+#define NODETYPE_HASH_SLOTS 32     // Potenza di 2, almeno 2x NODETYPE_MAX_TYPES
+
 // Struttura dati per le entità (simile a prima, ma popolata dinamicamente)
 struct NodeEntity {
     char suffix[32];       // e.g., "relay_1"
@@ -35,7 +42,7 @@ public:
             checkAndUpdateConfig();
         }
         
-        return loadConfig();
+        return reload();
     }
 
     // Restituisce il JSON grezzo per l'API
@@ -51,110 +58,38 @@ public:
         return "{}";
     }
 
-    // Popola l'array di entità per un dato tipo di nodo
-    static int getNodeConfig(const char* nodeType, NodeEntity* entities, int maxEntities) {
-        // --- 1. Gestione Dinamica per RL_CTRL_ESP8266_XCH ---
-        // Verifica se è un tipo dinamico "RL_CTRL_ESP8266_"
-        if (strstr(nodeType, "RL_CTRL_ESP8266_") != NULL) {
-            // Estrai il numero di canali dalla stringa (es. "..._3CH")
-            // Cerca l'ultimo underscore
-            const char* lastUnderscore = strrchr(nodeType, '_');
-            if (lastUnderscore) {
-                int channels = atoi(lastUnderscore + 1); // Parsa il numero dopo '_'
-                
-                // Limita al numero massimo di entità
-                if (channels > maxEntities) channels = maxEntities;
-                
-                // Genera dinamicamente le entità
-                for(int i=0; i<channels; i++) {
-                    snprintf(entities[i].suffix, sizeof(entities[i].suffix), "relay_%d", i+1);
-                    snprintf(entities[i].name, sizeof(entities[i].name), "Relay %d", i+1);
-                    strncpy(entities[i].component, "switch", sizeof(entities[i].component));
-                    strncpy(entities[i].deviceClass, "outlet", sizeof(entities[i].deviceClass));
-                    strncpy(entities[i].icon, "mdi:power-socket-eu", sizeof(entities[i].icon));
-                    entities[i].attributeIndex = i;
-                }
-                
-                DevLog.printf("Dynamic Config: Generated %d entities for %s\n", channels, nodeType);
-                return channels;
-            }
-        }
-        
-        // --- 2. Gestione Standard da JSON ---
-        // Ricarichiamo il config se necessario (per ora lo facciamo ogni volta per semplicità e RAM, 
-        // ma in produzione si potrebbe cachare in memoria se c'è spazio)
-        
-        File file = LittleFS.open(NODETYPES_FILE, "r");
-        if (!file) return 0;
-
-        // Buffer per il documento JSON (dimensione da calibrare)
-        DynamicJsonDocument doc(2048); 
-        DeserializationError error = deserializeJson(doc, file);
-        file.close();
-
-        if (error) {
-            DevLog.println("Failed to parse nodetypes.json");
-            return 0;
-        }
-
-        // Cerca il tipo specifico
-        JsonVariant typeConfig = doc[nodeType];
-        
-        // Fallback: se non trovato, cerca parziale "RELAY"
-        if (!typeConfig) {
-            if (strstr(nodeType, "RELAY") != NULL) {
-                // Prova a cercare un tipo generico "4_RELAY_CONTROLLER" come fallback
-                typeConfig = doc["4_RELAY_CONTROLLER"];
-            }
-        }
-
-        if (!typeConfig) return 0;
-
-        JsonArray entitiesJson = typeConfig["entities"];
-        int count = 0;
-
-        for (JsonObject entity : entitiesJson) {
-            if (count >= maxEntities) break;
-
-            strncpy(entities[count].suffix, entity["suffix"] | "", sizeof(entities[count].suffix) - 1);
-            entities[count].suffix[sizeof(entities[count].suffix) - 1] = '\0';
-            
-            strncpy(entities[count].name, entity["name"] | "", sizeof(entities[count].name) - 1);
-            entities[count].name[sizeof(entities[count].name) - 1] = '\0';
-            
-            strncpy(entities[count].component, entity["type"] | "switch", sizeof(entities[count].component) - 1);
-            entities[count].component[sizeof(entities[count].component) - 1] = '\0';
-            
-            strncpy(entities[count].deviceClass, entity["device_class"] | "", sizeof(entities[count].deviceClass) - 1);
-            entities[count].deviceClass[sizeof(entities[count].deviceClass) - 1] = '\0';
-            
-            strncpy(entities[count].icon, entity["icon"] | "", sizeof(entities[count].icon) - 1);
-            entities[count].icon[sizeof(entities[count].icon) - 1] = '\0';
+    // Restituisce le entità compilate per un tipo di nodo (span contiguo, sola lettura).
+    // Lookup O(1) sul registro in RAM: nessun accesso a LittleFS né parsing JSON.
+    // Il puntatore resta valido fino al prossimo reload().
+    static const NodeEntity* getEntities(const char* nodeType, int* count);
 
-            entities[count].attributeIndex = entity["idx"] | count;
+    // Ricompila il registro da nodetypes.json (da chiamare dopo ogni scrittura del file)
+    static bool reload();
 
-            count++;
-        }
-
-        return count;
-    }
+    static int getTypeCount() { return typeCount; }
+    static int getEntityCount() { return entityCount; }
 
 private:
-    static bool loadConfig() {
-        // Verifica validità JSON
-        File file = LittleFS.open(NODETYPES_FILE, "r");
-        if (!file) return false;
-        
-        DynamicJsonDocument doc(1024);
-        DeserializationError error = deserializeJson(doc, file);
-        file.close();
-        
-        if (error) {
-            DevLog.println("Invalid nodetypes.json format");
-            return false;
-        }
-        return true;
-    }
+    // --- REGISTRO COMPILATO --- //
+    struct NodeTypeEntry {
+        uint32_t hash;
+        char name[32];
+        uint16_t first;  // Indice della prima entità in entityPool
+        uint8_t count;   // 0 = tipo sconosciuto (cache negativa)
+    };
+
+    static NodeEntity entityPool[NODETYPE_MAX_ENTITIES];
+    static NodeTypeEntry types[NODETYPE_MAX_TYPES];
+    static uint8_t typeSlots[NODETYPE_HASH_SLOTS]; // indice+1 in types[], 0 = vuoto
+    static NodeEntity scratch[NODETYPE_MAX_PER_TYPE];
+    static int typeCount;
+    static int entityCount;
+
+    static void clearRegistry();
+    static int findType(const char* nodeType, uint32_t hash);
+    static int insertType(const char* nodeType, uint32_t hash, uint16_t first, uint8_t count);
+    static int resolveType(const char* nodeType, uint32_t hash, const NodeEntity** span, int* count);
+    static void fillRelayEntities(NodeEntity* entities, int channels);
 
     static void createDefaultConfig() {
         DynamicJsonDocument doc(2048);
@@ -4,6 +4,11 @@
 #include "HaDiscovery.h"
 #include "NodeTypeManager.h"
 #include "WebLog.h"
+#include "StatusCoalescer.h"
+#include "MqttJsonWriter.h"
+#include "MqttTopics.h"
+#include "PeerStore.h"
+#include "CommandTracker.h"
 
 // Forward declaration
 int getRequiredAttributeLength(const char* nodeType);
@@ -12,9 +17,6 @@ int getRequiredAttributeLength(const char* nodeType);
 Peer peerList[MAX_PEERS];
 int peerCount = 0;
 
-NodeCommand pendingCommands[MAX_PEERS];
-int pendingCommandsCount = 0;
-const unsigned long NODE_COMMAND_TIMEOUT = 5000;
 
 // Discovery and Ping flags
 bool networkDiscoveryActive = false;
@@ -36,7 +38,7 @@ extern char mqtt_topic_prefix[50];
 
 
 
-#define PEERS_FILE "/peers.json"
+#define PEERS_FILE "/peers.json" // Formato precedente, solo migrazione (vedi PeerStore)
 
 String macToString(const uint8_t* mac) {
     char macStr[18];
@@ -46,23 +48,21 @@ String macToString(const uint8_t* mac) {
 }
 
 void savePeer(const uint8_t* mac_addr, const char* nodeId, const char* nodeType, const char* firmwareVersion, bool forceDiscovery) {
-    bool isNewPeer = true;
-    int peerIndex = 0;
-    
     // Controlla se il peer è già nella lista
-    for (int i = 0; i < peerCount; i++) {
-        if (memcmp(peerList[i].mac, mac_addr, 6) == 0) {
-            isNewPeer = false;
-            peerIndex = i;
-            break;
-        }
-    }
+    int peerIndex = findPeerByMac(mac_addr);
+    bool isNewPeer = (peerIndex < 0);
     
     // Se è un nuovo peer, aggiungilo
     if (isNewPeer) {
         if (peerCount < MAX_PEERS) {
             peerIndex = peerCount;
             memcpy(peerList[peerIndex].mac, mac_addr, 6);
+            peerList[peerIndex].statusDirty = 0;
+            peerList[peerIndex].statusPublishedAt = 0;
+            peerList[peerIndex].stateHash = 0;
+            peerList[peerIndex].discoveryHash = 0;
+            peerList[peerIndex].storeDirty = false;
+            memset(&peerList[peerIndex].rtt, 0, sizeof(PeerRtt));
             peerCount++;
         } else {
             DevLog.println("Errore: Lista peer piena!");
@@ -77,6 +77,13 @@ void savePeer(const uint8_t* mac_addr, const char* nodeId, const char* nodeType,
         strncpy(peerList[peerIndex].nodeId, nodeId, sizeof(peerList[peerIndex].nodeId) - 1);
         peerList[peerIndex].nodeId[sizeof(peerList[peerIndex].nodeId) - 1] = '\0';
         dataChanged = true;
+        peerList[peerIndex].stateHash = 0; // Nuovo topic /nodo/<id>/state
+        // Rename: la vecchia chiave nodeId va tolta dall'indice
+        if (!isNewPeer) rebuildPeerIndex();
+    }
+    
+    if (isNewPeer) {
+        indexPeer(peerIndex);
     }
     
     if (strlen(nodeType) > 0 && strcmp(peerList[peerIndex].nodeType, nodeType) != 0) {
@@ -109,21 +116,25 @@ void savePeer(const uint8_t* mac_addr, const char* nodeId, const char* nodeType,
     
     // Salva su file se è nuovo o se sono cambiati dati importanti
     if (isNewPeer || dataChanged || forceDiscovery) {
-        if (isNewPeer || dataChanged) {
-            savePeersToLittleFS();
+        bool persist = isNewPeer || dataChanged;
+
+        // Invia aggiornamento MQTT (da disconnessi il flag attende la riconnessione)
+        if (isNewPeer) {
+            markPeerDirty(peerIndex, PEER_DIRTY_NEW);
+        } else if (dataChanged) {
+            markPeerDirty(peerIndex, PEER_DIRTY_UPDATE);
+        } else {
+            markPeerDirty(peerIndex, PEER_DIRTY_REFRESH);
         }
-        
-        // Invia aggiornamento MQTT
-        if (mqttConnected) {
-            if (isNewPeer) {
-                publishPeerStatus(peerIndex, "NODE_NEW");
-            } else if (dataChanged) {
-                publishPeerStatus(peerIndex, "NODE_UPDATE");
-            } else {
-                 publishPeerStatus(peerIndex, "NODE_REFRESH");
-            }
-            HaDiscovery::publishDiscovery(mqttClient, peerList[peerIndex], mqtt_topic_prefix);
-            HaDiscovery::publishDashboardConfig(mqttClient, peerList[peerIndex], mqtt_topic_prefix);
+        // Discovery HA solo se l'impronta è cambiata: un REGISTER ripetuto non ripubblica
+        // le config retained. Quella persa da disconnessi la recupera il job alla riconnessione.
+        if (mqttConnected && HaDiscovery::refreshDiscovery(mqttClient, peerList[peerIndex], mqtt_topic_prefix, false)) {
+            persist = true;
+        }
+
+        // Write-behind: la scrittura su flash avviene dal loop (PeerStore)
+        if (persist) {
+            peerStoreMarkDirty(peerIndex);
         }
     }
 }
@@ -144,7 +155,8 @@ int getRequiredAttributeLength(const char* nodeType) {
     return 0;
 }
 
-void loadPeersFromLittleFS() {
+// Formato JSON delle versioni precedenti: letto una sola volta per la migrazione
+static void loadLegacyPeersJson() {
     if (!LittleFS.exists(PEERS_FILE)) {
         DevLog.println("Nessun file peer trovato.");
         return;
@@ -156,30 +168,26 @@ void loadPeersFromLittleFS() {
         return;
     }
 
-    size_t size = configFile.size();
-    std::unique_ptr<char[]> buf(new char[size]);
-    configFile.readBytes(buf.get(), size);
-    configFile.close();
-
-    DynamicJsonDocument doc(4096);
-    DeserializationError error = deserializeJson(doc, buf.get());
-
-    if (error) {
-        DevLog.println("Errore parsing JSON peer");
-        return;
-    }
-
+    // Lettura in streaming: un oggetto peer alla volta, il file intero non passa mai in RAM
     peerCount = 0;
-    JsonArray peers = doc["peers"];
-    for (JsonObject peer : peers) {
-        if (peerCount < MAX_PEERS) {
-            const char* macStr = peer["mac"];
+    StaticJsonDocument<512> peer;
+    if (configFile.find("\"peers\"") && configFile.find("[") && configFile.peek() != ']') {
+        do {
+            DeserializationError error = deserializeJson(peer, configFile);
+            if (error) {
+                DevLog.println("Errore parsing JSON peer");
+                break;
+            }
+            if (peerCount >= MAX_PEERS) continue;
+
+            const char* macStr = peer["mac"] | "";
             
             // Parse MAC address string to bytes
             int values[6];
             if (sscanf(macStr, "%x:%x:%x:%x:%x:%x", 
                        &values[0], &values[1], &values[2], 
                        &values[3], &values[4], &values[5]) == 6) {
+                memset(&peerList[peerCount], 0, sizeof(Peer));
                 for(int i=0; i<6; i++) {
                     peerList[peerCount].mac[i] = (uint8_t)values[i];
                 }
@@ -189,16 +197,7 @@ void loadPeersFromLittleFS() {
                 strncpy(peerList[peerCount].firmwareVersion, peer["firmwareVersion"] | "", sizeof(peerList[peerCount].firmwareVersion) - 1);
                 strncpy(peerList[peerCount].attributes, peer["attributes"] | "", sizeof(peerList[peerCount].attributes) - 1);
                 peerList[peerCount].attributes[sizeof(peerList[peerCount].attributes) - 1] = '\0';
-                
-                // Ensure attributes are valid and have correct length
-                int reqLen = getRequiredAttributeLength(peerList[peerCount].nodeType);
-                int currLen = strlen(peerList[peerCount].attributes);
-                
-                if (currLen < reqLen) {
-                    // Extend with '0's
-                    for(int k=currLen; k<reqLen; k++) peerList[peerCount].attributes[k] = '0';
-                    peerList[peerCount].attributes[reqLen] = '\0';
-                }
+                peerList[peerCount].discoveryHash = peer["discoveryHash"] | 0UL;
                 
                 // Validazione base del nodo caricato
                 if (strlen(peerList[peerCount].nodeId) > 0 && strcmp(peerList[peerCount].nodeId, "null") != 0) {
@@ -210,37 +209,59 @@ void loadPeersFromLittleFS() {
                     DevLog.printf("⚠️ Ignorato peer non valido caricato da FS (MAC: %s)\n", macStr);
                 }
             }
-        }
+        } while (configFile.findUntil(",", "]"));
     }
-    DevLog.printf("Caricati %d peer da LittleFS\n", peerCount);
+    configFile.close();
 }
 
-void savePeersToLittleFS() {
-    DynamicJsonDocument doc(2048);
-    JsonArray peers = doc.createNestedArray("peers");
-
-    for (int i = 0; i < peerCount; i++) {
-        JsonObject peer = peers.createNestedObject();
-        char macStr[18];
-        snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", 
-                 peerList[i].mac[0], peerList[i].mac[1], peerList[i].mac[2], 
-                 peerList[i].mac[3], peerList[i].mac[4], peerList[i].mac[5]);
-        
-        peer["mac"] = macStr;
-        peer["nodeId"] = peerList[i].nodeId;
-        peer["nodeType"] = peerList[i].nodeType;
-        peer["firmwareVersion"] = peerList[i].firmwareVersion;
-        peer["attributes"] = peerList[i].attributes;
+// Ensure attributes are valid and have correct length
+static void extendAttributes(Peer& peer) {
+    int reqLen = getRequiredAttributeLength(peer.nodeType);
+    int currLen = strlen(peer.attributes);
+    
+    if (currLen < reqLen) {
+        // Extend with '0's
+        for(int k=currLen; k<reqLen; k++) peer.attributes[k] = '0';
+        peer.attributes[reqLen] = '\0';
     }
+}
 
-    File configFile = LittleFS.open(PEERS_FILE, "w");
-    if (!configFile) {
-        DevLog.println("Impossibile aprire file peer per scrittura");
-        return;
+void loadPeersFromLittleFS() {
+    PeerStoreLoadResult loaded = peerStoreLoad();
+    if (loaded != PEERSTORE_MISSING) {
+        // Anche da uno snapshot corrotto: quanto recuperato passa la stessa validazione,
+        // lo snapshot nuovo lo scrive la write-behind (l'originale è in PEERSTORE_BAD_FILE)
+        // Validazione base dei nodi caricati (come per il formato JSON)
+        int valid = 0;
+        for (int i = 0; i < peerCount; i++) {
+            if (strlen(peerList[i].nodeId) > 0 && strcmp(peerList[i].nodeId, "null") != 0) {
+                extendAttributes(peerList[i]);
+                if (valid != i) peerList[valid] = peerList[i];
+                valid++;
+            } else {
+                DevLog.printf("⚠️ Ignorato peer non valido caricato da FS (MAC: %s)\n", macToString(peerList[i].mac).c_str());
+            }
+        }
+        if (valid < peerCount) {
+            peerCount = valid;
+            peerStoreMarkRemoved();
+        }
+    } else {
+        // Nessuno snapshot: primo avvio o migrazione da peers.json
+        loadLegacyPeersJson();
+        for (int i = 0; i < peerCount; i++) {
+            extendAttributes(peerList[i]);
+        }
+        // Migrazione una tantum: il JSON diventa lo snapshot binario (anche vuoto, come
+        // base per il journal)
+        if (peerStoreCompact() && LittleFS.exists(PEERS_FILE)) {
+            LittleFS.remove(PEERS_FILE);
+            DevLog.println("💾 peers.json migrato nello snapshot binario");
+        }
     }
 
-    serializeJson(doc, configFile);
-    configFile.close();
+    rebuildPeerIndex();
+    DevLog.printf("Caricati %d peer da LittleFS\n", peerCount);
 }
 
 void printPeersList() {
@@ -254,6 +275,13 @@ void printPeersList() {
         DevLog.printf("%d) ID: %s, MAC: %s, Type: %s, Ver: %s, Online: %s\n", 
                       i, peerList[i].nodeId, macStr, peerList[i].nodeType, 
                       peerList[i].firmwareVersion, peerList[i].isOnline ? "YES" : "NO");
+
+        DomoticaPeerStats stats;
+        if (DomoticaEspNow::getPeerStats(peerList[i].mac, &stats)) {
+            DevLog.printf("   Consegna: %lu inviati, %lu confermati, %lu ritrasmessi, %lu persi, %lu duplicati\n",
+                          (unsigned long)stats.reliableSent, (unsigned long)stats.delivered, (unsigned long)stats.retries,
+                          (unsigned long)stats.failed, (unsigned long)stats.duplicates);
+        }
     }
     DevLog.println("------------------");
 }
@@ -297,15 +325,18 @@ void processPeerListSending() {
 void clearAllPeers() {
     DevLog.println("Cancellazione di TUTTI i peer...");
     
-    // 1. Rimuovi peer da ESP-NOW
+    // 1. Rimuovi peer da ESP-NOW e chiudi i comandi in attesa (finché i nodeId sono noti)
     for (int i = 0; i < peerCount; i++) {
-        esp_now_del_peer(peerList[i].mac);
+        espNow.removePeer(peerList[i].mac);
     }
+    commandTrackerClear();
     
-    // 2. Resetta contatore
+    // 2. Resetta contatore e indice
     peerCount = 0;
+    rebuildPeerIndex();
     
     // 3. Cancella file su LittleFS
+    peerStoreClear();
     if (LittleFS.exists(PEERS_FILE)) {
         LittleFS.remove(PEERS_FILE);
         DevLog.println("File peers.json rimosso");
@@ -318,7 +349,6 @@ void clearAllPeers() {
 void removePeer(const char* macAddress) {
     DevLog.printf("Rimozione peer con MAC: %s\n", macAddress);
     
-    int indexToRemove = -1;
     uint8_t macToRemove[6];
     
     // Parse MAC address
@@ -331,28 +361,32 @@ void removePeer(const char* macAddress) {
         }
         
         // Trova indice
-        for (int i = 0; i < peerCount; i++) {
-            if (memcmp(peerList[i].mac, macToRemove, 6) == 0) {
-                indexToRemove = i;
-                break;
-            }
-        }
+        int indexToRemove = findPeerByMac(macToRemove);
         
         if (indexToRemove != -1) {
-            // Rimuovi da ESP-NOW
-            esp_now_del_peer(peerList[indexToRemove].mac);
+            // Rimuovi da ESP-NOW; i comandi in attesa del nodo si chiudono come falliti
+            espNow.removePeer(peerList[indexToRemove].mac);
+            commandTrackerDropPeer(peerList[indexToRemove].mac);
             
             // Notifica rimozione
-            publishGatewayStatus("peer_removed", String("Peer removed: ") + peerList[indexToRemove].nodeId, "REMOVE_PEER");
+            publishGatewayStatus("peer_removed", (String("Peer removed: ") + peerList[indexToRemove].nodeId).c_str(), "REMOVE_PEER");
+
+            // Lo stato retained del nodo non deve sopravvivere alla rimozione
+            char stateTopic[MQTT_TOPIC_MAX];
+            if (node_state_topics && mqttClient.connected() &&
+                mqttNodeTopic(stateTopic, sizeof(stateTopic), peerList[indexToRemove].nodeId, "state") > 0) {
+                mqttClient.publish(stateTopic, "", true);
+            }
             
             // Sposta gli altri elementi
             for (int i = indexToRemove; i < peerCount - 1; i++) {
                 peerList[i] = peerList[i+1];
             }
             peerCount--;
+            rebuildPeerIndex();
             
-            // Salva modifiche
-            savePeersToLittleFS();
+            // Salva modifiche (snapshot al prossimo giro di PeerStore)
+            peerStoreMarkRemoved();
             DevLog.println("Peer rimosso con successo");
         } else {
             DevLog.println("Peer non trovato");
@@ -365,20 +399,169 @@ void removePeer(const char* macAddress) {
 }
 
 void checkAndSavePeers() {
-    // Logica per salvataggio periodico se necessario
-    // Al momento salviamo su ogni modifica importante
+    // Salvataggio differito dei peer segnati (journal/snapshot, vedi PeerStore.h)
+    peerStoreLoop();
 }
 
 void forceSavePeers() {
-    savePeersToLittleFS();
+    peerStoreFlush();
+}
+
+// Testo di un campo come lo restituirebbe as<String>(): stringhe invariate, numeri e
+// campi mancanti serializzati ("1", "null") nel buffer fornito
+static const char* commandField(JsonVariantConst value, char* buf, size_t size) {
+    if (value.is<const char*>()) return value.as<const char*>();
+    serializeJson(value, buf, size);
+    return buf;
+}
+
+// Copia senza spazi iniziali/finali e in maiuscolo (confronto dei comandi ON/OFF/...)
+static void normalizeCommand(const char* command, char* out, size_t size) {
+    while (*command == ' ' || *command == '\t') command++;
+    size_t len = 0;
+    while (command[len] && len < size - 1) {
+        out[len] = toupper((uint8_t) command[len]);
+        len++;
+    }
+    while (len > 0 && (out[len - 1] == ' ' || out[len - 1] == '\t' || out[len - 1] == '\r' || out[len - 1] == '\n')) len--;
+    out[len] = '\0';
+}
+
+// ON/OFF espliciti: ripeterli non cambia il risultato, il gateway può ritrasmetterli
+static bool isIdempotentCommand(const char* command, const char* type) {
+    return strcmp(type, "COMMAND") == 0 && (strcmp(command, "1") == 0 || strcmp(command, "0") == 0);
+}
+
+uint32_t groupCommandsSent = 0;
+uint32_t groupFramesSaved = 0;
+
+// Comando su tutti gli switch del nodo con un solo frame GROUP (nodi con DOMOTICA_CAP_GROUP).
+// false se il nodo non lo supporta o uno switch non è un canale relay_N: si invia per entità.
+static bool sendGroupCommand(int i, const NodeEntity* entities, int count, const char* action, const char* type) {
+    if (!(DomoticaEspNow::getPeerCaps(peerList[i].mac) & DOMOTICA_CAP_GROUP)) return false;
+
+    DomoticaGroupCommand group;
+    group.mask = 0;
+    uint8_t switches = 0;
+    for (int k = 0; k < count; k++) {
+        if (strcmp(entities[k].component, "switch") != 0) continue;
+        int channel = (strncmp(entities[k].suffix, "relay_", 6) == 0) ? atoi(entities[k].suffix + 6) : 0;
+        if (channel < 1 || channel > DOMOTICA_GROUP_MAX_CHANNELS) return false;
+        group.mask |= 1u << (channel - 1);
+        group.action[channel - 1] = action[0];
+        switches++;
+    }
+
+    char command[8], status[DOMOTICA_GROUP_MAX_CHANNELS + 1];
+    if (!domoticaEncodeGroup(group, command, sizeof(command), status, sizeof(status))) return false;
+
+    espNow.sendReliable(peerList[i].mac, peerList[i].nodeId, DOMOTICA_GROUP_TOPIC, command, status, type, gateway_id);
+    commandTrackerAdd(i, DOMOTICA_GROUP_TOPIC, command, status, isIdempotentCommand(action, type));
+    groupCommandsSent++;
+    groupFramesSaved += switches - 1;
+    DevLog.printf("Comando di gruppo %s/%s -> %s (%u canali in un frame)\n", command, status, peerList[i].nodeId, switches);
+    return true;
+}
+
+CommandLatency jsonCommandLatency = {0, 0, 0};
+CommandLatency directCommandLatency = {0, 0, 0};
+
+static void recordCommandLatency(CommandLatency& latency, unsigned long startUs) {
+    uint32_t elapsed = micros() - startUs;
+    latency.count++;
+    latency.totalUs += elapsed;
+    if (elapsed > latency.maxUs) latency.maxUs = elapsed;
+}
+
+// Comando grezzo (già normalizzato) -> comando firmware del componente. NULL se non valido.
+static const char* mapEntityCommand(const char* component, const char* cmd) {
+    if (strcmp(component, "cover") == 0) {
+        if (strcmp(cmd, "OPEN") == 0 || strcmp(cmd, "UP") == 0) return "UP";
+        if (strcmp(cmd, "CLOSE") == 0 || strcmp(cmd, "DOWN") == 0) return "DOWN";
+        if (strcmp(cmd, "STOP") == 0) return "STOP";
+        return NULL;
+    }
+    if (strcmp(cmd, "ON") == 0 || strcmp(cmd, "1") == 0 || strcmp(cmd, "TRUE") == 0) return "1";
+    if (strcmp(cmd, "OFF") == 0 || strcmp(cmd, "0") == 0 || strcmp(cmd, "FALSE") == 0) return "0";
+    if (strcmp(cmd, "TOGGLE") == 0 || strcmp(cmd, "SWITCH") == 0 || strcmp(cmd, "2") == 0) return "2";
+    return NULL;
+}
+
+const char* resolveEntityCommand(int i, const char* entity, const char* action, bool* entityFound) {
+    char cmdNorm[16];
+    normalizeCommand(action, cmdNorm, sizeof(cmdNorm));
+
+    // Entità dal registro del tipo nodo; "relay_N" sconosciuti come switch (come il percorso JSON)
+    const char* component = NULL;
+    int count = 0;
+    const NodeEntity* entities = NodeTypeManager::getEntities(peerList[i].nodeType, &count);
+    for (int k = 0; k < count; k++) {
+        if (strcmp(entity, entities[k].suffix) == 0) {
+            component = entities[k].component;
+            break;
+        }
+    }
+    if (component == NULL && strncmp(entity, "relay_", 6) == 0) {
+        component = "switch";
+    }
+    if (entityFound) *entityFound = (component != NULL);
+    if (component == NULL) return NULL;
+
+    return mapEntityCommand(component, cmdNorm);
+}
+
+int sendEntityCommand(int i, const char* entity, const char* command, uint8_t tag) {
+    espNow.sendReliable(peerList[i].mac, peerList[i].nodeId, entity, command, "", "COMMAND", gateway_id);
+    return commandTrackerAdd(i, entity, command, "", isIdempotentCommand(command, "COMMAND"), tag);
+}
+
+void processEntityCommand(const char* nodeId, const char* entity, const byte* payload, unsigned int length) {
+    unsigned long startUs = micros();
+
+    int i = findPeerByNodeId(nodeId);
+    if (i < 0) {
+        DevLog.printf("Nodo %s non trovato nella lista peer\n", nodeId);
+        return;
+    }
+
+    if (!peerList[i].isOnline) {
+        if (mqttConnected) {
+            publishNodeAvailability(nodeId, "offline");
+        }
+        markPeerDirty(i, PEER_DIRTY_STATE);
+        DevLog.printf("Nodo %s offline: comando non inviato\n", nodeId);
+        return;
+    }
+
+    // Payload non terminato: copia limitata sullo stack
+    char raw[16];
+    size_t len = length < sizeof(raw) - 1 ? length : sizeof(raw) - 1;
+    memcpy(raw, payload, len);
+    raw[len] = '\0';
+
+    bool entityFound;
+    const char* command = resolveEntityCommand(i, entity, raw, &entityFound);
+    if (!entityFound) {
+        DevLog.printf("Entità %s non presente sul nodo %s\n", entity, nodeId);
+        return;
+    }
+    if (command == NULL) {
+        DevLog.printf("Comando %s non valido per %s/%s\n", raw, nodeId, entity);
+        return;
+    }
+
+    sendEntityCommand(i, entity, command);
+    recordCommandLatency(directCommandLatency, startUs);
+    DevLog.printf("Comando diretto %s -> %s/%s via ESP-NOW\n", command, nodeId, entity);
 }
 
-void processNodeCommand(const String& msgStr) {
-    DevLog.print("RICEVUTO - Node Command: ");
-    DevLog.println(msgStr);
+void processNodeCommand(const byte* payload, unsigned int length) {
+    unsigned long startUs = micros();
+    DevLog.printf("RICEVUTO - Node Command: %.*s\n", (int) length, (const char*) payload);
     
-    DynamicJsonDocument doc(512);
-    DeserializationError parseError = deserializeJson(doc, msgStr);
+    // Input in sola lettura: vedi processMqttCommand()
+    StaticJsonDocument<512> doc;
+    DeserializationError parseError = deserializeJson(doc, payload, length);
     
     if (parseError) {
         DevLog.println("Errore parsing JSON per comando nodo");
@@ -387,160 +570,150 @@ void processNodeCommand(const String& msgStr) {
     
     // Caso 1: Comando speciale semplificato {"command":"NODE_REBOOT", "nodeId":"..."}
     if (doc.containsKey("command") && doc.containsKey("nodeId")) {
-        String command = doc["command"].as<String>();
-        String nodeId = doc["nodeId"].as<String>();
+        char commandBuf[24], nodeIdBuf[24];
+        const char* command = commandField(doc["command"], commandBuf, sizeof(commandBuf));
+        const char* nodeId = commandField(doc["nodeId"], nodeIdBuf, sizeof(nodeIdBuf));
         
-        DevLog.printf("Comando speciale per NODO - Command: %s, NodeId: %s\n", command.c_str(), nodeId.c_str());
+        DevLog.printf("Comando speciale per NODO - Command: %s, NodeId: %s\n", command, nodeId);
         
-        if (command == "NODE_REBOOT") {
+        if (strcmp(command, "NODE_REBOOT") == 0) {
             // Cerca il nodo
             bool nodeFound = false;
-            for (int i = 0; i < peerCount; i++) {
-                if (String(peerList[i].nodeId) == nodeId) {
-                    // Invia comando RESTART
-                    espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESTART", "", "COMMAND", gateway_id);
-                    DevLog.printf("Comando RESTART inviato al nodo %s via ESP-NOW\n", nodeId.c_str());
-                    nodeFound = true;
-                    break;
+            int i = findPeerByNodeId(nodeId);
+            if (i >= 0) {
+                // Invia comando RESTART
+                if (espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESTART", "", "COMMAND", gateway_id)) {
+                    DevLog.printf("Comando RESTART inviato al nodo %s via ESP-NOW\n", nodeId);
+                } else {
+                    DevLog.printf("⚠️ RESTART per %s scartato: coda radio piena\n", nodeId);
                 }
+                nodeFound = true;
             }
             
             if (!nodeFound) {
-                DevLog.printf("Nodo %s non trovato nella lista peer per REBOOT\n", nodeId.c_str());
+                DevLog.printf("Nodo %s non trovato nella lista peer per REBOOT\n", nodeId);
             }
             return;
         }
         
-        DevLog.printf("Comando speciale %s non riconosciuto\n", command.c_str());
+        DevLog.printf("Comando speciale %s non riconosciuto\n", command);
         return;
     }
     
     // Caso 2: Comando standard {"Node":"...", "Topic":"...", "Command":"...", "Type":"..."}
     if (doc.containsKey("Node") && doc.containsKey("Topic") && doc.containsKey("Command") && doc.containsKey("Type")) {
-        String nodeId = doc["Node"].as<String>();
-        String topic = doc["Topic"].as<String>();
-        String command = doc["Command"].as<String>();
-        String status = doc["Status"].as<String>();
-        String type = doc["Type"].as<String>();
+        char nodeIdBuf[24], topicBuf[24], commandBuf[24], statusBuf[24], typeBuf[24];
+        const char* nodeId = commandField(doc["Node"], nodeIdBuf, sizeof(nodeIdBuf));
+        const char* topic = commandField(doc["Topic"], topicBuf, sizeof(topicBuf));
+        const char* command = commandField(doc["Command"], commandBuf, sizeof(commandBuf));
+        const char* status = commandField(doc["Status"], statusBuf, sizeof(statusBuf));
+        const char* type = commandField(doc["Type"], typeBuf, sizeof(typeBuf));
         
         DevLog.printf("Comando per NODO - Node: %s, Topic: %s, Command: %s, Type: %s\n", 
-                      nodeId.c_str(), topic.c_str(), command.c_str(), type.c_str());
+                      nodeId, topic, command, type);
         
         bool nodeFound = false;
-        for (int i = 0; i < peerCount; i++) {
-            if (String(peerList[i].nodeId) == nodeId) {
-                
-                // Controlla se il nodo è offline
-                if (!peerList[i].isOnline) {
-                    if (mqttConnected) {
-                        publishNodeAvailability(nodeId, "offline");
-                        publishPeerStatus(i, "NODE_STATUS_UPDATE");
-                    }
-                    DevLog.printf("Nodo %s offline: comando non inviato\n", nodeId.c_str());
-                    nodeFound = true;
-                    break;
+        int i = findPeerByNodeId(nodeId);
+        if (i >= 0) {
+            
+            // Controlla se il nodo è offline
+            if (!peerList[i].isOnline) {
+                if (mqttConnected) {
+                    publishNodeAvailability(nodeId, "offline");
                 }
+                markPeerDirty(i, PEER_DIRTY_STATE);
+                DevLog.printf("Nodo %s offline: comando non inviato\n", nodeId);
+                return;
+            }
 
-                // --- GENERIC CONTROL LOGIC ---
-                // Handle "ALL_ON" / "ALL_OFF" or group commands based on Node Configuration
-                if (topic == "CONTROL") {
-                    String cmdNorm = command; cmdNorm.trim(); cmdNorm.toUpperCase();
-                    
-                    // Check for group commands
-                    bool isGroupCommand = (cmdNorm == "ALL_ON" || cmdNorm == "ALL_OFF" || cmdNorm == "ALL_SWITCH");
-                    
-                    // Legacy compatibility for "ON"/"OFF" sent to CONTROL topic (treated as ALL)
-                    // Only applies if the node has multiple switch entities
-                    if (cmdNorm == "ON" || cmdNorm == "OFF" || cmdNorm == "TRUE" || cmdNorm == "FALSE") {
-                        // Check if it's a multi-relay node
-                        NodeEntity entities[8];
-                        int count = NodeTypeManager::getNodeConfig(peerList[i].nodeType, entities, 8);
-                        if (count > 1) isGroupCommand = true;
-                    }
-                    
-                    if (isGroupCommand) {
-                         int mapCmd = -1;
-                         if (cmdNorm == "1" || cmdNorm == "ON" || cmdNorm == "TRUE" || cmdNorm == "ALL_ON") mapCmd = 1;
-                         else if (cmdNorm == "0" || cmdNorm == "OFF" || cmdNorm == "FALSE" || cmdNorm == "ALL_OFF") mapCmd = 0;
-                         else if (cmdNorm == "2" || cmdNorm == "SWITCH" || cmdNorm == "ALL_SWITCH") mapCmd = 2;
-                         
-                         if (mapCmd != -1) {
-                            NodeEntity entities[8];
-                            int count = NodeTypeManager::getNodeConfig(peerList[i].nodeType, entities, 8);
-                            
-                            for(int k=0; k<count; k++) {
-                                // Apply only to 'switch' components
-                                if(strcmp(entities[k].component, "switch") == 0) {
-                                    String cmdStr = String(mapCmd);
-                                    espNow.send(peerList[i].mac, nodeId.c_str(), entities[k].suffix, cmdStr.c_str(), status.c_str(), type.c_str(), gateway_id);
-                                    
-                                    // Add to pending
-                                    if (pendingCommandsCount < MAX_PEERS) {
-                                        pendingCommands[pendingCommandsCount].nodeId = nodeId;
-                                        pendingCommands[pendingCommandsCount].topic = String(entities[k].suffix);
-                                        pendingCommands[pendingCommandsCount].command = cmdStr;
-                                        pendingCommands[pendingCommandsCount].sentTime = millis();
-                                        pendingCommands[pendingCommandsCount].waitingResponse = true;
-                                        pendingCommandsCount++;
-                                    }
-                                }
-                            }
-                            nodeFound = true;
-                            break;
-                         }
-                    }
-                }
-                
-                // Normalizzazione comandi ON/OFF per switch
-                String cmdNorm = command; cmdNorm.trim(); cmdNorm.toUpperCase();
-                
-                // Check if topic matches a known entity
-                NodeEntity entities[8];
-                int count = NodeTypeManager::getNodeConfig(peerList[i].nodeType, entities, 8);
-                bool entityFound = false;
+            // Normalizzazione comandi ON/OFF per switch
+            char cmdNorm[24];
+            normalizeCommand(command, cmdNorm, sizeof(cmdNorm));
+
+            // --- GENERIC CONTROL LOGIC ---
+            // Handle "ALL_ON" / "ALL_OFF" or group commands based on Node Configuration
+            if (strcmp(topic, "CONTROL") == 0) {
+                // Check for group commands
+                bool isGroupCommand = (strcmp(cmdNorm, "ALL_ON") == 0 || strcmp(cmdNorm, "ALL_OFF") == 0 || strcmp(cmdNorm, "ALL_SWITCH") == 0);
                 
-                for(int k=0; k<count; k++) {
-                    if (topic == entities[k].suffix) {
-                        entityFound = true;
-                        // Normalize specific to component type
-                        if (strcmp(entities[k].component, "switch") == 0) {
-                             if (cmdNorm == "ON" || cmdNorm == "TRUE") command = "1";
-                             else if (cmdNorm == "OFF" || cmdNorm == "FALSE") command = "0";
-                             else if (cmdNorm == "SWITCH" || cmdNorm == "TOGGLE") command = "2";
-                        }
-                        // Add other component normalizations here if needed (e.g. cover)
-                        break;
-                    }
+                // Legacy compatibility for "ON"/"OFF" sent to CONTROL topic (treated as ALL)
+                // Only applies if the node has multiple switch entities
+                if (strcmp(cmdNorm, "ON") == 0 || strcmp(cmdNorm, "OFF") == 0 || strcmp(cmdNorm, "TRUE") == 0 || strcmp(cmdNorm, "FALSE") == 0) {
+                    // Check if it's a multi-relay node
+                    int count = 0;
+                    NodeTypeManager::getEntities(peerList[i].nodeType, &count);
+                    if (count > 1) isGroupCommand = true;
                 }
                 
-                // Fallback for legacy "relay_" prefix if not found in config (safety net)
-                if (!entityFound && topic.startsWith("relay_")) {
-                    if (cmdNorm == "ON" || cmdNorm == "TRUE") command = "1";
-                    else if (cmdNorm == "OFF" || cmdNorm == "FALSE") command = "0";
-                    else if (cmdNorm == "SWITCH" || cmdNorm == "TOGGLE") command = "2";
+                if (isGroupCommand) {
+                     const char* mapCmd = NULL;
+                     if (strcmp(cmdNorm, "1") == 0 || strcmp(cmdNorm, "ON") == 0 || strcmp(cmdNorm, "TRUE") == 0 || strcmp(cmdNorm, "ALL_ON") == 0) mapCmd = "1";
+                     else if (strcmp(cmdNorm, "0") == 0 || strcmp(cmdNorm, "OFF") == 0 || strcmp(cmdNorm, "FALSE") == 0 || strcmp(cmdNorm, "ALL_OFF") == 0) mapCmd = "0";
+                     else if (strcmp(cmdNorm, "2") == 0 || strcmp(cmdNorm, "SWITCH") == 0 || strcmp(cmdNorm, "ALL_SWITCH") == 0) mapCmd = "2";
+                     
+                     if (mapCmd != NULL) {
+                        int count = 0;
+                        const NodeEntity* entities = NodeTypeManager::getEntities(peerList[i].nodeType, &count);
+                        
+                        if (sendGroupCommand(i, entities, count, mapCmd, type)) {
+                            recordCommandLatency(jsonCommandLatency, startUs);
+                            return;
+                        }
+                        
+                        for(int k=0; k<count; k++) {
+                            // Apply only to 'switch' components
+                            if(strcmp(entities[k].component, "switch") == 0) {
+                                espNow.sendReliable(peerList[i].mac, nodeId, entities[k].suffix, mapCmd, status, type, gateway_id);
+                                
+                                // Add to pending
+                                commandTrackerAdd(i, entities[k].suffix, mapCmd, status, isIdempotentCommand(mapCmd, type));
+                            }
+                        }
+                        recordCommandLatency(jsonCommandLatency, startUs);
+                        return;
+                     }
                 }
-                
-                // Invia comando standard via ESP-NOW
-                espNow.send(peerList[i].mac, nodeId.c_str(), topic.c_str(), command.c_str(), status.c_str(), type.c_str(), gateway_id);
-                DevLog.printf("Comando inviato al nodo %s via ESP-NOW\n", nodeId.c_str());
-                
-                // Aggiungi alla coda comandi in attesa
-                if (pendingCommandsCount < MAX_PEERS) {
-                    pendingCommands[pendingCommandsCount].nodeId = nodeId;
-                    pendingCommands[pendingCommandsCount].topic = topic;
-                    pendingCommands[pendingCommandsCount].command = command;
-                    pendingCommands[pendingCommandsCount].sentTime = millis();
-                    pendingCommands[pendingCommandsCount].waitingResponse = true;
-                    pendingCommandsCount++;
+            }
+            
+            // Check if topic matches a known entity
+            int count = 0;
+            const NodeEntity* entities = NodeTypeManager::getEntities(peerList[i].nodeType, &count);
+            bool entityFound = false;
+            
+            for(int k=0; k<count; k++) {
+                if (strcmp(topic, entities[k].suffix) == 0) {
+                    entityFound = true;
+                    // Normalize specific to component type
+                    if (strcmp(entities[k].component, "switch") == 0) {
+                         if (strcmp(cmdNorm, "ON") == 0 || strcmp(cmdNorm, "TRUE") == 0) command = "1";
+                         else if (strcmp(cmdNorm, "OFF") == 0 || strcmp(cmdNorm, "FALSE") == 0) command = "0";
+                         else if (strcmp(cmdNorm, "SWITCH") == 0 || strcmp(cmdNorm, "TOGGLE") == 0) command = "2";
+                    }
+                    // Add other component normalizations here if needed (e.g. cover)
+                    break;
                 }
-                
-                nodeFound = true;
-                break;
             }
+            
+            // Fallback for legacy "relay_" prefix if not found in config (safety net)
+            if (!entityFound && strncmp(topic, "relay_", 6) == 0) {
+                if (strcmp(cmdNorm, "ON") == 0 || strcmp(cmdNorm, "TRUE") == 0) command = "1";
+                else if (strcmp(cmdNorm, "OFF") == 0 || strcmp(cmdNorm, "FALSE") == 0) command = "0";
+                else if (strcmp(cmdNorm, "SWITCH") == 0 || strcmp(cmdNorm, "TOGGLE") == 0) command = "2";
+            }
+            
+            // Invia comando standard via ESP-NOW (con ACK se il nodo lo supporta)
+            espNow.sendReliable(peerList[i].mac, nodeId, topic, command, status, type, gateway_id);
+            DevLog.printf("Comando inviato al nodo %s via ESP-NOW\n", nodeId);
+            
+            // Aggiungi alla coda comandi in attesa
+            commandTrackerAdd(i, topic, command, status, isIdempotentCommand(command, type));
+            recordCommandLatency(jsonCommandLatency, startUs);
+            
+            nodeFound = true;
         }
         
         if (!nodeFound) {
-            DevLog.printf("Nodo %s non trovato nella lista peer\n", nodeId.c_str());
+            DevLog.printf("Nodo %s non trovato nella lista peer\n", nodeId);
         }
     } else {
         DevLog.println("Formato comando nodo non valido");
@@ -548,46 +721,7 @@ void processNodeCommand(const String& msgStr) {
 }
 
 void processNodeCommandTimeout() {
-    unsigned long currentTime = millis();
-    
-    for (int i = 0; i < pendingCommandsCount; i++) {
-        if (pendingCommands[i].waitingResponse && 
-            (currentTime - pendingCommands[i].sentTime > NODE_COMMAND_TIMEOUT)) {
-            
-            DevLog.printf("TIMEOUT comando per nodo %s (Topic: %s)\n", 
-                          pendingCommands[i].nodeId.c_str(), pendingCommands[i].topic.c_str());
-            
-            // Marca nodo come offline o invia notifica errore
-            // Rimuovi comando dalla lista
-            // FIX: Non marcare offline immediatamente su timeout comando singolo.
-            // Lascia che sia il heartbeat o il ping a decidere se è offline.
-            DevLog.printf("Command timeout for node %s - Command discarded (Node status preserved)\n", pendingCommands[i].nodeId.c_str());
-            
-            /* 
-            // Marca il nodo come offline e aggiorna availability immediatamente
-            for (int p = 0; p < peerCount; p++) {
-                if (String(peerList[p].nodeId) == pendingCommands[i].nodeId) {
-                    bool wasOnline = peerList[p].isOnline;
-                    peerList[p].isOnline = false;
-                    if (mqttConnected) {
-                        if (wasOnline) {
-                            publishPeerStatus(p, "NODE_STATUS_UPDATE");
-                        }
-                        publishNodeAvailability(pendingCommands[i].nodeId, "offline");
-                    }
-                    break;
-                }
-            }
-            */
-            
-            // Rimuovi dalla coda
-            for (int j = i; j < pendingCommandsCount - 1; j++) {
-                pendingCommands[j] = pendingCommands[j + 1];
-            }
-            pendingCommandsCount--;
-            i--; // Riprocessa questo indice
-        }
-    }
+    commandTrackerExpire();
 }
 
 void processOfflineCheck() {
@@ -611,16 +745,13 @@ void processOfflineCheck() {
                 nodesTimedOut++;
                 
                 // Notifica MQTT che il nodo è offline
+                markPeerDirty(i, PEER_DIRTY_ONLINE);
                 if (mqttConnected) {
-                    publishPeerStatus(i, "NODE_STATUS_UPDATE");
-                    publishNodeAvailability(String(peerList[i].nodeId), "offline");
+                    publishNodeAvailability(peerList[i].nodeId, "offline");
                 }
             }
         }
         
-        if (nodesTimedOut > 0) {
-            savePeersToLittleFS();
-        }
     }
 }
 
@@ -658,68 +789,52 @@ void processNetworkDiscovery() {
             }
             */
             
-            if (nodesMarkedOffline > 0) {
-                savePeersToLittleFS();
-            }
-            
             // Invia report discovery
             if (mqttConnected) {
-                DynamicJsonDocument discoveryDoc(1024);
-                discoveryDoc["eventType"] = "network_discovery_complete";
-                discoveryDoc["gatewayId"] = gateway_id;
-                discoveryDoc["timestamp"] = currentTime;
-                
-                JsonArray peers = discoveryDoc.createNestedArray("peers");
                 int onlineCount = 0;
-                
                 for (int i = 0; i < peerCount; i++) {
-                    JsonObject peer = peers.createNestedObject();
-                    peer["id"] = peerList[i].nodeId;
-                    peer["online"] = peerList[i].isOnline;
                     if (peerList[i].isOnline) {
                         onlineCount++;
                     }
                 }
                 
-                discoveryDoc["totalPeers"] = peerCount;
-                discoveryDoc["onlinePeers"] = onlineCount;
-                discoveryDoc["nodesMarkedOffline"] = nodesMarkedOffline;
-                
-                String jsonString;
-                serializeJson(discoveryDoc, jsonString);
-                
-                String topic = String(mqtt_topic_prefix) + "/gateway/discovery";
-                mqttClient.publish(topic.c_str(), jsonString.c_str());
+                mqttPublishJson(mqttTopic(TOPIC_GATEWAY_DISCOVERY), false, [&](MqttJsonWriter& json) {
+                    json.beginObject();
+                    json.add("eventType", "network_discovery_complete");
+                    json.add("gatewayId", gateway_id);
+                    json.add("timestamp", currentTime);
+                    
+                    json.beginArray("peers");
+                    for (int i = 0; i < peerCount; i++) {
+                        json.beginObject();
+                        json.add("id", peerList[i].nodeId);
+                        json.add("online", peerList[i].isOnline);
+                        json.endObject();
+                    }
+                    json.endArray();
+                    
+                    json.add("totalPeers", peerCount);
+                    json.add("onlinePeers", onlineCount);
+                    json.add("nodesMarkedOffline", nodesMarkedOffline);
+                    json.endObject();
+                });
                 DevLog.println("Discovery report inviato");
             }
         }
     }
 }
 
-void processCommandResponse(const char* nodeId, const char* topic, const char* status, const uint8_t* mac) {
-    // Aggiorna attributi se il messaggio è di feedback relè e contiene lo stato completo
-    if (strncmp(topic, "relay_", 6) == 0 && strlen(status) >= 4) {
-         for (int i = 0; i < peerCount; i++) {
-            if (memcmp(peerList[i].mac, mac, 6) == 0) {
-                strncpy(peerList[i].attributes, status, sizeof(peerList[i].attributes) - 1);
-                peerList[i].attributes[sizeof(peerList[i].attributes) - 1] = '\0';
-                break;
-            }
+void processCommandResponse(const char*, const char* topic, const char* status, const uint8_t* mac) {
+    // Aggiorna attributi se il messaggio è di feedback relè (o di gruppo) e contiene lo stato completo
+    if ((strncmp(topic, "relay_", 6) == 0 || strcmp(topic, DOMOTICA_GROUP_TOPIC) == 0) && strlen(status) >= 4) {
+         int i = findPeerByMac(mac);
+         if (i >= 0) {
+             strncpy(peerList[i].attributes, status, sizeof(peerList[i].attributes) - 1);
+             peerList[i].attributes[sizeof(peerList[i].attributes) - 1] = '\0';
          }
     }
 
-    // Rimuovi comando dalla lista pending
-    for (int i = 0; i < pendingCommandsCount; i++) {
-        if (pendingCommands[i].waitingResponse && 
-            pendingCommands[i].nodeId == String(nodeId) &&
-            pendingCommands[i].topic == String(topic)) {
-            
-            // Rimuovi comando spostando gli elementi successivi
-            for (int j = i; j < pendingCommandsCount - 1; j++) {
-                pendingCommands[j] = pendingCommands[j + 1];
-            }
-            pendingCommandsCount--;
-            break;
-        }
-    }
+    // Chiudi il comando in attesa (chiave: slot del peer + entità)
+    int i = findPeerByMac(mac);
+    if (i >= 0) commandTrackerResolve(i, topic);
 }
@@ -7,15 +7,24 @@
 #include <DomoticaEspNow.h>
 #include "GatewayTypes.h"
 #include "Config.h"
+#include "PeerIndex.h"
 
 // Declaration of global variables (defined in PeerHandler.cpp)
 extern Peer peerList[MAX_PEERS];
 extern int peerCount;
 
-// Pending commands queue
-extern NodeCommand pendingCommands[MAX_PEERS];
-extern int pendingCommandsCount;
-extern const unsigned long NODE_COMMAND_TIMEOUT;
+// Latenza MQTT -> radio: dalla ricezione del comando all'accodamento ESP-NOW (µs)
+struct CommandLatency {
+    uint32_t count;
+    uint32_t totalUs;
+    uint32_t maxUs;
+};
+extern CommandLatency jsonCommandLatency;   // JSON su <prefix>/nodo/command
+extern CommandLatency directCommandLatency; // Payload grezzo su <prefix>/nodo/<id>/<entity>/set
+
+// Comandi ALL_* inviati come un solo frame GROUP e frame radio risparmiati
+extern uint32_t groupCommandsSent;
+extern uint32_t groupFramesSaved;
 
 // Discovery and Ping flags
 extern bool networkDiscoveryActive;
@@ -34,7 +43,6 @@ extern unsigned long lastPeerListSendTime;
 // Function prototypes
 void savePeer(const uint8_t* mac_addr, const char* nodeId = "", const char* nodeType = "", const char* firmwareVersion = "", bool forceDiscovery = false);
 void loadPeersFromLittleFS();
-void savePeersToLittleFS();
 void printPeersList();
 String macToString(const uint8_t* mac);
 void listPeers();
@@ -43,7 +51,14 @@ void clearAllPeers();
 void removePeer(const char* macAddress);
 void checkAndSavePeers();
 void forceSavePeers();
-void processNodeCommand(const String& msgStr);
+void processNodeCommand(const byte* payload, unsigned int length);
+// Comando diretto ON/OFF/TOGGLE (cover: OPEN/CLOSE/STOP) per un'entità, senza JSON
+void processEntityCommand(const char* nodeId, const char* entity, const byte* payload, unsigned int length);
+// Comando firmware per l'azione (ON/OFF/TOGGLE/OPEN/...) sull'entità del peer i.
+// NULL se l'entità non è del nodo (*entityFound = false) o l'azione non vale per il componente.
+const char* resolveEntityCommand(int i, const char* entity, const char* action, bool* entityFound = NULL);
+// Invio ESP-NOW affidabile e tracciamento del feedback (tag: target di un batch, vedi CommandBatch)
+int sendEntityCommand(int i, const char* entity, const char* command, uint8_t tag = 0);
 void processNodeCommandTimeout();
 void processOfflineCheck();
 void processNetworkDiscovery();
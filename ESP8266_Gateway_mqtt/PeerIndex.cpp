@@ -0,0 +1,59 @@
+#include "PeerIndex.h"
+#include "PeerHandler.h"
+#include "HashUtils.h"
+
+static_assert((PEER_INDEX_SLOTS & (PEER_INDEX_SLOTS - 1)) == 0, "PEER_INDEX_SLOTS deve essere una potenza di 2");
+static_assert(PEER_INDEX_SLOTS >= 2 * MAX_PEERS, "PEER_INDEX_SLOTS troppo piccolo per MAX_PEERS");
+static_assert(MAX_PEERS < 255, "Gli slot dell'indice sono uint8_t (indice+1)");
+
+// Indice+1 nel peerList, 0 = slot vuoto
+static uint8_t macSlots[PEER_INDEX_SLOTS];
+static uint8_t idSlots[PEER_INDEX_SLOTS];
+
+static void insertSlot(uint8_t* slots, uint32_t hash, int index) {
+    uint32_t slot = hash & (PEER_INDEX_SLOTS - 1);
+    while (slots[slot] != 0) {
+        slot = (slot + 1) & (PEER_INDEX_SLOTS - 1);
+    }
+    slots[slot] = index + 1;
+}
+
+void indexPeer(int index) {
+    insertSlot(macSlots, fnv1a(peerList[index].mac, 6), index);
+    if (peerList[index].nodeId[0] != '\0') {
+        insertSlot(idSlots, fnv1a(peerList[index].nodeId), index);
+    }
+}
+
+void rebuildPeerIndex() {
+    memset(macSlots, 0, sizeof(macSlots));
+    memset(idSlots, 0, sizeof(idSlots));
+    // Inserimento in ordine: a parità di nodeId vince il peer con indice minore
+    for (int i = 0; i < peerCount; i++) {
+        indexPeer(i);
+    }
+}
+
+int findPeerByMac(const uint8_t* mac) {
+    uint32_t slot = fnv1a(mac, 6) & (PEER_INDEX_SLOTS - 1);
+    for (int probe = 0; probe < PEER_INDEX_SLOTS; probe++) {
+        uint8_t ref = macSlots[slot];
+        if (ref == 0) return -1;
+        if (ref <= peerCount && memcmp(peerList[ref - 1].mac, mac, 6) == 0) return ref - 1;
+        slot = (slot + 1) & (PEER_INDEX_SLOTS - 1);
+    }
+    return -1;
+}
+
+int findPeerByNodeId(const char* nodeId) {
+    if (nodeId == NULL || nodeId[0] == '\0') return -1;
+
+    uint32_t slot = fnv1a(nodeId) & (PEER_INDEX_SLOTS - 1);
+    for (int probe = 0; probe < PEER_INDEX_SLOTS; probe++) {
+        uint8_t ref = idSlots[slot];
+        if (ref == 0) return -1;
+        if (ref <= peerCount && strcmp(peerList[ref - 1].nodeId, nodeId) == 0) return ref - 1;
+        slot = (slot + 1) & (PEER_INDEX_SLOTS - 1);
+    }
+    return -1;
+}
@@ -0,0 +1,25 @@
+#ifndef PEER_INDEX_H
+#define PEER_INDEX_H
+
+#include <Arduino.h>
+#include "GatewayTypes.h"
+
+// --- INDICE PEER --- //
+// Tabelle hash a indirizzamento aperto (nessuna allocazione heap) che mappano
+// MAC -> indice in peerList e nodeId -> indice in peerList.
+// Ogni lookup verifica la chiave sul peerList, quindi una collisione non può
+// mai restituire il peer sbagliato.
+
+#define PEER_INDEX_SLOTS 256 // Potenza di 2, almeno 2x MAX_PEERS
+
+// Ricostruisce entrambe le tabelle da peerList (dopo rimozioni, load, clear, rename)
+void rebuildPeerIndex();
+
+// Aggiunge un peer appena inserito in coda a peerList
+void indexPeer(int index);
+
+// Restituiscono l'indice in peerList oppure -1
+int findPeerByMac(const uint8_t* mac);
+int findPeerByNodeId(const char* nodeId);
+
+#endif
@@ -0,0 +1,331 @@
+#include "PeerStore.h"
+#include "PeerHandler.h"
+#include "HashUtils.h"
+#include "WebLog.h"
+#include <LittleFS.h>
+
+#define PEERSTORE_MAGIC   0x31535044u  // "DPS1"
+#define PEERSTORE_FORMAT  1
+
+uint32_t peerStoreWrites = 0;
+uint32_t peerStoreBytes = 0;
+uint32_t peerStoreCompactions = 0;
+uint16_t peerStoreJournalRecords = 0;
+
+// Campi persistiti di un peer (lo stato runtime resta fuori)
+struct PeerStoreRecord {
+    uint8_t mac[6];
+    char nodeId[20];
+    char nodeType[20];
+    char firmwareVersion[20];
+    char attributes[50];
+    uint32_t discoveryHash;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t count;
+    uint32_t generation;
+    uint32_t crc;               // CRC32 dei record che seguono
+};
+
+struct JournalEntry {
+    uint32_t generation;        // Generazione dello snapshot a cui si applica
+    PeerStoreRecord record;
+    uint32_t crc;               // CRC32 di generation + record
+};
+
+static uint32_t generation = 0;
+static bool dirty = false;
+static bool compactPending = false;
+static unsigned long dirtySince = 0;
+static unsigned long lastMarkAt = 0;
+
+// --- CONVERSIONI --- //
+static void toRecord(const Peer& peer, PeerStoreRecord& record) {
+    memset(&record, 0, sizeof(record));
+    memcpy(record.mac, peer.mac, sizeof(record.mac));
+    memcpy(record.nodeId, peer.nodeId, sizeof(record.nodeId));
+    memcpy(record.nodeType, peer.nodeType, sizeof(record.nodeType));
+    memcpy(record.firmwareVersion, peer.firmwareVersion, sizeof(record.firmwareVersion));
+    memcpy(record.attributes, peer.attributes, sizeof(record.attributes));
+    record.discoveryHash = peer.discoveryHash;
+}
+
+// Applica un record alla tabella: aggiorna il peer con lo stesso MAC o lo aggiunge
+static void applyRecord(const PeerStoreRecord& record) {
+    int i = -1;
+    for (int k = 0; k < peerCount; k++) {
+        if (memcmp(peerList[k].mac, record.mac, sizeof(record.mac)) == 0) {
+            i = k;
+            break;
+        }
+    }
+    if (i < 0) {
+        if (peerCount >= MAX_PEERS) return;
+        i = peerCount++;
+        memset(&peerList[i], 0, sizeof(Peer));
+        memcpy(peerList[i].mac, record.mac, sizeof(record.mac));
+    }
+
+    Peer& peer = peerList[i];
+    memcpy(peer.nodeId, record.nodeId, sizeof(peer.nodeId));
+    memcpy(peer.nodeType, record.nodeType, sizeof(peer.nodeType));
+    memcpy(peer.firmwareVersion, record.firmwareVersion, sizeof(peer.firmwareVersion));
+    memcpy(peer.attributes, record.attributes, sizeof(peer.attributes));
+    peer.nodeId[sizeof(peer.nodeId) - 1] = '\0';
+    peer.nodeType[sizeof(peer.nodeType) - 1] = '\0';
+    peer.firmwareVersion[sizeof(peer.firmwareVersion) - 1] = '\0';
+    peer.attributes[sizeof(peer.attributes) - 1] = '\0';
+    peer.discoveryHash = record.discoveryHash;
+
+    // Assume online on boot to prevent "Unavailable" in HA
+    peer.isOnline = true;
+    peer.lastSeen = millis();
+}
+
+static uint32_t entryCrc(const JournalEntry& entry) {
+    return crc32(&entry, offsetof(JournalEntry, crc));
+}
+
+// --- CARICAMENTO --- //
+// Lo snapshot corrotto esce di scena prima di qualunque scrittura: la prossima
+// compattazione crea un file nuovo invece di sovrascrivere l'unica copia dei dati
+static void setAsideSnapshot() {
+    LittleFS.remove(PEERSTORE_BAD_FILE);
+    if (!LittleFS.rename(PEERSTORE_SNAPSHOT_FILE, PEERSTORE_BAD_FILE)) {
+        DevLog.println("❌ PeerStore: impossibile spostare lo snapshot corrotto");
+    }
+}
+
+PeerStoreLoadResult peerStoreLoad() {
+    File f = LittleFS.open(PEERSTORE_SNAPSHOT_FILE, "r");
+    if (!f) return PEERSTORE_MISSING;
+
+    peerCount = 0;
+    SnapshotHeader header;
+    if (f.read((uint8_t*) &header, sizeof(header)) != sizeof(header) ||
+        header.magic != PEERSTORE_MAGIC || header.format != PEERSTORE_FORMAT) {
+        // Senza header non si conosce la generazione: nemmeno il journal è utilizzabile
+        f.close();
+        DevLog.printf("⚠️ PeerStore: header snapshot non valido, spostato in %s\n", PEERSTORE_BAD_FILE);
+        setAsideSnapshot();
+        compactPending = true;
+        dirty = true;
+        dirtySince = lastMarkAt = millis();
+        return PEERSTORE_CORRUPT;
+    }
+
+    // Record letti uno alla volta, CRC calcolato in streaming
+    bool truncated = false;
+    uint32_t crc = 0;
+    PeerStoreRecord record;
+    for (uint16_t n = 0; n < header.count; n++) {
+        if (f.read((uint8_t*) &record, sizeof(record)) != sizeof(record)) {
+            truncated = true;
+            break;
+        }
+        crc = crc32(&record, sizeof(record), crc);
+        applyRecord(record);
+    }
+    f.close();
+
+    bool corrupt = truncated || crc != header.crc;
+    if (corrupt) {
+        // Troncato: i record completi prima del taglio sono integri e restano.
+        // CRC errato a lunghezza piena: non si sa quale record è rovinato, nessuno è affidabile.
+        if (!truncated) peerCount = 0;
+        DevLog.printf("⚠️ PeerStore: snapshot %s, %d peer recuperati, originale in %s\n",
+                      truncated ? "troncato" : "con CRC errato", peerCount, PEERSTORE_BAD_FILE);
+        setAsideSnapshot();
+    }
+    generation = header.generation;
+
+    // Replay del journal: si ferma al primo record incompleto o corrotto
+    peerStoreJournalRecords = 0;
+    bool journalBroken = false;
+    File j = LittleFS.open(PEERSTORE_JOURNAL_FILE, "r");
+    if (j) {
+        JournalEntry entry;
+        while (j.available() > 0) {
+            if (j.read((uint8_t*) &entry, sizeof(entry)) != sizeof(entry) || entry.crc != entryCrc(entry)) {
+                journalBroken = true;
+                break;
+            }
+            // Journal di una generazione precedente (compattazione interrotta): già nello snapshot
+            if (entry.generation != generation) {
+                journalBroken = true;
+                break;
+            }
+            applyRecord(entry.record);
+            peerStoreJournalRecords++;
+        }
+        j.close();
+    }
+
+    // In coda a un record rotto non si può appendere, e dopo uno snapshot corrotto il
+    // journal va consolidato: si riparte da uno snapshot pulito (con la write-behind)
+    if (journalBroken || corrupt) {
+        if (journalBroken) {
+            DevLog.printf("⚠️ PeerStore: journal interrotto dopo %u record, compattazione\n", peerStoreJournalRecords);
+        }
+        compactPending = true;
+        dirty = true;
+        dirtySince = lastMarkAt = millis();
+    }
+
+    DevLog.printf("💾 PeerStore: %d peer (snapshot gen %lu + %u record di journal)\n",
+                  peerCount, (unsigned long) generation, peerStoreJournalRecords);
+    return corrupt ? PEERSTORE_CORRUPT : PEERSTORE_LOADED;
+}
+
+// --- SEGNALAZIONI DAI PERCORSI CALDI --- //
+static void markPending() {
+    unsigned long now = millis();
+    if (!dirty) dirtySince = now;
+    lastMarkAt = now;
+    dirty = true;
+}
+
+void peerStoreMarkDirty(int index) {
+    if (index < 0 || index >= peerCount) return;
+    peerList[index].storeDirty = true;
+    markPending();
+}
+
+void peerStoreMarkRemoved() {
+    compactPending = true;
+    markPending();
+}
+
+// --- SCRITTURA --- //
+bool peerStoreCompact() {
+    File f = LittleFS.open(PEERSTORE_TMP_FILE, "w");
+    if (!f) {
+        DevLog.println("❌ PeerStore: impossibile scrivere lo snapshot");
+        return false;
+    }
+
+    SnapshotHeader header;
+    header.magic = PEERSTORE_MAGIC;
+    header.format = PEERSTORE_FORMAT;
+    header.count = peerCount;
+    header.generation = generation + 1;
+    header.crc = 0;
+
+    // Header provvisorio, CRC calcolato durante la scrittura dei record
+    bool ok = f.write((const uint8_t*) &header, sizeof(header)) == sizeof(header);
+    PeerStoreRecord record;
+    for (int i = 0; ok && i < peerCount; i++) {
+        toRecord(peerList[i], record);
+        header.crc = crc32(&record, sizeof(record), header.crc);
+        ok = f.write((const uint8_t*) &record, sizeof(record)) == sizeof(record);
+    }
+    ok = ok && f.seek(0) && f.write((const uint8_t*) &header, sizeof(header)) == sizeof(header);
+    f.close();
+
+    if (!ok) {
+        LittleFS.remove(PEERSTORE_TMP_FILE);
+        DevLog.println("❌ PeerStore: scrittura snapshot fallita");
+        return false;
+    }
+
+    // Il rename sostituisce lo snapshot in modo atomico; il journal vecchio ha una
+    // generazione diversa e viene ignorato anche se la rimozione non avviene
+    if (!LittleFS.rename(PEERSTORE_TMP_FILE, PEERSTORE_SNAPSHOT_FILE)) {
+        LittleFS.remove(PEERSTORE_TMP_FILE);
+        DevLog.println("❌ PeerStore: rename snapshot fallito");
+        return false;
+    }
+    LittleFS.remove(PEERSTORE_JOURNAL_FILE);
+
+    generation = header.generation;
+    peerStoreJournalRecords = 0;
+    peerStoreWrites++;
+    peerStoreBytes += 2 * sizeof(header) + (uint32_t) peerCount * sizeof(PeerStoreRecord);   // Header scritto due volte
+    peerStoreCompactions++;
+
+    for (int i = 0; i < peerCount; i++) {
+        peerList[i].storeDirty = false;
+    }
+    compactPending = false;
+    dirty = false;
+    return true;
+}
+
+static bool appendJournal() {
+    File f = LittleFS.open(PEERSTORE_JOURNAL_FILE, "a");
+    if (!f) return false;
+
+    JournalEntry entry;
+    uint32_t written = 0;
+    bool ok = true;
+    for (int i = 0; ok && i < peerCount; i++) {
+        if (!peerList[i].storeDirty) continue;
+        entry.generation = generation;
+        toRecord(peerList[i], entry.record);
+        entry.crc = entryCrc(entry);
+        ok = f.write((const uint8_t*) &entry, sizeof(entry)) == sizeof(entry);
+        if (ok) {
+            peerList[i].storeDirty = false;
+            peerStoreJournalRecords++;
+            written += sizeof(entry);
+        }
+    }
+    f.close();
+
+    if (written > 0) {
+        peerStoreWrites++;
+        peerStoreBytes += written;
+    }
+    return ok;
+}
+
+void peerStoreFlush() {
+    if (!dirty) return;
+
+    int pending = 0;
+    for (int i = 0; i < peerCount; i++) {
+        if (peerList[i].storeDirty) pending++;
+    }
+
+    // Journal lungo o tabella ridotta: lo snapshot costa meno del replay al boot
+    if (compactPending || peerStoreJournalRecords + pending > PEERSTORE_JOURNAL_MAX) {
+        peerStoreCompact();
+        return;
+    }
+    if (appendJournal()) {
+        dirty = false;
+    } else {
+        // Append fallito a metà: il prossimo giro riscrive tutto da capo
+        compactPending = true;
+    }
+}
+
+void peerStoreLoop() {
+    if (!dirty) return;
+    unsigned long now = millis();
+    if (now - lastMarkAt >= PEERSTORE_WRITE_DELAY_MS || now - dirtySince >= PEERSTORE_MAX_DELAY_MS) {
+        peerStoreFlush();
+        // Se la scrittura fallisce si riprova dopo un'altra attesa, non a ogni giro
+        if (dirty) dirtySince = lastMarkAt = now;
+    }
+}
+
+void peerStoreClear() {
+    LittleFS.remove(PEERSTORE_SNAPSHOT_FILE);
+    LittleFS.remove(PEERSTORE_JOURNAL_FILE);
+    LittleFS.remove(PEERSTORE_TMP_FILE);
+    generation = 0;
+    peerStoreJournalRecords = 0;
+    // Senza snapshot il journal non verrebbe letto: la prossima scrittura ne crea uno
+    compactPending = true;
+    dirty = false;
+}
+
+uint32_t peerStoreBytesPerHour() {
+    unsigned long uptime = millis();
+    if (uptime < 60000UL) return peerStoreBytes;
+    return (uint32_t) (((uint64_t) peerStoreBytes * 3600000ULL) / uptime);
+}
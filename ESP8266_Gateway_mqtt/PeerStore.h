@@ -0,0 +1,52 @@
+#ifndef PEER_STORE_H
+#define PEER_STORE_H
+
+#include <Arduino.h>
+#include "GatewayTypes.h"
+
+// --- PERSISTENZA PEER: SNAPSHOT + JOURNAL --- //
+// La tabella peer è salvata in binario: uno snapshot completo (/peers.bin) e un journal
+// in append (/peers.jnl) con un record per ogni peer modificato, entrambi con CRC32.
+// I percorsi caldi segnano solo il peer (peerStoreMarkDirty): peerStoreLoop() scrive i
+// record dopo PEERSTORE_WRITE_DELAY_MS senza nuove modifiche (al massimo dopo
+// PEERSTORE_MAX_DELAY_MS) e riscrive lo snapshot quando il journal supera
+// PEERSTORE_JOURNAL_MAX record o dopo una rimozione.
+// Al boot: snapshot + replay del journal della stessa generazione, fino al primo record
+// non valido (scrittura interrotta). Lo stato online non è persistito.
+// Uno snapshot illeggibile non viene mai sovrascritto: è spostato in PEERSTORE_BAD_FILE,
+// si tengono i record completi prima di un troncamento e il journal (record con CRC
+// proprio) viene comunque riapplicato; il nuovo snapshot arriva con la write-behind.
+
+#define PEERSTORE_SNAPSHOT_FILE  "/peers.bin"
+#define PEERSTORE_JOURNAL_FILE   "/peers.jnl"
+#define PEERSTORE_TMP_FILE       "/peers.tmp"
+#define PEERSTORE_BAD_FILE       "/peers.bad"    // Ultimo snapshot corrotto, per il recupero manuale
+#define PEERSTORE_WRITE_DELAY_MS 5000    // Quiete prima di scrivere: una raffica = una scrittura
+#define PEERSTORE_MAX_DELAY_MS   30000   // Scrittura garantita anche sotto modifiche continue
+#define PEERSTORE_JOURNAL_MAX    64      // Record di journal oltre i quali si compatta
+
+enum PeerStoreLoadResult : uint8_t {
+    PEERSTORE_LOADED = 0,
+    PEERSTORE_MISSING,      // Nessuno snapshot: primo avvio o migrazione da peers.json
+    PEERSTORE_CORRUPT       // Snapshot spostato in PEERSTORE_BAD_FILE, peerList con quanto recuperato
+};
+
+// Carica snapshot + journal in peerList
+PeerStoreLoadResult peerStoreLoad();
+
+void peerStoreMarkDirty(int index);
+void peerStoreMarkRemoved();            // Tabella ridotta: alla prossima scrittura si compatta
+void peerStoreLoop();
+void peerStoreFlush();                  // Scrive subito quanto in attesa (prima di un riavvio)
+bool peerStoreCompact();                // Snapshot dell'intera tabella, journal azzerato
+void peerStoreClear();                  // Cancella snapshot e journal
+
+extern uint32_t peerStoreWrites;        // Scritture su flash (append e snapshot)
+extern uint32_t peerStoreBytes;         // Byte scritti in totale
+extern uint32_t peerStoreCompactions;
+extern uint16_t peerStoreJournalRecords;
+
+// Byte scritti per ora, in media dall'avvio
+uint32_t peerStoreBytesPerHour();
+
+#endif
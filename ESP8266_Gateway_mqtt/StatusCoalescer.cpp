@@ -0,0 +1,49 @@
+#include "StatusCoalescer.h"
+#include "PeerHandler.h"
+#include "MqttHandler.h"
+#include "Config.h"
+
+uint32_t statusPublished = 0;
+uint32_t statusSuppressed = 0;
+
+static bool anyDirty = false;
+
+// Il command pubblicato riflette il motivo più significativo tra quelli accumulati
+static const char* statusCommandFor(uint8_t reasons) {
+    if (reasons & PEER_DIRTY_NEW) return "NODE_NEW";
+    if (reasons & PEER_DIRTY_UPDATE) return "NODE_UPDATE";
+    if (reasons & PEER_DIRTY_VERSION) return "NODE_VERSION_UPDATE";
+    if (reasons & (PEER_DIRTY_STATE | PEER_DIRTY_ONLINE)) return "NODE_STATUS_UPDATE";
+    return "NODE_REFRESH";
+}
+
+void markPeerDirty(int index, uint8_t reasons) {
+    if (index < 0 || index >= peerCount) return;
+
+    if (peerList[index].statusDirty != 0) statusSuppressed++;
+    peerList[index].statusDirty |= reasons;
+    anyDirty = true;
+}
+
+void flushPeerStatus() {
+    // Da disconnessi i flag restano: si pubblica alla riconnessione
+    if (!anyDirty || !mqttConnected) return;
+
+    unsigned long now = millis();
+    anyDirty = false;
+    for (int i = 0; i < peerCount; i++) {
+        Peer& peer = peerList[i];
+        if (peer.statusDirty == 0) continue;
+
+        bool urgent = (peer.statusDirty & PEER_DIRTY_URGENT) != 0;
+        if (!urgent && peer.statusPublishedAt != 0 && now - peer.statusPublishedAt < status_coalesce_ms) {
+            anyDirty = true; // Ancora nella finestra: riprova al prossimo giro
+            continue;
+        }
+
+        publishPeerStatus(i, statusCommandFor(peer.statusDirty));
+        peer.statusDirty = 0;
+        peer.statusPublishedAt = now;
+        statusPublished++;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef STATUS_COALESCER_H
+#define STATUS_COALESCER_H
+
+#include <Arduino.h>
+
+// --- COALESCENZA STATUS PEER --- //
+// I gestori non pubblicano /nodo/status direttamente: marcano il peer con il motivo
+// e flushPeerStatus() (dal loop) pubblica al massimo un messaggio per peer ogni
+// status_coalesce_ms. Le transizioni online/offline non attendono la finestra.
+
+#define PEER_DIRTY_STATE     0x01   // Attributi / stato del nodo
+#define PEER_DIRTY_ONLINE    0x02   // Transizione di availability (urgente)
+#define PEER_DIRTY_VERSION   0x04   // Nuova versione firmware
+#define PEER_DIRTY_NEW       0x08   // Primo REGISTER
+#define PEER_DIRTY_UPDATE    0x10   // Dati di registrazione cambiati
+#define PEER_DIRTY_REFRESH   0x20   // REGISTER senza cambiamenti
+
+#define PEER_DIRTY_URGENT    (PEER_DIRTY_ONLINE)
+
+void markPeerDirty(int index, uint8_t reasons);
+void flushPeerStatus();
+
+extern uint32_t statusPublished;    // Messaggi /nodo/status pubblicati dal coalescer
+extern uint32_t statusSuppressed;   // Richieste assorbite da un publish già in attesa
+
+#endif
@@ -5,6 +5,9 @@
 #include "EspNowHandler.h"
 #include "NodeTypeManager.h"
 #include "HaDiscovery.h"
+#include "MqttRepublish.h"
+#include "PeerStore.h"
+#include "NodeFanout.h"
 #include <ESP8266WiFi.h>
 #include <LittleFS.h>
 #include <ArduinoJson.h>
@@ -179,6 +182,7 @@ void setupWebRoutes() {
              printGatewayStatus();
         } else if (cmd == "restart") {
              DevLog.println("Rebooting...");
+             forceSavePeers();
              configServer.send(200, "text/plain", "Rebooting...");
              delay(1000);
              ESP.restart();
@@ -384,9 +388,7 @@ void handleRoot() {
     if (now > 100000) {
         struct tm * timeinfo = localtime(&now);
         char buf[20];
-        snprintf(buf, sizeof(buf), "%02d:%02d:%02d %02d/%02d/%04d", 
-                 timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec,
-                 timeinfo->tm_mday, timeinfo->tm_mon + 1, timeinfo->tm_year + 1900);
+        strftime(buf, sizeof(buf), "%H:%M:%S %d/%m/%Y", timeinfo);
         timeStr = String(buf);
     }
     configServer.sendContent("<div><b>🕒 Orario:</b> " + timeStr + "</div>");
@@ -796,12 +798,14 @@ void handleApiNodesList() {
 void handleApiNodeRestart() {
     if (!configServer.hasArg("nodeId")) { configServer.send(400, "application/json", "{\"error\":\"Missing nodeId\"}"); return; }
     String nodeId = configServer.arg("nodeId");
-    for (int i = 0; i < peerCount; i++) {
-        if (String(peerList[i].nodeId) == nodeId) {
-            espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESTART", "", "COMMAND", gateway_id);
-            configServer.send(200, "application/json", "{\"status\":\"ok\",\"message\":\"Restart command sent\"}");
+    int i = findPeerByNodeId(nodeId.c_str());
+    if (i >= 0) {
+        if (!espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESTART", "", "COMMAND", gateway_id)) {
+            configServer.send(503, "application/json", "{\"error\":\"Radio queue full\"}");
             return;
         }
+        configServer.send(200, "application/json", "{\"status\":\"ok\",\"message\":\"Restart command sent\"}");
+        return;
     }
     configServer.send(404, "application/json", "{\"error\":\"Node not found\"}");
 }
@@ -809,12 +813,14 @@ void handleApiNodeRestart() {
 void handleApiNodeReset() {
     if (!configServer.hasArg("nodeId")) { configServer.send(400, "application/json", "{\"error\":\"Missing nodeId\"}"); return; }
     String nodeId = configServer.arg("nodeId");
-    for (int i = 0; i < peerCount; i++) {
-        if (String(peerList[i].nodeId) == nodeId) {
-            espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESET_WIFI", "", "COMMAND", gateway_id);
-            configServer.send(200, "application/json", "{\"status\":\"ok\",\"message\":\"Reset WiFi command sent\"}");
+    int i = findPeerByNodeId(nodeId.c_str());
+    if (i >= 0) {
+        if (!espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "RESET_WIFI", "", "COMMAND", gateway_id)) {
+            configServer.send(503, "application/json", "{\"error\":\"Radio queue full\"}");
             return;
         }
+        configServer.send(200, "application/json", "{\"status\":\"ok\",\"message\":\"Reset WiFi command sent\"}");
+        return;
     }
     configServer.send(404, "application/json", "{\"error\":\"Node not found\"}");
 }
@@ -822,12 +828,14 @@ void handleApiNodeReset() {
 void handleApiPingNode() {
     if (!configServer.hasArg("nodeId")) { configServer.send(400, "application/json", "{\"error\":\"Missing nodeId\"}"); return; }
     String targetNodeId = configServer.arg("nodeId");
-    for (int i = 0; i < peerCount; i++) {
-        if (String(peerList[i].nodeId) == targetNodeId) {
-            espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "PING", "REQUEST", "COMMAND", gateway_id);
-            configServer.send(200, "application/json", "{\"status\":\"ping_sent\"}");
+    int i = findPeerByNodeId(targetNodeId.c_str());
+    if (i >= 0) {
+        if (!espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "PING", "REQUEST", "COMMAND", gateway_id)) {
+            configServer.send(503, "application/json", "{\"error\":\"Radio queue full\"}");
             return;
         }
+        configServer.send(200, "application/json", "{\"status\":\"ping_sent\"}");
+        return;
     }
     configServer.send(404, "application/json", "{\"error\":\"Node not found\"}");
 }
@@ -835,16 +843,15 @@ void handleApiPingNode() {
 void handleApiNodeStatus() {
     if (!configServer.hasArg("nodeId")) { configServer.send(400, "application/json", "{\"error\":\"Missing nodeId\"}"); return; }
     String targetNodeId = configServer.arg("nodeId");
-    for (int i = 0; i < peerCount; i++) {
-        if (String(peerList[i].nodeId) == targetNodeId) {
-            String json = "{";
-            json += "\"id\":\"" + String(peerList[i].nodeId) + "\",";
-            json += "\"online\":" + String(peerList[i].isOnline ? "true" : "false") + ",";
-            json += "\"version\":\"" + String(peerList[i].firmwareVersion) + "\"";
-            json += "}";
-            configServer.send(200, "application/json", json);
-            return;
-        }
+    int i = findPeerByNodeId(targetNodeId.c_str());
+    if (i >= 0) {
+        String json = "{";
+        json += "\"id\":\"" + String(peerList[i].nodeId) + "\",";
+        json += "\"online\":" + String(peerList[i].isOnline ? "true" : "false") + ",";
+        json += "\"version\":\"" + String(peerList[i].firmwareVersion) + "\"";
+        json += "}";
+        configServer.send(200, "application/json", json);
+        return;
     }
     configServer.send(404, "application/json", "{\"error\":\"Node not found\"}");
 }
@@ -862,18 +869,25 @@ void handleApiForceHaDiscovery() {
         targetNodeId = configServer.arg("nodeId");
     }
 
+    // Tutti i peer: job a passi dal loop, la risposta HTTP non attende i publish
+    if (targetNodeId.length() == 0 && peerCount > 0) {
+        startRepublish("FORCE_DISCOVERY", REPUBLISH_DISCOVERY_FORCE);
+        configServer.send(200, "application/json", "{\"status\":\"ok\", \"count\":" + String(peerCount) + "}");
+        return;
+    }
+
     int count = 0;
-    for (int i = 0; i < peerCount; i++) {
-        if (targetNodeId.length() == 0 || String(peerList[i].nodeId) == targetNodeId) {
-            // Force full discovery
-            HaDiscovery::publishDiscovery(mqttClient, peerList[i], mqtt_topic_prefix);
-            HaDiscovery::publishDashboardConfig(mqttClient, peerList[i], mqtt_topic_prefix);
-            
-            // Force status update to ensure availability is online
-            publishPeerStatus(i, "FORCE_DISCOVERY");
-            
-            count++;
+    int i = findPeerByNodeId(targetNodeId.c_str());
+    if (i >= 0) {
+        // Force full discovery (ignora l'impronta, la aggiorna se cambiata)
+        if (HaDiscovery::refreshDiscovery(mqttClient, peerList[i], mqtt_topic_prefix, true)) {
+            peerStoreMarkDirty(i);
         }
+        
+        // Force status update to ensure availability is online
+        publishPeerStatus(i, "FORCE_DISCOVERY");
+        
+        count++;
     }
 
     if (count > 0) {
@@ -891,16 +905,8 @@ void handleNetworkDiscovery() {
 }
 
 void handlePingNetwork() {
-    pingNetworkActive = true;
-    pingNetworkStartTime = millis();
-    pingResponseCount = 0;
-    memset(pingResponseReceived, 0, sizeof(pingResponseReceived));
-    // Copy peers to ping list
-    for (int i = 0; i < peerCount; i++) {
-        memcpy(pingedNodesMac[i], peerList[i].mac, 6);
-        espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "PING", "REQUEST", "COMMAND", gateway_id);
-    }
-    pingResponseCount = peerCount;
+    // Stesso job del comando MQTT PING_NETWORK: i PING partono a passi dal loop
+    startPingNetwork();
     configServer.send(200, "application/json", "{\"message\":\"Ping network started\"}");
 }
 
@@ -921,6 +927,7 @@ void handleFactoryReset() {
 }
 
 void handleReboot() {
+    forceSavePeers();
     configServer.send(200, "text/plain", "Rebooting...");
     delay(1000);
     ESP.restart();
@@ -976,36 +983,38 @@ void handleTriggerOta() {
     globalOtaStatus.progress = 0;
 
     // Find peer
-    for (int i = 0; i < peerCount; i++) {
-        if (String(peerList[i].nodeId) == nodeId) {
-            // Construct payload: SSID|PASS|URL
-            String ssid = WiFi.SSID();
-            String pass = WiFi.psk();
-            
-            // Fallback to saved config if WiFi.SSID/PSK is empty
-            if (ssid.length() == 0) ssid = String(saved_wifi_ssid);
-            if (pass.length() == 0) pass = String(saved_wifi_password);
-            
-            // Ultimo tentativo: usa la password globale hardcoded se disponibile
-            if (pass.length() == 0 && wifi_password != nullptr) {
-                 pass = String(wifi_password);
-            }
+    int i = findPeerByNodeId(nodeId.c_str());
+    if (i >= 0) {
+        // Construct payload: SSID|PASS|URL
+        String ssid = WiFi.SSID();
+        String pass = WiFi.psk();
+        
+        // Fallback to saved config if WiFi.SSID/PSK is empty
+        if (ssid.length() == 0) ssid = String(saved_wifi_ssid);
+        if (pass.length() == 0) pass = String(saved_wifi_password);
+        
+        // Ultimo tentativo: usa la password globale hardcoded se disponibile
+        if (pass.length() == 0 && wifi_password != nullptr) {
+             pass = String(wifi_password);
+        }
 
-            String payload = ssid + "|" + pass + "|" + url;
-            
-            // Mask password for debug log
-            String maskedPass = (pass.length() > 0) ? (String(pass.charAt(0)) + "****" + String(pass.charAt(pass.length()-1))) : "EMPTY";
+        String payload = ssid + "|" + pass + "|" + url;
+        
+        // Mask password for debug log
+        String maskedPass = (pass.length() > 0) ? (String(pass.charAt(0)) + "****" + String(pass.charAt(pass.length()-1))) : "EMPTY";
 
-            DevLog.printf("[OTA] Triggering OTA for %s\n", nodeId.c_str());
-            DevLog.printf("[OTA] Payload: SSID=%s, PASS=%s (Len:%d), URL=%s\n", ssid.c_str(), maskedPass.c_str(), pass.length(), url.c_str());
-            DevLog.printf("[OTA] Gateway ID used for command: '%s' (Address: %p)\n", gateway_id, gateway_id);
+        DevLog.printf("[OTA] Triggering OTA for %s\n", nodeId.c_str());
+        DevLog.printf("[OTA] Payload: SSID=%s, PASS=%s (Len:%d), URL=%s\n", ssid.c_str(), maskedPass.c_str(), pass.length(), url.c_str());
+        DevLog.printf("[OTA] Gateway ID used for command: '%s' (Address: %p)\n", gateway_id, gateway_id);
 
-            // Send OTA_UPDATE command with payload
-            espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "OTA_UPDATE", payload.c_str(), "COMMAND", gateway_id);
-            
-            configServer.send(200, "application/json", "{\"status\":\"ok\"}");
+        // Send OTA_UPDATE command with payload
+        if (!espNow.send(peerList[i].mac, peerList[i].nodeId, "CONTROL", "OTA_UPDATE", payload.c_str(), "COMMAND", gateway_id)) {
+            configServer.send(503, "application/json", "{\"error\":\"Radio queue full\"}");
             return;
         }
+        
+        configServer.send(200, "application/json", "{\"status\":\"ok\"}");
+        return;
     }
     configServer.send(404, "text/plain", "Node not found");
 }
@@ -1013,6 +1022,7 @@ void handleTriggerOta() {
 void handleGatewayUpdate() {
     HTTPUpload& upload = configServer.upload();
     if (upload.status == UPLOAD_FILE_START) {
+        forceSavePeers();
         otaRunning = true; // Stop other tasks
         WiFiUDP::stopAll();
         uint32_t maxSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
@@ -0,0 +1 @@
+-DDOMOTICA_PROTO_PEERS=100
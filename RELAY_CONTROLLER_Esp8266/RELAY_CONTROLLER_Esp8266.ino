@@ -552,6 +552,11 @@ void OnDataRecv(uint8_t* mac, uint8_t* incomingData, uint8_t len) {
                 saveGatewayMac();
                 
                 if (!espNow.hasPeer(gatewayMac)) { espNow.addPeer(gatewayMac); }
+
+                // Negoziazione protocollo: il gateway annuncia il formato compatto nello status.
+                // Un gateway datato risponde solo "AVAILABLE" e resta in formato legacy.
+                bool compact = (strstr(receivedData.status, DOMOTICA_PROTO_TOKEN) != NULL);
+                DomoticaEspNow::setPeerProtocol(gatewayMac, compact ? DOMOTICA_PROTO_COMPACT : DOMOTICA_PROTO_LEGACY);
     
                 sendGatewayRegistration();
             }
@@ -697,6 +702,28 @@ void handleControlCommand(uint8_t* senderMac, struct_message* msg) {
             }
         }
     }
+    // Comando di gruppo dal gateway: più canali con un solo frame.
+    // Prima si calcola il nuovo stato di tutti i canali, poi si scrivono i pin in blocco.
+    else if (strcmp(msg->topic, DOMOTICA_GROUP_TOPIC) == 0) {
+        DomoticaGroupCommand group;
+        if (domoticaDecodeGroup(msg->command, msg->status, &group)) {
+            bool newStates[MAX_RELAYS];
+            for (int i = 0; i < MAX_RELAYS; i++) {
+                newStates[i] = relayStates[i];
+                if (!(group.mask & (1 << i)) || relayPins[i] == PIN_DISABLED) continue;
+                if (group.action[i] == '2') newStates[i] = !relayStates[i];
+                else newStates[i] = (group.action[i] == '1');
+            }
+            for (int i = 0; i < MAX_RELAYS; i++) {
+                if (newStates[i] == relayStates[i]) continue;
+                relayStates[i] = newStates[i];
+                digitalWrite(relayPins[i], relayStates[i] ? HIGH : LOW);
+            }
+            commandExecuted = true;
+        } else {
+            Serial.println("Comando di gruppo non valido");
+        }
+    }
     // Comandi di sistema
     else if (strcmp(msg->topic, "Life") == 0) {
         responseStr = "ALIVE";
@@ -779,7 +806,9 @@ void handleControlCommand(uint8_t* senderMac, struct_message* msg) {
     // Comando OTA_UPDATE - avvia aggiornamento firmware
     else if (strcmp(msg->topic, "CONTROL") == 0 && strcmp(msg->command, "OTA_UPDATE") == 0) {
         // Payload format: SSID|PASS|URL
-        String payload = String(msg->status);
+        // Siamo nel callback di ricezione: rxPayload() contiene lo status completo
+        // anche quando il gateway lo ha spedito in più frammenti (URL lunghi)
+        String payload = String(DomoticaEspNow::rxPayload());
         int firstPipe = payload.indexOf('|');
         int secondPipe = payload.indexOf('|', firstPipe + 1);
         
@@ -874,6 +903,11 @@ void handleControlCommand(uint8_t* senderMac, struct_message* msg) {
             
             // Usa actualCommandState invece di msg->command per confermare lo stato reale
             sendResponse(senderMac, msg->topic, actualCommandState, relayStatus.c_str());
+        } else if (strcmp(msg->topic, DOMOTICA_GROUP_TOPIC) == 0) {
+            // Un solo FEEDBACK con lo stato di tutti i canali
+            String relayStatus = "";
+            for(int i=0; i<MAX_RELAYS; i++) relayStatus += relayStates[i] ? "1" : "0";
+            sendResponse(senderMac, DOMOTICA_GROUP_TOPIC, msg->command, relayStatus.c_str());
         } else if (!restartPending && !factoryResetPending && !otaPending && strcmp(msg->command, "PING") != 0 && strcmp(msg->command, "SLEEP_STATUS") != 0 && strcmp(msg->command, "NETWORK_DISCOVERY") != 0) {
             // Per altri comandi generici (se non già gestiti sopra)
             sendResponse(senderMac, msg->topic, msg->command, "COMPLETED");
@@ -1108,6 +1142,7 @@ void setup() {
         // Inizializzazione ESP-NOW
         espNow.begin(false);
         DomoticaEspNow::onDataReceived(OnDataRecv);
+        DomoticaEspNow::addLocalCaps(DOMOTICA_CAP_GROUP);
         
         // Aggiungi peer broadcast
         uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -1187,6 +1222,7 @@ void loop() {
             // Inizializzazione ESP-NOW
             espNow.begin(false);
             DomoticaEspNow::onDataReceived(OnDataRecv);
+            DomoticaEspNow::addLocalCaps(DOMOTICA_CAP_GROUP);
             
             // Aggiungi peer broadcast
             uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -1227,6 +1263,11 @@ void loop() {
          }
     }
     
+    // ACK dei comandi affidabili ricevuti dal gateway
+    if (espNowInitialized) {
+        espNow.loop();
+    }
+    
     // Controlla reset fabbrica (GPIO0 + GND) a runtime
     static bool resetButtonPressed = false;
     static unsigned long resetButtonPressTime = 0;
@@ -1255,7 +1296,7 @@ void loop() {
                  // Send: Node, Topic, Command, Status, Type, GatewayID
                  // Topic: SYSTEM, Command: REMOVE_PEER, Status: LEAVING, Type: STATUS
                  espNow.send(gatewayMac, nodeId.c_str(), "SYSTEM", "REMOVE_PEER", "LEAVING", "STATUS", targetGatewayId.c_str());
-                 delay(200); // Attesa tecnica per assicurare l'invio fisico del pacchetto
+                 espNow.flush(200); // Attende la conferma radio del pacchetto (max 200ms)
             }
 
             Serial.println("Cancellazione configurazione e riavvio...");
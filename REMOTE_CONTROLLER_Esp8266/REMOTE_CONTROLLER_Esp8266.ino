@@ -107,7 +107,7 @@ void setup() {
   
   espNow.begin();
   espNow.onDataReceived(onDataRecv);
-  esp_now_register_send_cb(onDataSent);
+  espNow.onDataSent(onDataSent); // Il callback della libreria fa avanzare la coda TX
 
   // --- SAFETY CHECK FOR STUCK BUTTONS AT BOOT ---
   Serial.println("Checking for stuck buttons...");
@@ -167,6 +167,9 @@ void loop() {
     return; // SKIP ALL OTHER LOGIC IN CONFIG MODE
   }
 
+  // Coda di trasmissione ESP-NOW (ACK e ritrasmissioni)
+  espNow.loop();
+
   // Check Buttons (TTP223 Active High: Pressed = HIGH)
   int pressedBtn = -1;
   
@@ -377,7 +380,7 @@ void enterSleep() {
   
   espNow.begin();
   espNow.onDataReceived(onDataRecv);
-  esp_now_register_send_cb(onDataSent);
+  espNow.onDataSent(onDataSent);
 }
 
 void handleButtonPress(int btnIndex) {
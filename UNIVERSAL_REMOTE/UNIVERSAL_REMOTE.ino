@@ -157,6 +157,9 @@ void setup() {
 }
 
 void loop() {
+  // 0. Coda di trasmissione ESP-NOW
+  espNow.loop();
+
   // 1. Gestione Input TTP229
   handleKeypad();
 
@@ -1,14 +1,591 @@
 #include "DomoticaEspNow.h"
 
+#ifdef ESP8266
+  #include <Schedule.h>
+#endif
+
 #ifdef ESP32
 void (*DomoticaEspNow::_onDataReceived)(const uint8_t*, const uint8_t*, int) = nullptr;
 #elif defined(ESP8266)
 void (*DomoticaEspNow::_onDataReceived)(uint8_t*, uint8_t*, uint8_t) = nullptr;
+void (*DomoticaEspNow::_onDataSent)(uint8_t*, uint8_t) = nullptr;
 #endif
 
 // Variabile debug statica
 static bool _debugEnabled = false;
 
+// --- SEZIONI CRITICHE --- //
+// Su ESP32 OnDataSent/OnDataRecv girano nel task WiFi, in parallelo a loop() e send():
+// lo stato che entrambi toccano (peer link, frame in attesa di ACK, coda ACK, slot in
+// volo, backoff) si legge e si modifica solo dentro DOMOTICA_LOCK. Le sezioni restano
+// brevi e non chiamano mai esp_now_* né Serial. Le funzioni marcate "sotto lock" non lo
+// prendono da sole. Su ESP8266 i callback non interrompono lo sketch: macro vuote.
+#ifdef ESP32
+static portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+  #define DOMOTICA_LOCK()    portENTER_CRITICAL(&_lock)
+  #define DOMOTICA_UNLOCK()  portEXIT_CRITICAL(&_lock)
+#else
+  #define DOMOTICA_LOCK()
+  #define DOMOTICA_UNLOCK()
+#endif
+
+// --- STATO PER PEER (protocollo negoziato, seq, finestra duplicati) --- //
+struct PeerLink {
+  uint8_t mac[6];
+  uint8_t version;
+  uint8_t caps;
+  uint16_t txSeq;
+  uint16_t rxSeqMax;          // Seq più alto ricevuto con ACK_REQ
+  uint32_t rxWindow;          // Bit n = seq (rxSeqMax - n) già ricevuto
+  bool rxValid;
+  unsigned long lastUsed;     // Ultimo frame da/verso il peer: sostituzione LRU
+  DomoticaPeerStats stats;
+};
+
+static_assert(DOMOTICA_PROTO_PEERS <= 255, "_peerLinkCount è uint8_t");
+
+static PeerLink _peerLinks[DOMOTICA_PROTO_PEERS];
+static uint8_t _peerLinkCount = 0;
+static bool _rawFrames = false;
+static uint32_t _localCaps = DOMOTICA_LOCAL_CAPS;
+static DomoticaStats _stats;
+static struct_message _rxDecoded;       // Frame normalizzato per i callback non raw
+static const char* _rxPayload = "";     // Status completo del messaggio in consegna
+
+// --- FRAME IN ATTESA DI ACK --- //
+struct PendingFrame {
+  bool inUse;
+  uint8_t mac[6];
+  uint8_t len;
+  uint8_t attempts;
+  uint8_t prio;
+  bool queued;                // In coda di trasmissione: nextRetryAt non ancora valido
+  uint16_t seq;
+  unsigned long nextRetryAt;
+  uint8_t frame[DOMOTICA_MAX_FRAME];
+};
+
+struct PendingAck {
+  uint8_t mac[6];
+  uint16_t seq;
+};
+
+static PendingFrame _pending[DOMOTICA_RELIABLE_SLOTS];
+static PendingAck _ackQueue[DOMOTICA_ACK_QUEUE];
+static uint8_t _ackCount = 0;
+static void (*_onDeliveryFailed)(const uint8_t*, uint16_t) = nullptr;
+
+static int findPeerLink(const uint8_t *peer_addr) {
+  for (int i = 0; i < _peerLinkCount; i++) {
+    if (memcmp(_peerLinks[i].mac, peer_addr, 6) == 0) return i;
+  }
+  return -1;
+}
+
+// Seq iniziale casuale: dopo un riavvio il peer non scambia i nuovi frame per duplicati
+static uint16_t randomSeq() {
+  #ifdef ESP32
+    return (uint16_t) esp_random();
+  #elif defined(ESP8266)
+    return (uint16_t) RANDOM_REG32;
+  #endif
+}
+
+static unsigned long retryDelay(uint8_t attempts) {
+  unsigned long delayMs = (unsigned long) DOMOTICA_RETRY_BASE_MS << (attempts - 1);
+  return delayMs > DOMOTICA_RETRY_MAX_MS ? DOMOTICA_RETRY_MAX_MS : delayMs;
+}
+
+// Registra il seq nella finestra del peer. Ritorna true se era già stato ricevuto.
+static bool markReceived(PeerLink& link, uint16_t seq) {
+  if (!link.rxValid) {
+    link.rxValid = true;
+    link.rxSeqMax = seq;
+    link.rxWindow = 1;
+    return false;
+  }
+
+  int16_t diff = (int16_t)(seq - link.rxSeqMax);
+  if (diff > 0) {
+    link.rxWindow = (diff >= DOMOTICA_DUP_WINDOW) ? 0 : (link.rxWindow << diff);
+    link.rxWindow |= 1;
+    link.rxSeqMax = seq;
+    return false;
+  }
+
+  int back = -diff;
+  if (back >= DOMOTICA_DUP_WINDOW) {
+    // Troppo vecchio per la finestra: il peer ha ripreso da un altro seq
+    link.rxSeqMax = seq;
+    link.rxWindow = 1;
+    return false;
+  }
+
+  uint32_t bit = 1UL << back;
+  if (link.rxWindow & bit) return true;
+  link.rxWindow |= bit;
+  return false;
+}
+
+// Sotto lock (callback di ricezione)
+static void queueAck(const uint8_t *mac, uint16_t seq) {
+  if (_ackCount >= DOMOTICA_ACK_QUEUE) return; // Il mittente ritrasmette e riceverà l'ACK dopo
+  memcpy(_ackQueue[_ackCount].mac, mac, 6);
+  _ackQueue[_ackCount].seq = seq;
+  _ackCount++;
+}
+
+// Nessun ACK di livello radio: la ritrasmissione affidabile verso questo peer viene
+// anticipata al primo passo di backoff invece di attendere il timeout dell'ACK applicativo.
+// Sotto lock.
+static void linkFailure(const uint8_t *mac) {
+  unsigned long retryAt = millis() + DOMOTICA_RETRY_BASE_MS;
+  for (int s = 0; s < DOMOTICA_RELIABLE_SLOTS; s++) {
+    PendingFrame& p = _pending[s];
+    if (p.inUse && !p.queued && memcmp(p.mac, mac, 6) == 0 && (long)(p.nextRetryAt - retryAt) > 0) {
+      p.nextRetryAt = retryAt;
+    }
+  }
+}
+
+// --- CODA DI TRASMISSIONE --- //
+struct TxEntry {
+  bool inUse;
+  uint8_t prio;
+  int8_t pendingSlot;         // >= 0: frame affidabile, i byte restano in _pending[slot]
+  uint16_t pendingSeq;
+  uint8_t mac[6];
+  uint8_t len;
+  uint32_t order;             // FIFO a parità di priorità
+  uint8_t frame[DOMOTICA_MAX_FRAME];
+};
+
+struct InFlight {
+  volatile bool inUse;        // Liberato da OnDataSent (o dal timeout)
+  uint8_t mac[6];
+  unsigned long sentAt;
+};
+
+static TxEntry _txQueue[DOMOTICA_TX_QUEUE];
+static uint8_t _txCount = 0;
+static uint32_t _txOrder = 0;
+static InFlight _inFlight[DOMOTICA_TX_INFLIGHT];
+static volatile uint8_t _txFailStreak = 0;
+static volatile unsigned long _txBackoffMs = 0;     // 0 = nessuna pausa in corso
+static volatile unsigned long _txPausedUntil = 0;
+
+static void txPump();
+
+// OnDataSent libera lo slot in volo ma non trasmette (contesto callback radio): la coda
+// riparte dal contesto dello sketch. Su ESP8266 una funzione ricorrente del core gira a
+// ogni yield()/delay() e a ogni fine loop(), quindi il frame successivo parte anche negli
+// sketch che attendono una risposta in un ciclo di delay(); lì vengono recuperati anche
+// gli slot in volo scaduti. Su ESP32 la coda avanza da loop() e da send().
+#ifdef ESP8266
+static bool _txServiceScheduled = false;
+
+static bool txService() {
+  if (_txCount > 0) txPump();
+  return true; // Resta schedulata
+}
+#endif
+
+static uint8_t txPriority(const char* topic, const char* type) {
+  if (strcmp(topic, "DISCOVERY") == 0 || strcmp(type, "DISCOVERY") == 0 || strcmp(type, "discovery_response") == 0) {
+    return DOMOTICA_PRIO_DISCOVERY;
+  }
+  if (strcmp(type, "FEEDBACK") == 0 || strcmp(type, "STATUS") == 0) return DOMOTICA_PRIO_TELEMETRY;
+  return DOMOTICA_PRIO_CONTROL;
+}
+
+static TxEntry* txFreeEntry() {
+  for (int q = 0; q < DOMOTICA_TX_QUEUE; q++) {
+    if (!_txQueue[q].inUse) return &_txQueue[q];
+  }
+  return NULL;
+}
+
+// Slot libero in coda, senza mai attendere la radio. A coda piena si sacrifica il frame
+// più recente della priorità peggiore, purché sia meno importante di quello nuovo;
+// altrimenti il nuovo è scartato. I fan-out verso molti peer vanno cadenzati dal
+// chiamante (txQueueCount()). Sotto lock: la vittima può essere un frame affidabile.
+static TxEntry* txReserve(uint8_t prio) {
+  TxEntry* slot = txFreeEntry();
+  if (slot != NULL) return slot;
+
+  _stats.txDropped++;
+  int victim = -1;
+  for (int q = 0; q < DOMOTICA_TX_QUEUE; q++) {
+    TxEntry& e = _txQueue[q];
+    if (e.prio <= prio) continue;
+    if (victim < 0 || e.prio > _txQueue[victim].prio ||
+        (e.prio == _txQueue[victim].prio && (int32_t)(e.order - _txQueue[victim].order) > 0)) {
+      victim = q;
+    }
+  }
+  if (victim < 0) return NULL;
+
+  TxEntry& e = _txQueue[victim];
+  if (e.pendingSlot >= 0 && _pending[e.pendingSlot].seq == e.pendingSeq) {
+    // Il frame affidabile torna al backoff normale
+    _pending[e.pendingSlot].queued = false;
+    _pending[e.pendingSlot].nextRetryAt = millis() + retryDelay(_pending[e.pendingSlot].attempts);
+  }
+  e.inUse = false;
+  _txCount--;
+  return &e;
+}
+
+static void txCommit(TxEntry* e, uint8_t len) {
+  e->len = len;
+  e->order = _txOrder++;
+  e->inUse = true;
+  _txCount++;
+  if (_txCount > _stats.txQueueHighWater) _stats.txQueueHighWater = _txCount;
+}
+
+// Mette in coda l'invio (o la ritrasmissione) di un frame affidabile. Sotto lock.
+static void queuePending(int slot) {
+  PendingFrame& p = _pending[slot];
+  TxEntry* e = txReserve(p.prio);
+  if (e == NULL) {
+    p.nextRetryAt = millis() + retryDelay(p.attempts);
+    return;
+  }
+  memcpy(e->mac, p.mac, 6);
+  e->prio = p.prio;
+  e->pendingSlot = slot;
+  e->pendingSeq = p.seq;
+  p.queued = true;
+  txCommit(e, p.len);
+}
+
+static uint8_t peerInFlight(const uint8_t *mac) {
+  uint8_t n = 0;
+  for (int f = 0; f < DOMOTICA_TX_INFLIGHT; f++) {
+    if (_inFlight[f].inUse && memcmp(_inFlight[f].mac, mac, 6) == 0) n++;
+  }
+  return n;
+}
+
+// --- MESSAGGI FRAMMENTATI --- //
+static_assert(DOMOTICA_MAX_FRAGMENTS <= 8, "Bitmap dei frammenti ricevuti a 8 bit");
+
+#define STATUS_FIELD_MAX (sizeof(((struct_message*)0)->status) - 1)
+
+struct Reassembly {
+  bool inUse;
+  uint8_t mac[6];
+  uint8_t msgId;
+  uint8_t msgType;
+  uint8_t count;
+  uint8_t received;           // Bit n = frammento n arrivato
+  uint16_t bodyLen;           // Noto all'arrivo dell'ultimo frammento
+  unsigned long startedAt;
+  uint8_t body[DOMOTICA_MAX_MESSAGE - DOMOTICA_HEADER_SIZE];
+};
+
+static Reassembly _reasm[DOMOTICA_REASM_SLOTS];
+static char _rxLongPayload[DOMOTICA_MAX_PAYLOAD + 1];
+static uint8_t _txMsgId = 0;
+
+// Aggiunge un frammento (contesto callback). Ritorna lo slot quando il messaggio
+// è completo: il buffer resta valido fino al frammento successivo.
+static int reassemble(const uint8_t *mac, const DomoticaFrameInfo& info) {
+  unsigned long now = millis();
+  int slot = -1, freeSlot = -1, oldest = -1;
+  for (int r = 0; r < DOMOTICA_REASM_SLOTS; r++) {
+    Reassembly& a = _reasm[r];
+    if (a.inUse && now - a.startedAt > DOMOTICA_REASM_TIMEOUT) {
+      a.inUse = false;
+      _stats.reassemblyDropped++;
+    }
+    if (!a.inUse) {
+      if (freeSlot < 0) freeSlot = r;
+      continue;
+    }
+    if (a.msgId == info.fragId && memcmp(a.mac, mac, 6) == 0) slot = r;
+    if (oldest < 0 || (long)(a.startedAt - _reasm[oldest].startedAt) < 0) oldest = r;
+  }
+
+  if (slot < 0) {
+    if (freeSlot < 0) {
+      // Tutti i buffer occupati: si sacrifica il messaggio più vecchio
+      freeSlot = oldest;
+      _stats.reassemblyDropped++;
+    }
+    slot = freeSlot;
+    Reassembly& a = _reasm[slot];
+    a.inUse = true;
+    memcpy(a.mac, mac, 6);
+    a.msgId = info.fragId;
+    a.msgType = info.msgType;
+    a.count = info.fragCount;
+    a.received = 0;
+    a.bodyLen = 0;
+    a.startedAt = now;
+  }
+
+  Reassembly& a = _reasm[slot];
+  size_t offset = (size_t) info.fragIndex * DOMOTICA_FRAG_CHUNK;
+  bool last = (info.fragIndex == a.count - 1);
+  if (info.fragCount != a.count || (!last && info.fragLen != DOMOTICA_FRAG_CHUNK) ||
+      offset + info.fragLen > sizeof(a.body)) {
+    a.inUse = false;
+    _stats.reassemblyDropped++;
+    return -1;
+  }
+
+  memcpy(a.body + offset, info.fragData, info.fragLen);
+  a.received |= 1 << info.fragIndex;
+  if (last) a.bodyLen = offset + info.fragLen;
+  if (a.received != (uint8_t)((1 << a.count) - 1)) return -1;
+
+  a.inUse = false;
+  _stats.messagesReassembled++;
+  return slot;
+}
+
+// --- SLOT PEER ESP-NOW (LRU) --- //
+// Lo stack ESP-NOW accetta pochi peer registrati: la libreria li registra al momento
+// dell'invio e, a tabella piena, sfratta quello usato meno di recente. I peer aggiunti
+// con addPeer() (gateway, broadcast) restano fissi.
+struct PeerSlot {
+  bool inUse;
+  bool pinned;
+  uint8_t mac[6];
+  uint32_t lastUsed;
+};
+
+static PeerSlot _peerSlots[DOMOTICA_PEER_SLOTS];
+static uint32_t _peerClock = 0;
+
+static int findPeerSlot(const uint8_t *mac) {
+  for (int s = 0; s < DOMOTICA_PEER_SLOTS; s++) {
+    if (_peerSlots[s].inUse && memcmp(_peerSlots[s].mac, mac, 6) == 0) return s;
+  }
+  return -1;
+}
+
+static bool hwHasPeer(const uint8_t *mac) {
+  #ifdef ESP32
+    return esp_now_is_peer_exist(mac);
+  #elif defined(ESP8266)
+    return esp_now_is_peer_exist((uint8_t *) mac) > 0;
+  #endif
+}
+
+static bool hwAddPeer(const uint8_t *mac) {
+  #ifdef ESP32
+    esp_now_peer_info_t peerInfo = {};
+    memcpy(peerInfo.peer_addr, mac, 6);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+    if (esp_now_add_peer(&peerInfo) == ESP_OK) return true;
+  #elif defined(ESP8266)
+    // Per ESP8266, usa ESP_NOW_ROLE_COMBO per permettere comunicazione bidirezionale
+    if (esp_now_add_peer((uint8_t *) mac, ESP_NOW_ROLE_COMBO, 0, NULL, 0) == 0) return true;
+  #endif
+  return hwHasPeer(mac); // Già registrato fuori dalla libreria
+}
+
+// Slot meno usato di recente tra quelli non fissati e senza frame in volo
+static int lruPeerSlot() {
+  int victim = -1;
+  for (int s = 0; s < DOMOTICA_PEER_SLOTS; s++) {
+    PeerSlot& slot = _peerSlots[s];
+    if (!slot.inUse || slot.pinned || peerInFlight(slot.mac) > 0) continue;
+    if (victim < 0 || (int32_t)(slot.lastUsed - _peerSlots[victim].lastUsed) < 0) victim = s;
+  }
+  return victim;
+}
+
+// Registra mac nello stack ESP-NOW (se non lo è già). Ritorna lo slot o -1.
+static int acquirePeerSlot(const uint8_t *mac, bool pinned) {
+  int s = findPeerSlot(mac);
+  if (s < 0) {
+    for (int f = 0; f < DOMOTICA_PEER_SLOTS; f++) {
+      if (!_peerSlots[f].inUse) { s = f; break; }
+    }
+    if (s < 0) {
+      s = lruPeerSlot();
+      if (s < 0) return -1;
+      esp_now_del_peer(_peerSlots[s].mac);
+      _peerSlots[s].inUse = false;
+      _stats.peerEvictions++;
+    }
+    if (!hwAddPeer(mac)) return -1;
+
+    memcpy(_peerSlots[s].mac, mac, 6);
+    _peerSlots[s].pinned = false;
+    _peerSlots[s].inUse = true;
+  }
+  if (pinned) _peerSlots[s].pinned = true;
+  _peerSlots[s].lastUsed = ++_peerClock;
+  return s;
+}
+
+// Rilascia verso la radio i frame in coda finché ci sono slot in volo disponibili.
+// La coda appartiene al contesto dello sketch; con i callback si condividono solo
+// _pending e _inFlight, toccati sotto lock. Registrazione del peer ed esp_now_send
+// avvengono fuori dalla sezione critica.
+static void txPump() {
+  unsigned long now = millis();
+  uint8_t busy = 0;
+  DOMOTICA_LOCK();
+  for (int f = 0; f < DOMOTICA_TX_INFLIGHT; f++) {
+    if (!_inFlight[f].inUse) continue;
+    if (now - _inFlight[f].sentAt >= DOMOTICA_TX_SENT_TIMEOUT) {
+      _inFlight[f].inUse = false; // OnDataSent perso
+    } else {
+      busy++;
+    }
+  }
+  bool paused = _txBackoffMs != 0 && (long)(now - _txPausedUntil) < 0;
+  DOMOTICA_UNLOCK();
+  if (paused) return;
+
+  while (_txCount > 0 && busy < DOMOTICA_TX_INFLIGHT) {
+    int best = -1;
+    bool stale = false;
+    DOMOTICA_LOCK();
+    for (int q = 0; q < DOMOTICA_TX_QUEUE; q++) {
+      TxEntry& e = _txQueue[q];
+      if (!e.inUse || peerInFlight(e.mac) >= DOMOTICA_TX_PEER_INFLIGHT) continue;
+      if (best < 0 || e.prio < _txQueue[best].prio ||
+          (e.prio == _txQueue[best].prio && (int32_t)(e.order - _txQueue[best].order) < 0)) {
+        best = q;
+      }
+    }
+    if (best >= 0 && _txQueue[best].pendingSlot >= 0) {
+      TxEntry& e = _txQueue[best];
+      PendingFrame& p = _pending[e.pendingSlot];
+      // ACK arrivato mentre il frame era in coda: nessun invio, nessuno slot peer
+      stale = !p.inUse || p.seq != e.pendingSeq || memcmp(p.mac, e.mac, 6) != 0;
+      if (stale) {
+        e.inUse = false;
+        _txCount--;
+      }
+    }
+    DOMOTICA_UNLOCK();
+    if (best < 0) break; // Restano solo frame verso peer già occupati
+    if (stale) continue;
+
+    // Con tutti gli slot peer fissati o in volo si attende una conferma;
+    // a radio ferma il frame non ha modo di partire e viene scartato.
+    // Hit/miss si contano solo per il frame che parte davvero, non per ogni tentativo.
+    TxEntry& e = _txQueue[best];
+    bool hit = findPeerSlot(e.mac) >= 0;
+    bool registered = acquirePeerSlot(e.mac, false) >= 0;
+    if (!registered && busy > 0) break;
+
+    // Lo slot in volo si occupa prima di esp_now_send: su ESP32 OnDataSent può
+    // arrivare prima che esp_now_send ritorni
+    const uint8_t *frame = e.frame;
+    int slot = -1;
+    DOMOTICA_LOCK();
+    e.inUse = false;
+    _txCount--;
+    if (e.pendingSlot >= 0) {
+      PendingFrame& p = _pending[e.pendingSlot];
+      p.queued = false;
+      p.nextRetryAt = now + retryDelay(p.attempts);
+      frame = p.frame;
+    }
+    if (registered) {
+      for (int f = 0; f < DOMOTICA_TX_INFLIGHT; f++) {
+        if (_inFlight[f].inUse) continue;
+        memcpy(_inFlight[f].mac, e.mac, 6);
+        _inFlight[f].sentAt = now;
+        _inFlight[f].inUse = true;
+        slot = f;
+        break;
+      }
+    }
+    DOMOTICA_UNLOCK();
+
+    if (!registered) {
+      _stats.txDropped++;
+      continue;
+    }
+    if (hit) {
+      _stats.peerHits++;
+    } else {
+      _stats.peerMisses++;
+    }
+
+    // Errore immediato: nessun OnDataSent in arrivo
+    if (esp_now_send(e.mac, (uint8_t *) frame, e.len) != 0) {
+      DOMOTICA_LOCK();
+      if (slot >= 0) _inFlight[slot].inUse = false;
+      DOMOTICA_UNLOCK();
+      continue;
+    }
+
+    if (e.len == sizeof(struct_message)) {
+      _stats.framesSentLegacy++;
+    } else if (!(frame[3] & DOMOTICA_FLAG_ACK)) {
+      _stats.framesSentCompact++;
+    }
+    _stats.bytesSent += e.len;
+    busy++;
+  }
+}
+
+// Esito di un invio (contesto callback): libera lo slot in volo e, dopo
+// DOMOTICA_TX_FAIL_STREAK fallimenti consecutivi, mette in pausa la coda
+static void txSent(const uint8_t *mac, bool ok) {
+  unsigned long now = millis();
+  DOMOTICA_LOCK();
+  for (int f = 0; f < DOMOTICA_TX_INFLIGHT; f++) {
+    if (_inFlight[f].inUse && memcmp(_inFlight[f].mac, mac, 6) == 0) {
+      _inFlight[f].inUse = false;
+      break;
+    }
+  }
+
+  if (ok) {
+    _txFailStreak = 0;
+    _txBackoffMs = 0;
+  } else {
+    linkFailure(mac);
+    _txFailStreak = _txFailStreak + 1;
+    if (_txFailStreak >= DOMOTICA_TX_FAIL_STREAK) {
+      _txFailStreak = 0;
+      unsigned long backoff = _txBackoffMs ? _txBackoffMs * 2 : DOMOTICA_TX_BACKOFF_MS;
+      _txBackoffMs = backoff > DOMOTICA_TX_BACKOFF_MAX ? DOMOTICA_TX_BACKOFF_MAX : backoff;
+      _txPausedUntil = now + _txBackoffMs;
+      _stats.txBackoffs++;
+    }
+  }
+  DOMOTICA_UNLOCK();
+}
+
+// Caps negoziate con il peer (0 = formato legacy). Copia sotto lock: il callback di
+// ricezione può spostare le voci di _peerLinks (fallback legacy, sostituzione).
+static uint8_t peerLinkCaps(const uint8_t *mac) {
+  DOMOTICA_LOCK();
+  int i = findPeerLink(mac);
+  uint8_t caps = i >= 0 ? _peerLinks[i].caps : 0;
+  DOMOTICA_UNLOCK();
+  return caps;
+}
+
+// Riserva count seq consecutivi verso il peer e ritorna il primo
+static uint16_t takePeerSeq(const uint8_t *mac, uint8_t count, bool reliable) {
+  DOMOTICA_LOCK();
+  int i = findPeerLink(mac);
+  uint16_t seq = 0;
+  if (i >= 0) {
+    seq = _peerLinks[i].txSeq;
+    _peerLinks[i].txSeq += count;
+    _peerLinks[i].lastUsed = millis();
+    if (reliable) _peerLinks[i].stats.reliableSent += count;
+  }
+  DOMOTICA_UNLOCK();
+  return seq;
+}
+
 DomoticaEspNow::DomoticaEspNow() {
 }
 
@@ -37,30 +614,24 @@ void DomoticaEspNow::begin(bool master) {
     }
     esp_now_register_send_cb(OnDataSent);
     esp_now_register_recv_cb(OnDataRecv);
+    if (!_txServiceScheduled) {
+      _txServiceScheduled = schedule_recurrent_function_us(txService, 0);
+    }
   #endif
 }
 
 int DomoticaEspNow::addPeer(uint8_t *peer_addr) {
-  #ifdef ESP32
-    esp_now_peer_info_t peerInfo = {};
-    memcpy(peerInfo.peer_addr, peer_addr, 6);
-    peerInfo.channel = 0;
-    peerInfo.encrypt = false;
-    if (esp_now_add_peer(&peerInfo) != ESP_OK){
-      if(_debugEnabled) Serial.println("Failed to add peer");
-      return -1;
-    }
-  #elif defined(ESP8266)
-    // Per ESP8266, usa ESP_NOW_ROLE_COMBO per permettere comunicazione bidirezionale
-    if (esp_now_add_peer(peer_addr, ESP_NOW_ROLE_COMBO, 0, NULL, 0) != 0){
-        if(_debugEnabled) Serial.println("Failed to add peer");
-        return -1;
-    }
-  #endif
+  if (acquirePeerSlot(peer_addr, true) < 0) {
+    if(_debugEnabled) Serial.println("Failed to add peer");
+    return -1;
+  }
   return 0;
 }
 
 int DomoticaEspNow::removePeer(uint8_t *peer_addr) {
+  int s = findPeerSlot(peer_addr);
+  if (s >= 0) _peerSlots[s].inUse = false;
+
   #ifdef ESP32
     if (esp_now_del_peer(peer_addr) != ESP_OK){
       if(_debugEnabled) Serial.println("Failed to remove peer");
@@ -76,41 +647,389 @@ int DomoticaEspNow::removePeer(uint8_t *peer_addr) {
 }
 
 bool DomoticaEspNow::hasPeer(uint8_t *peer_addr) {
-  #ifdef ESP32
-    return esp_now_is_peer_exist(peer_addr);
-  #elif defined(ESP8266)
-    return esp_now_is_peer_exist(peer_addr) > 0;
-  #endif
+  return findPeerSlot(peer_addr) >= 0 || hwHasPeer(peer_addr);
 }
 
 void DomoticaEspNow::clearPeers() {
-    // ESP8266/ESP32 non hanno una funzione "clear all" nativa
-    // Bisognerebbe tenere traccia dei peer internamente per rimuoverli tutti
-    // Per ora lasciamo vuoto per evitare errori di compilazione, 
-    // ma il chiamante dovrebbe gestire la rimozione individuale se necessario.
-}
-
-void DomoticaEspNow::send(uint8_t *address, const char* node, const char* topic, const char* command, const char* status, const char* type, const char* gateway_id) {
-  struct_message message;
-  strncpy(message.node, node, sizeof(message.node) - 1);
-  strncpy(message.topic, topic, sizeof(message.topic) - 1);
-  strncpy(message.command, command, sizeof(message.command) - 1);
-  strncpy(message.status, status, sizeof(message.status) - 1);
-  strncpy(message.type, type, sizeof(message.type) - 1);
-  strncpy(message.gateway_id, gateway_id, sizeof(message.gateway_id) - 1);
-
-  message.node[sizeof(message.node) - 1] = '\0';
-  message.topic[sizeof(message.topic) - 1] = '\0';
-  message.command[sizeof(message.command) - 1] = '\0';
-  message.status[sizeof(message.status) - 1] = '\0';
-  message.type[sizeof(message.type) - 1] = '\0';
-  message.gateway_id[sizeof(message.gateway_id) - 1] = '\0';
+  // Lo stack non ha un "clear all": si rimuovono i peer registrati dalla libreria
+  for (int s = 0; s < DOMOTICA_PEER_SLOTS; s++) {
+    if (!_peerSlots[s].inUse) continue;
+    esp_now_del_peer(_peerSlots[s].mac);
+    _peerSlots[s].inUse = false;
+  }
+}
 
-  #ifdef ESP32
-    esp_now_send(address, (uint8_t *) &message, sizeof(message));
-  #elif defined(ESP8266)
-    esp_now_send(address, (uint8_t *) &message, sizeof(message));
-  #endif
+uint8_t DomoticaEspNow::peerSlotCount() {
+  uint8_t n = 0;
+  for (int s = 0; s < DOMOTICA_PEER_SLOTS; s++) {
+    if (_peerSlots[s].inUse) n++;
+  }
+  return n;
+}
+
+// Aggiorna (o crea) lo stato del peer. Ritorna l'indice in _peerLinks, -1 per i peer
+// legacy. Sotto lock.
+static int updatePeerLink(const uint8_t *peer_addr, uint8_t version, uint32_t caps) {
+  int i = findPeerLink(peer_addr);
+
+  if (version < DOMOTICA_PROTO_COMPACT) {
+    // Fallback legacy: il peer esce dalla tabella
+    if (i >= 0) _peerLinks[i] = _peerLinks[--_peerLinkCount];
+    return -1;
+  }
+
+  if (i < 0) {
+    if (_peerLinkCount < DOMOTICA_PROTO_PEERS) {
+      i = _peerLinkCount++;
+    } else {
+      // Tabella piena: esce il peer senza traffico da più tempo
+      unsigned long now = millis();
+      i = 0;
+      for (int k = 1; k < _peerLinkCount; k++) {
+        if (now - _peerLinks[k].lastUsed > now - _peerLinks[i].lastUsed) i = k;
+      }
+    }
+    memset(&_peerLinks[i], 0, sizeof(PeerLink));
+    memcpy(_peerLinks[i].mac, peer_addr, 6);
+    _peerLinks[i].caps = DOMOTICA_CAP_COMPACT;
+    _peerLinks[i].txSeq = randomSeq();
+  }
+  _peerLinks[i].version = version;
+  _peerLinks[i].lastUsed = millis();
+  if (caps != 0) _peerLinks[i].caps = caps;
+  return i;
+}
+
+void DomoticaEspNow::setPeerProtocol(const uint8_t *peer_addr, uint8_t version, uint32_t caps) {
+  DOMOTICA_LOCK();
+  updatePeerLink(peer_addr, version, caps);
+  DOMOTICA_UNLOCK();
+}
+
+uint8_t DomoticaEspNow::getPeerProtocol(const uint8_t *peer_addr) {
+  DOMOTICA_LOCK();
+  int i = findPeerLink(peer_addr);
+  uint8_t version = i >= 0 ? _peerLinks[i].version : DOMOTICA_PROTO_LEGACY;
+  DOMOTICA_UNLOCK();
+  return version;
+}
+
+uint32_t DomoticaEspNow::getPeerCaps(const uint8_t *peer_addr) {
+  return peerLinkCaps(peer_addr);
+}
+
+void DomoticaEspNow::addLocalCaps(uint32_t caps) {
+  _localCaps |= caps;
+}
+
+bool DomoticaEspNow::getPeerStats(const uint8_t *peer_addr, DomoticaPeerStats *out) {
+  DOMOTICA_LOCK();
+  int i = findPeerLink(peer_addr);
+  if (i >= 0) *out = _peerLinks[i].stats;
+  DOMOTICA_UNLOCK();
+  return i >= 0;
+}
+
+void DomoticaEspNow::onDeliveryFailed(void (*cb)(const uint8_t *mac, uint16_t seq)) {
+  _onDeliveryFailed = cb;
+}
+
+void DomoticaEspNow::setRawFrames(bool raw) {
+  _rawFrames = raw;
+}
+
+const DomoticaStats& DomoticaEspNow::getStats() {
+  return _stats;
+}
+
+const char* DomoticaEspNow::rxPayload() {
+  return _rxPayload;
+}
+
+bool DomoticaEspNow::decodeFrame(const uint8_t *mac, const uint8_t *data, int len, struct_message *out, DomoticaFrameInfo *info) {
+  DomoticaFrameInfo localInfo;
+  if (info == NULL) info = &localInfo;
+
+  if (!domoticaDecodeFrame(data, len, out, info)) {
+    _stats.framesInvalid++;
+    return false;
+  }
+
+  _rxPayload = out->status;
+
+  if (info->version < DOMOTICA_PROTO_COMPACT) {
+    _stats.framesRecvLegacy++;
+    // Una REGISTER legacy indica un firmware senza formato compatto: fallback automatico
+    if (strcmp(out->command, "REGISTER") == 0) {
+      setPeerProtocol(mac, DOMOTICA_PROTO_LEGACY);
+    }
+    return true;
+  }
+
+  // Chi trasmette in compatto sa anche riceverlo
+  _stats.framesRecvCompact++;
+  bool fragment = (info->flags & DOMOTICA_FLAG_FRAG) != 0;
+  bool deliver = true;
+
+  DOMOTICA_LOCK();
+  PeerLink& link = _peerLinks[updatePeerLink(mac, info->version, info->caps)];
+
+  if (info->flags & DOMOTICA_FLAG_ACK) {
+    // ACK: libera il frame in attesa, non va consegnato all'applicazione
+    deliver = false;
+    for (int s = 0; s < DOMOTICA_RELIABLE_SLOTS; s++) {
+      PendingFrame& p = _pending[s];
+      if (p.inUse && p.seq == info->seq && memcmp(p.mac, mac, 6) == 0) {
+        p.inUse = false;
+        link.stats.delivered++;
+        break;
+      }
+    }
+  } else {
+    // Una nuova REGISTER indica un riavvio del peer: la finestra riparte da zero
+    if (!fragment && strcmp(out->command, "REGISTER") == 0) {
+      link.rxValid = false;
+    }
+
+    if (info->flags & DOMOTICA_FLAG_ACK_REQ) {
+      // L'ACK parte anche per i duplicati: quello precedente potrebbe essere andato perso
+      queueAck(mac, info->seq);
+      if (markReceived(link, info->seq)) {
+        link.stats.duplicates++;
+        deliver = false;
+      }
+    }
+  }
+  DOMOTICA_UNLOCK();
+  if (!deliver) return false;
+
+  if (fragment) {
+    int r = reassemble(mac, *info);
+    if (r < 0) return false;
+    if (!domoticaDecodeMessage(_reasm[r].body, _reasm[r].bodyLen, _reasm[r].msgType, out,
+                               _rxLongPayload, sizeof(_rxLongPayload))) {
+      _stats.framesInvalid++;
+      return false;
+    }
+    _rxPayload = _rxLongPayload;
+  }
+  return true;
+}
+
+// Accoda i frammenti di un messaggio con status lungo. Con reliable ogni frammento occupa
+// uno slot del pool affidabile (tutti o nessuno). Ritorna 1 se l'invio è affidabile,
+// 0 se i frammenti partono una volta sola, -1 se il messaggio è stato scartato.
+static int sendFragments(uint8_t caps, const uint8_t *address, const char* node, const char* topic, const char* command,
+                         const char* status, const char* type, const char* gateway_id, bool reliable) {
+  uint8_t message[DOMOTICA_MAX_MESSAGE];
+  int len = domoticaEncodeMessage(message, sizeof(message), node, topic, command, status, type, gateway_id);
+  if (len <= 0) return -1;
+
+  int count = domoticaFragmentCount(len);
+  uint8_t prio = txPriority(topic, type);
+  uint8_t msgId = _txMsgId++;
+
+  // Gli slot liberi restano tali: il callback di ricezione li libera ma non li occupa
+  int slots[DOMOTICA_MAX_FRAGMENTS];
+  int found = 0;
+  if (reliable && (caps & DOMOTICA_CAP_RELIABLE)) {
+    for (int s = 0; s < DOMOTICA_RELIABLE_SLOTS && found < count; s++) {
+      if (!_pending[s].inUse) slots[found++] = s;
+    }
+  }
+  reliable = (found == count);
+
+  // Senza ritrasmissione un frammento scartato renderebbe inutili gli altri: tutti o nessuno
+  if (!reliable && DOMOTICA_TX_QUEUE - _txCount < count) {
+    _stats.txDropped++;
+    return -1;
+  }
+
+  uint16_t firstSeq = takePeerSeq(address, count, reliable);
+  for (int f = 0; f < count; f++) {
+    uint16_t seq = firstSeq + f;
+    if (reliable) {
+      PendingFrame& p = _pending[slots[f]];
+      p.len = domoticaEncodeFragment(p.frame, sizeof(p.frame), message, len, msgId, f, seq, DOMOTICA_FLAG_ACK_REQ);
+      memcpy(p.mac, address, 6);
+      p.seq = seq;
+      p.attempts = 1;
+      p.prio = prio;
+      p.queued = false;
+      DOMOTICA_LOCK();
+      p.inUse = true;
+      queuePending(slots[f]);
+      DOMOTICA_UNLOCK();
+    } else {
+      TxEntry* e = txFreeEntry();
+      memcpy(e->mac, address, 6);
+      e->prio = prio;
+      e->pendingSlot = -1;
+      txCommit(e, domoticaEncodeFragment(e->frame, sizeof(e->frame), message, len, msgId, f, seq, 0));
+    }
+    _stats.fragmentsSent++;
+  }
+
+  txPump();
+  return reliable ? 1 : 0;
+}
+
+// Status che non entra in un frame, verso un peer in grado di ricomporlo
+static bool needsFragments(uint8_t caps, const char* status) {
+  return (caps & DOMOTICA_CAP_FRAG) && strlen(status) > STATUS_FIELD_MAX;
+}
+
+bool DomoticaEspNow::send(const uint8_t *address, const char* node, const char* topic, const char* command, const char* status, const char* type, const char* gateway_id) {
+  uint8_t peerCaps = peerLinkCaps(address);
+  if (needsFragments(peerCaps, status)) {
+    return sendFragments(peerCaps, address, node, topic, command, status, type, gateway_id, false) >= 0;
+  }
+
+  uint8_t prio = txPriority(topic, type);
+  DOMOTICA_LOCK();
+  TxEntry* e = txReserve(prio);
+  DOMOTICA_UNLOCK();
+  if (e == NULL) return false; // Coda piena di frame più importanti: contato in txDropped
+
+  memcpy(e->mac, address, 6);
+  e->prio = prio;
+  e->pendingSlot = -1;
+
+  int len = 0;
+  if (peerCaps != 0) {
+    uint32_t caps = (strcmp(command, "REGISTER") == 0) ? _localCaps : 0;
+    len = domoticaEncodeFrame(e->frame, sizeof(e->frame), node, topic, command, status, type, gateway_id, takePeerSeq(address, 1, false), 0, caps);
+    if (len > 0) _stats.bytesSaved += sizeof(struct_message) - len;
+    // Frame non codificabile in compatto: si ripiega sul formato legacy
+  }
+
+  if (len <= 0) {
+    struct_message* message = (struct_message*) e->frame;
+    memset(message, 0, sizeof(struct_message));
+    strncpy(message->node, node, sizeof(message->node) - 1);
+    strncpy(message->topic, topic, sizeof(message->topic) - 1);
+    strncpy(message->command, command, sizeof(message->command) - 1);
+    strncpy(message->status, status, sizeof(message->status) - 1);
+    strncpy(message->type, type, sizeof(message->type) - 1);
+    strncpy(message->gateway_id, gateway_id, sizeof(message->gateway_id) - 1);
+    len = sizeof(struct_message);
+  }
+
+  txCommit(e, len);
+  txPump();
+  return true;
+}
+
+bool DomoticaEspNow::sendReliable(const uint8_t *address, const char* node, const char* topic, const char* command, const char* status, const char* type, const char* gateway_id) {
+  uint8_t caps = peerLinkCaps(address);
+  if (needsFragments(caps, status)) {
+    return sendFragments(caps, address, node, topic, command, status, type, gateway_id, true) > 0;
+  }
+  int slot = -1;
+  if (caps & DOMOTICA_CAP_RELIABLE) {
+    for (int s = 0; s < DOMOTICA_RELIABLE_SLOTS; s++) {
+      if (!_pending[s].inUse) { slot = s; break; }
+    }
+  }
+
+  if (slot >= 0) {
+    PendingFrame& p = _pending[slot];
+    uint16_t seq = takePeerSeq(address, 1, true);
+    int len = domoticaEncodeFrame(p.frame, sizeof(p.frame), node, topic, command, status, type, gateway_id, seq, DOMOTICA_FLAG_ACK_REQ, 0);
+
+    if (len > 0) {
+      memcpy(p.mac, address, 6);
+      p.len = len;
+      p.seq = seq;
+      p.attempts = 1;
+      p.prio = txPriority(topic, type);
+      p.queued = false;
+      _stats.bytesSaved += sizeof(struct_message) - len;
+      DOMOTICA_LOCK();
+      p.inUse = true;
+      queuePending(slot);
+      DOMOTICA_UNLOCK();
+      txPump();
+      return true;
+    }
+  }
+
+  // Peer senza modalità affidabile o pool esaurito: invio singolo
+  send(address, node, topic, command, status, type, gateway_id);
+  return false;
+}
+
+void DomoticaEspNow::loop() {
+  // --- ACK in uscita --- //
+  // Copia e svuotamento nella stessa sezione critica: un ACK accodato dal callback
+  // durante la codifica resta per il giro successivo invece di andare perso
+  PendingAck acks[DOMOTICA_ACK_QUEUE];
+  DOMOTICA_LOCK();
+  uint8_t ackCount = _ackCount;
+  memcpy(acks, _ackQueue, ackCount * sizeof(PendingAck));
+  _ackCount = 0;
+  DOMOTICA_UNLOCK();
+
+  for (int a = 0; a < ackCount; a++) {
+    DOMOTICA_LOCK();
+    TxEntry* e = txReserve(DOMOTICA_PRIO_CONTROL);
+    DOMOTICA_UNLOCK();
+    if (e == NULL) break; // Il mittente ritrasmette e riceverà l'ACK dopo
+    memcpy(e->mac, acks[a].mac, 6);
+    e->prio = DOMOTICA_PRIO_CONTROL;
+    e->pendingSlot = -1;
+    txCommit(e, domoticaEncodeAck(e->frame, sizeof(e->frame), acks[a].seq));
+  }
+
+  // --- Ritrasmissioni --- //
+  // Decisione e aggiornamento sotto lock (un ACK può arrivare in qualsiasi momento);
+  // il callback applicativo di consegna fallita parte fuori dalla sezione critica
+  unsigned long now = millis();
+  for (int s = 0; s < DOMOTICA_RELIABLE_SLOTS; s++) {
+    PendingFrame& p = _pending[s];
+    bool failed = false;
+    uint8_t mac[6];
+    uint16_t seq = 0;
+
+    DOMOTICA_LOCK();
+    if (p.inUse && !p.queued && (long)(now - p.nextRetryAt) >= 0) {
+      int i = findPeerLink(p.mac);
+      if (p.attempts >= DOMOTICA_MAX_ATTEMPTS) {
+        p.inUse = false;
+        if (i >= 0) _peerLinks[i].stats.failed++;
+        memcpy(mac, p.mac, 6);
+        seq = p.seq;
+        failed = true;
+      } else {
+        p.attempts++;
+        if (i >= 0) _peerLinks[i].stats.retries++;
+        queuePending(s);
+      }
+    }
+    DOMOTICA_UNLOCK();
+
+    if (failed && _onDeliveryFailed) _onDeliveryFailed(mac, seq);
+  }
+
+  txPump();
+}
+
+bool DomoticaEspNow::flush(unsigned long timeoutMs) {
+  unsigned long start = millis();
+  while (true) {
+    loop();
+    bool idle = (_txCount == 0);
+    for (int f = 0; f < DOMOTICA_TX_INFLIGHT; f++) {
+      if (_inFlight[f].inUse) idle = false;
+    }
+    if (idle) return true;
+    if (millis() - start >= timeoutMs) return false;
+    delay(1); // Lascia girare lo stack WiFi che consegna OnDataSent
+  }
+}
+
+uint8_t DomoticaEspNow::txQueueCount() {
+  return _txCount;
 }
 
 #ifdef ESP32
@@ -121,10 +1040,15 @@ void DomoticaEspNow::onDataReceived(void (*cb)(const uint8_t*, const uint8_t*, i
 void DomoticaEspNow::onDataReceived(void (*cb)(uint8_t*, uint8_t*, uint8_t)) {
     DomoticaEspNow::_onDataReceived = cb;
 }
+
+void DomoticaEspNow::onDataSent(void (*cb)(uint8_t*, uint8_t)) {
+    DomoticaEspNow::_onDataSent = cb;
+}
 #endif
 
 #ifdef ESP32
 void DomoticaEspNow::OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  txSent(mac_addr, status == ESP_NOW_SEND_SUCCESS);
   Serial.print("ESP-NOW send -> ");
   char macStr[18];
   snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
@@ -134,28 +1058,42 @@ void DomoticaEspNow::OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t s
   Serial.println(status == ESP_NOW_SEND_SUCCESS ? "OK" : "FAIL");
 }
 void DomoticaEspNow::OnDataRecv(const esp_now_recv_info *info, const uint8_t *incomingData, int len) {
-    if (_onDataReceived) {
+    if (!_onDataReceived) return;
+    if (_rawFrames) {
         _onDataReceived(info->src_addr, incomingData, len);
+    } else if (decodeFrame(info->src_addr, incomingData, len, &_rxDecoded)) {
+        _onDataReceived(info->src_addr, (const uint8_t *) &_rxDecoded, sizeof(_rxDecoded));
     }
 }
 #elif defined(ESP8266)
 void DomoticaEspNow::OnDataSent(uint8_t *mac_addr, uint8_t sendStatus) {
-  Serial.print("[ESP8266 SEND DEBUG] Target: ");
-  for(int i=0; i<6; i++) {
-      Serial.print(mac_addr[i], HEX);
-      if(i<5) Serial.print(":");
+  if (_debugEnabled) {
+    Serial.print("[ESP8266 SEND DEBUG] Target: ");
+    for(int i=0; i<6; i++) {
+        Serial.print(mac_addr[i], HEX);
+        if(i<5) Serial.print(":");
+    }
+    Serial.print(" Status: ");
+    if (sendStatus == 0){
+      Serial.println("SUCCESS (Delivery Confirmed)");
+    } else{
+      Serial.println("FAIL (No ACK)");
+    }
   }
-  Serial.print(" Status: ");
-  if (sendStatus == 0){
-    Serial.println("SUCCESS (Delivery Confirmed)");
-  } else{
-    Serial.println("FAIL (No ACK)");
+
+  txSent(mac_addr, sendStatus == 0);
+
+  if (_onDataSent) {
+    _onDataSent(mac_addr, sendStatus);
   }
 }
 
 void DomoticaEspNow::OnDataRecv(uint8_t *mac, uint8_t *incomingData, uint8_t len) {
-    if (_onDataReceived) {
+    if (!_onDataReceived) return;
+    if (_rawFrames) {
         _onDataReceived(mac, incomingData, len);
+    } else if (decodeFrame(mac, incomingData, len, &_rxDecoded)) {
+        _onDataReceived(mac, (uint8_t *) &_rxDecoded, sizeof(_rxDecoded));
     }
 }
 #endif
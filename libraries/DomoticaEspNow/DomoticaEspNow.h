@@ -11,31 +11,150 @@
   #include <ESP8266WiFi.h>
 #endif
 
-// Struttura unificata per i messaggi
-typedef struct struct_message {
-  char node[20];
-  char topic[20];
-  char command[20];
-  char status[100]; // Aumentato da 20 a 100 per supportare payload lunghi (es. OTA)
-  char type[20];
-  char gateway_id[20];  // ID univoco del gateway per auto-discovery
-} struct_message;
+#include "DomoticaProtocol.h"
+
+// Capability di questa versione della libreria (annunciate con REGISTER)
+#define DOMOTICA_LOCAL_CAPS   (DOMOTICA_CAP_COMPACT | DOMOTICA_CAP_RELIABLE | DOMOTICA_CAP_FRAG)
+
+// Peer con protocollo compatto negoziato (gli altri usano il formato legacy). A tabella
+// piena si sostituisce il meno recente, perdendone caps e finestra duplicati: il gateway
+// la porta a MAX_PEERS con build_opt.h (circa 44 byte per peer).
+#ifndef DOMOTICA_PROTO_PEERS
+#define DOMOTICA_PROTO_PEERS  32
+#endif
+
+// Statistiche di trasmissione/ricezione per formato
+struct DomoticaStats {
+  uint32_t framesSentLegacy;
+  uint32_t framesSentCompact;
+  uint32_t bytesSent;
+  uint32_t bytesSaved;        // Byte risparmiati rispetto all'invio legacy
+  uint32_t framesRecvLegacy;
+  uint32_t framesRecvCompact;
+  uint32_t framesInvalid;
+  uint32_t txDropped;         // Frame scartati a coda di trasmissione piena
+  uint32_t txBackoffs;        // Pause per congestione (fallimenti consecutivi)
+  uint8_t txQueueHighWater;   // Occupazione massima della coda
+  uint32_t peerHits;          // Invii verso un peer già registrato nello stack
+  uint32_t peerMisses;        // Invii che hanno richiesto la registrazione del peer
+  uint32_t peerEvictions;     // Peer LRU rimossi per fare spazio
+  uint32_t fragmentsSent;
+  uint32_t messagesReassembled;
+  uint32_t reassemblyDropped; // Messaggi incompleti scaduti o sfrattati
+};
+
+// --- MESSAGGI FRAMMENTATI --- //
+// send() spezza in frammenti gli status più lunghi di un campo di struct_message
+// (fino a DOMOTICA_MAX_PAYLOAD) verso i peer con DOMOTICA_CAP_FRAG; per gli altri
+// lo status viene troncato come prima. In ricezione il messaggio ricomposto arriva
+// al callback come struct_message (status troncato) e rxPayload() dà quello completo.
+#define DOMOTICA_REASM_SLOTS       2     // Messaggi in ricomposizione contemporanei (cap di memoria)
+#define DOMOTICA_REASM_TIMEOUT     1000  // ms per ricevere tutti i frammenti
+
+// Slot peer dello stack ESP-NOW gestiti dalla libreria (limite hardware: 20 non cifrati).
+// send() registra il destinatario al volo e a tabella piena sfratta il peer LRU,
+// quindi i peer logici dell'applicazione possono essere molti di più.
+#ifndef DOMOTICA_PEER_SLOTS
+#define DOMOTICA_PEER_SLOTS        20
+#endif
+
+// --- CODA DI TRASMISSIONE --- //
+// send() non chiama esp_now_send direttamente: il frame entra in una coda a priorità
+// e viene rilasciato quando OnDataSent conferma il frame precedente, con al massimo
+// DOMOTICA_TX_INFLIGHT frame in volo (DOMOTICA_TX_PEER_INFLIGHT per peer).
+// Dopo DOMOTICA_TX_FAIL_STREAK fallimenti consecutivi la coda si ferma con backoff
+// esponenziale. La coda avanza da send(), da loop() e, su ESP8266, a ogni yield() dopo
+// una conferma radio. send() non attende mai: a coda piena il frame meno importante
+// viene scartato e send() ritorna false se è quello nuovo.
+#ifndef DOMOTICA_TX_QUEUE
+#define DOMOTICA_TX_QUEUE          10
+#endif
+#ifndef DOMOTICA_TX_INFLIGHT
+#define DOMOTICA_TX_INFLIGHT       2
+#endif
+#ifndef DOMOTICA_TX_PEER_INFLIGHT
+#define DOMOTICA_TX_PEER_INFLIGHT  1
+#endif
+#define DOMOTICA_TX_SENT_TIMEOUT   50    // ms senza OnDataSent prima di liberare lo slot in volo
+#define DOMOTICA_TX_FAIL_STREAK    3
+#define DOMOTICA_TX_BACKOFF_MS     10
+#define DOMOTICA_TX_BACKOFF_MAX    320
+
+// Priorità di trasmissione, assegnata da send() in base a type/topic
+enum DomoticaTxPriority : uint8_t {
+  DOMOTICA_PRIO_CONTROL = 0,  // COMMAND, REGISTRATION, GATEWAY_INFO, RESPONSE, ACK, ritrasmissioni
+  DOMOTICA_PRIO_TELEMETRY,    // FEEDBACK, STATUS, heartbeat
+  DOMOTICA_PRIO_DISCOVERY     // Discovery e risposte discovery
+};
+
+// --- CONSEGNA AFFIDABILE --- //
+// sendReliable() numera il frame per peer, lo tiene in un pool finché arriva l'ACK e
+// lo ritrasmette con backoff esponenziale (a partire dall'esito di OnDataSent).
+// Il ricevente scarta i duplicati con una finestra di DOMOTICA_DUP_WINDOW seq.
+// ACK e ritrasmissioni partono da loop(), da chiamare nel loop() dello sketch.
+#define DOMOTICA_RELIABLE_SLOTS  6     // Frame in attesa di ACK
+#define DOMOTICA_RETRY_BASE_MS   30    // Attesa dopo il primo invio
+#define DOMOTICA_RETRY_MAX_MS    480   // Tetto del backoff
+#define DOMOTICA_MAX_ATTEMPTS    5     // Invii totali prima di dichiarare il frame perso
+#define DOMOTICA_ACK_QUEUE       8     // ACK in attesa di invio
+#define DOMOTICA_DUP_WINDOW      32    // Ampiezza finestra anti-duplicati (bit)
+
+// Statistiche di consegna per peer
+struct DomoticaPeerStats {
+  uint32_t reliableSent;      // Frame affidabili inviati
+  uint32_t delivered;         // Confermati da ACK
+  uint32_t retries;           // Ritrasmissioni
+  uint32_t failed;            // Abbandonati dopo DOMOTICA_MAX_ATTEMPTS
+  uint32_t duplicates;        // Duplicati scartati in ricezione
+};
 
 class DomoticaEspNow
 {
   public:
     DomoticaEspNow();
     void begin(bool master = false);
-    void send(uint8_t *address, const char* node, const char* topic, const char* command, const char* status, const char* type, const char* gateway_id = "");
+    // Accoda il frame. Ritorna false se è stato scartato (coda piena di frame più importanti).
+    bool send(const uint8_t *address, const char* node, const char* topic, const char* command, const char* status, const char* type, const char* gateway_id = "");
+    // Come send() ma con ACK e ritrasmissione. Ritorna false se il peer non supporta la
+    // modalità affidabile o il pool è pieno: il frame parte comunque una volta sola.
+    bool sendReliable(const uint8_t *address, const char* node, const char* topic, const char* command, const char* status, const char* type, const char* gateway_id = "");
+    void loop();
+    // Attende (bloccante) lo svuotamento della coda di trasmissione, es. prima di un riavvio.
+    // Ritorna false se allo scadere del timeout restano frame in coda o in volo.
+    bool flush(unsigned long timeoutMs);
+    static uint8_t txQueueCount();
     int addPeer(uint8_t *peer_addr);
     int removePeer(uint8_t *peer_addr);
     bool hasPeer(uint8_t *peer_addr);
     void clearPeers();
+    static uint8_t peerSlotCount();
     static void setDebug(bool debug);
+
+    // Negoziazione protocollo: send() usa il formato compatto solo verso i peer registrati qui
+    static void setPeerProtocol(const uint8_t *peer_addr, uint8_t version, uint32_t caps = 0);
+    static uint8_t getPeerProtocol(const uint8_t *peer_addr);
+    // Capability annunciate dal peer con REGISTER (0 se sconosciute)
+    static uint32_t getPeerCaps(const uint8_t *peer_addr);
+    // Capability dello sketch (es. DOMOTICA_CAP_GROUP) da annunciare oltre a DOMOTICA_LOCAL_CAPS
+    static void addLocalCaps(uint32_t caps);
+
+    // Con raw = true il callback utente riceve i byte radio invariati e li decodifica con
+    // decodeFrame() (es. direttamente in un buffer proprio); di default riceve sempre
+    // una struct_message completa, anche per i frame compatti.
+    static void setRawFrames(bool raw);
+    static bool decodeFrame(const uint8_t *mac, const uint8_t *data, int len, struct_message *out, DomoticaFrameInfo *info = NULL);
+    static const DomoticaStats& getStats();
+    // Status completo dell'ultimo messaggio decodificato: valido solo dentro il callback di ricezione
+    static const char* rxPayload();
+    static bool getPeerStats(const uint8_t *peer_addr, DomoticaPeerStats *out);
+
+    // Notifica (dal loop) dei frame affidabili abbandonati dopo l'ultimo tentativo
+    static void onDeliveryFailed(void (*cb)(const uint8_t *mac, uint16_t seq));
     #ifdef ESP32
     static void onDataReceived(void (*cb)(const uint8_t*, const uint8_t*, int));
 #elif defined(ESP8266)
     static void onDataReceived(void (*cb)(uint8_t*, uint8_t*, uint8_t));
+    static void onDataSent(void (*cb)(uint8_t*, uint8_t));
 #endif
 
 #ifdef ESP32
@@ -51,6 +170,7 @@ class DomoticaEspNow
     static void (*_onDataReceived)(const uint8_t*, const uint8_t*, int);
 #elif defined(ESP8266)
     static void (*_onDataReceived)(uint8_t*, uint8_t*, uint8_t);
+    static void (*_onDataSent)(uint8_t*, uint8_t);
 #endif
 };
 
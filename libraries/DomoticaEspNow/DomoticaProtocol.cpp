@@ -0,0 +1,314 @@
+#include "DomoticaProtocol.h"
+
+// Nomi dei tipi codificati nell'header (indice = DomoticaMsgType)
+static const char* const msgTypeNames[DMT_COUNT] = {
+  "",
+  "COMMAND",
+  "FEEDBACK",
+  "STATUS",
+  "DISCOVERY",
+  "REGISTRATION",
+  "GATEWAY_INFO",
+  "RESPONSE",
+  "discovery_response"
+};
+
+// Lunghezza massima utile di un campo di struct_message
+#define FIELD_MAX(f) (sizeof(((struct_message*)0)->f) - 1)
+
+static DomoticaMsgType msgTypeFromString(const char* type) {
+  for (uint8_t t = 1; t < DMT_COUNT; t++) {
+    if (strcmp(type, msgTypeNames[t]) == 0) return (DomoticaMsgType) t;
+  }
+  return DMT_OTHER;
+}
+
+static bool putVarint(uint8_t* buf, size_t size, size_t* pos, uint32_t value) {
+  do {
+    if (*pos >= size) return false;
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    buf[(*pos)++] = value ? (b | 0x80) : b;
+  } while (value);
+  return true;
+}
+
+static bool getVarint(const uint8_t* buf, int len, int* pos, uint32_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 32; shift += 7) {
+    if (*pos >= len) return false;
+    uint8_t b = buf[(*pos)++];
+    *value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+// Scrive un campo stringa; i campi vuoti non occupano spazio
+static bool putString(uint8_t* buf, size_t size, size_t* pos, uint8_t tag, const char* s, size_t maxLen) {
+  if (s == NULL) return true;
+  size_t len = strnlen(s, maxLen);
+  if (len == 0) return true;
+  if (*pos >= size) return false;
+  buf[(*pos)++] = tag;
+  if (!putVarint(buf, size, pos, len)) return false;
+  if (*pos + len > size) return false;
+  memcpy(buf + *pos, s, len);
+  *pos += len;
+  return true;
+}
+
+static void copyField(char* dest, size_t size, const uint8_t* src, uint32_t len) {
+  if (len > size - 1) len = size - 1;
+  memcpy(dest, src, len);
+  dest[len] = '\0';
+}
+
+static int encodeFields(uint8_t* buf, size_t size, const char* node, const char* topic, const char* command,
+                        const char* status, size_t statusMax, const char* type, const char* gateway_id,
+                        uint16_t seq, uint8_t flags, uint32_t caps) {
+  if (size < DOMOTICA_HEADER_SIZE) return 0;
+
+  uint8_t msgType = type ? msgTypeFromString(type) : DMT_OTHER;
+
+  buf[0] = DOMOTICA_FRAME_MAGIC;
+  buf[1] = DOMOTICA_PROTO_COMPACT;
+  buf[2] = msgType;
+  buf[3] = flags;
+  buf[4] = seq & 0xFF;
+  buf[5] = seq >> 8;
+  size_t pos = DOMOTICA_HEADER_SIZE;
+
+  bool ok = putString(buf, size, &pos, DTAG_NODE, node, FIELD_MAX(node)) &&
+            putString(buf, size, &pos, DTAG_TOPIC, topic, FIELD_MAX(topic)) &&
+            putString(buf, size, &pos, DTAG_COMMAND, command, FIELD_MAX(command)) &&
+            putString(buf, size, &pos, DTAG_STATUS, status, statusMax) &&
+            putString(buf, size, &pos, DTAG_GATEWAY_ID, gateway_id, FIELD_MAX(gateway_id));
+
+  if (ok && msgType == DMT_OTHER) {
+    ok = putString(buf, size, &pos, DTAG_TYPE, type, FIELD_MAX(type));
+  }
+  if (ok && caps != 0) {
+    // TLV con valore varint: la lunghezza resta esplicita per i decoder che non lo conoscono
+    uint8_t value[5];
+    size_t valueLen = 0;
+    putVarint(value, sizeof(value), &valueLen, caps);
+    ok = (pos + 2 + valueLen <= size);
+    if (ok) {
+      buf[pos++] = DTAG_CAPS;
+      buf[pos++] = valueLen;
+      memcpy(buf + pos, value, valueLen);
+      pos += valueLen;
+    }
+  }
+
+  return ok ? (int)pos : 0;
+}
+
+int domoticaEncodeFrame(uint8_t* buf, size_t size, const char* node, const char* topic, const char* command,
+                        const char* status, const char* type, const char* gateway_id,
+                        uint16_t seq, uint8_t flags, uint32_t caps) {
+  int len = encodeFields(buf, size, node, topic, command, status, FIELD_MAX(status), type, gateway_id, seq, flags, caps);
+  // Un frame lungo esattamente quanto struct_message verrebbe letto come legacy:
+  // in quel caso (tutti i campi quasi pieni) il chiamante invia il formato legacy
+  if (len == (int)sizeof(struct_message)) return 0;
+  return len;
+}
+
+// Lunghezza del frame che porta l'ultimo frammento del messaggio
+static int lastFragmentLen(int messageLen) {
+  int body = messageLen - DOMOTICA_HEADER_SIZE;
+  return DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER + body - (domoticaFragmentCount(messageLen) - 1) * DOMOTICA_FRAG_CHUNK;
+}
+
+int domoticaEncodeMessage(uint8_t* buf, size_t size, const char* node, const char* topic, const char* command,
+                          const char* status, const char* type, const char* gateway_id) {
+  int len = encodeFields(buf, size, node, topic, command, status, DOMOTICA_MAX_PAYLOAD, type, gateway_id, 0, 0, 0);
+  // Un frammento lungo esattamente quanto struct_message verrebbe letto come legacy:
+  // due byte di padding lo allungano (l'ultimo frammento ha sempre spazio)
+  if (len > 0 && lastFragmentLen(len) == (int)sizeof(struct_message)) {
+    if ((size_t)len + 2 > size) return 0;
+    buf[len++] = DTAG_PAD;
+    buf[len++] = 0;
+  }
+  return len;
+}
+
+int domoticaFragmentCount(int messageLen) {
+  int body = messageLen - DOMOTICA_HEADER_SIZE;
+  return (body + DOMOTICA_FRAG_CHUNK - 1) / DOMOTICA_FRAG_CHUNK;
+}
+
+int domoticaEncodeFragment(uint8_t* out, size_t size, const uint8_t* message, int messageLen,
+                           uint8_t msgId, uint8_t index, uint16_t seq, uint8_t flags) {
+  int count = domoticaFragmentCount(messageLen);
+  int offset = DOMOTICA_HEADER_SIZE + index * DOMOTICA_FRAG_CHUNK;
+  if (index >= count) return 0;
+  int chunk = messageLen - offset;
+  if (chunk > DOMOTICA_FRAG_CHUNK) chunk = DOMOTICA_FRAG_CHUNK;
+  if (size < (size_t)(DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER + chunk)) return 0;
+
+  out[0] = DOMOTICA_FRAME_MAGIC;
+  out[1] = DOMOTICA_PROTO_COMPACT;
+  out[2] = message[2];
+  out[3] = flags | DOMOTICA_FLAG_FRAG;
+  out[4] = seq & 0xFF;
+  out[5] = seq >> 8;
+  out[6] = msgId;
+  out[7] = index;
+  out[8] = count;
+  memcpy(out + DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER, message + offset, chunk);
+  return DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER + chunk;
+}
+
+int domoticaEncodeAck(uint8_t* buf, size_t size, uint16_t seq) {
+  if (size < DOMOTICA_HEADER_SIZE) return 0;
+  buf[0] = DOMOTICA_FRAME_MAGIC;
+  buf[1] = DOMOTICA_PROTO_COMPACT;
+  buf[2] = DMT_OTHER;
+  buf[3] = DOMOTICA_FLAG_ACK;
+  buf[4] = seq & 0xFF;
+  buf[5] = seq >> 8;
+  return DOMOTICA_HEADER_SIZE;
+}
+
+// Decodifica i TLV in out; lo status va in status/statusSize (out->status o un buffer più grande)
+static bool decodeTlv(const uint8_t* buf, int len, uint8_t msgType, struct_message* out,
+                      char* status, size_t statusSize, uint32_t* caps) {
+  out->node[0] = '\0';
+  out->topic[0] = '\0';
+  out->command[0] = '\0';
+  out->status[0] = '\0';
+  out->gateway_id[0] = '\0';
+  status[0] = '\0';
+  strcpy(out->type, msgTypeNames[msgType]);
+
+  *caps = 0;
+  int pos = 0;
+  while (pos < len) {
+    uint8_t tag = buf[pos++];
+    uint32_t fieldLen;
+    if (!getVarint(buf, len, &pos, &fieldLen)) return false;
+
+    if (fieldLen > (uint32_t)(len - pos)) return false;
+    const uint8_t* value = buf + pos;
+    pos += fieldLen;
+
+    switch (tag) {
+      case DTAG_CAPS: {
+        int capsPos = 0;
+        if (!getVarint(value, fieldLen, &capsPos, caps)) return false;
+        break;
+      }
+      case DTAG_NODE:       copyField(out->node, sizeof(out->node), value, fieldLen); break;
+      case DTAG_TOPIC:      copyField(out->topic, sizeof(out->topic), value, fieldLen); break;
+      case DTAG_COMMAND:    copyField(out->command, sizeof(out->command), value, fieldLen); break;
+      case DTAG_STATUS:     copyField(status, statusSize, value, fieldLen); break;
+      case DTAG_TYPE:       copyField(out->type, sizeof(out->type), value, fieldLen); break;
+      case DTAG_GATEWAY_ID: copyField(out->gateway_id, sizeof(out->gateway_id), value, fieldLen); break;
+      default: break; // Tag sconosciuto (versione futura): ignorato
+    }
+  }
+  return true;
+}
+
+bool domoticaDecodeFrame(const uint8_t* buf, int len, struct_message* out, DomoticaFrameInfo* info) {
+  // --- Formato legacy: struct_message completa --- //
+  if (len == (int)sizeof(struct_message)) {
+    memcpy(out, buf, sizeof(struct_message));
+    out->node[sizeof(out->node) - 1] = '\0';
+    out->topic[sizeof(out->topic) - 1] = '\0';
+    out->command[sizeof(out->command) - 1] = '\0';
+    out->status[sizeof(out->status) - 1] = '\0';
+    out->type[sizeof(out->type) - 1] = '\0';
+    out->gateway_id[sizeof(out->gateway_id) - 1] = '\0';
+
+    if (info) {
+      info->version = DOMOTICA_PROTO_LEGACY;
+      info->msgType = DMT_OTHER;
+      info->flags = 0;
+      info->seq = 0;
+      info->caps = 0;
+    }
+    return true;
+  }
+
+  // --- Formato compatto --- //
+  if (len < DOMOTICA_HEADER_SIZE || len > DOMOTICA_MAX_FRAME) return false;
+  if (buf[0] != DOMOTICA_FRAME_MAGIC || buf[1] != DOMOTICA_PROTO_COMPACT) return false;
+
+  uint8_t msgType = buf[2];
+  if (msgType >= DMT_COUNT) msgType = DMT_OTHER;
+
+  uint32_t caps = 0;
+  if (buf[3] & DOMOTICA_FLAG_FRAG) {
+    // Frammento: i TLV si decodificano solo a messaggio ricomposto
+    if (len < DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER) return false;
+    if (buf[8] == 0 || buf[8] > DOMOTICA_MAX_FRAGMENTS || buf[7] >= buf[8]) return false;
+  } else if (!decodeTlv(buf + DOMOTICA_HEADER_SIZE, len - DOMOTICA_HEADER_SIZE, msgType, out,
+                        out->status, sizeof(out->status), &caps)) {
+    return false;
+  }
+
+  if (info) {
+    info->version = DOMOTICA_PROTO_COMPACT;
+    info->msgType = msgType;
+    info->flags = buf[3];
+    info->seq = buf[4] | ((uint16_t)buf[5] << 8);
+    info->caps = caps;
+    if (buf[3] & DOMOTICA_FLAG_FRAG) {
+      info->fragId = buf[6];
+      info->fragIndex = buf[7];
+      info->fragCount = buf[8];
+      info->fragData = buf + DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER;
+      info->fragLen = len - DOMOTICA_HEADER_SIZE - DOMOTICA_FRAG_HEADER;
+    }
+  }
+  return true;
+}
+
+bool domoticaDecodeMessage(const uint8_t* body, int len, uint8_t msgType, struct_message* out,
+                           char* status, size_t statusSize) {
+  if (msgType >= DMT_COUNT) msgType = DMT_OTHER;
+  uint32_t caps;
+  if (!decodeTlv(body, len, msgType, out, status, statusSize, &caps)) return false;
+  copyField(out->status, sizeof(out->status), (const uint8_t*) status, strlen(status));
+  return true;
+}
+
+// --- COMANDI DI GRUPPO --- //
+bool domoticaEncodeGroup(const DomoticaGroupCommand& group, char* command, size_t commandSize,
+                         char* status, size_t statusSize) {
+  if (group.mask == 0) return false;
+
+  uint8_t channels = 0;
+  while (channels < DOMOTICA_GROUP_MAX_CHANNELS && (group.mask >> channels)) channels++;
+  if (statusSize < (size_t)channels + 1) return false;
+
+  int len = snprintf(command, commandSize, "%X", group.mask);
+  if (len <= 0 || (size_t)len >= commandSize) return false;
+
+  for (uint8_t c = 0; c < channels; c++) {
+    status[c] = (group.mask & (1u << c)) ? group.action[c] : '-';
+  }
+  status[channels] = '\0';
+  return true;
+}
+
+bool domoticaDecodeGroup(const char* command, const char* status, DomoticaGroupCommand* out) {
+  char* end;
+  unsigned long mask = strtoul(command, &end, 16);
+  if (end == command || *end != '\0' || mask == 0 || mask >> DOMOTICA_GROUP_MAX_CHANNELS) return false;
+
+  size_t statusLen = strlen(status);
+  out->mask = mask;
+  for (uint8_t c = 0; c < DOMOTICA_GROUP_MAX_CHANNELS; c++) {
+    out->action[c] = '-';
+    if (!(mask & (1ul << c))) continue;
+    if (c >= statusLen) return false;
+    char a = status[c];
+    if (a != '0' && a != '1' && a != '2') return false;
+    out->action[c] = a;
+  }
+  return true;
+}
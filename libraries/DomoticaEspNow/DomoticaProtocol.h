@@ -0,0 +1,146 @@
+#ifndef DomoticaProtocol_h
+#define DomoticaProtocol_h
+
+#include "Arduino.h"
+
+// Struttura unificata per i messaggi (formato legacy, protocollo 1)
+typedef struct struct_message {
+  char node[20];
+  char topic[20];
+  char command[20];
+  char status[100]; // Aumentato da 20 a 100 per supportare payload lunghi (es. OTA)
+  char type[20];
+  char gateway_id[20];  // ID univoco del gateway per auto-discovery
+} struct_message;
+
+// --- FORMATO COMPATTO (PROTOCOLLO 2) --- //
+// Header fisso di 6 byte seguito da campi TLV: tag (1 byte), lunghezza (varint), valore.
+// I campi vuoti non vengono trasmessi e il campo "type" più comune viaggia come enum
+// nell'header. Un frame lungo esattamente sizeof(struct_message) è sempre legacy
+// (l'encoder non produce mai quella lunghezza), qualsiasi altra lunghezza è compatta.
+//
+//   0       1         2         3       4..5
+//  [0xD7][version][msgType][flags][seq LE] [tag][len][valore] ...
+
+#define DOMOTICA_FRAME_MAGIC    0xD7
+#define DOMOTICA_PROTO_LEGACY   1
+#define DOMOTICA_PROTO_COMPACT  2
+#define DOMOTICA_PROTO_TOKEN    "P2"   // Annunciato dal gateway nello status di DISCOVERY RESPONSE
+#define DOMOTICA_HEADER_SIZE    6
+#define DOMOTICA_MAX_FRAME      250    // Payload massimo ESP-NOW
+
+// Capability annunciate nel TLV CAPS (inviato con REGISTER)
+#define DOMOTICA_CAP_COMPACT    0x01
+#define DOMOTICA_CAP_RELIABLE   0x02   // Gestisce ACK e finestra anti-duplicati
+#define DOMOTICA_CAP_FRAG       0x04   // Riassembla messaggi in più frammenti
+#define DOMOTICA_CAP_GROUP      0x08   // Esegue i comandi di gruppo (annunciato dallo sketch)
+
+// Flag dell'header
+#define DOMOTICA_FLAG_ACK_REQ   0x01   // Il mittente attende un ACK con lo stesso seq
+#define DOMOTICA_FLAG_ACK       0x02   // Frame di sola conferma (header senza TLV)
+#define DOMOTICA_FLAG_FRAG      0x04   // Frammento: dopo l'header [msgId][index][count] + dati
+
+// --- FRAMMENTAZIONE --- //
+// Un messaggio con status lungo (fino a DOMOTICA_MAX_PAYLOAD caratteri) viene codificato
+// come un unico frame compatto "virtuale" e spezzato: ogni frammento ripete l'header con
+// DOMOTICA_FLAG_FRAG e porta un pezzo dei TLV. Il ricevente li ricompone per posizione.
+#define DOMOTICA_MAX_PAYLOAD    400    // Lunghezza massima dello status di un messaggio frammentato
+#define DOMOTICA_MAX_MESSAGE    560    // Header + TLV del messaggio completo
+#define DOMOTICA_FRAG_HEADER    3
+#define DOMOTICA_FRAG_CHUNK     (DOMOTICA_MAX_FRAME - DOMOTICA_HEADER_SIZE - DOMOTICA_FRAG_HEADER)
+#define DOMOTICA_MAX_FRAGMENTS  ((DOMOTICA_MAX_MESSAGE - DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_CHUNK - 1) / DOMOTICA_FRAG_CHUNK)
+
+// --- COMANDI DI GRUPPO --- //
+// Un solo frame COMMAND con topic DOMOTICA_GROUP_TOPIC comanda più canali del nodo:
+// command = maschera dei canali in esadecimale (bit 0 = canale 1), status = un'azione
+// per canale in ordine di posizione ('0' spegni, '1' accendi, '2' inverti, '-' fuori
+// maschera). Il nodo applica tutte le azioni e risponde con un solo FEEDBACK sullo
+// stesso topic con lo stato completo dei canali.
+#define DOMOTICA_GROUP_TOPIC        "GROUP"
+#define DOMOTICA_GROUP_MAX_CHANNELS 16
+
+struct DomoticaGroupCommand {
+  uint16_t mask;
+  char action[DOMOTICA_GROUP_MAX_CHANNELS];   // Significativa solo per i bit della maschera
+};
+
+enum DomoticaMsgType : uint8_t {
+  DMT_OTHER = 0,          // Tipo non in tabella: viaggia come TLV stringa
+  DMT_COMMAND,
+  DMT_FEEDBACK,
+  DMT_STATUS,
+  DMT_DISCOVERY,
+  DMT_REGISTRATION,
+  DMT_GATEWAY_INFO,
+  DMT_RESPONSE,
+  DMT_DISCOVERY_RESPONSE,
+  DMT_COUNT
+};
+
+enum DomoticaTag : uint8_t {
+  DTAG_NODE = 1,
+  DTAG_TOPIC,
+  DTAG_COMMAND,
+  DTAG_STATUS,
+  DTAG_TYPE,
+  DTAG_GATEWAY_ID,
+  DTAG_CAPS,              // varint
+  DTAG_PAD                // Vuoto: ignorato in decodifica
+};
+
+// Metadati del frame ricevuto (per i frame legacy version = DOMOTICA_PROTO_LEGACY)
+struct DomoticaFrameInfo {
+  uint8_t version;
+  uint8_t msgType;
+  uint8_t flags;
+  uint16_t seq;
+  uint32_t caps;
+  // Solo per i frammenti (flags & DOMOTICA_FLAG_FRAG): i TLV non sono decodificati
+  uint8_t fragId;
+  uint8_t fragIndex;
+  uint8_t fragCount;
+  const uint8_t* fragData;    // Punta dentro il buffer ricevuto
+  uint8_t fragLen;
+};
+
+// Codifica i sei campi in formato compatto. Ritorna la lunghezza del frame o 0 se non entra.
+// Le stringhe vengono troncate alle stesse dimensioni di struct_message.
+int domoticaEncodeFrame(uint8_t* buf, size_t size, const char* node, const char* topic, const char* command,
+                        const char* status, const char* type, const char* gateway_id,
+                        uint16_t seq, uint8_t flags, uint32_t caps);
+
+// Codifica un ACK (solo header) per il seq indicato. Ritorna la lunghezza del frame.
+int domoticaEncodeAck(uint8_t* buf, size_t size, uint16_t seq);
+
+// Come domoticaEncodeFrame ma con status fino a DOMOTICA_MAX_PAYLOAD: il risultato
+// (fino a DOMOTICA_MAX_MESSAGE byte) va spedito con domoticaEncodeFragment().
+// Se l'ultimo frammento sarebbe lungo quanto struct_message il messaggio riceve un
+// TLV DTAG_PAD vuoto, come fa domoticaEncodeFrame ripiegando sul formato legacy.
+int domoticaEncodeMessage(uint8_t* buf, size_t size, const char* node, const char* topic, const char* command,
+                          const char* status, const char* type, const char* gateway_id);
+
+int domoticaFragmentCount(int messageLen);
+
+// Scrive in out il frammento index del messaggio. Ritorna la lunghezza del frame.
+int domoticaEncodeFragment(uint8_t* out, size_t size, const uint8_t* message, int messageLen,
+                           uint8_t msgId, uint8_t index, uint16_t seq, uint8_t flags);
+
+// Decodifica un frame legacy o compatto in out (campi sempre terminati).
+// Per i frammenti compila solo info (fragId/fragIndex/fragCount/fragData).
+// Ritorna false se il frame non è riconosciuto o è malformato.
+bool domoticaDecodeFrame(const uint8_t* buf, int len, struct_message* out, DomoticaFrameInfo* info);
+
+// Compone i campi command (maschera) e status (azioni) di un comando di gruppo.
+// Ritorna false se la maschera è vuota o i buffer non bastano.
+bool domoticaEncodeGroup(const DomoticaGroupCommand& group, char* command, size_t commandSize,
+                         char* status, size_t statusSize);
+
+// Interpreta command/status di un comando di gruppo ricevuto. false se malformato.
+bool domoticaDecodeGroup(const char* command, const char* status, DomoticaGroupCommand* out);
+
+// Decodifica i TLV di un messaggio riassemblato (body = byte dopo l'header).
+// Lo status completo va in status (statusSize incluso il terminatore), quello in out è troncato.
+bool domoticaDecodeMessage(const uint8_t* body, int len, uint8_t msgType, struct_message* out,
+                           char* status, size_t statusSize);
+
+#endif
@@ -0,0 +1,91 @@
+// --- ESP-NOW EMULATO --- //
+// Tabella peer con il limite dello stack ESP8266 (20 peer non cifrati), frame inviati
+// registrati per il test e OnDataSent consegnato in differita secondo il link scelto.
+#include "HostFakes.h"
+#include <espnow.h>
+
+#define HOST_ESPNOW_MAX_PEERS 20
+
+struct HostPeer {
+    uint8_t mac[6];
+};
+
+static std::vector<HostPeer> peers;
+static std::vector<HostFrame> sent;
+static std::vector<HostFrame> inFlight;
+static esp_now_send_cb_t sendCb = nullptr;
+static esp_now_recv_cb_t recvCb = nullptr;
+static std::function<bool(const HostFrame&)> link;
+
+static int findPeer(const uint8_t* mac) {
+    for (size_t i = 0; i < peers.size(); i++) {
+        if (memcmp(peers[i].mac, mac, 6) == 0) return (int) i;
+    }
+    return -1;
+}
+
+int esp_now_init() { return 0; }
+int esp_now_deinit() { peers.clear(); return 0; }
+int esp_now_set_self_role(uint8_t) { return 0; }
+int esp_now_register_send_cb(esp_now_send_cb_t cb) { sendCb = cb; return 0; }
+int esp_now_register_recv_cb(esp_now_recv_cb_t cb) { recvCb = cb; return 0; }
+
+int esp_now_add_peer(uint8_t* mac, uint8_t, uint8_t, uint8_t*, uint8_t) {
+    if (findPeer(mac) >= 0) return 0;
+    if (peers.size() >= HOST_ESPNOW_MAX_PEERS) return -1;
+    HostPeer p;
+    memcpy(p.mac, mac, 6);
+    peers.push_back(p);
+    return 0;
+}
+
+int esp_now_del_peer(uint8_t* mac) {
+    int i = findPeer(mac);
+    if (i < 0) return -1;
+    peers.erase(peers.begin() + i);
+    return 0;
+}
+
+int esp_now_is_peer_exist(uint8_t* mac) { return findPeer(mac) >= 0 ? 1 : 0; }
+
+int esp_now_send(uint8_t* mac, uint8_t* data, int len) {
+    // Come lo stack reale: destinatario non registrato o frame oltre 250 byte rifiutati
+    if (!mac || findPeer(mac) < 0 || len <= 0 || len > 250) return -1;
+    HostFrame f;
+    memcpy(f.mac, mac, 6);
+    f.data.assign(data, data + len);
+    f.at = millis();
+    sent.push_back(f);
+    inFlight.push_back(f);
+    return 0;
+}
+
+int esp_now_get_cnt_info(unsigned char* all, unsigned char* encrypted) {
+    if (all) *all = (unsigned char) peers.size();
+    if (encrypted) *encrypted = 0;
+    return 0;
+}
+
+std::vector<HostFrame>& hostEspNowSent() { return sent; }
+
+void hostEspNowSetLink(std::function<bool(const HostFrame&)> delivered) { link = delivered; }
+
+void hostEspNowDeliverSent() {
+    // Solo i frame già in volo: quelli partiti dai callback aspettano il giro successivo
+    std::vector<HostFrame> batch;
+    batch.swap(inFlight);
+    for (HostFrame& f : batch) {
+        bool ok = link ? link(f) : true;
+        if (sendCb) sendCb(f.mac, ok ? 0 : 1);
+    }
+}
+
+void hostEspNowReceive(const uint8_t* mac, const uint8_t* data, int len) {
+    if (!recvCb) return;
+    uint8_t macCopy[6];
+    memcpy(macCopy, mac, 6);
+    std::vector<uint8_t> copy(data, data + len);
+    recvCb(macCopy, copy.data(), (uint8_t) len);
+}
+
+int hostEspNowPeerCount() { return (int) peers.size(); }
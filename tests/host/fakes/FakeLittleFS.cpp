@@ -0,0 +1,133 @@
+// --- LITTLEFS IN MEMORIA --- //
+// File in una mappa path -> contenuto. Ogni write() conta come una scrittura su flash:
+// i test misurano chiamate e byte scritti (amplificazione) e troncano i file per
+// simulare uno spegnimento a metà scrittura.
+#include "HostFakes.h"
+#include <LittleFS.h>
+#include <map>
+
+struct HostFileData {
+    std::string bytes;
+};
+
+FS LittleFS;
+
+static std::map<std::string, std::shared_ptr<HostFileData>> files;
+static uint32_t writeCalls = 0;
+static uint32_t bytesWritten = 0;
+
+File::File(std::shared_ptr<HostFileData> data, const char* path, bool write, bool append)
+    : _data(data), _name(path), _pos(append ? data->bytes.size() : 0), _write(write) {}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+    if (!_data || !_write || size == 0) return 0;
+    if (_pos > _data->bytes.size()) _pos = _data->bytes.size();
+    _data->bytes.replace(_pos, std::min(size, _data->bytes.size() - _pos), (const char*) buffer, size);
+    _pos += size;
+    writeCalls++;
+    bytesWritten += size;
+    return size;
+}
+
+int File::available() {
+    return (_data && _pos < _data->bytes.size()) ? (int) (_data->bytes.size() - _pos) : 0;
+}
+
+int File::read() {
+    if (!available()) return -1;
+    return (uint8_t) _data->bytes[_pos++];
+}
+
+int File::peek() {
+    if (!available()) return -1;
+    return (uint8_t) _data->bytes[_pos];
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+    size_t n = std::min(size, (size_t) available());
+    if (n) memcpy(buffer, _data->bytes.data() + _pos, n);
+    _pos += n;
+    return n;
+}
+
+bool File::seek(uint32_t pos) {
+    if (!_data || pos > _data->bytes.size()) return false;
+    _pos = pos;
+    return true;
+}
+
+size_t File::size() const { return _data ? _data->bytes.size() : 0; }
+
+void File::close() { _data.reset(); }
+
+bool FS::format() {
+    files.clear();
+    return true;
+}
+
+File FS::open(const char* path, const char* mode) {
+    auto it = files.find(path);
+    if (mode[0] == 'r') {
+        if (it == files.end()) return File();
+        return File(it->second, path, mode[1] == '+', false);
+    }
+    if (it == files.end()) {
+        auto data = std::make_shared<HostFileData>();
+        files[path] = data;
+        return File(data, path, true, false);
+    }
+    if (mode[0] == 'w') it->second->bytes.clear();
+    return File(it->second, path, true, mode[0] == 'a');
+}
+
+bool FS::exists(const char* path) { return files.count(path) > 0; }
+
+bool FS::remove(const char* path) { return files.erase(path) > 0; }
+
+bool FS::rename(const char* from, const char* to) {
+    auto it = files.find(from);
+    if (it == files.end()) return false;
+    std::shared_ptr<HostFileData> data = it->second;
+    files.erase(it);
+    files[to] = data;
+    return true;
+}
+
+bool FS::info(FSInfo& info) {
+    size_t used = 0;
+    for (auto& f : files) used += ((f.second->bytes.size() + 4095) / 4096 + 1) * 4096;
+    info.totalBytes = 1024 * 1024;
+    info.usedBytes = used;
+    info.blockSize = 4096;
+    info.pageSize = 256;
+    info.maxOpenFiles = 5;
+    info.maxPathLength = 32;
+    return true;
+}
+
+// --- CONTROLLO --- //
+void hostFsPut(const char* path, const std::string& content) {
+    auto data = std::make_shared<HostFileData>();
+    data->bytes = content;
+    files[path] = data;
+}
+
+std::string hostFsGet(const char* path) {
+    auto it = files.find(path);
+    return it == files.end() ? std::string() : it->second->bytes;
+}
+
+bool hostFsTruncate(const char* path, size_t size) {
+    auto it = files.find(path);
+    if (it == files.end() || size > it->second->bytes.size()) return false;
+    it->second->bytes.resize(size);
+    return true;
+}
+
+uint32_t hostFsWriteCalls() { return writeCalls; }
+uint32_t hostFsBytesWritten() { return bytesWritten; }
+
+void hostFsResetCounters() {
+    writeCalls = 0;
+    bytesWritten = 0;
+}
@@ -0,0 +1,85 @@
+// --- lwIP EMULATO --- //
+// DNS e sonda TCP di MqttSession: le richieste restano in attesa e vengono risolte da
+// hostNetPump() (chiamata da hostLoop) secondo lo stato del broker, come farebbe lo
+// stack tra due giri del loop.
+#include "HostFakes.h"
+#include <ESP8266WiFi.h>
+#include <lwip/dns.h>
+#include <lwip/tcp.h>
+#include <algorithm>
+
+struct tcp_pcb {
+    tcp_err_fn err = nullptr;
+    tcp_connected_fn connected = nullptr;
+    bool connecting = false;
+};
+
+static std::vector<tcp_pcb*> pcbs;
+static HostBrokerState broker = HOST_BROKER_UP;
+
+struct PendingDns {
+    dns_found_callback found;
+    void* arg;
+    std::string name;
+};
+static std::vector<PendingDns> dnsQueue;
+
+HostBrokerState hostBrokerState() { return broker; }   // FakeMqtt.cpp
+void hostBrokerSet(HostBrokerState state) { broker = state; }
+
+static void release(tcp_pcb* pcb) {
+    pcbs.erase(std::remove(pcbs.begin(), pcbs.end(), pcb), pcbs.end());
+    delete pcb;
+}
+
+struct tcp_pcb* tcp_new(void) {
+    tcp_pcb* pcb = new tcp_pcb();
+    pcbs.push_back(pcb);
+    return pcb;
+}
+
+void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err) { pcb->err = err; }
+
+err_t tcp_connect(struct tcp_pcb* pcb, const ip_addr_t*, uint16_t, tcp_connected_fn connected) {
+    pcb->connected = connected;
+    pcb->connecting = true;
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb* pcb) {
+    tcp_err_fn err = pcb->err;
+    release(pcb);
+    if (err) err(nullptr, ERR_ABRT);
+}
+
+err_t dns_gethostbyname(const char* hostname, ip_addr_t*, dns_found_callback found, void* arg) {
+    dnsQueue.push_back(PendingDns{found, arg, hostname});
+    return ERR_INPROGRESS;
+}
+
+void hostNetPump() {
+    std::vector<PendingDns> answers;
+    answers.swap(dnsQueue);
+    for (PendingDns& q : answers) {
+        ip_addr_t addr;
+        addr.addr = (uint32_t) IPAddress(192, 168, 99, 15);
+        q.found(q.name.c_str(), &addr, q.arg);
+    }
+
+    std::vector<tcp_pcb*> pending;
+    for (tcp_pcb* pcb : pcbs) {
+        if (pcb->connecting) pending.push_back(pcb);
+    }
+    for (tcp_pcb* pcb : pending) {
+        if (broker == HOST_BROKER_SILENT) continue;   // SYN senza risposta
+        pcb->connecting = false;
+        if (broker == HOST_BROKER_UP || broker == HOST_BROKER_STALLED) {
+            // Il callback può chiudere il pcb (tcp_abort): non va più toccato dopo
+            pcb->connected(nullptr, pcb, ERR_OK);
+        } else {
+            tcp_err_fn err = pcb->err;
+            release(pcb);
+            if (err) err(nullptr, ERR_RST);
+        }
+    }
+}
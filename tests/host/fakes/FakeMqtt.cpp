@@ -0,0 +1,116 @@
+// --- BROKER MQTT EMULATO --- //
+// PubSubClient con sessione in processo: registra ogni publish, applica il limite del
+// buffer come la libreria reale e consegna i messaggi iniettati dal test da loop().
+#include "HostFakes.h"
+#include <PubSubClient.h>
+#include <deque>
+
+HostBrokerState hostBrokerState();   // FakeLwip.cpp
+
+static std::vector<HostPublish> published;
+static std::deque<std::pair<std::string, std::string>> inbound;
+static bool recording = true;
+static bool sessionOpen = false;
+static int lastState = MQTT_DISCONNECTED;
+static int connects = 0;
+
+// Publish in streaming (beginPublish/write/endPublish)
+static std::string streamTopic;
+static std::string streamPayload;
+static bool streamRetained = false;
+static bool streaming = false;
+
+std::vector<HostPublish>& hostMqttPublished() { return published; }
+int hostMqttConnects() { return connects; }
+void hostMqttRecord(bool record) { recording = record; }
+
+void hostMqttInject(const char* topic, const std::string& payload) {
+    inbound.emplace_back(topic, payload);
+}
+
+PubSubClient& PubSubClient::setServer(const char*, uint16_t) { return *this; }
+PubSubClient& PubSubClient::setServer(IPAddress, uint16_t) { return *this; }
+
+bool PubSubClient::connect(const char*, const char*, const char*, const char*, uint8_t, bool,
+                           const char*, bool) {
+    if (hostBrokerState() == HOST_BROKER_STALLED) {
+        // CONNECT inviato, CONNACK mai arrivato: la libreria resta nel ciclo di attesa
+        hostAdvance(_socketTimeout * 1000UL);
+        sessionOpen = false;
+        lastState = MQTT_CONNECTION_TIMEOUT;
+        return false;
+    }
+    if (hostBrokerState() != HOST_BROKER_UP) {
+        sessionOpen = false;
+        lastState = MQTT_CONNECT_FAILED;
+        return false;
+    }
+    sessionOpen = true;
+    lastState = MQTT_CONNECTED;
+    connects++;
+    return true;
+}
+
+void PubSubClient::disconnect() {
+    sessionOpen = false;
+    lastState = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::connected() {
+    if (sessionOpen && hostBrokerState() != HOST_BROKER_UP) {
+        sessionOpen = false;
+        lastState = MQTT_CONNECTION_LOST;
+    }
+    return sessionOpen;
+}
+
+int PubSubClient::state() { return lastState; }
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (!connected()) return false;
+    // Header fisso (fino a 5 byte) + lunghezza del topic (2) + topic + payload nel buffer
+    if (5 + 2 + strlen(topic) + length > _bufferSize) return false;
+    if (!recording) return true;
+    published.push_back(HostPublish{topic, std::string((const char*) payload, length), retained, millis()});
+    return true;
+}
+
+bool PubSubClient::beginPublish(const char* topic, unsigned int, bool retained) {
+    if (!connected()) return false;
+    streaming = true;
+    if (!recording) return true;
+    streamTopic = topic;
+    streamPayload.clear();
+    streamRetained = retained;
+    return true;
+}
+
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+    if (!streaming) return 0;
+    if (recording) streamPayload.append((const char*) buffer, size);
+    return size;
+}
+
+int PubSubClient::endPublish() {
+    if (!streaming) return 0;
+    streaming = false;
+    if (!connected()) return 0;
+    if (recording) published.push_back(HostPublish{streamTopic, streamPayload, streamRetained, millis()});
+    return 1;
+}
+
+bool PubSubClient::subscribe(const char*, uint8_t) { return connected(); }
+
+bool PubSubClient::loop() {
+    if (!connected()) return false;
+    // Come la libreria reale: al massimo un pacchetto per chiamata
+    if (inbound.empty()) return true;
+    std::pair<std::string, std::string> m = inbound.front();
+    inbound.pop_front();
+    if (!_callback) return true;
+    std::vector<uint8_t> payload(m.second.begin(), m.second.end());
+    std::vector<char> topic(m.first.begin(), m.first.end());
+    topic.push_back('\0');
+    _callback(topic.data(), payload.data(), payload.size());
+    return true;
+}
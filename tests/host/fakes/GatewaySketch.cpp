@@ -0,0 +1,2 @@
+// Lo sketch compilato come unità C++: setup() e loop() reali per i test
+#include "../../../ESP8266_Gateway_mqtt/ESP8266_Gateway_mqtt.ino"
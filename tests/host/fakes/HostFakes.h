@@ -0,0 +1,102 @@
+#ifndef HOST_FAKES_H
+#define HOST_FAKES_H
+
+// --- CONTROLLO DEI FAKE HOST --- //
+// API con cui i test pilotano orologio, radio, broker e file system emulati.
+// Ogni eseguibile di test è un processo a sé: lo stato globale del gateway e della
+// libreria parte pulito a ogni test.
+#include <Arduino.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// --- OROLOGIO --- //
+// millis() avanza solo quando lo chiede il test (o con delay(), che conta il tempo
+// "perso" in attesa: un loop che non blocca mantiene hostDelayedMs() a zero).
+void hostSetMillis(unsigned long ms);
+void hostAdvance(unsigned long ms);
+unsigned long hostDelayedMs();
+void hostResetDelayed();
+
+// Funzioni ricorrenti del core (Schedule.h) e callback di rete in attesa
+void hostRunScheduled();
+
+// Un giro dello sketch come sul dispositivo: loop(), poi quello che il core e lo stack
+// WiFi fanno tra due giri (funzioni ricorrenti, esiti lwIP, conferme ESP-NOW)
+void hostLoop();
+
+// --- GATEWAY --- //
+// setup() reale con /config.json (WiFi configurato, broker 192.168.99.15, id GW_TEST,
+// più le chiavi di extraConfig, es. "\"outbox_spill\":true"), poi giri del loop fino
+// alla sessione MQTT. Restituisce false se il broker non è stato raggiunto.
+bool hostBoot(const char* extraConfig = nullptr);
+
+// Giri del loop per ms millisecondi, avanzando l'orologio di stepMs a ogni giro
+void hostLoopFor(unsigned long ms, unsigned long stepMs = 1);
+
+// --- NODI SIMULATI --- //
+// MAC distinto per il nodo n (02:00:00:00:hi:lo)
+void hostNodeMac(uint8_t* mac, int n);
+
+// Frame legacy (struct_message) dal nodo verso il gateway GW_TEST
+void hostNodeSend(const uint8_t* mac, const char* node, const char* topic, const char* command,
+                  const char* status, const char* type);
+
+// REGISTER "tipo|1.0" seguito da un giro del loop che lo elabora
+void hostNodeRegister(const uint8_t* mac, const char* node, const char* nodeType);
+
+// --- ESP-NOW --- //
+struct HostFrame {
+    uint8_t mac[6];
+    std::vector<uint8_t> data;
+    unsigned long at;
+};
+
+// Frame passati a esp_now_send, in ordine
+std::vector<HostFrame>& hostEspNowSent();
+
+// Esito radio di ogni frame (true = ACK del destinatario). Predefinito: sempre consegnato.
+void hostEspNowSetLink(std::function<bool(const HostFrame&)> delivered);
+
+// Consegna gli OnDataSent dei frame in volo secondo il link (fatto anche da hostLoop)
+void hostEspNowDeliverSent();
+
+// Frame in ingresso dal nodo mac
+void hostEspNowReceive(const uint8_t* mac, const uint8_t* data, int len);
+
+int hostEspNowPeerCount();
+
+// --- BROKER MQTT --- //
+enum HostBrokerState {
+    HOST_BROKER_UP,        // Sonda TCP e CONNECT riescono
+    HOST_BROKER_REFUSED,   // RST immediato alla sonda
+    HOST_BROKER_SILENT,    // Nessuna risposta: la sonda scade sul timeout del gateway
+    HOST_BROKER_STALLED    // Accetta la connessione TCP ma non manda mai il CONNACK
+};
+void hostBrokerSet(HostBrokerState state);
+
+struct HostPublish {
+    std::string topic;
+    std::string payload;
+    bool retained;
+    unsigned long at;
+};
+std::vector<HostPublish>& hostMqttPublished();
+int hostMqttConnects();
+
+// Con record = false i publish riescono ma non vengono registrati: il fake non alloca
+// e i benchmark contano solo le allocazioni del gateway
+void hostMqttRecord(bool record);
+
+// Messaggio dal broker, consegnato al callback dal prossimo mqttClient.loop()
+void hostMqttInject(const char* topic, const std::string& payload);
+
+// --- LITTLEFS --- //
+void hostFsPut(const char* path, const std::string& content);   // Senza contare scritture
+std::string hostFsGet(const char* path);
+bool hostFsTruncate(const char* path, size_t size);              // Spegnimento a metà scrittura
+uint32_t hostFsWriteCalls();
+uint32_t hostFsBytesWritten();
+void hostFsResetCounters();
+
+#endif
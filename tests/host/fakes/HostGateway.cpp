@@ -0,0 +1,65 @@
+// --- AVVIO DEL GATEWAY SULL'HOST --- //
+#include "HostFakes.h"
+#include "MqttHandler.h"
+#include <DomoticaProtocol.h>
+
+void setup();
+
+bool hostBoot(const char* extraConfig) {
+    std::string config =
+        "{\"wifi_ssid\":\"host\",\"wifi_password\":\"host\",\"network_mode\":\"dhcp\","
+        "\"mqtt_server\":\"192.168.99.15\",\"mqtt_port\":1883,\"gateway_id\":\"GW_TEST\","
+        "\"mqtt_topic_prefix\":\"domoriky\",\"led_enabled\":false";
+    if (extraConfig && *extraConfig) {
+        config += ",";
+        config += extraConfig;
+    }
+    config += "}";
+    hostFsPut("/config.json", config);
+
+    hostSetMillis(1000);
+    setup();
+    hostResetDelayed();
+    for (int i = 0; i < 100 && !mqttConnected; i++) {
+        hostAdvance(10);
+        hostLoop();
+    }
+    return mqttConnected;
+}
+
+void hostLoopFor(unsigned long ms, unsigned long stepMs) {
+    for (unsigned long t = 0; t < ms; t += stepMs) {
+        hostAdvance(stepMs);
+        hostLoop();
+    }
+}
+
+// --- NODI SIMULATI --- //
+void hostNodeMac(uint8_t* mac, int n) {
+    const uint8_t base[6] = {0x02, 0x00, 0x00, 0x00, (uint8_t) (n >> 8), (uint8_t) n};
+    memcpy(mac, base, 6);
+}
+
+static void field(char* dest, size_t size, const char* src) {
+    strncpy(dest, src ? src : "", size - 1);
+    dest[size - 1] = '\0';
+}
+
+void hostNodeSend(const uint8_t* mac, const char* node, const char* topic, const char* command,
+                  const char* status, const char* type) {
+    struct_message msg;
+    memset(&msg, 0, sizeof(msg));
+    field(msg.node, sizeof(msg.node), node);
+    field(msg.topic, sizeof(msg.topic), topic);
+    field(msg.command, sizeof(msg.command), command);
+    field(msg.status, sizeof(msg.status), status);
+    field(msg.type, sizeof(msg.type), type);
+    field(msg.gateway_id, sizeof(msg.gateway_id), "GW_TEST");
+    hostEspNowReceive(mac, (const uint8_t*) &msg, sizeof(msg));
+}
+
+void hostNodeRegister(const uint8_t* mac, const char* node, const char* nodeType) {
+    std::string status = std::string(nodeType) + "|1.0";
+    hostNodeSend(mac, node, "CONTROL", "REGISTER", status.c_str(), "REGISTRATION");
+    hostLoop();
+}
@@ -0,0 +1,167 @@
+// --- PIATTAFORMA HOST --- //
+// Orologio pilotato dal test, Serial, pin, casuale deterministico, funzioni ricorrenti
+// del core e oggetti globali del core ESP8266.
+#include "HostFakes.h"
+#include <ESP8266WiFi.h>
+#include <ESP8266httpUpdate.h>
+#include <ArduinoOTA.h>
+#include <Schedule.h>
+
+void setup();
+void loop();
+void hostNetPump();   // FakeLwip.cpp
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+ArduinoOTAClass ArduinoOTA;
+ESP8266HTTPUpdate ESPhttpUpdate;
+UpdaterClass Update;
+
+// --- OROLOGIO --- //
+static unsigned long clockMs = 0;
+static unsigned long clockUs = 0;
+static unsigned long delayedMs = 0;
+
+unsigned long millis() { return clockMs; }
+unsigned long micros() { return clockMs * 1000UL + clockUs; }
+
+void hostSetMillis(unsigned long ms) { clockMs = ms; clockUs = 0; }
+unsigned long hostDelayedMs() { return delayedMs; }
+void hostResetDelayed() { delayedMs = 0; }
+
+void hostAdvance(unsigned long ms) {
+    clockMs += ms;
+    hostRunScheduled();
+}
+
+void delay(unsigned long ms) {
+    delayedMs += ms;
+    clockMs += ms;
+    hostRunScheduled();
+    hostEspNowDeliverSent();
+}
+
+void yield() {
+    hostRunScheduled();
+}
+
+// --- FUNZIONI RICORRENTI --- //
+struct Recurrent {
+    std::function<bool(void)> fn;
+    uint32_t repeatUs;
+    unsigned long lastUs;
+};
+static std::vector<Recurrent> recurrent;
+static bool runningScheduled = false;
+
+bool schedule_recurrent_function_us(const std::function<bool(void)>& fn, uint32_t repeat_us,
+                                    const std::function<bool(void)>&) {
+    recurrent.push_back(Recurrent{fn, repeat_us, micros()});
+    return true;
+}
+
+void hostRunScheduled() {
+    if (runningScheduled) return;   // Come nel core: niente rientro da yield() annidati
+    runningScheduled = true;
+    for (size_t i = 0; i < recurrent.size();) {
+        Recurrent& r = recurrent[i];
+        if (micros() - r.lastUs < r.repeatUs) { i++; continue; }
+        r.lastUs = micros();
+        if (r.fn()) {
+            i++;
+        } else {
+            recurrent.erase(recurrent.begin() + i);
+        }
+    }
+    runningScheduled = false;
+}
+
+void hostLoop() {
+    loop();
+    hostRunScheduled();
+    hostNetPump();
+    hostEspNowDeliverSent();
+}
+
+// --- PIN --- //
+static int pins[32];
+
+void pinMode(int, int) {}
+void digitalWrite(int pin, int value) { if (pin >= 0 && pin < 32) pins[pin] = value; }
+int digitalRead(int pin) { return (pin >= 0 && pin < 32) ? (pins[pin] ? HIGH : LOW) : HIGH; }
+
+// Pulsante di reset (GPIO0) a riposo: alto
+static struct PinsInit { PinsInit() { for (int& p : pins) p = HIGH; } } pinsInit;
+
+// --- CASUALE --- //
+// Deterministico: le esecuzioni dei test si ripetono identiche
+static uint32_t rngState = 0x12345678;
+
+uint32_t hostRandom32() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+void randomSeed(unsigned long seed) { if (seed) rngState = (uint32_t) seed; }
+long random(long howBig) { return howBig > 0 ? (long) (hostRandom32() % (uint32_t) howBig) : 0; }
+long random(long howSmall, long howBig) {
+    return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+// --- SERIAL / PRINT --- //
+static bool verbose() {
+    static int cached = -1;
+    if (cached < 0) {
+        const char* v = getenv("HOST_VERBOSE");
+        cached = (v && *v && *v != '0') ? 1 : 0;
+    }
+    return cached == 1;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (verbose()) fwrite(buffer, 1, size, stdout);
+    return size;
+}
+
+size_t Print::printf(const char* format, ...) {
+    char stackBuf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(stackBuf, sizeof(stackBuf), format, args);
+    va_end(args);
+    if (n < 0) return 0;
+    if ((size_t) n < sizeof(stackBuf)) return write((const uint8_t*) stackBuf, n);
+
+    std::string big(n + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&big[0], big.size(), format, args);
+    va_end(args);
+    return write((const uint8_t*) big.data(), n);
+}
+
+// --- CORE --- //
+void EspClass::restart() {
+    fprintf(stderr, "ESP.restart() chiamato durante il test\n");
+    exit(3);
+}
+
+void configTime(long, int, const char*, const char*, const char*) {}
+
+bool IPAddress::fromString(const char* address) {
+    unsigned a, b, c, d;
+    char tail;
+    if (!address || sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) return false;
+    if (a > 255 || b > 255 || c > 255 || d > 255) return false;
+    *this = IPAddress(a, b, c, d);
+    return true;
+}
+
+String IPAddress::toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buf);
+}
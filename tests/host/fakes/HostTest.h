@@ -0,0 +1,48 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+// --- MINI FRAMEWORK DEI TEST HOST --- //
+// CHECK non interrompe il test: tutti i fallimenti vengono riportati, poi main()
+// restituisce il conteggio (ctest considera fallito un codice diverso da zero).
+#include "HostFakes.h"
+#include <stdio.h>
+
+static int hostTestFailures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) fallito\n", __FILE__, __LINE__, #cond); \
+        hostTestFailures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long _va = (long long) (a), _vb = (long long) (b); \
+    if (_va != _vb) { \
+        fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) fallito: %lld != %lld\n", \
+                __FILE__, __LINE__, #a, #b, _va, _vb); \
+        hostTestFailures++; \
+    } \
+} while (0)
+
+#define CHECK_STR(a, b) do { \
+    std::string _sa = (a), _sb = (b); \
+    if (_sa != _sb) { \
+        fprintf(stderr, "%s:%d: CHECK_STR(%s, %s) fallito:\n  \"%s\"\n  \"%s\"\n", \
+                __FILE__, __LINE__, #a, #b, _sa.c_str(), _sb.c_str()); \
+        hostTestFailures++; \
+    } \
+} while (0)
+
+#define RUN_TEST(fn) do { \
+    int _before = hostTestFailures; \
+    fn(); \
+    printf("%s %s\n", hostTestFailures == _before ? "[ OK ]" : "[FAIL]", #fn); \
+} while (0)
+
+static inline int hostTestResult() {
+    if (hostTestFailures) fprintf(stderr, "%d controlli falliti\n", hostTestFailures);
+    return hostTestFailures ? 1 : 0;
+}
+
+#endif
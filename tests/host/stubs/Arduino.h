@@ -0,0 +1,301 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// --- CORE ARDUINO PER I TEST HOST --- //
+// Sottoinsieme del core ESP8266 usato dal gateway e dalla libreria, con comportamento
+// reale dove i test lo osservano (String, Print, millis() pilotato dal test).
+// Le implementazioni stanno in fakes/HostPlatform.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define LED_BUILTIN 2
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define HEX 16
+#define DEC 10
+
+// Registro hardware del generatore casuale: sull'host una funzione
+uint32_t hostRandom32();
+#define RANDOM_REG32 (hostRandom32())
+
+typedef uint8_t byte;
+typedef bool boolean;
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+#define PSTR(s) (s)
+#define FPSTR(s) ((const __FlashStringHelper*)(s))
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+void pinMode(int pin, int mode);
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+// --- STRING --- //
+class String {
+public:
+    String() {}
+    String(const char* c) : s(c ? c : "") {}
+    String(const __FlashStringHelper* c) : s(c ? (const char*) c : "") {}
+    String(const std::string& c) : s(c) {}
+    explicit String(char c) : s(1, c) {}
+    explicit String(int v, int base = 10) { s = number((long) v, base); }
+    explicit String(unsigned v, int base = 10) { s = number((unsigned long) v, base); }
+    explicit String(long v, int base = 10) { s = number(v, base); }
+    explicit String(unsigned long v, int base = 10) { s = number(v, base); }
+    explicit String(float v, int decimals = 2) { s = fixed(v, decimals); }
+    explicit String(double v, int decimals = 2) { s = fixed(v, decimals); }
+
+    const char* c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+    bool reserve(unsigned n) { s.reserve(n); return true; }
+    bool isEmpty() const { return s.empty(); }
+
+    String& operator+=(const String& o) { s += o.s; return *this; }
+    String& operator+=(const char* o) { if (o) s += o; return *this; }
+    String& operator+=(char o) { s += o; return *this; }
+    String& operator+=(int o) { s += std::to_string(o); return *this; }
+    String& operator+=(unsigned o) { s += std::to_string(o); return *this; }
+    String& operator+=(long o) { s += std::to_string(o); return *this; }
+    String& operator+=(unsigned long o) { s += std::to_string(o); return *this; }
+    String& operator+=(float o) { s += fixed(o, 2); return *this; }
+    String& operator+=(double o) { s += fixed(o, 2); return *this; }
+    String& operator+=(const __FlashStringHelper* o) { s += (const char*) o; return *this; }
+    bool concat(const char* c, unsigned n) { s.append(c, n); return true; }
+    bool concat(const String& c) { s += c.s; return true; }
+    bool concat(const char* c) { if (c) s += c; return true; }
+    bool concat(char c) { s += c; return true; }
+
+    bool operator==(const String& o) const { return s == o.s; }
+    bool operator==(const char* o) const { return s == (o ? o : ""); }
+    bool operator!=(const String& o) const { return s != o.s; }
+    bool operator!=(const char* o) const { return !(*this == o); }
+    bool operator<(const String& o) const { return s < o.s; }
+    bool equals(const String& o) const { return s == o.s; }
+    bool equalsIgnoreCase(const String& o) const {
+        return s.size() == o.s.size() && strcasecmp(s.c_str(), o.s.c_str()) == 0;
+    }
+
+    char operator[](unsigned i) const { return i < s.size() ? s[i] : '\0'; }
+    char& operator[](unsigned i) { return s[i]; }
+    char charAt(unsigned i) const { return (*this)[i]; }
+    int indexOf(char c, unsigned from = 0) const { return found(s.find(c, from)); }
+    int indexOf(const String& c, unsigned from = 0) const { return found(s.find(c.s, from)); }
+    int lastIndexOf(char c) const { return found(s.rfind(c)); }
+    int lastIndexOf(const String& c) const { return found(s.rfind(c.s)); }
+    String substring(unsigned from) const { return from < s.size() ? String(s.substr(from)) : String(); }
+    String substring(unsigned from, unsigned to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= s.size()) return String();
+        return String(s.substr(from, to - from));
+    }
+    bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+    bool endsWith(const String& p) const {
+        return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0;
+    }
+
+    void trim() {
+        size_t a = s.find_first_not_of(" \t\r\n");
+        size_t b = s.find_last_not_of(" \t\r\n");
+        s = (a == std::string::npos) ? std::string() : s.substr(a, b - a + 1);
+    }
+    void toUpperCase() { for (char& c : s) c = toupper((unsigned char) c); }
+    void toLowerCase() { for (char& c : s) c = tolower((unsigned char) c); }
+    void replace(const String& from, const String& to) {
+        if (from.s.empty()) return;
+        for (size_t p = s.find(from.s); p != std::string::npos; p = s.find(from.s, p + to.s.size())) {
+            s.replace(p, from.s.size(), to.s);
+        }
+    }
+    void remove(unsigned index) { if (index < s.size()) s.erase(index); }
+    void remove(unsigned index, unsigned count) { if (index < s.size()) s.erase(index, count); }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+    void toCharArray(char* buf, unsigned size) const { getBytes((unsigned char*) buf, size); }
+    void getBytes(unsigned char* buf, unsigned size) const {
+        if (size == 0) return;
+        size_t n = std::min<size_t>(size - 1, s.size());
+        memcpy(buf, s.data(), n);
+        buf[n] = '\0';
+    }
+
+private:
+    std::string s;
+
+    static int found(size_t p) { return p == std::string::npos ? -1 : (int) p; }
+    static std::string number(long v, int base) {
+        if (v < 0 && base == 10) return "-" + number((unsigned long) -v, base);
+        return number((unsigned long) v, base);
+    }
+    static std::string number(unsigned long v, int base) {
+        char buf[34];
+        int i = sizeof(buf) - 1;
+        buf[i] = '\0';
+        do {
+            int digit = v % base;
+            buf[--i] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+            v /= base;
+        } while (v > 0 && i > 0);
+        return buf + i;
+    }
+    static std::string fixed(double v, int decimals) {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        return buf;
+    }
+};
+
+inline String operator+(const String& a, const String& b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, const char* b) { String r = a; r += b; return r; }
+inline String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+inline String operator+(const String& a, char b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, int b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, unsigned b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, long b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, unsigned long b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, float b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, double b) { String r = a; r += b; return r; }
+inline String operator+(const String& a, const __FlashStringHelper* b) { String r = a; r += b; return r; }
+inline bool operator==(const char* a, const String& b) { return b == a; }
+inline bool operator!=(const char* a, const String& b) { return b != a; }
+
+// --- PRINT / STREAM --- //
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t write(const char* str) { return str ? write((const uint8_t*) str, strlen(str)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*) buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const char* v) { return write(v); }
+    size_t print(const String& v) { return write(v.c_str()); }
+    size_t print(const __FlashStringHelper* v) { return write((const char*) v); }
+    size_t print(char v) { return write((uint8_t) v); }
+    size_t print(int v, int base = DEC) { return print(String(v, base)); }
+    size_t print(unsigned v, int base = DEC) { return print(String(v, base)); }
+    size_t print(long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(unsigned long v, int base = DEC) { return print(String(v, base)); }
+    size_t print(unsigned char v, int base = DEC) { return print(String((unsigned) v, base)); }
+    size_t print(double v, int decimals = 2) { return print(String(v, decimals)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T& v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(const T& v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    void setTimeout(unsigned long) {}
+    size_t readBytes(char* buffer, size_t length) {
+        size_t n = 0;
+        int c;
+        while (n < length && (c = read()) >= 0) buffer[n++] = (char) c;
+        return n;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*) buffer, length); }
+    // Consuma lo stream fino a target compreso (false se finisce o se arriva prima terminator)
+    bool findUntil(const char* target, const char* terminator) {
+        size_t t = 0, e = 0;
+        size_t tLen = strlen(target), eLen = terminator ? strlen(terminator) : 0;
+        int c;
+        while ((c = read()) >= 0) {
+            t = (c == target[t]) ? t + 1 : (c == target[0] ? 1 : 0);
+            if (t == tLen) return true;
+            if (eLen) {
+                e = (c == terminator[e]) ? e + 1 : (c == terminator[0] ? 1 : 0);
+                if (e == eLen) return false;
+            }
+        }
+        return false;
+    }
+    bool find(const char* target) { return findUntil(target, nullptr); }
+
+    String readString() {
+        String r;
+        int c;
+        while ((c = read()) >= 0) r += (char) c;
+        return r;
+    }
+    String readStringUntil(char terminator) {
+        String r;
+        int c;
+        while ((c = read()) >= 0 && c != terminator) r += (char) c;
+        return r;
+    }
+};
+
+// Serial scrive su stdout solo con HOST_VERBOSE=1 nell'ambiente
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return 40000; }
+    uint8_t getHeapFragmentation() { return 5; }
+    uint32_t getMaxFreeBlockSize() { return 30000; }
+    String getResetReason() { return "Host"; }
+    String getResetInfo() { return "Host"; }
+    void restart();
+    void wdtEnable(uint32_t) {}
+    void wdtFeed() {}
+    void wdtDisable() {}
+    uint32_t getFreeSketchSpace() { return 1 << 20; }
+    uint32_t getChipId() { return 0x00C0FFEE; }
+    uint32_t getCycleCount() { return (uint32_t) micros() * 80; }
+    uint32_t getFlashChipSize() { return 4 << 20; }
+    uint8_t getCpuFreqMHz() { return 80; }
+};
+extern EspClass ESP;
+
+void configTime(long gmtOffset, int daylightOffset, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+
+#endif
@@ -0,0 +1,884 @@
+#ifndef HOST_ARDUINOJSON_H
+#define HOST_ARDUINOJSON_H
+
+// --- ARDUINOJSON (SOTTOINSIEME) PER I TEST HOST --- //
+// Implementazione ridotta dell'API ArduinoJson 6 usata dal gateway: DOM con oggetti
+// ordinati, parser, serializzazione compatta/pretty. Basta per eseguire sull'host i
+// percorsi reali (nodetypes.json, comandi JSON, batch, config). La capacità dichiarata
+// è applicata solo da deserializeJson, con il conto della libreria su ESP8266: 16 byte
+// per membro o elemento, più le stringhe copiate (deduplicate) se l'input non è
+// modificabile; da char* il parsing è in place e le stringhe non costano. Oltre la
+// capacità: NoMemory. I setter non la controllano.
+
+#include "Arduino.h"
+#include <deque>
+#include <memory>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define JSON_OBJECT_SIZE(n) ((n) * 16)
+#define JSON_ARRAY_SIZE(n)  ((n) * 16)
+#define JSON_STRING_SIZE(n) ((n) + 1)
+
+namespace HostJson {
+
+struct Node {
+    enum Kind : uint8_t { Null, Object, Array, Str, Int, Real, Bool };
+    Kind kind = Null;
+    std::string text;
+    long long integer = 0;
+    double real = 0;
+    bool boolean = false;
+    std::vector<std::pair<std::string, Node*>> members;
+    std::vector<Node*> items;
+
+    void reset(Kind k) {
+        kind = k;
+        text.clear();
+        members.clear();
+        items.clear();
+        integer = 0;
+        real = 0;
+        boolean = false;
+    }
+};
+
+struct Arena {
+    std::deque<Node> nodes;
+    Node* make() { nodes.emplace_back(); return &nodes.back(); }
+};
+
+template <typename T, typename = void> struct Converter;
+
+}  // namespace HostJson
+
+class JsonObject;
+class JsonArray;
+class JsonPair;
+
+class JsonVariant {
+public:
+    JsonVariant() {}
+    JsonVariant(HostJson::Arena* arena, HostJson::Node* node) : _arena(arena), _node(node) {}
+
+    // --- Lettura --- //
+    HostJson::Node* node() const {
+        if (_node || !_parent) return _node;
+        if (_index >= 0) {
+            return (_parent->kind == HostJson::Node::Array && (size_t) _index < _parent->items.size())
+                ? _parent->items[_index] : nullptr;
+        }
+        if (_parent->kind != HostJson::Node::Object) return nullptr;
+        for (auto& m : _parent->members) {
+            if (m.first == _key) return m.second;
+        }
+        return nullptr;
+    }
+    HostJson::Arena* arena() const { return _arena; }
+
+    bool isNull() const { HostJson::Node* n = node(); return !n || n->kind == HostJson::Node::Null; }
+    size_t size() const {
+        HostJson::Node* n = node();
+        if (!n) return 0;
+        if (n->kind == HostJson::Node::Object) return n->members.size();
+        if (n->kind == HostJson::Node::Array) return n->items.size();
+        return 0;
+    }
+    bool containsKey(const char* key) const { return !(*this)[key].isNull() || hasMember(key); }
+    bool containsKey(const String& key) const { return containsKey(key.c_str()); }
+
+    template <typename T> T as() const { return HostJson::Converter<T>::as(*this); }
+    template <typename T> bool is() const { return HostJson::Converter<T>::is(*this); }
+    template <typename T> operator T() const { return as<T>(); }
+
+    const char* operator|(const char* fallback) const {
+        HostJson::Node* n = node();
+        return (n && n->kind == HostJson::Node::Str) ? n->text.c_str() : fallback;
+    }
+    template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    T operator|(T fallback) const { return is<T>() ? as<T>() : fallback; }
+
+    bool operator==(const char* other) const {
+        HostJson::Node* n = node();
+        return n && n->kind == HostJson::Node::Str && other && n->text == other;
+    }
+    bool operator!=(const char* other) const { return !(*this == other); }
+
+    JsonVariant operator[](const char* key) const { return child(key); }
+    JsonVariant operator[](const String& key) const { return child(key.c_str()); }
+    JsonVariant operator[](int index) const { return element(index); }
+    JsonVariant operator[](size_t index) const { return element((int) index); }
+
+    // --- Scrittura --- //
+    template <typename T> JsonVariant& operator=(const T& value) { set(value); return *this; }
+    JsonVariant& operator=(const JsonVariant&) = default;
+    JsonVariant(const JsonVariant&) = default;
+
+    bool set(const char* value) {
+        if (!value) return setNull();
+        HostJson::Node* n = materialize(HostJson::Node::Str);
+        n->text = value;
+        return true;
+    }
+    bool set(char* value) { return set((const char*) value); }
+    bool set(const String& value) { return set(value.c_str()); }
+    bool set(bool value) {
+        HostJson::Node* n = materialize(HostJson::Node::Bool);
+        n->boolean = value;
+        return true;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, bool>::type
+    set(T value) {
+        HostJson::Node* n = materialize(HostJson::Node::Int);
+        n->integer = (long long) value;
+        return true;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, bool>::type set(T value) {
+        HostJson::Node* n = materialize(HostJson::Node::Real);
+        n->real = value;
+        return true;
+    }
+    bool set(const JsonVariant& value) {
+        HostJson::Node* src = value.node();
+        if (!src) return setNull();
+        HostJson::Node* n = materialize(src->kind);
+        copyInto(n, src);
+        return true;
+    }
+    bool setNull() { materialize(HostJson::Node::Null); return true; }
+
+    template <typename T> bool add(const T& value) {
+        JsonVariant item = append();
+        return item.set(value);
+    }
+    JsonObject createNestedObject() const;
+    JsonArray createNestedArray() const;
+    JsonObject createNestedObject(const char* key) const;
+    JsonArray createNestedArray(const char* key) const;
+    JsonObject createNestedObject(const String& key) const;
+    JsonArray createNestedArray(const String& key) const;
+    template <typename T> T to();
+
+    void remove(const char* key) {
+        HostJson::Node* n = node();
+        if (!n || n->kind != HostJson::Node::Object) return;
+        for (auto it = n->members.begin(); it != n->members.end(); ++it) {
+            if (it->first == key) { n->members.erase(it); return; }
+        }
+    }
+    void remove(const String& key) { remove(key.c_str()); }
+    void remove(int index) {
+        HostJson::Node* n = node();
+        if (n && n->kind == HostJson::Node::Array && index >= 0 && (size_t) index < n->items.size()) {
+            n->items.erase(n->items.begin() + index);
+        }
+    }
+
+    // Nodo esistente o creato al volo nel genitore (assegnazioni tramite operator[])
+    HostJson::Node* materialize(HostJson::Node::Kind kind) const {
+        HostJson::Node* n = node();
+        if (!n) {
+            if (!_parent || !_arena) return scratch();
+            n = _arena->make();
+            if (_index >= 0) {
+                if (_parent->kind != HostJson::Node::Array) _parent->reset(HostJson::Node::Array);
+                while (_parent->items.size() <= (size_t) _index) {
+                    _parent->items.push_back((_parent->items.size() == (size_t) _index) ? n : _arena->make());
+                }
+            } else {
+                if (_parent->kind != HostJson::Node::Object) _parent->reset(HostJson::Node::Object);
+                _parent->members.emplace_back(_key, n);
+            }
+        }
+        n->reset(kind);
+        return n;
+    }
+
+protected:
+    HostJson::Arena* _arena = nullptr;
+    HostJson::Node* _node = nullptr;
+    HostJson::Node* _parent = nullptr;   // Riferimento lazy: membro _key o elemento _index
+    std::string _key;
+    int _index = -1;
+
+    bool hasMember(const char* key) const {
+        HostJson::Node* n = node();
+        if (!n || n->kind != HostJson::Node::Object) return false;
+        for (auto& m : n->members) {
+            if (m.first == key) return true;
+        }
+        return false;
+    }
+
+    // Il genitore di un riferimento lazy va creato come oggetto/array solo in scrittura
+    HostJson::Node* container(HostJson::Node::Kind kind) const {
+        HostJson::Node* n = node();
+        if (n && (n->kind == kind || n->kind != HostJson::Node::Null)) return n;
+        return materialize(kind);
+    }
+
+    JsonVariant child(const char* key) const {
+        JsonVariant v;
+        v._arena = _arena;
+        HostJson::Node* n = node();
+        if (!n) {
+            if (!_parent) return v;
+            n = const_cast<JsonVariant*>(this)->container(HostJson::Node::Object);
+        }
+        v._parent = n;
+        v._key = key ? key : "";
+        return v;
+    }
+
+    JsonVariant element(int index) const {
+        JsonVariant v;
+        v._arena = _arena;
+        v._parent = node();
+        v._index = index;
+        return v;
+    }
+
+    JsonVariant append() const {
+        HostJson::Node* n = node();
+        if (!n || n->kind != HostJson::Node::Array) n = container(HostJson::Node::Array);
+        if (n->kind != HostJson::Node::Array) n->reset(HostJson::Node::Array);
+        HostJson::Node* item = _arena ? _arena->make() : scratch();
+        n->items.push_back(item);
+        return JsonVariant(_arena, item);
+    }
+
+    void copyInto(HostJson::Node* dst, const HostJson::Node* src) const {
+        dst->reset(src->kind);
+        dst->text = src->text;
+        dst->integer = src->integer;
+        dst->real = src->real;
+        dst->boolean = src->boolean;
+        for (auto& m : src->members) {
+            HostJson::Node* c = _arena->make();
+            copyInto(c, m.second);
+            dst->members.emplace_back(m.first, c);
+        }
+        for (auto* i : src->items) {
+            HostJson::Node* c = _arena->make();
+            copyInto(c, i);
+            dst->items.push_back(c);
+        }
+    }
+
+    static HostJson::Node* scratch() {
+        static HostJson::Node sink;
+        return &sink;
+    }
+};
+
+using JsonVariantConst = JsonVariant;
+
+class JsonPair {
+public:
+    JsonPair(HostJson::Arena* arena, std::pair<std::string, HostJson::Node*>* member)
+        : _arena(arena), _member(member) {}
+    struct Key {
+        const char* str;
+        const char* c_str() const { return str; }
+        operator const char*() const { return str; }
+    };
+    Key key() const { return Key{_member->first.c_str()}; }
+    JsonVariant value() const { return JsonVariant(_arena, _member->second); }
+
+private:
+    HostJson::Arena* _arena;
+    std::pair<std::string, HostJson::Node*>* _member;
+};
+
+typedef JsonPair::Key JsonString;
+
+class JsonObject : public JsonVariant {
+public:
+    JsonObject() {}
+    JsonObject(const JsonVariant& v) : JsonVariant(v) {}
+
+    struct iterator {
+        HostJson::Arena* arena;
+        std::pair<std::string, HostJson::Node*>* it;
+        JsonPair operator*() const { return JsonPair(arena, it); }
+        iterator& operator++() { ++it; return *this; }
+        bool operator!=(const iterator& o) const { return it != o.it; }
+    };
+    iterator begin() const { return iterator{_arena, range().first}; }
+    iterator end() const { return iterator{_arena, range().second}; }
+
+private:
+    std::pair<std::pair<std::string, HostJson::Node*>*, std::pair<std::string, HostJson::Node*>*> range() const {
+        HostJson::Node* n = node();
+        if (!n || n->kind != HostJson::Node::Object || n->members.empty()) return {nullptr, nullptr};
+        return {n->members.data(), n->members.data() + n->members.size()};
+    }
+};
+
+class JsonArray : public JsonVariant {
+public:
+    JsonArray() {}
+    JsonArray(const JsonVariant& v) : JsonVariant(v) {}
+
+    struct iterator {
+        HostJson::Arena* arena;
+        HostJson::Node** it;
+        JsonVariant operator*() const { return JsonVariant(arena, *it); }
+        iterator& operator++() { ++it; return *this; }
+        bool operator!=(const iterator& o) const { return it != o.it; }
+    };
+    iterator begin() const { return iterator{_arena, range().first}; }
+    iterator end() const { return iterator{_arena, range().second}; }
+
+private:
+    std::pair<HostJson::Node**, HostJson::Node**> range() const {
+        HostJson::Node* n = node();
+        if (!n || n->kind != HostJson::Node::Array || n->items.empty()) return {nullptr, nullptr};
+        return {n->items.data(), n->items.data() + n->items.size()};
+    }
+};
+
+inline JsonObject JsonVariant::createNestedObject() const {
+    JsonVariant item = append();
+    item.materialize(HostJson::Node::Object);
+    return item;
+}
+inline JsonArray JsonVariant::createNestedArray() const {
+    JsonVariant item = append();
+    item.materialize(HostJson::Node::Array);
+    return item;
+}
+inline JsonObject JsonVariant::createNestedObject(const char* key) const {
+    JsonVariant member = child(key);
+    return JsonVariant(_arena, member.materialize(HostJson::Node::Object));
+}
+inline JsonArray JsonVariant::createNestedArray(const char* key) const {
+    JsonVariant member = child(key);
+    return JsonVariant(_arena, member.materialize(HostJson::Node::Array));
+}
+inline JsonObject JsonVariant::createNestedObject(const String& key) const { return createNestedObject(key.c_str()); }
+inline JsonArray JsonVariant::createNestedArray(const String& key) const { return createNestedArray(key.c_str()); }
+
+template <typename T> T JsonVariant::to() {
+    HostJson::Node::Kind kind = std::is_same<T, JsonObject>::value ? HostJson::Node::Object
+                              : std::is_same<T, JsonArray>::value ? HostJson::Node::Array
+                              : HostJson::Node::Null;
+    return T(JsonVariant(_arena, materialize(kind)));
+}
+
+// --- DOCUMENTI --- //
+class JsonDocument : public JsonVariant {
+public:
+    JsonDocument(size_t capacity = 0) : _owned(new HostJson::Arena()), _capacity(capacity) {
+        _arena = _owned.get();
+        _node = _arena->make();
+    }
+    JsonDocument(const JsonDocument&) = delete;
+    JsonDocument& operator=(const JsonDocument&) = delete;
+
+    void clear() { _node->reset(HostJson::Node::Null); }
+    size_t capacity() const { return _capacity; }
+    size_t memoryUsage() const { return _owned->nodes.size() * 16; }
+    bool overflowed() const { return false; }
+
+    template <typename T> JsonVariant& operator=(const T& value) { set(value); return *this; }
+
+private:
+    std::unique_ptr<HostJson::Arena> _owned;
+    size_t _capacity;
+};
+
+class DynamicJsonDocument : public JsonDocument {
+public:
+    explicit DynamicJsonDocument(size_t capacity) : JsonDocument(capacity) {}
+};
+
+template <size_t N> class StaticJsonDocument : public JsonDocument {
+public:
+    StaticJsonDocument() : JsonDocument(N) {}
+};
+
+// --- CONVERSIONI --- //
+namespace HostJson {
+
+template <> struct Converter<const char*> {
+    static const char* as(const JsonVariant& v) {
+        Node* n = v.node();
+        return (n && n->kind == Node::Str) ? n->text.c_str() : nullptr;
+    }
+    static bool is(const JsonVariant& v) { Node* n = v.node(); return n && n->kind == Node::Str; }
+};
+template <> struct Converter<char*> {
+    static char* as(const JsonVariant& v) { return const_cast<char*>(Converter<const char*>::as(v)); }
+    static bool is(const JsonVariant& v) { return Converter<const char*>::is(v); }
+};
+template <> struct Converter<bool> {
+    // Valore di verità: campo presente e non falso/zero (uso tipico: if (doc["chiave"]))
+    static bool as(const JsonVariant& v) {
+        Node* n = v.node();
+        if (!n) return false;
+        switch (n->kind) {
+            case Node::Bool: return n->boolean;
+            case Node::Int: return n->integer != 0;
+            case Node::Real: return n->real != 0;
+            case Node::Null: return false;
+            default: return true;
+        }
+    }
+    static bool is(const JsonVariant& v) { Node* n = v.node(); return n && n->kind == Node::Bool; }
+};
+template <typename T>
+struct Converter<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+    static T as(const JsonVariant& v) {
+        Node* n = v.node();
+        if (!n) return 0;
+        if (n->kind == Node::Int) return (T) n->integer;
+        if (n->kind == Node::Real) return (T) n->real;
+        if (n->kind == Node::Bool) return n->boolean ? 1 : 0;
+        return 0;
+    }
+    static bool is(const JsonVariant& v) { Node* n = v.node(); return n && n->kind == Node::Int; }
+};
+template <typename T>
+struct Converter<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static T as(const JsonVariant& v) {
+        Node* n = v.node();
+        if (!n) return 0;
+        if (n->kind == Node::Real) return (T) n->real;
+        if (n->kind == Node::Int) return (T) n->integer;
+        return 0;
+    }
+    static bool is(const JsonVariant& v) {
+        Node* n = v.node();
+        return n && (n->kind == Node::Real || n->kind == Node::Int);
+    }
+};
+template <> struct Converter<JsonVariant> {
+    static JsonVariant as(const JsonVariant& v) { return v; }
+    static bool is(const JsonVariant& v) { return !v.isNull(); }
+};
+template <> struct Converter<JsonObject> {
+    static JsonObject as(const JsonVariant& v) { return JsonObject(v); }
+    static bool is(const JsonVariant& v) { Node* n = v.node(); return n && n->kind == Node::Object; }
+};
+template <> struct Converter<JsonArray> {
+    static JsonArray as(const JsonVariant& v) { return JsonArray(v); }
+    static bool is(const JsonVariant& v) { Node* n = v.node(); return n && n->kind == Node::Array; }
+};
+
+// --- SERIALIZZAZIONE --- //
+class Writer {
+public:
+    virtual ~Writer() {}
+    virtual void put(const char* s, size_t n) = 0;
+    void put(const char* s) { put(s, strlen(s)); }
+    void put(char c) { put(&c, 1); }
+    size_t written = 0;
+};
+
+inline void writeString(Writer& out, const std::string& s) {
+    out.put('"');
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"': out.put("\\\""); break;
+            case '\\': out.put("\\\\"); break;
+            case '\b': out.put("\\b"); break;
+            case '\f': out.put("\\f"); break;
+            case '\n': out.put("\\n"); break;
+            case '\r': out.put("\\r"); break;
+            case '\t': out.put("\\t"); break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out.put(buf);
+                } else {
+                    out.put((char) c);
+                }
+        }
+    }
+    out.put('"');
+}
+
+inline void indent(Writer& out, int depth) {
+    out.put("\r\n");
+    for (int i = 0; i < depth; i++) out.put("  ");
+}
+
+inline void writeNode(Writer& out, const Node* n, bool pretty, int depth) {
+    char buf[32];
+    if (!n) { out.put("null"); return; }
+    switch (n->kind) {
+        case Node::Null: out.put("null"); break;
+        case Node::Bool: out.put(n->boolean ? "true" : "false"); break;
+        case Node::Int: snprintf(buf, sizeof(buf), "%lld", n->integer); out.put(buf); break;
+        case Node::Real: snprintf(buf, sizeof(buf), "%.9g", n->real); out.put(buf); break;
+        case Node::Str: writeString(out, n->text); break;
+        case Node::Object: {
+            out.put('{');
+            bool first = true;
+            for (auto& m : n->members) {
+                if (!first) out.put(',');
+                first = false;
+                if (pretty) indent(out, depth + 1);
+                writeString(out, m.first);
+                out.put(pretty ? ": " : ":");
+                writeNode(out, m.second, pretty, depth + 1);
+            }
+            if (pretty && !n->members.empty()) indent(out, depth);
+            out.put('}');
+            break;
+        }
+        case Node::Array: {
+            out.put('[');
+            bool first = true;
+            for (auto* item : n->items) {
+                if (!first) out.put(',');
+                first = false;
+                if (pretty) indent(out, depth + 1);
+                writeNode(out, item, pretty, depth + 1);
+            }
+            if (pretty && !n->items.empty()) indent(out, depth);
+            out.put(']');
+            break;
+        }
+    }
+}
+
+struct StringWriter : Writer {
+    String& s;
+    explicit StringWriter(String& target) : s(target) {}
+    void put(const char* p, size_t n) override { s.concat(p, n); written += n; }
+};
+struct PrintWriter : Writer {
+    Print& p;
+    explicit PrintWriter(Print& target) : p(target) {}
+    void put(const char* s, size_t n) override { written += p.write((const uint8_t*) s, n); }
+};
+struct BufferWriter : Writer {
+    char* buf;
+    size_t size;
+    BufferWriter(char* b, size_t s) : buf(b), size(s) {}
+    void put(const char* p, size_t n) override {
+        for (size_t i = 0; i < n && written + 1 < size; i++) buf[written++] = p[i];
+        if (size > 0) buf[written] = '\0';
+    }
+};
+struct CountWriter : Writer {
+    void put(const char*, size_t n) override { written += n; }
+};
+
+// --- PARSER --- //
+class Parser {
+public:
+    Parser(Arena* arena, const char* p, const char* end) : _arena(arena), _p(p), _end(end) {}
+
+    int parse(Node* root) {
+        skip();
+        if (_p >= _end) return 1;   // EmptyInput
+        if (!value(root, 0)) return _incomplete ? 2 : 3;
+        return 0;
+    }
+
+private:
+    Arena* _arena;
+    const char* _p;
+    const char* _end;
+    bool _incomplete = false;
+
+    void skip() { while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\r' || *_p == '\n')) _p++; }
+    bool eof() { if (_p >= _end) { _incomplete = true; return true; } return false; }
+    bool literal(const char* word) {
+        size_t n = strlen(word);
+        if ((size_t) (_end - _p) < n) { _incomplete = true; return false; }
+        if (strncmp(_p, word, n) != 0) return false;
+        _p += n;
+        return true;
+    }
+
+    bool value(Node* n, int depth) {
+        if (depth > 10) return false;
+        skip();
+        if (eof()) return false;
+        char c = *_p;
+        if (c == '{') return object(n, depth);
+        if (c == '[') return array(n, depth);
+        if (c == '"') { n->reset(Node::Str); return string(n->text); }
+        if (c == 't') { n->reset(Node::Bool); n->boolean = true; return literal("true"); }
+        if (c == 'f') { n->reset(Node::Bool); n->boolean = false; return literal("false"); }
+        if (c == 'n') { n->reset(Node::Null); return literal("null"); }
+        return number(n);
+    }
+
+    bool object(Node* n, int depth) {
+        n->reset(Node::Object);
+        _p++;
+        skip();
+        if (eof()) return false;
+        if (*_p == '}') { _p++; return true; }
+        while (true) {
+            skip();
+            if (eof()) return false;
+            std::string key;
+            if (*_p != '"' || !string(key)) return false;
+            skip();
+            if (eof()) return false;
+            if (*_p++ != ':') return false;
+            Node* child = _arena->make();
+            if (!value(child, depth + 1)) return false;
+            n->members.emplace_back(key, child);
+            skip();
+            if (eof()) return false;
+            if (*_p == ',') { _p++; continue; }
+            if (*_p == '}') { _p++; return true; }
+            return false;
+        }
+    }
+
+    bool array(Node* n, int depth) {
+        n->reset(Node::Array);
+        _p++;
+        skip();
+        if (eof()) return false;
+        if (*_p == ']') { _p++; return true; }
+        while (true) {
+            Node* child = _arena->make();
+            if (!value(child, depth + 1)) return false;
+            n->items.push_back(child);
+            skip();
+            if (eof()) return false;
+            if (*_p == ',') { _p++; continue; }
+            if (*_p == ']') { _p++; return true; }
+            return false;
+        }
+    }
+
+    static void utf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out += (char) cp;
+        } else if (cp < 0x800) {
+            out += (char) (0xC0 | (cp >> 6));
+            out += (char) (0x80 | (cp & 0x3F));
+        } else {
+            out += (char) (0xE0 | (cp >> 12));
+            out += (char) (0x80 | ((cp >> 6) & 0x3F));
+            out += (char) (0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool string(std::string& out) {
+        _p++;
+        while (true) {
+            if (eof()) return false;
+            char c = *_p++;
+            if (c == '"') return true;
+            if (c != '\\') { out += c; continue; }
+            if (eof()) return false;
+            char e = *_p++;
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    if (_end - _p < 4) { _incomplete = true; return false; }
+                    char hex[5] = {_p[0], _p[1], _p[2], _p[3], 0};
+                    char* stop;
+                    unsigned cp = strtoul(hex, &stop, 16);
+                    if (stop != hex + 4) return false;
+                    utf8(out, cp);
+                    _p += 4;
+                    break;
+                }
+                default: return false;
+            }
+        }
+    }
+
+    bool number(Node* n) {
+        const char* start = _p;
+        bool real = false;
+        if (_p < _end && (*_p == '-' || *_p == '+')) _p++;
+        while (_p < _end && (isdigit((unsigned char) *_p) || *_p == '.' || *_p == 'e' || *_p == 'E' ||
+                             ((*_p == '-' || *_p == '+') && (_p[-1] == 'e' || _p[-1] == 'E')))) {
+            if (*_p == '.' || *_p == 'e' || *_p == 'E') real = true;
+            _p++;
+        }
+        if (_p == start || (_p == start + 1 && !isdigit((unsigned char) *start))) return false;
+        std::string text(start, _p - start);
+        if (real) {
+            n->reset(Node::Real);
+            n->real = strtod(text.c_str(), nullptr);
+        } else {
+            n->reset(Node::Int);
+            n->integer = strtoll(text.c_str(), nullptr, 10);
+        }
+        return true;
+    }
+};
+
+}  // namespace HostJson
+
+class DeserializationError {
+public:
+    enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+    DeserializationError(Code code = Ok) : _code(code) {}
+    explicit operator bool() const { return _code != Ok; }
+    bool operator==(Code code) const { return _code == code; }
+    bool operator!=(Code code) const { return _code != code; }
+    Code code() const { return _code; }
+    const char* c_str() const {
+        static const char* const names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+        return names[_code];
+    }
+
+private:
+    Code _code;
+};
+
+namespace HostJson {
+
+// Byte del pool che la libreria userebbe per il documento analizzato
+inline size_t poolUsage(const Node* n, bool copyStrings, std::set<std::string>& strings) {
+    size_t bytes = 0;
+    auto addString = [&](const std::string& text) {
+        if (copyStrings && strings.insert(text).second) bytes += JSON_STRING_SIZE(text.size());
+    };
+    if (n->kind == Node::Str) addString(n->text);
+    for (const auto& member : n->members) {
+        bytes += JSON_OBJECT_SIZE(1);
+        addString(member.first);
+        bytes += poolUsage(member.second, copyStrings, strings);
+    }
+    for (const Node* item : n->items) {
+        bytes += JSON_ARRAY_SIZE(1);
+        bytes += poolUsage(item, copyStrings, strings);
+    }
+    return bytes;
+}
+
+inline DeserializationError deserialize(JsonDocument& doc, const char* input, size_t length, bool zeroCopy) {
+    doc.clear();
+    if (!input) return DeserializationError::EmptyInput;
+    Parser parser(doc.arena(), input, input + length);
+    static const DeserializationError::Code codes[] = {
+        DeserializationError::Ok, DeserializationError::EmptyInput,
+        DeserializationError::IncompleteInput, DeserializationError::InvalidInput
+    };
+    DeserializationError::Code code = codes[parser.parse(doc.node())];
+    if (code == DeserializationError::Ok && doc.capacity() > 0) {
+        std::set<std::string> strings;
+        if (poolUsage(doc.node(), !zeroCopy, strings) > doc.capacity()) code = DeserializationError::NoMemory;
+    }
+    if (code != DeserializationError::Ok) doc.clear();
+    return code;
+}
+
+}  // namespace HostJson
+
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input, size_t length) {
+    return HostJson::deserialize(doc, input, length, false);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, char* input, size_t length) {
+    return HostJson::deserialize(doc, input, length, true);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const char* input) {
+    return deserializeJson(doc, input, input ? strlen(input) : 0);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const uint8_t* input, size_t length) {
+    return deserializeJson(doc, (const char*) input, length);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, uint8_t* input, size_t length) {
+    return deserializeJson(doc, (char*) input, length);
+}
+inline DeserializationError deserializeJson(JsonDocument& doc, const String& input) {
+    return deserializeJson(doc, input.c_str(), input.length());
+}
+// Da uno stream si consuma un solo valore JSON, come la libreria reale: i lettori a
+// oggetti (peers.json) possono proseguire con find()/findUntil() dopo ogni documento
+inline DeserializationError deserializeJson(JsonDocument& doc, Stream& input) {
+    std::string text;
+    int c;
+    while ((c = input.peek()) >= 0 && isspace(c)) input.read();
+    if (c == '{' || c == '[' || c == '"') {
+        int depth = 0;
+        bool inString = false, escaped = false;
+        while ((c = input.read()) >= 0) {
+            text += (char) c;
+            if (inString) {
+                if (escaped) escaped = false;
+                else if (c == '\\') escaped = true;
+                else if (c == '"') inString = false;
+            } else if (c == '"') {
+                inString = true;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if (c == '}' || c == ']') {
+                depth--;
+            }
+            if (depth == 0 && !inString) break;
+        }
+    } else {
+        while ((c = input.peek()) >= 0 && !isspace(c) && c != ',' && c != ']' && c != '}') {
+            text += (char) input.read();
+        }
+    }
+    return deserializeJson(doc, text.c_str(), text.size());
+}
+
+inline size_t serializeJson(const JsonVariant& v, String& out) {
+    HostJson::StringWriter w(out);
+    HostJson::writeNode(w, v.node(), false, 0);
+    return w.written;
+}
+inline size_t serializeJson(const JsonVariant& v, Print& out) {
+    HostJson::PrintWriter w(out);
+    HostJson::writeNode(w, v.node(), false, 0);
+    return w.written;
+}
+inline size_t serializeJson(const JsonVariant& v, char* buf, size_t size) {
+    HostJson::BufferWriter w(buf, size);
+    if (size > 0) buf[0] = '\0';
+    HostJson::writeNode(w, v.node(), false, 0);
+    return w.written;
+}
+inline size_t serializeJsonPretty(const JsonVariant& v, Print& out) {
+    HostJson::PrintWriter w(out);
+    HostJson::writeNode(w, v.node(), true, 0);
+    return w.written;
+}
+inline size_t serializeJsonPretty(const JsonVariant& v, String& out) {
+    HostJson::StringWriter w(out);
+    HostJson::writeNode(w, v.node(), true, 0);
+    return w.written;
+}
+inline size_t measureJson(const JsonVariant& v) {
+    HostJson::CountWriter w;
+    HostJson::writeNode(w, v.node(), false, 0);
+    return w.written;
+}
+
+// as<String>(): stringhe invariate, gli altri valori serializzati ("1", "null")
+namespace HostJson {
+template <> struct Converter<String> {
+    static String as(const JsonVariant& v) {
+        Node* n = v.node();
+        if (n && n->kind == Node::Str) return String(n->text.c_str());
+        String out;
+        serializeJson(v, out);
+        return out;
+    }
+    static bool is(const JsonVariant& v) { return Converter<const char*>::is(v); }
+};
+}  // namespace HostJson
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HOST_ARDUINO_OTA_H
+#define HOST_ARDUINO_OTA_H
+
+#include "Arduino.h"
+#include <functional>
+
+enum ota_error_t { OTA_AUTH_ERROR, OTA_BEGIN_ERROR, OTA_CONNECT_ERROR, OTA_RECEIVE_ERROR, OTA_END_ERROR };
+#define U_FLASH 0
+#define U_FS 100
+
+class ArduinoOTAClass {
+public:
+    void setHostname(const char*) {}
+    void setPassword(const char*) {}
+    void onStart(std::function<void()>) {}
+    void onEnd(std::function<void()>) {}
+    void onProgress(std::function<void(unsigned, unsigned)>) {}
+    void onError(std::function<void(ota_error_t)>) {}
+    void begin(bool = true) {}
+    void handle() {}
+    int getCommand() { return U_FLASH; }
+};
+extern ArduinoOTAClass ArduinoOTA;
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_DNSSERVER_H
+#define HOST_DNSSERVER_H
+
+#include "ESP8266WiFi.h"
+
+#define DNSReplyCode_NoError 0
+
+class DNSServer {
+public:
+    bool start(uint16_t, const String&, IPAddress) { return true; }
+    void stop() {}
+    void processNextRequest() {}
+    void setErrorReplyCode(int) {}
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef HOST_ESP8266WEBSERVER_H
+#define HOST_ESP8266WEBSERVER_H
+
+// --- WEB SERVER PER I TEST HOST --- //
+// Le route vengono registrate ma nessuna richiesta arriva: gli handler web non sono
+// oggetto dei test host. Le risposte vengono scartate.
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include <functional>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+struct HTTPUpload {
+    HTTPUploadStatus status;
+    String filename;
+    String name;
+    String type;
+    size_t totalSize;
+    size_t currentSize;
+    uint8_t buf[2048];
+};
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+
+class ESP8266WebServer {
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    ESP8266WebServer(int) {}
+    void on(const String&, THandlerFunction) {}
+    void on(const String&, HTTPMethod, THandlerFunction) {}
+    void on(const String&, HTTPMethod, THandlerFunction, THandlerFunction) {}
+    void onNotFound(THandlerFunction) {}
+    void begin() {}
+    void stop() {}
+    void close() {}
+    void handleClient() {}
+    void enableCORS(bool) {}
+
+    void send(int, const char* = nullptr, const String& = String()) {}
+    void send(int, const char*, const char*) {}
+    void send(int, const String&, const String&) {}
+    void send_P(int, const char*, const char*) {}
+    void sendContent(const String&) {}
+    void sendContent(const char*) {}
+    void sendContent(const __FlashStringHelper*) {}
+    void sendContent_P(const char*) {}
+    void sendHeader(const String&, const String&, bool = false) {}
+    void setContentLength(size_t) {}
+
+    bool hasArg(const String&) { return false; }
+    String arg(const String&) { return String(); }
+    String arg(int) { return String(); }
+    int args() { return 0; }
+    String argName(int) { return String(); }
+    HTTPMethod method() { return HTTP_GET; }
+    String uri() { return "/"; }
+    String hostHeader() { return "host"; }
+    HTTPUpload& upload() { return _upload; }
+    WiFiClient client() { return WiFiClient(); }
+
+private:
+    HTTPUpload _upload;
+};
+
+#endif
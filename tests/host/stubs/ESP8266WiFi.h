@@ -0,0 +1,101 @@
+#ifndef HOST_ESP8266WIFI_H
+#define HOST_ESP8266WIFI_H
+
+// --- WIFI PER I TEST HOST --- //
+// Stazione sempre connessa. WiFiClient non apre socket: la sessione MQTT dei test
+// passa da PubSubClient (stubs/PubSubClient.h).
+#include "Arduino.h"
+#include "lwip/err.h"
+
+class IPAddress {
+public:
+    IPAddress() { _ip.addr = 0; }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        _ip.addr = (uint32_t) a | ((uint32_t) b << 8) | ((uint32_t) c << 16) | ((uint32_t) d << 24);
+    }
+    IPAddress(uint32_t address) { _ip.addr = address; }
+    IPAddress(const ip_addr_t& address) : _ip(address) {}
+
+    bool fromString(const char* address);
+    bool fromString(const String& address) { return fromString(address.c_str()); }
+    String toString() const;
+
+    operator uint32_t() const { return _ip.addr; }
+    operator ip_addr_t() const { return _ip; }
+    uint8_t operator[](int index) const { return (_ip.addr >> (8 * index)) & 0xFF; }
+    bool isSet() const { return _ip.addr != 0; }
+
+private:
+    ip_addr_t _ip;
+};
+
+class Client : public Stream {
+public:
+    virtual int connect(const char*, uint16_t) { return 0; }
+    virtual int connect(IPAddress, uint16_t) { return 0; }
+    virtual uint8_t connected() { return 0; }
+    virtual void stop() {}
+    size_t write(uint8_t) override { return 1; }
+    using Print::write;
+};
+
+class WiFiClient : public Client {
+public:
+    void setNoDelay(bool) {}
+    void setTimeout(unsigned long) {}
+    int status() { return 0; }
+    static void stopAll() {}
+};
+
+class WiFiUDP {
+public:
+    static void stopAll() {}
+};
+
+enum wl_status_t { WL_IDLE_STATUS, WL_CONNECTED, WL_DISCONNECTED };
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+#define WIFI_SCAN_RUNNING -1
+
+class ESP8266WiFiClass {
+public:
+    void persistent(bool) {}
+    bool disconnect(bool = false) { return true; }
+    bool mode(WiFiMode_t m) { _mode = m; return true; }
+    WiFiMode_t getMode() { return _mode; }
+    bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress(), IPAddress = IPAddress()) { return true; }
+    wl_status_t begin(const char*, const char* = nullptr) { return WL_CONNECTED; }
+    wl_status_t status() { return WL_CONNECTED; }
+    bool isConnected() { return true; }
+    String SSID() { return "host"; }
+    String SSID(int) { return "host"; }
+    String psk() { return ""; }
+    IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+    IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+    IPAddress dnsIP() { return IPAddress(192, 168, 1, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+    int32_t RSSI() { return -55; }
+    int32_t RSSI(int) { return -55; }
+    String macAddress() { return "AA:BB:CC:00:00:01"; }
+    uint8_t* macAddress(uint8_t* mac) { static const uint8_t m[6] = {0xAA, 0xBB, 0xCC, 0, 0, 1}; memcpy(mac, m, 6); return mac; }
+    int8_t scanComplete() { return 0; }
+    int8_t scanNetworks(bool = false) { return 0; }
+    void scanDelete() {}
+    bool softAP(const char*, const char* = nullptr) { return true; }
+    bool softAPConfig(IPAddress, IPAddress, IPAddress) { return true; }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    String softAPmacAddress() { return "AA:BB:CC:00:00:02"; }
+    bool softAPdisconnect(bool = false) { return true; }
+    int32_t channel() { return 1; }
+    int hostByName(const char* host, IPAddress& result) { return result.fromString(host) ? 1 : 0; }
+    int hostByName(const char* host, IPAddress& result, uint32_t) { return hostByName(host, result); }
+    bool setAutoReconnect(bool) { return true; }
+    bool hostname(const char*) { return true; }
+    void setSleepMode(int) {}
+    int encryptionType(int) { return 0; }
+
+private:
+    WiFiMode_t _mode = WIFI_STA;
+};
+extern ESP8266WiFiClass WiFi;
+
+#endif
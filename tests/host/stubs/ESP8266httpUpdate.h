@@ -0,0 +1,29 @@
+#ifndef HOST_ESP8266HTTPUPDATE_H
+#define HOST_ESP8266HTTPUPDATE_H
+
+#include "ESP8266WiFi.h"
+
+enum HTTPUpdateResult { HTTP_UPDATE_FAILED, HTTP_UPDATE_NO_UPDATES, HTTP_UPDATE_OK };
+typedef HTTPUpdateResult t_httpUpdate_return;
+
+class ESP8266HTTPUpdate {
+public:
+    void setLedPin(int, uint8_t) {}
+    t_httpUpdate_return update(WiFiClient&, const String&) { return HTTP_UPDATE_FAILED; }
+    int getLastError() { return -1; }
+    String getLastErrorString() { return "host"; }
+    void rebootOnUpdate(bool) {}
+};
+extern ESP8266HTTPUpdate ESPhttpUpdate;
+
+class UpdaterClass {
+public:
+    bool begin(size_t) { return false; }
+    size_t write(uint8_t*, size_t) { return 0; }
+    bool end(bool = false) { return false; }
+    void printError(Print&) {}
+    bool hasError() { return true; }
+};
+extern UpdaterClass Update;
+
+#endif
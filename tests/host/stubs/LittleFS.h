@@ -0,0 +1,66 @@
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+// --- LITTLEFS IN MEMORIA --- //
+// File system emulato per i test host: contenuto in RAM, contatori di scritture e
+// byte scritti, possibilità di troncare un file per simulare uno spegnimento durante
+// la scrittura (fakes/HostFakes.h). Le API seguono FS del core ESP8266.
+#include "Arduino.h"
+#include <memory>
+#include <string>
+
+struct HostFileData;
+
+class File : public Stream {
+public:
+    File() {}
+    File(std::shared_ptr<HostFileData> data, const char* path, bool write, bool append);
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t* buffer, size_t size);
+    bool seek(uint32_t pos);
+    size_t position() const { return _pos; }
+    size_t size() const;
+    const char* name() const { return _name.c_str(); }
+    void flush() override {}
+    void close();
+    explicit operator bool() const { return _data != nullptr; }
+
+private:
+    std::shared_ptr<HostFileData> _data;
+    std::string _name;
+    size_t _pos = 0;
+    bool _write = false;
+};
+
+struct FSInfo {
+    size_t totalBytes;
+    size_t usedBytes;
+    size_t blockSize;
+    size_t pageSize;
+    size_t maxOpenFiles;
+    size_t maxPathLength;
+};
+
+class FS {
+public:
+    bool begin() { return true; }
+    void end() {}
+    bool format();
+    File open(const char* path, const char* mode);
+    File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to);
+    bool info(FSInfo& info);
+};
+extern FS LittleFS;
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef HOST_PUBSUBCLIENT_H
+#define HOST_PUBSUBCLIENT_H
+
+// --- PUBSUBCLIENT PER I TEST HOST --- //
+// Broker fittizio in processo: connect() riesce se il test ha messo il broker online
+// (in stallo attende il CONNACK per tutto il socket timeout, come la libreria reale,
+// facendo avanzare l'orologio), ogni publish (anche in streaming con beginPublish/
+// write/endPublish) viene registrato e loop() consegna al callback i messaggi
+// iniettati dal test (fakes/HostFakes.h).
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 256
+#endif
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST    -3
+#define MQTT_CONNECT_FAILED     -2
+#define MQTT_DISCONNECTED       -1
+#define MQTT_CONNECTED           0
+
+typedef void (*MqttCallback)(char* topic, uint8_t* payload, unsigned int length);
+
+class PubSubClient : public Print {
+public:
+    PubSubClient() {}
+    PubSubClient(Client&) {}
+
+    PubSubClient& setServer(const char* domain, uint16_t port);
+    PubSubClient& setServer(IPAddress ip, uint16_t port);
+    PubSubClient& setCallback(MqttCallback callback) { _callback = callback; return *this; }
+    PubSubClient& setClient(Client&) { return *this; }
+    PubSubClient& setKeepAlive(uint16_t) { return *this; }
+    PubSubClient& setSocketTimeout(uint16_t timeout) { _socketTimeout = timeout; return *this; }
+    bool setBufferSize(uint16_t size) { _bufferSize = size; return true; }
+    uint16_t getBufferSize() { return _bufferSize; }
+
+    bool connect(const char* id) { return connect(id, nullptr, nullptr, nullptr, 0, false, nullptr, true); }
+    bool connect(const char* id, const char* user, const char* pass) {
+        return connect(id, user, pass, nullptr, 0, false, nullptr, true);
+    }
+    bool connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+        return connect(id, nullptr, nullptr, willTopic, willQos, willRetain, willMessage, true);
+    }
+    bool connect(const char* id, const char* user, const char* pass, const char* willTopic,
+                 uint8_t willQos, bool willRetain, const char* willMessage) {
+        return connect(id, user, pass, willTopic, willQos, willRetain, willMessage, true);
+    }
+    bool connect(const char* id, const char* user, const char* pass, const char* willTopic,
+                 uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession);
+    void disconnect();
+
+    bool publish(const char* topic, const char* payload) { return publish(topic, payload, false); }
+    bool publish(const char* topic, const char* payload, bool retained) {
+        return publish(topic, (const uint8_t*) payload, payload ? strlen(payload) : 0, retained);
+    }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length) {
+        return publish(topic, payload, length, false);
+    }
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained);
+    bool publish_P(const char* topic, const char* payload, bool retained) { return publish(topic, payload, retained); }
+    bool beginPublish(const char* topic, unsigned int length, bool retained);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int endPublish();
+
+    bool subscribe(const char* topic) { return subscribe(topic, 0); }
+    bool subscribe(const char* topic, uint8_t qos);
+    bool unsubscribe(const char*) { return connected(); }
+    bool loop();
+    bool connected();
+    int state();
+
+private:
+    MqttCallback _callback = nullptr;
+    uint16_t _bufferSize = MQTT_MAX_PACKET_SIZE;
+    uint16_t _socketTimeout = 15;   // Default di PubSubClient (MQTT_SOCKET_TIMEOUT)
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HOST_SCHEDULE_H
+#define HOST_SCHEDULE_H
+
+// --- FUNZIONI RICORRENTI DEL CORE --- //
+// Sull'host girano a ogni yield()/delay() e a ogni hostRunScheduled(), come nel core
+// ESP8266 dove girano a ogni yield e a fine loop().
+#include <functional>
+#include <stdint.h>
+
+bool schedule_recurrent_function_us(const std::function<bool(void)>& fn, uint32_t repeat_us,
+                                    const std::function<bool(void)>& alarm = nullptr);
+
+#endif
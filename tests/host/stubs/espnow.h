@@ -0,0 +1,25 @@
+#ifndef HOST_ESPNOW_H
+#define HOST_ESPNOW_H
+
+// --- ESP-NOW (API ESP8266) PER I TEST HOST --- //
+// Tabella peer con il limite dello stack reale; i frame inviati passano al test
+// tramite hostEspNowOnSend() e gli esiti li consegna hostEspNowDeliver*()
+// (fakes/HostFakes.h).
+#include <stdint.h>
+
+enum { ESP_NOW_ROLE_IDLE, ESP_NOW_ROLE_CONTROLLER, ESP_NOW_ROLE_SLAVE, ESP_NOW_ROLE_COMBO };
+typedef void (*esp_now_recv_cb_t)(uint8_t* mac, uint8_t* data, uint8_t len);
+typedef void (*esp_now_send_cb_t)(uint8_t* mac, uint8_t status);
+
+int esp_now_init();
+int esp_now_deinit();
+int esp_now_set_self_role(uint8_t role);
+int esp_now_register_send_cb(esp_now_send_cb_t cb);
+int esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+int esp_now_add_peer(uint8_t* mac, uint8_t role, uint8_t channel, uint8_t* key, uint8_t keyLen);
+int esp_now_del_peer(uint8_t* mac);
+int esp_now_is_peer_exist(uint8_t* mac);
+int esp_now_send(uint8_t* mac, uint8_t* data, int len);
+int esp_now_get_cnt_info(unsigned char* all, unsigned char* encrypted);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HOST_LWIP_ERR_H
+#define HOST_LWIP_ERR_H
+
+// --- lwIP: TIPI DI BASE --- //
+#include <stdint.h>
+
+typedef int8_t err_t;
+#define ERR_OK          0
+#define ERR_MEM        -1
+#define ERR_INPROGRESS -5
+#define ERR_VAL        -6
+#define ERR_ABRT      -13
+#define ERR_RST       -14
+#define ERR_CONN      -11
+
+typedef struct ip_addr {
+    uint32_t addr;   // Ordine di rete, come lwIP
+} ip_addr_t;
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_LWIP_TCP_H
+#define HOST_LWIP_TCP_H
+
+// --- lwIP: API TCP RAW --- //
+// Solo le chiamate usate dalla sonda di MqttSession; il test decide l'esito della
+// connessione con hostTcpComplete() (fakes/HostFakes.h).
+#include "lwip/err.h"
+
+struct tcp_pcb;
+typedef err_t (*tcp_connected_fn)(void* arg, struct tcp_pcb* pcb, err_t err);
+typedef void (*tcp_err_fn)(void* arg, err_t err);
+
+struct tcp_pcb* tcp_new(void);
+void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err);
+err_t tcp_connect(struct tcp_pcb* pcb, const ip_addr_t* ipaddr, uint16_t port, tcp_connected_fn connected);
+void tcp_abort(struct tcp_pcb* pcb);
+
+#endif
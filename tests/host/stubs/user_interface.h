@@ -0,0 +1,4 @@
+#ifndef HOST_USER_INTERFACE_H
+#define HOST_USER_INTERFACE_H
+// SDK ESP8266: nessuna chiamata usata dal gateway richiede un'implementazione host
+#endif
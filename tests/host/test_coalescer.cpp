@@ -0,0 +1,180 @@
+// --- COALESCENZA STATUS PEER --- //
+// Replay di una raffica registrata (feedback dei relè, heartbeat, cambio versione) su
+// due gruppi di nodi: finestra 0 (un /nodo/status per evento, come prima del coalescer)
+// e finestra predefinita. Riduzione dei publish, contatori, stato finale consolidato
+// e transizioni di availability che scavalcano la finestra.
+#include "HostTest.h"
+#include "StatusCoalescer.h"
+#include "PeerHandler.h"
+#include "PeerIndex.h"
+#include "MqttTopics.h"
+#include "Config.h"
+#include <algorithm>
+
+#define REPLAY_NODES 8
+
+struct ReplayEvent {
+    unsigned long at;       // ms dall'inizio della raffica del nodo
+    const char* topic;
+    const char* command;
+    const char* status;
+    const char* type;
+};
+
+// Raffica di un 4 relè: scena "tutto acceso", ribalzi di un interruttore, spegnimenti
+// sparsi, heartbeat con nuova versione
+static const ReplayEvent burst[] = {
+    {0, "relay_1", "ON", "ON", "FEEDBACK"},
+    {30, "relay_2", "ON", "ON", "FEEDBACK"},
+    {60, "relay_3", "ON", "ON", "FEEDBACK"},
+    {90, "relay_4", "ON", "ON", "FEEDBACK"},
+    {400, "STATUS", "HEARTBEAT", "ALIVE|1.0|1111", "STATUS"},
+    {500, "relay_1", "OFF", "OFF", "FEEDBACK"},
+    {520, "relay_1", "ON", "ON", "FEEDBACK"},
+    {540, "relay_1", "OFF", "OFF", "FEEDBACK"},
+    {1500, "relay_2", "OFF", "OFF", "FEEDBACK"},
+    {1530, "relay_3", "OFF", "OFF", "FEEDBACK"},
+    {2600, "STATUS", "HEARTBEAT", "ALIVE|1.1|0001", "STATUS"},
+    {3000, "relay_4", "OFF", "OFF", "FEEDBACK"},
+};
+static const int burstEvents = sizeof(burst) / sizeof(burst[0]);
+
+static void nodeName(char* out, size_t size, char group, int n) {
+    snprintf(out, size, "NODE_%c%d", group, n);
+}
+
+static std::vector<const HostPublish*> statusOf(const char* nodeId, size_t from) {
+    std::string needle = std::string("\"nodeId\":\"") + nodeId + "\"";
+    std::vector<const HostPublish*> out;
+    const char* topic = mqttTopic(TOPIC_NODE_STATUS);
+    for (size_t p = from; p < hostMqttPublished().size(); p++) {
+        const HostPublish& pub = hostMqttPublished()[p];
+        if (pub.topic == topic && pub.payload.find(needle) != std::string::npos) out.push_back(&pub);
+    }
+    return out;
+}
+
+struct ReplayResult {
+    int events;
+    int publishes;
+    uint32_t published;
+    uint32_t suppressed;
+    size_t from;
+};
+
+// Registra i nodi del gruppo, poi riproduce la raffica di tutti i nodi sfasata di 7 ms
+static ReplayResult replay(char group, unsigned long windowMs) {
+    status_coalesce_ms = windowMs;
+    for (int n = 0; n < REPLAY_NODES; n++) {
+        uint8_t mac[6];
+        char node[16];
+        hostNodeMac(mac, (group << 8) + n);
+        nodeName(node, sizeof(node), group, n);
+        hostNodeRegister(mac, node, "4_RELAY_CONTROLLER");
+    }
+    hostLoopFor(2000, 10);
+
+    ReplayResult r = {0, 0, statusPublished, statusSuppressed, hostMqttPublished().size()};
+    unsigned long start = millis();
+    std::vector<std::pair<unsigned long, int>> timeline;
+    for (int n = 0; n < REPLAY_NODES; n++) {
+        for (int e = 0; e < burstEvents; e++) timeline.push_back({burst[e].at + n * 7, n * burstEvents + e});
+    }
+    std::sort(timeline.begin(), timeline.end());
+
+    for (auto& entry : timeline) {
+        while (millis() - start < entry.first) {
+            hostAdvance(1);
+            hostLoop();
+        }
+        int n = entry.second / burstEvents;
+        const ReplayEvent& ev = burst[entry.second % burstEvents];
+        uint8_t mac[6];
+        char node[16];
+        hostNodeMac(mac, (group << 8) + n);
+        nodeName(node, sizeof(node), group, n);
+        hostNodeSend(mac, node, ev.topic, ev.command, ev.status, ev.type);
+        hostLoop();
+        r.events++;
+    }
+    hostLoopFor(2 * windowMs + 100);
+
+    for (int n = 0; n < REPLAY_NODES; n++) {
+        char node[16];
+        nodeName(node, sizeof(node), group, n);
+        r.publishes += statusOf(node, r.from).size();
+    }
+    r.published = statusPublished - r.published;
+    r.suppressed = statusSuppressed - r.suppressed;
+    return r;
+}
+
+static void testReplayBurst() {
+    ReplayResult perEvent = replay('A', 0);
+    ReplayResult coalesced = replay('B', 1000);
+
+    printf("  raffica di %d eventi su %d nodi: %d /nodo/status senza finestra, %d con 1000 ms (-%d%%)\n",
+           coalesced.events, REPLAY_NODES, perEvent.publishes, coalesced.publishes,
+           100 - coalesced.publishes * 100 / perEvent.publishes);
+    printf("  contatori: %u pubblicati, %u assorbiti\n", (unsigned) coalesced.published,
+           (unsigned) coalesced.suppressed);
+
+    // Senza finestra ogni evento che cambia lo stato produce un publish (come prima)
+    CHECK_EQ(perEvent.publishes, perEvent.published);
+    CHECK(perEvent.publishes >= REPLAY_NODES * (burstEvents - 2));
+    CHECK_EQ(coalesced.publishes, coalesced.published);
+    CHECK(coalesced.publishes * 2 < perEvent.publishes);
+
+    // Nessuna richiesta persa: ogni evento è un publish o è stato assorbito
+    CHECK_EQ(coalesced.published + coalesced.suppressed, perEvent.published + perEvent.suppressed);
+
+    for (int n = 0; n < REPLAY_NODES; n++) {
+        char node[16];
+        nodeName(node, sizeof(node), 'B', n);
+        std::vector<const HostPublish*> pubs = statusOf(node, coalesced.from);
+        CHECK(!pubs.empty());
+        if (pubs.empty()) continue;
+
+        // Al più un publish per finestra, e l'ultimo porta lo stato finale
+        for (size_t p = 1; p < pubs.size(); p++) CHECK(pubs[p]->at - pubs[p - 1]->at >= 1000);
+        const std::string& last = pubs.back()->payload;
+        CHECK(last.find("\"attributes\":\"0000\"") != std::string::npos);
+        CHECK(last.find("\"firmwareVersion\":\"1.1\"") != std::string::npos);
+    }
+}
+
+static void testAvailabilityBypassesWindow() {
+    status_coalesce_ms = 5000;
+    uint8_t mac[6];
+    hostNodeMac(mac, 0xC00);
+    hostNodeRegister(mac, "NODE_C0", "4_RELAY_CONTROLLER");
+    hostLoopFor(100);
+
+    // Feedback nella finestra: trattenuto
+    size_t from = hostMqttPublished().size();
+    hostNodeSend(mac, "NODE_C0", "relay_1", "ON", "ON", "FEEDBACK");
+    hostLoopFor(100);
+    CHECK_EQ(statusOf("NODE_C0", from).size(), 0);
+
+    // Il nodo torna online: publish al giro successivo, con lo stato accumulato
+    int i = findPeerByMac(mac);
+    CHECK(i >= 0);
+    if (i < 0) return;
+    peerList[i].isOnline = false;
+    hostNodeSend(mac, "NODE_C0", "relay_2", "ON", "ON", "FEEDBACK");
+    hostLoop();
+    hostLoop();
+    std::vector<const HostPublish*> pubs = statusOf("NODE_C0", from);
+    CHECK_EQ(pubs.size(), 1);
+    if (!pubs.empty()) {
+        CHECK(pubs[0]->payload.find("\"status\":\"online\"") != std::string::npos);
+        CHECK(pubs[0]->payload.find("\"attributes\":\"1100\"") != std::string::npos);
+    }
+}
+
+int main() {
+    CHECK(hostBoot());
+    RUN_TEST(testReplayBurst);
+    RUN_TEST(testAvailabilityBypassesWindow);
+    return hostTestResult();
+}
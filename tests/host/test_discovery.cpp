@@ -0,0 +1,180 @@
+// --- DISCOVERY HOME ASSISTANT --- //
+// Config retained pubblicate per ogni tipo nodo predefinito: formato attuale (chiavi
+// abbreviate, topic base "~", blocco device solo sulla prima entità) contro il formato
+// con chiavi estese di prima, ricopiato qui dalla versione originale. Byte per nodo,
+// JSON valido e stesse identità per Home Assistant (uniq_id, nome, dispositivo).
+#include "HostTest.h"
+#include "HaDiscovery.h"
+#include "MqttHandler.h"
+#include "Config.h"
+#include <ArduinoJson.h>
+
+static const char* const DEFAULT_TYPES[] = {"4_RELAY_CONTROLLER", "2_RELAY_CONTROLLER", "SHUTTER_CONTROLLER"};
+
+// --- FORMATO PRECEDENTE --- //
+static String legacyCommandTemplate(const String& nodeId, const String& topic, const char* component) {
+    if (strcmp(component, "cover") == 0) {
+         String json = "{\"Node\":\"" + nodeId + "\",\"Topic\":\"" + topic;
+         json += "\",\"Command\":\"{{ 'UP' if value == 'OPEN' else 'DOWN' if value == 'CLOSE' else 'STOP' }}\",\"Status\":\"\",\"Type\":\"COMMAND\"}";
+         return json;
+    }
+    String json = "{\"Node\":\"" + nodeId + "\",\"Topic\":\"" + topic;
+    json += "\",\"Command\":\"{{ '1' if value in ['ON','1', true] else '0' }}\",\"Status\":\"\",\"Type\":\"COMMAND\"}";
+    return json;
+}
+
+static String legacyValueTemplate(const String& nodeId, int attrIndex) {
+    return String("{% if value_json.Node == '") + nodeId + String("' and value_json.attributes is defined %}{{ value_json.attributes[") + String(attrIndex) + String("] }}{% endif %}");
+}
+
+static bool legacyPublishEntityDiscovery(PubSubClient& client, const Peer& peer, const char* topicPrefix, const NodeEntity& entity) {
+    String nodeIdStr = String(peer.nodeId);
+
+    DynamicJsonDocument c(1024);
+
+    JsonObject device = c.createNestedObject("device");
+    JsonArray identifiers = device.createNestedArray("identifiers");
+    identifiers.add(String("domoriky_") + nodeIdStr);
+
+    device["name"] = nodeIdStr;
+    device["model"] = String(peer.nodeType);
+    device["manufacturer"] = "Domoriky";
+    if (strlen(peer.firmwareVersion) > 0) {
+        device["sw_version"] = String(peer.firmwareVersion);
+    }
+
+    c["state_topic"] = String(topicPrefix) + String("/nodo/status");
+
+    JsonArray avail = c.createNestedArray("availability");
+    JsonObject a1 = avail.createNestedObject();
+    a1["topic"] = String(topicPrefix) + String("/nodo/") + nodeIdStr + String("/availability");
+    a1["payload_available"] = String("online");
+    a1["payload_not_available"] = String("offline");
+
+    JsonObject a2 = avail.createNestedObject();
+    a2["topic"] = String(topicPrefix) + String("/gateway/availability");
+    a2["payload_available"] = String("online");
+    a2["payload_not_available"] = String("offline");
+
+    c["command_topic"] = String(topicPrefix) + String("/nodo/command");
+
+    c["name"] = nodeIdStr + String(" ") + entity.name;
+    c["unique_id"] = String("domoriky_") + nodeIdStr + String("_") + entity.suffix;
+    c["icon"] = entity.icon;
+    c["device_class"] = entity.deviceClass;
+
+    if (strcmp(entity.component, "switch") == 0) {
+        c["payload_on"] = "ON";
+        c["payload_off"] = "OFF";
+        c["state_on"] = "1";
+        c["state_off"] = "0";
+    } else if (strcmp(entity.component, "cover") == 0) {
+        c["payload_open"] = "OPEN";
+        c["payload_close"] = "CLOSE";
+        c["payload_stop"] = "STOP";
+        c["state_open"] = "1";
+        c["state_closed"] = "0";
+        c["optimistic"] = false;
+    }
+
+    c["command_template"] = legacyCommandTemplate(nodeIdStr, entity.suffix, entity.component);
+    c["value_template"] = legacyValueTemplate(nodeIdStr, entity.attributeIndex);
+
+    String cfgTopic = String("homeassistant/") + entity.component + "/" + peer.nodeId + "_" + entity.suffix + "/config";
+    String payload;
+    serializeJson(c, payload);
+    return client.publish(cfgTopic.c_str(), payload.c_str(), true);
+}
+
+// --- CONFRONTO --- //
+static Peer makePeer(const char* nodeType) {
+    Peer peer;
+    memset(&peer, 0, sizeof(peer));
+    strcpy(peer.nodeId, "NODE_01");
+    snprintf(peer.nodeType, sizeof(peer.nodeType), "%s", nodeType);
+    strcpy(peer.firmwareVersion, "1.0.0");
+    peer.isOnline = true;
+    return peer;
+}
+
+// Payload retained pubblicati da publish() su homeassistant/...
+template<typename F>
+static std::vector<std::string> configs(F publish) {
+    size_t from = hostMqttPublished().size();
+    publish();
+    std::vector<std::string> out;
+    for (size_t p = from; p < hostMqttPublished().size(); p++) {
+        const HostPublish& pub = hostMqttPublished()[p];
+        if (pub.topic.compare(0, 14, "homeassistant/") == 0 && pub.retained) out.push_back(pub.payload);
+    }
+    return out;
+}
+
+static size_t total(const std::vector<std::string>& payloads) {
+    size_t bytes = 0;
+    for (const std::string& p : payloads) bytes += p.size();
+    return bytes;
+}
+
+static void compareDefaultTypes() {
+    size_t allNow = 0, allOld = 0;
+    for (const char* type : DEFAULT_TYPES) {
+        Peer peer = makePeer(type);
+        int count = 0;
+        const NodeEntity* entities = NodeTypeManager::getEntities(type, &count);
+        CHECK(count > 0);
+
+        std::vector<std::string> now = configs([&] {
+            for (int i = 0; i < count; i++) {
+                CHECK(HaDiscovery::publishEntityDiscovery(mqttClient, peer, mqtt_topic_prefix, entities[i], i == 0));
+            }
+        });
+        std::vector<std::string> old = configs([&] {
+            for (int i = 0; i < count; i++) {
+                CHECK(legacyPublishEntityDiscovery(mqttClient, peer, mqtt_topic_prefix, entities[i]));
+            }
+        });
+        CHECK_EQ(now.size(), (size_t) count);
+        CHECK_EQ(old.size(), (size_t) count);
+        if (now.size() != old.size()) continue;
+
+        // Stesse identità in Home Assistant: le entità esistenti non vengono duplicate
+        for (size_t i = 0; i < now.size(); i++) {
+            DynamicJsonDocument dn(2048), dold(2048);
+            CHECK(!deserializeJson(dn, now[i].c_str()));
+            CHECK(!deserializeJson(dold, old[i].c_str()));
+            CHECK_STR(dn["~"].as<const char*>(), mqtt_topic_prefix);
+            CHECK(dn["uniq_id"].as<String>() == dold["unique_id"].as<String>());
+            CHECK(dn["name"].as<String>() == dold["name"].as<String>());
+            CHECK(dn["dev"]["ids"][0].as<String>() == dold["device"]["identifiers"][0].as<String>());
+            CHECK_EQ(dn["dev"].containsKey("mdl"), i == 0);
+            CHECK(dn["stat_t"].as<String>().startsWith("~/"));
+        }
+
+        size_t bytesNow = total(now), bytesOld = total(old);
+        printf("  %-20s %d ent: %5zu -> %5zu byte retained (%+.0f%%)\n", type, count, bytesOld, bytesNow,
+               100.0 * ((double) bytesNow - (double) bytesOld) / (double) bytesOld);
+        CHECK(bytesNow < bytesOld);
+        allNow += bytesNow;
+        allOld += bytesOld;
+    }
+    // Riduzione complessiva di almeno un quarto rispetto alle chiavi estese
+    CHECK(allNow * 4 <= allOld * 3);
+}
+
+// Stato sullo stream condiviso /nodo/status (come il formato precedente) e per nodo
+static void testDefaultTypes() {
+    bool saved = node_state_topics;
+    for (bool perNode : {false, true}) {
+        node_state_topics = perNode;
+        printf("  stato %s\n", perNode ? "per nodo (<prefix>/nodo/<id>/state)" : "condiviso (<prefix>/nodo/status)");
+        compareDefaultTypes();
+    }
+    node_state_topics = saved;
+}
+
+int main() {
+    CHECK(hostBoot());
+    RUN_TEST(testDefaultTypes);
+    return hostTestResult();
+}
@@ -0,0 +1,186 @@
+// --- DISPATCH MESSAGGI --- //
+// Hash perfetto delle keyword (MessageDispatch), instradamento dei frame ESP-NOW e dei
+// comandi MQTT del gateway sul firmware reale, throughput del dispatcher su un mix di
+// traffico realistico.
+#include "HostTest.h"
+#include "MessageDispatch.h"
+#include "EspNowHandler.h"
+#include "MqttTopics.h"
+#include "PeerIndex.h"
+#include <chrono>
+
+static int countPublished(const char* topic, const char* needle) {
+    int n = 0;
+    for (const HostPublish& p : hostMqttPublished()) {
+        if (p.topic == topic && p.payload.find(needle) != std::string::npos) n++;
+    }
+    return n;
+}
+
+static int framesTo(const uint8_t* mac, size_t from) {
+    int n = 0;
+    for (size_t f = from; f < hostEspNowSent().size(); f++) {
+        if (memcmp(hostEspNowSent()[f].mac, mac, 6) == 0) n++;
+    }
+    return n;
+}
+
+static void testEveryKeywordRoundTrips() {
+    for (int kw = 1; kw < KW_COUNT; kw++) {
+        const char* name = keywordName((MsgKeyword) kw);
+        CHECK(name[0] != '\0');
+        CHECK_EQ(lookupKeyword(name), kw);
+    }
+    CHECK_STR(keywordName(KW_UNKNOWN), "");
+    CHECK_STR(keywordName((MsgKeyword) 250), "");
+}
+
+static void testUnknownStringsAreRejected() {
+    CHECK_EQ(lookupKeyword(NULL), KW_UNKNOWN);
+    CHECK_EQ(lookupKeyword(""), KW_UNKNOWN);
+    CHECK_EQ(lookupKeyword("register"), KW_UNKNOWN);
+    CHECK_EQ(lookupKeyword("REGISTE"), KW_UNKNOWN);
+    CHECK_EQ(lookupKeyword("REGISTERX"), KW_UNKNOWN);
+    CHECK_EQ(lookupKeyword("relay_1"), KW_UNKNOWN);
+
+    // Stringhe casuali: un risultato diverso da KW_UNKNOWN deve essere la keyword esatta
+    char buf[24];
+    int hits = 0;
+    for (int i = 0; i < 200000; i++) {
+        int len = 1 + hostRandom32() % 20;
+        for (int c = 0; c < len; c++) buf[c] = "ABCDEGHIKLMNOPRSTUVWY_"[hostRandom32() % 22];
+        buf[len] = '\0';
+        MsgKeyword kw = lookupKeyword(buf);
+        if (kw != KW_UNKNOWN) {
+            hits++;
+            CHECK_STR(keywordName(kw), buf);
+        }
+    }
+    CHECK(hits < 10);
+}
+
+static void testEspNowRouting() {
+    uint8_t mac[6];
+    hostNodeMac(mac, 1);
+
+    // REGISTER: peer creato con tipo e versione dallo status
+    hostNodeRegister(mac, "NODE_1", "4_RELAY_CONTROLLER");
+    int i = findPeerByMac(mac);
+    CHECK(i >= 0);
+    if (i < 0) return;
+    CHECK_STR(peerList[i].nodeType, "4_RELAY_CONTROLLER");
+    CHECK_STR(peerList[i].firmwareVersion, "1.0");
+
+    // FEEDBACK generico: attributi aggiornati e stato pubblicato sullo stream dei nodi
+    const char* nodeStatus = mqttTopic(TOPIC_NODE_STATUS);
+    int before = countPublished(nodeStatus, "relay_2");
+    hostNodeSend(mac, "NODE_1", "relay_2", "ON", "ON", "FEEDBACK");
+    hostLoopFor(1500, 50);
+    CHECK_EQ(peerList[i].attributes[1], '1');
+    CHECK(countPublished(nodeStatus, "relay_2") > before);
+
+    // HEARTBEAT: solo lastSeen, nessun inoltro del messaggio su MQTT
+    hostAdvance(5000);
+    unsigned long sentAt = millis();
+    hostNodeSend(mac, "NODE_1", "STATUS", "HEARTBEAT", "ALIVE|1.1|0100", "STATUS");
+    hostLoop();
+    CHECK_EQ(peerList[i].lastSeen, sentAt);
+    CHECK_STR(peerList[i].firmwareVersion, "1.1");
+    CHECK_EQ(countPublished(nodeStatus, "\"HEARTBEAT\""), 0);
+
+    // Probe di discovery: risposta solo se rivolto a questo gateway
+    size_t sent = hostEspNowSent().size();
+    hostNodeSend(mac, "NODE_1", "DISCOVERY", "REQUEST", "OTHER_GW", "DISCOVERY");
+    hostLoopFor(20);
+    CHECK_EQ(framesTo(mac, sent), 0);
+    hostNodeSend(mac, "NODE_1", "DISCOVERY", "REQUEST", "GW_TEST", "DISCOVERY");
+    hostLoopFor(20);
+    CHECK_EQ(framesTo(mac, sent), 1);
+
+    // REMOVE_PEER: gestito senza filtro gateway
+    hostNodeSend(mac, "NODE_1", "CONTROL", "REMOVE_PEER", "", "COMMAND");
+    hostLoop();
+    CHECK(findPeerByMac(mac) < 0);
+}
+
+static void testMqttGatewayCommands() {
+    const char* cmdTopic = mqttTopic(TOPIC_GATEWAY_COMMAND);
+    const char* gwStatus = mqttTopic(TOPIC_GATEWAY_STATUS);
+
+    int before = countPublished(gwStatus, "version_info");
+    hostMqttInject(cmdTopic, "{\"command\":\"GET_VERSION\"}");
+    hostLoop();
+    CHECK_EQ(countPublished(gwStatus, "version_info"), before + 1);
+
+    // Chiave "Command" accettata come alternativa
+    hostMqttInject(cmdTopic, "{\"Command\":\"GET_VERSION\"}");
+    hostLoop();
+    CHECK_EQ(countPublished(gwStatus, "version_info"), before + 2);
+
+    // Comando sconosciuto o keyword ESP-NOW non gateway: nessun handler
+    size_t total = hostMqttPublished().size();
+    hostMqttInject(cmdTopic, "{\"command\":\"SELF_DESTRUCT\"}");
+    hostLoop();
+    hostMqttInject(cmdTopic, "{\"command\":\"REGISTER\"}");
+    hostLoop();
+    CHECK_EQ(hostMqttPublished().size(), total);
+
+    // JSON non valido: errore pubblicato
+    hostMqttInject(cmdTopic, "{\"command\":");
+    hostLoop();
+    CHECK_EQ(countPublished(gwStatus, "Invalid JSON"), 1);
+}
+
+// Catena if/else di strcmp equivalente all'instradamento precedente
+static int routeByStrcmp(const char* type, const char* topic, const char* command) {
+    if (strcmp(type, "DISCOVERY") == 0 && strcmp(topic, "DISCOVERY") == 0) return 1;
+    if (strcmp(command, "REMOVE_PEER") == 0) return 2;
+    if (strcmp(type, "FEEDBACK") == 0 && strcmp(command, "OTA_UPDATE") == 0) return 3;
+    if (strcmp(command, "REGISTER") == 0) return 4;
+    if (strcmp(type, "DISCOVERY") == 0 && strcmp(command, "REQUEST") == 0) return 5;
+    if ((strcmp(command, "PONG") == 0 && strcmp(topic, "CONTROL") == 0) ||
+        (strcmp(command, "HEARTBEAT") == 0 && strcmp(topic, "STATUS") == 0)) return 6;
+    if (strcmp(type, "DISCOVERY") == 0 && strcmp(command, "DISCOVERY_RESPONSE") == 0) return 7;
+    return 0;
+}
+
+static void benchmarkDispatch() {
+    // Mix di una rete domestica: feedback e heartbeat dominano, discovery e registrazioni rare
+    static const char* const mix[][3] = {
+        {"FEEDBACK", "relay_1", "ON"}, {"FEEDBACK", "relay_2", "OFF"}, {"STATUS", "STATUS", "HEARTBEAT"},
+        {"FEEDBACK", "relay_3", "ON"}, {"STATUS", "STATUS", "HEARTBEAT"}, {"RESPONSE", "CONTROL", "PONG"},
+        {"FEEDBACK", "shutter", "UP"}, {"STATUS", "STATUS", "HEARTBEAT"}, {"DISCOVERY", "DISCOVERY", "REQUEST"},
+        {"REGISTRATION", "CONTROL", "REGISTER"}, {"FEEDBACK", "relay_4", "OFF"}, {"STATUS", "STATUS", "HEARTBEAT"},
+        {"FEEDBACK", "relay_1", "OFF"}, {"FEEDBACK", "relay_2", "ON"}, {"STATUS", "STATUS", "HEARTBEAT"},
+        {"DISCOVERY", "DISCOVERY", "DISCOVERY_RESPONSE"}
+    };
+    const int rounds = 2000000;
+    volatile unsigned sink = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int n = 0; n < rounds; n++) {
+        const char* const* m = mix[n & 15];
+        sink += lookupKeyword(m[0]) + lookupKeyword(m[1]) + lookupKeyword(m[2]);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int n = 0; n < rounds; n++) {
+        const char* const* m = mix[n & 15];
+        sink += routeByStrcmp(m[0], m[1], m[2]);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    double hashRate = rounds / std::chrono::duration<double>(t1 - t0).count();
+    double strcmpRate = rounds / std::chrono::duration<double>(t2 - t1).count();
+    printf("  dispatcher: %.1f M msg/s, catena strcmp: %.1f M msg/s\n", hashRate / 1e6, strcmpRate / 1e6);
+    CHECK(hashRate > 1e6);
+}
+
+int main() {
+    RUN_TEST(testEveryKeywordRoundTrips);
+    RUN_TEST(testUnknownStringsAreRejected);
+    CHECK(hostBoot());
+    RUN_TEST(testEspNowRouting);
+    RUN_TEST(testMqttGatewayCommands);
+    RUN_TEST(benchmarkDispatch);
+    return hostTestResult();
+}
@@ -0,0 +1,138 @@
+// --- LATENZA MQTT -> RADIO --- //
+// Lo stesso comando relè inviato dal broker sui due percorsi: JSON su
+// <prefix>/nodo/command e payload grezzo su <prefix>/nodo/<id>/<entity>/set.
+// Per ogni comando: tempo reale (CPU dell'host) dalla consegna del messaggio al frame
+// ESP-NOW verso il nodo, millisecondi simulati fino all'invio e campioni dei contatori
+// jsonCommandLatency/directCommandLatency del gateway (i loro µs vengono da micros(),
+// che sull'host è simulato: qui conta solo che ogni comando finisca nel suo contatore).
+#include "HostTest.h"
+#include "PeerHandler.h"
+#include "MqttTopics.h"
+#include <DomoticaProtocol.h>
+#include <algorithm>
+#include <chrono>
+
+#define LATENCY_NODES    4
+#define LATENCY_COMMANDS 400
+
+struct PathResult {
+    int sent;
+    int reached;
+    std::vector<double> wallUs;     // Tempo reale dalla consegna al frame radio
+    unsigned long maxSimMs;         // Millisecondi simulati fino al frame
+};
+
+static void nodeName(char* out, size_t size, int n) {
+    snprintf(out, size, "NODE_L%d", n);
+}
+
+// Primo frame verso mac da from in poi, -1 se non ancora partito
+static int frameTo(const uint8_t* mac, size_t from) {
+    for (size_t f = from; f < hostEspNowSent().size(); f++) {
+        if (memcmp(hostEspNowSent()[f].mac, mac, 6) == 0) return (int) f;
+    }
+    return -1;
+}
+
+// Consegna il messaggio, poi giri del loop (senza far avanzare l'orologio finché il
+// frame non parte) fino al frame per il nodo
+template<typename F>
+static PathResult run(F message) {
+    PathResult r = {0, 0, {}, 0};
+    for (int c = 0; c < LATENCY_COMMANDS; c++) {
+        int n = c % LATENCY_NODES;
+        uint8_t mac[6];
+        char node[16], topic[MQTT_TOPIC_MAX], entity[12];
+        std::string payload;
+        hostNodeMac(mac, 100 + n);
+        nodeName(node, sizeof(node), n);
+        snprintf(entity, sizeof(entity), "relay_%d", c % 4 + 1);
+        message(node, entity, topic, sizeof(topic), payload);
+
+        size_t from = hostEspNowSent().size();
+        unsigned long startMs = millis();
+        auto start = std::chrono::steady_clock::now();
+        hostMqttInject(topic, payload);
+        r.sent++;
+
+        int f = -1;
+        for (int t = 0; t < 50 && f < 0; t++) {
+            if (t > 0) hostAdvance(1);
+            hostLoop();
+            f = frameTo(mac, from);
+        }
+        auto end = std::chrono::steady_clock::now();
+        if (f >= 0) {
+            const HostFrame& frame = hostEspNowSent()[f];
+            const struct_message* msg = (const struct_message*) frame.data.data();
+            CHECK_EQ(frame.data.size(), sizeof(struct_message));
+            CHECK_STR(msg->topic, entity);
+            CHECK_STR(msg->command, "1");
+            r.reached++;
+            r.wallUs.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+            r.maxSimMs = std::max(r.maxSimMs, millis() - startMs);
+        }
+
+        // Feedback del nodo: il comando esce dalla coda di quelli in attesa
+        hostNodeSend(mac, node, entity, "1", "ON", "FEEDBACK");
+        hostLoopFor(20);
+    }
+    return r;
+}
+
+static double percentile(std::vector<double> v, int p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[(v.size() - 1) * p / 100];
+}
+
+static void report(const char* name, const PathResult& r, uint32_t samples) {
+    printf("  %-8s %4d/%d frame | reale p50 %6.1f us, p99 %6.1f us | simulato max %lu ms | contatore %u\n", name,
+           r.reached, r.sent, percentile(r.wallUs, 50), percentile(r.wallUs, 99), r.maxSimMs,
+           (unsigned) samples);
+}
+
+static void testBothPaths() {
+    for (int n = 0; n < LATENCY_NODES; n++) {
+        uint8_t mac[6];
+        char node[16];
+        hostNodeMac(mac, 100 + n);
+        nodeName(node, sizeof(node), n);
+        hostNodeRegister(mac, node, "4_RELAY_CONTROLLER");
+    }
+    hostLoopFor(2000, 10);
+
+    uint32_t jsonBefore = jsonCommandLatency.count;
+    PathResult json = run([](const char* node, const char* entity, char* topic, size_t size, std::string& payload) {
+        snprintf(topic, size, "%s", mqttTopic(TOPIC_NODE_COMMAND));
+        payload = std::string("{\"Node\":\"") + node + "\",\"Topic\":\"" + entity +
+                  "\",\"Command\":\"ON\",\"Status\":\"\",\"Type\":\"COMMAND\"}";
+    });
+    uint32_t jsonSamples = jsonCommandLatency.count - jsonBefore;
+
+    uint32_t directBefore = directCommandLatency.count;
+    PathResult direct = run([](const char* node, const char* entity, char* topic, size_t size, std::string& payload) {
+        snprintf(topic, size, "domoriky/nodo/%s/%s/set", node, entity);
+        payload = "ON";
+    });
+    uint32_t directSamples = directCommandLatency.count - directBefore;
+
+    report("JSON", json, jsonSamples);
+    report("diretto", direct, directSamples);
+
+    // Ogni comando arriva alla radio entro il giro del loop che lo riceve
+    CHECK_EQ(json.reached, json.sent);
+    CHECK_EQ(direct.reached, direct.sent);
+    CHECK_EQ(json.maxSimMs, 0);
+    CHECK_EQ(direct.maxSimMs, 0);
+
+    // Strumentazione del gateway: un campione per comando, ciascuno sul suo percorso
+    CHECK_EQ(jsonSamples, json.sent);
+    CHECK_EQ(directSamples, direct.sent);
+}
+
+int main() {
+    CHECK(hostBoot());
+    RUN_TEST(testBothPaths);
+    return hostTestResult();
+}
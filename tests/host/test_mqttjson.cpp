@@ -0,0 +1,236 @@
+// --- JSON MQTT IN STREAMING --- //
+// Byte e allocazioni per messaggio dei publish del gateway: percorso attuale
+// (MqttJsonWriter verso beginPublish/write/endPublish) contro il percorso precedente
+// (DynamicJsonDocument + String + publish), ricopiato qui dalla versione originale.
+// Il percorso precedente usa l'ArduinoJson degli stub host, che alloca per nodo:
+// sul dispositivo il documento è un solo blocco da 512 byte, le String restano.
+#include "HostTest.h"
+#include "MqttHandler.h"
+#include "MqttJsonWriter.h"
+#include "PeerHandler.h"
+#include "PeerIndex.h"
+#include "Config.h"
+#include <ArduinoJson.h>
+#include <new>
+
+// --- CONTEGGIO ALLOCAZIONI --- //
+static bool counting = false;
+static uint32_t allocCount = 0;
+static size_t allocBytes = 0;
+
+void* operator new(size_t size) {
+    if (counting) {
+        allocCount++;
+        allocBytes += size;
+    }
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+struct AllocStats {
+    double allocs;
+    double bytes;
+};
+
+// Media per messaggio su rounds publish, senza le allocazioni del broker emulato
+template<typename F>
+static AllocStats measure(F publish, int rounds = 200) {
+    hostMqttRecord(false);
+    allocCount = 0;
+    allocBytes = 0;
+    counting = true;
+    for (int r = 0; r < rounds; r++) publish();
+    counting = false;
+    hostMqttRecord(true);
+    return AllocStats{(double) allocCount / rounds, (double) allocBytes / rounds};
+}
+
+// Payload dell'ultimo publish (registrato)
+template<typename F>
+static std::string capture(F publish) {
+    size_t before = hostMqttPublished().size();
+    publish();
+    return hostMqttPublished().size() > before ? hostMqttPublished().back().payload : std::string();
+}
+
+// --- PERCORSO PRECEDENTE --- //
+static void legacyPublishPeerStatus(int i, const char* command) {
+    if (!mqttClient.connected()) return;
+
+    unsigned long currentTime = millis();
+    DynamicJsonDocument peerDoc(512);
+    peerDoc["command"] = command;
+
+    if (String(gateway_id).length() == 0 || String(gateway_id) == "null") {
+        peerDoc["gatewayId"] = "GATEWAY_02";
+    } else {
+        peerDoc["gatewayId"] = gateway_id;
+    }
+
+    peerDoc["timestamp"] = currentTime;
+    peerDoc["index"] = i;
+    peerDoc["totalNodes"] = peerCount;
+
+    int onlineNodes = 0;
+    for (int j = 0; j < peerCount; j++) {
+        if (peerList[j].isOnline) onlineNodes++;
+    }
+    peerDoc["onlineNodes"] = onlineNodes;
+
+    char macStr[18];
+    snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+             peerList[i].mac[0], peerList[i].mac[1], peerList[i].mac[2],
+             peerList[i].mac[3], peerList[i].mac[4], peerList[i].mac[5]);
+
+    peerDoc["mac"] = macStr;
+    peerDoc["nodeId"] = strlen(peerList[i].nodeId) > 0 ? peerList[i].nodeId : macStr;
+    // Sul dispositivo peerDoc["Node"] = peerDoc["nodeId"] copia il valore, lo stub no
+    peerDoc["Node"] = strlen(peerList[i].nodeId) > 0 ? peerList[i].nodeId : macStr;
+    peerDoc["nodeType"] = strlen(peerList[i].nodeType) > 0 ? peerList[i].nodeType : "UNKNOWN";
+    peerDoc["firmwareVersion"] = strlen(peerList[i].firmwareVersion) > 0 ? peerList[i].firmwareVersion : "UNKNOWN";
+    peerDoc["attributes"] = strlen(peerList[i].attributes) > 0 ? peerList[i].attributes : "";
+    peerDoc["status"] = peerList[i].isOnline ? "online" : "offline";
+
+    if (peerList[i].lastSeen > 0) {
+        unsigned long lastSeenAgo = currentTime - peerList[i].lastSeen;
+        peerDoc["lastSeenMs"] = lastSeenAgo;
+        peerDoc["lastSeen"] = String(lastSeenAgo / 1000) + "s fa";
+    } else {
+        peerDoc["lastSeenMs"] = -1;
+        peerDoc["lastSeen"] = "MAI";
+    }
+
+    String peerResponse;
+    serializeJson(peerDoc, peerResponse);
+
+    String topic = String(mqtt_topic_prefix) + "/nodo/status";
+    mqttClient.publish(topic.c_str(), peerResponse.c_str());
+}
+
+static void legacyPublishNodeStatus(const String& nodeId, const String& topic_name, const String& command,
+                                    const String& status, const String& type) {
+    if (!mqttClient.connected()) return;
+
+    String topic = String(mqtt_topic_prefix) + "/nodo/status";
+
+    DynamicJsonDocument doc(512);
+    doc["Node"] = nodeId;
+    doc["Topic"] = topic_name;
+    doc["Command"] = command;
+    doc["Status"] = status;
+    doc["Type"] = type;
+    doc["gatewayId"] = gateway_id;
+    doc["timestamp"] = millis();
+
+    for (int i = 0; i < peerCount; i++) {
+        if (String(peerList[i].nodeId) == nodeId) {
+            char macStr[18];
+            snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+                     peerList[i].mac[0], peerList[i].mac[1], peerList[i].mac[2],
+                     peerList[i].mac[3], peerList[i].mac[4], peerList[i].mac[5]);
+            doc["MAC"] = macStr;
+            if (strlen(peerList[i].attributes) > 0) {
+                doc["attributes"] = peerList[i].attributes;
+            }
+            break;
+        }
+    }
+
+    String payload;
+    serializeJson(doc, payload);
+    mqttClient.publish(topic.c_str(), payload.c_str());
+}
+
+// Stessi campi con gli stessi valori (l'ordine delle chiavi non conta)
+static bool sameJson(const std::string& a, const std::string& b) {
+    DynamicJsonDocument da(1024), db(1024);
+    if (deserializeJson(da, a.c_str()) || deserializeJson(db, b.c_str())) return false;
+    JsonObject oa = da.as<JsonObject>(), ob = db.as<JsonObject>();
+    if (oa.size() != ob.size()) return false;
+    for (JsonPair kv : oa) {
+        if (!ob.containsKey(kv.key().c_str())) return false;
+        if (kv.value().as<String>() != ob[kv.key().c_str()].as<String>()) return false;
+    }
+    return true;
+}
+
+static int peer = -1;
+
+static void report(const char* name, size_t bytes, AllocStats before, AllocStats after) {
+    printf("  %-22s %5zu byte | prima: %5.1f alloc, %6.0f byte heap | ora: %4.1f alloc, %4.0f byte heap\n",
+           name, bytes, before.allocs, before.bytes, after.allocs, after.bytes);
+}
+
+static void testPeerStatus() {
+    std::string now = capture([] { publishPeerStatus(peer, "NODE_STATUS_UPDATE"); });
+    std::string old = capture([] { legacyPublishPeerStatus(peer, "NODE_STATUS_UPDATE"); });
+    CHECK(!now.empty());
+    CHECK(sameJson(now, old));
+
+    AllocStats before = measure([] { legacyPublishPeerStatus(peer, "NODE_STATUS_UPDATE"); });
+    AllocStats after = measure([] { publishPeerStatus(peer, "NODE_STATUS_UPDATE"); });
+    report("publishPeerStatus", now.size(), before, after);
+    CHECK_EQ(after.allocs, 0);
+    CHECK(before.allocs > 0);
+}
+
+static void testNodeStatus() {
+    std::string now = capture([] { publishNodeStatus("NODE_1", "relay_1", "ON", "ON", "FEEDBACK"); });
+    std::string old = capture([] { legacyPublishNodeStatus("NODE_1", "relay_1", "ON", "ON", "FEEDBACK"); });
+    CHECK(!now.empty());
+    CHECK(sameJson(now, old));
+
+    AllocStats before = measure([] { legacyPublishNodeStatus("NODE_1", "relay_1", "ON", "ON", "FEEDBACK"); });
+    AllocStats after = measure([] { publishNodeStatus("NODE_1", "relay_1", "ON", "ON", "FEEDBACK"); });
+    report("publishNodeStatus", now.size(), before, after);
+    CHECK_EQ(after.allocs, 0);
+}
+
+static void testGatewayPublishes() {
+    // Senza confronto: JSON valido e nessuna allocazione oltre alle righe di DevLog,
+    // che conserva ogni riga del log web in una String (una allocazione per riga)
+    struct { const char* name; void (*publish)(); int logLines; } paths[] = {
+        {"publishGatewayStatus", [] { publishGatewayStatus("INFO", "Gateway operativo", "GET_STATUS", "192.168.1.2"); }, 0},
+        {"sendGatewayHeartbeat", [] { sendGatewayHeartbeat(); }, 1},
+        {"sendDashboardDiscovery", [] { sendDashboardDiscovery(); }, 1},
+    };
+    for (auto& path : paths) {
+        size_t from = hostMqttPublished().size();
+        path.publish();
+        CHECK(hostMqttPublished().size() > from);
+        size_t bytes = 0;
+        for (size_t p = from; p < hostMqttPublished().size(); p++) {
+            DynamicJsonDocument doc(4096);
+            CHECK(!deserializeJson(doc, hostMqttPublished()[p].payload.c_str()));
+            bytes += hostMqttPublished()[p].payload.size();
+        }
+
+        AllocStats after = measure(path.publish, 50);
+        printf("  %-22s %5zu byte | ora: %4.1f alloc, %4.0f byte heap (%d righe di log)\n", path.name, bytes,
+               after.allocs, after.bytes, path.logLines);
+        CHECK_EQ(after.allocs, path.logLines);
+    }
+}
+
+int main() {
+    CHECK(hostBoot());
+    uint8_t mac[6];
+    hostNodeMac(mac, 1);
+    hostNodeRegister(mac, "NODE_1", "4_RELAY_CONTROLLER");
+    hostNodeSend(mac, "NODE_1", "relay_2", "ON", "ON", "FEEDBACK");
+    hostLoopFor(2000, 10);
+    peer = findPeerByMac(mac);
+    CHECK(peer >= 0);
+    if (peer < 0) return hostTestResult();
+
+    RUN_TEST(testPeerStatus);
+    RUN_TEST(testNodeStatus);
+    RUN_TEST(testGatewayPublishes);
+    return hostTestResult();
+}
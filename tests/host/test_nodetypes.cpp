@@ -0,0 +1,188 @@
+// --- REGISTRO NODETYPES --- //
+// NodeTypeManager su LittleFS in memoria: file di default, tipi dinamici e alias,
+// cache negativa, limiti del registro e costo per messaggio rispetto al parsing del
+// file a ogni chiamata (il percorso precedente al registro).
+#include "HostTest.h"
+#include "NodeTypeManager.h"
+#include <LittleFS.h>
+#include <chrono>
+
+static void resetFs() {
+    LittleFS.format();
+}
+
+static void testDefaultFileCreated() {
+    resetFs();
+    CHECK(NodeTypeManager::begin());
+    CHECK(LittleFS.exists(NODETYPES_FILE));
+    CHECK_EQ(NodeTypeManager::getTypeCount(), 3);
+    CHECK_EQ(NodeTypeManager::getEntityCount(), 7);
+
+    int count = 0;
+    const NodeEntity* e = NodeTypeManager::getEntities("4_RELAY_CONTROLLER", &count);
+    CHECK_EQ(count, 4);
+    CHECK(e != NULL);
+    if (e && count == 4) {
+        CHECK_STR(e[0].suffix, "relay_1");
+        CHECK_STR(e[3].suffix, "relay_4");
+        CHECK_STR(e[3].component, "switch");
+        CHECK_EQ(e[3].attributeIndex, 3);
+    }
+
+    e = NodeTypeManager::getEntities("SHUTTER_CONTROLLER", &count);
+    CHECK_EQ(count, 1);
+    if (e) CHECK_STR(e[0].component, "cover");
+}
+
+static void testLookupsNeverTouchTheFile() {
+    resetFs();
+    NodeTypeManager::begin();
+    // Il registro è compilato: senza il file i lookup restano identici
+    LittleFS.remove(NODETYPES_FILE);
+
+    int count = 0;
+    CHECK(NodeTypeManager::getEntities("2_RELAY_CONTROLLER", &count) != NULL);
+    CHECK_EQ(count, 2);
+}
+
+static void testDynamicAndAliasTypes() {
+    resetFs();
+    NodeTypeManager::begin();
+    int types = NodeTypeManager::getTypeCount();
+
+    int count = 0;
+    const NodeEntity* dyn = NodeTypeManager::getEntities("RL_CTRL_ESP8266_3CH", &count);
+    CHECK_EQ(count, 3);
+    CHECK(dyn != NULL);
+    if (dyn) CHECK_STR(dyn[2].suffix, "relay_3");
+    CHECK_EQ(NodeTypeManager::getTypeCount(), types + 1);
+
+    // Secondo lookup: stesso span, nessun tipo aggiunto
+    CHECK(NodeTypeManager::getEntities("RL_CTRL_ESP8266_3CH", &count) == dyn);
+    CHECK_EQ(NodeTypeManager::getTypeCount(), types + 1);
+
+    // Alias RELAY sconosciuto: condivide le entità del 4 relè
+    int baseCount = 0;
+    const NodeEntity* base = NodeTypeManager::getEntities("4_RELAY_CONTROLLER", &baseCount);
+    CHECK(NodeTypeManager::getEntities("CUSTOM_RELAY_BOARD", &count) == base);
+    CHECK_EQ(count, baseCount);
+    CHECK_EQ(NodeTypeManager::getTypeCount(), types + 2);
+}
+
+static void testUnknownTypeIsCachedNegative() {
+    resetFs();
+    NodeTypeManager::begin();
+    int types = NodeTypeManager::getTypeCount();
+
+    int count = 7;
+    CHECK(NodeTypeManager::getEntities("THERMOSTAT", &count) == NULL);
+    CHECK_EQ(count, 0);
+    CHECK_EQ(NodeTypeManager::getTypeCount(), types + 1);
+    NodeTypeManager::getEntities("THERMOSTAT", &count);
+    CHECK_EQ(NodeTypeManager::getTypeCount(), types + 1);
+
+    CHECK(NodeTypeManager::getEntities("", &count) == NULL);
+    CHECK(NodeTypeManager::getEntities(NULL, &count) == NULL);
+    CHECK_EQ(count, 0);
+}
+
+static void testCustomFileAndMissingDefaults() {
+    resetFs();
+    hostFsPut(NODETYPES_FILE,
+              "{\"DIMMER\":{\"entities\":["
+              "{\"suffix\":\"dim\",\"name\":\"Dimmer\",\"type\":\"light\"},"
+              "{\"suffix\":\"aux\",\"name\":\"Aux\"}]}}");
+    CHECK(NodeTypeManager::begin());
+
+    int count = 0;
+    const NodeEntity* e = NodeTypeManager::getEntities("DIMMER", &count);
+    CHECK_EQ(count, 2);
+    if (e && count == 2) {
+        CHECK_STR(e[0].component, "light");
+        CHECK_STR(e[1].component, "switch");      // Default del campo type
+        CHECK_EQ(e[1].attributeIndex, 1);         // idx assente: posizione
+    }
+
+    // I tipi standard mancanti vengono aggiunti al file e compilati
+    CHECK(NodeTypeManager::getEntities("SHUTTER_CONTROLLER", &count) != NULL);
+    CHECK(hostFsGet(NODETYPES_FILE).find("4_RELAY_CONTROLLER") != std::string::npos);
+    CHECK(hostFsGet(NODETYPES_FILE).find("DIMMER") != std::string::npos);
+}
+
+static void testInvalidFileIsRecreated() {
+    resetFs();
+    hostFsPut(NODETYPES_FILE, "{\"4_RELAY_CONTROLLER\": [");
+    CHECK(NodeTypeManager::begin());
+    CHECK_EQ(NodeTypeManager::getTypeCount(), 3);
+}
+
+static void testRegistryLimits() {
+    resetFs();
+    std::string json = "{";
+    for (int t = 0; t < NODETYPE_MAX_TYPES + 4; t++) {
+        char type[48];
+        snprintf(type, sizeof(type), "%s\"TYPE_%d\":{\"entities\":[", t ? "," : "", t);
+        json += type;
+        for (int i = 0; i < 3; i++) json += i ? ",{\"suffix\":\"x\"}" : "{\"suffix\":\"x\"}";
+        json += "]}";
+    }
+    json += "}";
+    hostFsPut(NODETYPES_FILE, json);
+    NodeTypeManager::begin();
+
+    CHECK(NodeTypeManager::getTypeCount() <= NODETYPE_MAX_TYPES);
+    CHECK(NodeTypeManager::getEntityCount() <= NODETYPE_MAX_ENTITIES);
+
+    // Registro pieno: i tipi dinamici usano il buffer temporaneo ma restano corretti
+    int count = 0;
+    const NodeEntity* e = NodeTypeManager::getEntities("RL_CTRL_ESP8266_2CH", &count);
+    CHECK_EQ(count, 2);
+    if (e) CHECK_STR(e[1].suffix, "relay_2");
+}
+
+// Percorso precedente: parsing di nodetypes.json a ogni messaggio
+static int lookupByParsing(const char* nodeType) {
+    File file = LittleFS.open(NODETYPES_FILE, "r");
+    DynamicJsonDocument doc(2048);
+    deserializeJson(doc, file);
+    file.close();
+    JsonArray entities = doc[nodeType]["entities"];
+    return entities.size();
+}
+
+static void benchmarkLookup() {
+    resetFs();
+    NodeTypeManager::begin();
+    const char* mix[] = {"4_RELAY_CONTROLLER", "2_RELAY_CONTROLLER", "SHUTTER_CONTROLLER", "RL_CTRL_ESP8266_2CH"};
+    const int rounds = 20000;
+    int sink = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        int count = 0;
+        NodeTypeManager::getEntities(mix[i & 3], &count);
+        sink += count;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds / 20; i++) sink += lookupByParsing(mix[i & 3]);
+    auto t2 = std::chrono::steady_clock::now();
+
+    double registryNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds;
+    double parseNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / (rounds / 20);
+    printf("  lookup registro: %.0f ns/messaggio, parsing del file: %.0f ns/messaggio (x%.0f)\n",
+           registryNs, parseNs, parseNs / registryNs);
+    CHECK(sink > 0);
+    CHECK(registryNs * 10 < parseNs);
+}
+
+int main() {
+    RUN_TEST(testDefaultFileCreated);
+    RUN_TEST(testLookupsNeverTouchTheFile);
+    RUN_TEST(testDynamicAndAliasTypes);
+    RUN_TEST(testUnknownTypeIsCachedNegative);
+    RUN_TEST(testCustomFileAndMissingDefaults);
+    RUN_TEST(testInvalidFileIsRecreated);
+    RUN_TEST(testRegistryLimits);
+    RUN_TEST(benchmarkLookup);
+    return hostTestResult();
+}
@@ -0,0 +1,145 @@
+// --- BROKER IRRAGGIUNGIBILE --- //
+// Broker muto (la sonda TCP scade), broker che rifiuta la connessione e broker in stallo
+// (accetta il TCP ma non manda mai il CONNACK) per alcuni minuti, con i nodi che
+// continuano a trasmettere. Muto e rifiuto non fermano mai il loop; lo stallo lo ferma
+// solo per l'attesa del CONNACK, una volta per tentativo. Il ring ESP-NOW si svuota a
+// ogni giro, i tentativi seguono il backoff e la sessione torna su quando il broker
+// risponde di nuovo.
+#include "HostTest.h"
+#include "MqttSession.h"
+#include "MqttHandler.h"
+#include "EspNowHandler.h"
+#include "PeerHandler.h"
+#include "PeerIndex.h"
+#include "MqttTopics.h"
+#include <algorithm>
+
+#define OUTAGE_MS        180000
+#define FRAME_EVERY_MS   10
+
+static uint8_t nodeMac[6];
+static int peer = -1;
+
+// Il nodo alterna relay_1 ON/OFF: dopo ogni giro lo stato del peer deve seguirlo
+static bool sendAndCheck(int n) {
+    bool on = (n % 2) == 0;
+    unsigned long before = millis();
+    hostNodeSend(nodeMac, "NODE_O", "relay_1", on ? "ON" : "OFF", on ? "ON" : "OFF", "FEEDBACK");
+    hostLoop();
+    return peerList[peer].attributes[0] == (on ? '1' : '0') && peerList[peer].lastSeen >= before;
+}
+
+// maxStallMs: attesa massima ammessa in un solo giro del loop (0 = mai fermo)
+static void outage(HostBrokerState state, const char* name, unsigned long maxStallMs) {
+    hostBrokerSet(state);
+    hostLoopFor(50);
+    CHECK(!mqttConnected);
+
+    hostResetDelayed();
+    unsigned long overflowsBefore = rxRingOverflows;
+    uint32_t attemptsBefore = mqttConnectAttempts;
+    int frames = 0, tracked = 0;
+    unsigned long start = millis(), nextFrame = start, longest = 0, stalled = 0;
+    while (millis() - start < OUTAGE_MS) {
+        hostAdvance(1);
+        unsigned long before = millis();
+        if ((long) (before - nextFrame) >= 0) {
+            if (sendAndCheck(frames)) tracked++;
+            frames++;
+            nextFrame = before + FRAME_EVERY_MS;
+        } else {
+            hostLoop();
+        }
+        unsigned long stall = millis() - before;
+        longest = std::max(longest, stall);
+        stalled += stall;
+    }
+
+    // Raffica che riempie il ring in un colpo solo, mentre la sessione è giù
+    for (int n = 0; n < RX_RING_SIZE; n++) {
+        hostNodeSend(nodeMac, "NODE_O", "relay_2", "ON", "ON", "FEEDBACK");
+    }
+    hostLoop();
+    hostLoop();
+
+    uint32_t attempts = mqttConnectAttempts - attemptsBefore;
+    printf("  %-8s %d s: %d frame dai nodi, %d elaborati al giro, %u tentativi, "
+           "loop fermo %lu ms in tutto (max %lu ms in un giro)\n",
+           name, OUTAGE_MS / 1000, frames, tracked, (unsigned) attempts, stalled, longest);
+
+    CHECK_EQ(hostDelayedMs(), 0);
+    CHECK(longest <= maxStallMs);
+    CHECK(stalled <= attempts * maxStallMs);
+    CHECK_EQ(tracked, frames);
+    CHECK_EQ(rxRingOverflows, overflowsBefore);
+    CHECK_EQ(peerList[peer].attributes[1], '1');
+    CHECK(!mqttConnected);
+
+    // Backoff: pochi tentativi, non uno ogni 5 s
+    CHECK(attempts >= 3);
+    CHECK(attempts < OUTAGE_MS / 5000);
+    CHECK_EQ(mqttBackoffMs, MQTT_BACKOFF_MAX_MS);
+}
+
+static void testSilentBroker() {
+    outage(HOST_BROKER_SILENT, "muto", 0);
+}
+
+static void testRefusedBroker() {
+    outage(HOST_BROKER_REFUSED, "rifiuta", 0);
+}
+
+static void testStalledBroker() {
+    // Unica attesa: il CONNACK dopo una sonda riuscita
+    outage(HOST_BROKER_STALLED, "stallo", MQTT_CONNACK_TIMEOUT_S * 1000UL);
+    CHECK(mqttConnectFailures > 0);
+}
+
+static void testRecovery() {
+    int connectsBefore = hostMqttConnects();
+    size_t from = hostMqttPublished().size();
+    hostBrokerSet(HOST_BROKER_UP);
+    hostResetDelayed();
+
+    unsigned long start = millis();
+    while (!mqttConnected && millis() - start < MQTT_BACKOFF_MAX_MS + 1000) {
+        hostAdvance(10);
+        hostLoop();
+    }
+    CHECK(mqttConnected);
+    CHECK_EQ(hostMqttConnects() - connectsBefore, 1);
+    CHECK_EQ(mqttSessionState, MQTT_SESSION_CONNECTED);
+    CHECK_EQ(hostDelayedMs(), 0);
+    printf("  broker di nuovo su: sessione riaperta dopo %lu ms\n", millis() - start);
+
+    // La sessione riaperta riparte dal minimo e riprende a pubblicare i feedback
+    CHECK_EQ(mqttBackoffMs, MQTT_BACKOFF_MIN_MS);
+    hostNodeSend(nodeMac, "NODE_O", "relay_3", "ON", "ON", "FEEDBACK");
+    hostLoopFor(2000, 10);
+    bool published = false;
+    for (size_t p = from; p < hostMqttPublished().size(); p++) {
+        const HostPublish& pub = hostMqttPublished()[p];
+        if (pub.topic == mqttTopic(TOPIC_NODE_STATUS) && pub.payload.find("\"NODE_O\"") != std::string::npos) {
+            published = true;
+        }
+    }
+    CHECK(published);
+}
+
+int main() {
+    CHECK(hostBoot());
+    hostNodeMac(nodeMac, 0x0500);
+    hostNodeRegister(nodeMac, "NODE_O", "4_RELAY_CONTROLLER");
+    hostLoopFor(100);
+    peer = findPeerByMac(nodeMac);
+    CHECK(peer >= 0);
+    if (peer < 0) return hostTestResult();
+
+    RUN_TEST(testSilentBroker);
+    RUN_TEST(testRecovery);
+    RUN_TEST(testRefusedBroker);
+    RUN_TEST(testRecovery);
+    RUN_TEST(testStalledBroker);
+    RUN_TEST(testRecovery);
+    return hostTestResult();
+}
@@ -0,0 +1,242 @@
+// --- SLOT PEER LRU --- //
+// 200 nodi serviti attraverso la tabella peer a 20 slot dello stack ESP-NOW emulato:
+// registrazione al volo, sfratto LRU, peer fissati, contatori hit/miss/eviction
+// (uno per frame trasmesso), gateway con la tabella logica piena e tabella dei link
+// compatti grande quanto quella dei peer (sostituzione LRU oltre il limite).
+#include "HostTest.h"
+#include "DomoticaEspNow.h"
+#include "PeerHandler.h"
+#include "MqttTopics.h"
+#include <map>
+
+#define WORKLOAD_NODES 200
+
+static DomoticaEspNow espNow;
+static int maxPeerCount = 0;
+
+static void pump(int ms) {
+    for (int t = 0; t < ms; t++) {
+        hostAdvance(1);
+        espNow.loop();
+        hostRunScheduled();
+        hostEspNowDeliverSent();
+        maxPeerCount = std::max(maxPeerCount, hostEspNowPeerCount());
+    }
+}
+
+static int framesTo(const uint8_t* mac, size_t from) {
+    int n = 0;
+    for (size_t f = from; f < hostEspNowSent().size(); f++) {
+        if (memcmp(hostEspNowSent()[f].mac, mac, 6) == 0) n++;
+    }
+    return n;
+}
+
+static void sendTo(int node) {
+    uint8_t mac[6];
+    hostNodeMac(mac, node);
+    espNow.send(mac, "GATEWAY", "relay_1", "ON", "", "COMMAND", "GW_TEST");
+}
+
+static void testSweepOverAllNodes() {
+    espNow.clearPeers();
+    uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    CHECK_EQ(espNow.addPeer(broadcast), 0);
+    DomoticaStats before = DomoticaEspNow::getStats();
+    size_t from = hostEspNowSent().size();
+    maxPeerCount = 0;
+
+    // Due giri completi: con 200 nodi e 19 slot liberi ogni invio è un miss
+    for (int round = 0; round < 2; round++) {
+        for (int n = 0; n < WORKLOAD_NODES; n++) {
+            sendTo(1000 + n);
+            pump(2);
+        }
+    }
+    pump(100);
+
+    const DomoticaStats& s = DomoticaEspNow::getStats();
+    CHECK(maxPeerCount <= DOMOTICA_PEER_SLOTS);
+    CHECK_EQ(hostEspNowSent().size() - from, 2 * WORKLOAD_NODES);
+    for (int n = 0; n < WORKLOAD_NODES; n++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 1000 + n);
+        CHECK_EQ(framesTo(mac, from), 2);
+    }
+    CHECK_EQ(s.peerHits - before.peerHits, 0);
+    CHECK_EQ(s.peerMisses - before.peerMisses, 2 * WORKLOAD_NODES);
+    CHECK_EQ(s.peerEvictions - before.peerEvictions, 2 * WORKLOAD_NODES - (DOMOTICA_PEER_SLOTS - 1));
+    CHECK_EQ(s.txDropped, before.txDropped);
+
+    // Il peer fissato con addPeer non viene mai sfrattato
+    CHECK(espNow.hasPeer(broadcast));
+    CHECK_EQ(DomoticaEspNow::peerSlotCount(), DOMOTICA_PEER_SLOTS);
+}
+
+static void testSkewedWorkload() {
+    espNow.clearPeers();
+    DomoticaStats before = DomoticaEspNow::getStats();
+    size_t from = hostEspNowSent().size();
+    maxPeerCount = 0;
+
+    // Rete domestica: pochi nodi attivi fanno la maggior parte del traffico
+    const int frames = 5000, hot = 15;
+    std::map<int, int> expected;
+    for (int i = 0; i < frames; i++) {
+        int node = (hostRandom32() % 100 < 80) ? hostRandom32() % hot : hostRandom32() % WORKLOAD_NODES;
+        expected[node]++;
+        sendTo(2000 + node);
+        pump(2);
+    }
+    pump(100);
+
+    const DomoticaStats& s = DomoticaEspNow::getStats();
+    uint32_t hits = s.peerHits - before.peerHits;
+    uint32_t misses = s.peerMisses - before.peerMisses;
+    uint32_t evictions = s.peerEvictions - before.peerEvictions;
+    printf("  %d frame verso %d nodi: hit %u, miss %u (%.1f%% hit), sfratti %u, picco slot %d\n", frames,
+           WORKLOAD_NODES, (unsigned) hits, (unsigned) misses, hits * 100.0 / frames, (unsigned) evictions,
+           maxPeerCount);
+
+    CHECK(maxPeerCount <= DOMOTICA_PEER_SLOTS);
+    CHECK_EQ(hits + misses, frames);
+    CHECK_EQ(evictions, misses - DOMOTICA_PEER_SLOTS);
+    CHECK(hits > frames * 2 / 3);
+    CHECK_EQ(hostEspNowSent().size() - from, frames);
+    for (auto& e : expected) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 2000 + e.first);
+        CHECK_EQ(framesTo(mac, from), e.second);
+    }
+}
+
+static void testMissCountedOncePerFrame() {
+    espNow.clearPeers();
+
+    // 19 slot fissati e l'ultimo occupato da un frame in volo: il frame verso un nodo
+    // nuovo resta in coda e viene ritentato a ogni giro
+    for (int n = 0; n < DOMOTICA_PEER_SLOTS - 1; n++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 3000 + n);
+        espNow.addPeer(mac);
+    }
+    DomoticaStats before = DomoticaEspNow::getStats();
+    sendTo(3100);
+    hostAdvance(1);
+    espNow.loop();
+    sendTo(3101);
+    for (int t = 0; t < DOMOTICA_TX_SENT_TIMEOUT / 2; t++) {
+        hostAdvance(1);
+        espNow.loop();
+        hostRunScheduled();
+    }
+    uint8_t waiting[6];
+    hostNodeMac(waiting, 3101);
+    CHECK(!espNow.hasPeer(waiting));
+    CHECK_EQ(DomoticaEspNow::getStats().peerMisses - before.peerMisses, 1);
+
+    // Conferma radio: lo slot si libera, il frame parte e conta un solo miss
+    pump(20);
+    const DomoticaStats& s = DomoticaEspNow::getStats();
+    CHECK(espNow.hasPeer(waiting));
+    CHECK_EQ(s.peerMisses - before.peerMisses, 2);
+    CHECK_EQ(s.peerEvictions - before.peerEvictions, 1);
+    CHECK_EQ(s.txDropped, before.txDropped);
+    espNow.clearPeers();
+}
+
+static void testGatewayServesFullPeerTable() {
+    CHECK(hostBoot());
+    size_t from = hostEspNowSent().size();
+    maxPeerCount = 0;
+    for (int n = 0; n < MAX_PEERS; n++) {
+        uint8_t mac[6];
+        char node[16];
+        hostNodeMac(mac, 4000 + n);
+        snprintf(node, sizeof(node), "NODE_%d", n);
+        hostNodeRegister(mac, node, "4_RELAY_CONTROLLER");
+        for (int t = 0; t < 5; t++) {
+            hostAdvance(1);
+            hostLoop();
+            maxPeerCount = std::max(maxPeerCount, hostEspNowPeerCount());
+        }
+    }
+    CHECK_EQ(peerCount, MAX_PEERS);
+
+    // Un comando diretto a ogni nodo: tutti raggiunti con la tabella radio entro il limite
+    for (int n = 0; n < MAX_PEERS; n++) {
+        char topic[MQTT_TOPIC_MAX];
+        snprintf(topic, sizeof(topic), "domoriky/nodo/NODE_%d/relay_1/set", n);
+        hostMqttInject(topic, "ON");
+        for (int t = 0; t < 5; t++) {
+            hostAdvance(1);
+            hostLoop();
+            maxPeerCount = std::max(maxPeerCount, hostEspNowPeerCount());
+        }
+    }
+    hostLoopFor(200);
+
+    CHECK(maxPeerCount <= DOMOTICA_PEER_SLOTS);
+    int reached = 0;
+    for (int n = 0; n < MAX_PEERS; n++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 4000 + n);
+        if (framesTo(mac, from) > 0) reached++;
+    }
+    printf("  gateway: %d peer logici, %d raggiunti, picco slot radio %d\n", peerCount, reached, maxPeerCount);
+    CHECK_EQ(reached, MAX_PEERS);
+}
+
+// Tabella dei link compatti grande quanto quella del gateway: nessun nodo perde le caps
+// annunciate con REGISTER quando i successivi frame dati (caps 0) ricreano il link
+static void testLinkTableCoversPeerTable() {
+    CHECK(DOMOTICA_PROTO_PEERS >= MAX_PEERS);
+    const uint32_t caps = DOMOTICA_CAP_COMPACT | DOMOTICA_CAP_RELIABLE | DOMOTICA_CAP_GROUP;
+    for (int n = 0; n < MAX_PEERS; n++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 6000 + n);
+        DomoticaEspNow::setPeerProtocol(mac, DOMOTICA_PROTO_COMPACT, caps);
+        hostAdvance(1);
+    }
+    int kept = 0;
+    for (int n = 0; n < MAX_PEERS; n++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 6000 + n);
+        DomoticaEspNow::setPeerProtocol(mac, DOMOTICA_PROTO_COMPACT);
+        if (DomoticaEspNow::getPeerCaps(mac) == caps) kept++;
+        hostAdvance(1);
+    }
+    CHECK_EQ(kept, MAX_PEERS);
+
+    // Oltre la tabella esce il link senza traffico da più tempo, non il successivo in giro
+    uint8_t idle[6], stranger[6], first[6];
+    hostNodeMac(idle, 6000 + 7);
+    hostNodeMac(first, 6000);
+    hostNodeMac(stranger, 6999);
+    for (int extra = 0; extra < DOMOTICA_PROTO_PEERS - MAX_PEERS; extra++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 7000 + extra);
+        DomoticaEspNow::setPeerProtocol(mac, DOMOTICA_PROTO_COMPACT, caps);
+    }
+    for (int n = 0; n < MAX_PEERS; n++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, 6000 + n);
+        if (n != 7) DomoticaEspNow::setPeerProtocol(mac, DOMOTICA_PROTO_COMPACT);
+        hostAdvance(1);
+    }
+    DomoticaEspNow::setPeerProtocol(stranger, DOMOTICA_PROTO_COMPACT, caps);
+    CHECK_EQ(DomoticaEspNow::getPeerProtocol(idle), DOMOTICA_PROTO_LEGACY);
+    CHECK_EQ(DomoticaEspNow::getPeerCaps(first), caps);
+    CHECK_EQ(DomoticaEspNow::getPeerCaps(stranger), caps);
+}
+
+int main() {
+    // Prima il gateway (hostBoot riparte da millis() = 1000), poi la libreria da sola
+    RUN_TEST(testGatewayServesFullPeerTable);
+    espNow.begin(true);
+    RUN_TEST(testSweepOverAllNodes);
+    RUN_TEST(testSkewedWorkload);
+    RUN_TEST(testMissCountedOncePerFrame);
+    RUN_TEST(testLinkTableCoversPeerTable);
+    return hostTestResult();
+}
@@ -0,0 +1,307 @@
+// --- PERSISTENZA PEER --- //
+// PeerStore sul LittleFS in memoria: snapshot + replay del journal, coda del journal
+// troncata da uno spegnimento, compattazione e journal di una generazione precedente,
+// snapshot corrotto mai sovrascritto, migrazione da peers.json e amplificazione delle
+// scritture in un'ora di traffico contro la riscrittura completa di peers.json.
+#include "HostTest.h"
+#include "PeerStore.h"
+#include "PeerHandler.h"
+#include "Config.h"
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+
+// Dimensioni su flash, come in PeerStore.cpp
+#define SNAPSHOT_HEADER_SIZE 16
+#define RECORD_SIZE          120
+#define JOURNAL_ENTRY_SIZE   128
+#define LEGACY_PEERS_FILE    "/peers.json"   // PEERS_FILE di PeerHandler.cpp
+
+static void setPeer(int i, int n, const char* attributes) {
+    memset(&peerList[i], 0, sizeof(Peer));
+    hostNodeMac(peerList[i].mac, n);
+    snprintf(peerList[i].nodeId, sizeof(peerList[i].nodeId), "NODE_%d", n);
+    strcpy(peerList[i].nodeType, "4_RELAY_CONTROLLER");
+    strcpy(peerList[i].firmwareVersion, "1.0");
+    strcpy(peerList[i].attributes, attributes);
+    peerList[i].discoveryHash = 0x1000 + n;
+}
+
+// Tabella di count peer salvata in uno snapshot pulito, senza journal
+static void freshTable(int count) {
+    peerStoreClear();
+    peerCount = count;
+    for (int i = 0; i < count; i++) setPeer(i, i, "0000");
+    CHECK(peerStoreCompact());
+    hostFsResetCounters();
+}
+
+// Riavvio: tabella in RAM persa, poi caricamento
+static PeerStoreLoadResult reboot() {
+    memset(peerList, 0xAA, sizeof(peerList));
+    peerCount = 0;
+    return peerStoreLoad();
+}
+
+static void setAttributes(int i, const char* attributes) {
+    strcpy(peerList[i].attributes, attributes);
+    peerStoreMarkDirty(i);
+}
+
+static void testSnapshotRoundTrip() {
+    freshTable(10);
+    strcpy(peerList[3].firmwareVersion, "2.1");
+    CHECK(peerStoreCompact());
+    CHECK_EQ(hostFsGet(PEERSTORE_SNAPSHOT_FILE).size(), SNAPSHOT_HEADER_SIZE + 10 * RECORD_SIZE);
+    CHECK(!LittleFS.exists(PEERSTORE_JOURNAL_FILE));
+
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerCount, 10);
+    for (int i = 0; i < peerCount; i++) {
+        uint8_t mac[6];
+        hostNodeMac(mac, i);
+        CHECK(memcmp(peerList[i].mac, mac, 6) == 0);
+        CHECK_STR(peerList[i].nodeId, "NODE_" + std::to_string(i));
+        CHECK_STR(peerList[i].attributes, "0000");
+        CHECK_EQ(peerList[i].discoveryHash, 0x1000 + i);
+        CHECK(peerList[i].isOnline);
+        CHECK(!peerList[i].storeDirty);
+    }
+    CHECK_STR(peerList[3].firmwareVersion, "2.1");
+}
+
+static void testJournalReplay() {
+    freshTable(10);
+
+    // Raffica su tre peer: una sola scrittura dopo la quiete, un record per peer
+    hostAdvance(10);
+    setAttributes(2, "1000");
+    setAttributes(5, "0100");
+    setAttributes(2, "1100");
+    setAttributes(7, "0010");
+    peerStoreLoop();
+    CHECK_EQ(hostFsWriteCalls(), 0);
+    hostAdvance(PEERSTORE_WRITE_DELAY_MS);
+    peerStoreLoop();
+    CHECK_EQ(peerStoreJournalRecords, 3);
+    CHECK_EQ(hostFsGet(PEERSTORE_JOURNAL_FILE).size(), 3 * JOURNAL_ENTRY_SIZE);
+
+    // Un peer nuovo entra dal journal, senza snapshot
+    peerCount = 11;
+    setPeer(10, 10, "0001");
+    peerStoreMarkDirty(10);
+    peerStoreFlush();
+
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerCount, 11);
+    CHECK_EQ(peerStoreJournalRecords, 4);
+    CHECK_STR(peerList[2].attributes, "1100");
+    CHECK_STR(peerList[5].attributes, "0100");
+    CHECK_STR(peerList[7].attributes, "0010");
+    CHECK_STR(peerList[0].attributes, "0000");
+    CHECK_STR(peerList[10].nodeId, "NODE_10");
+    CHECK_STR(peerList[10].attributes, "0001");
+}
+
+static void testTornJournalTail() {
+    freshTable(5);
+    for (int i = 0; i < 3; i++) {
+        setAttributes(i, "1111");
+        peerStoreFlush();
+    }
+    CHECK_EQ(peerStoreJournalRecords, 3);
+
+    // Spegnimento a metà del terzo record: i primi due restano, il terzo no
+    CHECK(hostFsTruncate(PEERSTORE_JOURNAL_FILE, 2 * JOURNAL_ENTRY_SIZE + JOURNAL_ENTRY_SIZE / 2));
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerCount, 5);
+    CHECK_EQ(peerStoreJournalRecords, 2);
+    CHECK_STR(peerList[0].attributes, "1111");
+    CHECK_STR(peerList[1].attributes, "1111");
+    CHECK_STR(peerList[2].attributes, "0000");
+
+    // Nulla si appende dopo la coda rotta: la write-behind compatta
+    uint32_t compactions = peerStoreCompactions;
+    hostAdvance(PEERSTORE_WRITE_DELAY_MS);
+    peerStoreLoop();
+    CHECK_EQ(peerStoreCompactions - compactions, 1);
+    CHECK(!LittleFS.exists(PEERSTORE_JOURNAL_FILE));
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_STR(peerList[1].attributes, "1111");
+
+    // Record con CRC errato in mezzo: il replay si ferma lì
+    setAttributes(3, "0110");
+    peerStoreFlush();
+    setAttributes(4, "0110");
+    peerStoreFlush();
+    std::string journal = hostFsGet(PEERSTORE_JOURNAL_FILE);
+    journal[20] ^= 0x01;
+    hostFsPut(PEERSTORE_JOURNAL_FILE, journal);
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerStoreJournalRecords, 0);
+    CHECK_STR(peerList[3].attributes, "0000");
+    CHECK_STR(peerList[4].attributes, "0000");
+}
+
+static void testCompaction() {
+    freshTable(20);
+
+    // Oltre PEERSTORE_JOURNAL_MAX record lo snapshot sostituisce il journal
+    uint32_t compactions = peerStoreCompactions;
+    int flushes = 0;
+    while (peerStoreCompactions == compactions && flushes < 100) {
+        for (int i = 0; i < 8; i++) setAttributes((flushes * 8 + i) % peerCount, flushes % 2 ? "1010" : "0101");
+        peerStoreFlush();
+        flushes++;
+    }
+    CHECK_EQ(peerStoreCompactions - compactions, 1);
+    CHECK_EQ(flushes, PEERSTORE_JOURNAL_MAX / 8 + 1);
+    CHECK_EQ(peerStoreJournalRecords, 0);
+    CHECK(!LittleFS.exists(PEERSTORE_JOURNAL_FILE));
+
+    // Compattazione interrotta dopo il rename: il journal vecchio ha un'altra
+    // generazione e non viene riapplicato sopra lo snapshot nuovo
+    setAttributes(0, "1111");
+    peerStoreFlush();
+    std::string staleJournal = hostFsGet(PEERSTORE_JOURNAL_FILE);
+    setAttributes(0, "0001");
+    CHECK(peerStoreCompact());
+    hostFsPut(PEERSTORE_JOURNAL_FILE, staleJournal);
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerStoreJournalRecords, 0);
+    CHECK_STR(peerList[0].attributes, "0001");
+
+    // Una rimozione compatta alla prossima scrittura: il peer non torna dal journal
+    peerCount = 19;
+    peerStoreMarkRemoved();
+    peerStoreFlush();
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerCount, 19);
+}
+
+static void testCorruptSnapshotKept() {
+    // CRC errato a lunghezza piena: nessun record affidabile, originale conservato
+    freshTable(6);
+    std::string snapshot = hostFsGet(PEERSTORE_SNAPSHOT_FILE);
+    std::string damaged = snapshot;
+    damaged[SNAPSHOT_HEADER_SIZE + 2 * RECORD_SIZE + 10] ^= 0xFF;
+    hostFsPut(PEERSTORE_SNAPSHOT_FILE, damaged);
+    CHECK_EQ(reboot(), PEERSTORE_CORRUPT);
+    CHECK_EQ(peerCount, 0);
+    CHECK_STR(hostFsGet(PEERSTORE_BAD_FILE), damaged);
+    CHECK(!LittleFS.exists(PEERSTORE_SNAPSHOT_FILE));
+
+    // La write-behind crea uno snapshot nuovo senza toccare la copia corrotta
+    hostAdvance(PEERSTORE_WRITE_DELAY_MS);
+    peerStoreLoop();
+    CHECK(LittleFS.exists(PEERSTORE_SNAPSHOT_FILE));
+    CHECK_STR(hostFsGet(PEERSTORE_BAD_FILE), damaged);
+
+    // Snapshot troncato: i record completi prima del taglio restano, più il journal
+    freshTable(6);
+    setAttributes(1, "1001");
+    peerStoreFlush();
+    CHECK(hostFsTruncate(PEERSTORE_SNAPSHOT_FILE, SNAPSHOT_HEADER_SIZE + 4 * RECORD_SIZE + 7));
+    std::string truncated = hostFsGet(PEERSTORE_SNAPSHOT_FILE);
+    CHECK_EQ(reboot(), PEERSTORE_CORRUPT);
+    CHECK_EQ(peerCount, 4);
+    CHECK_EQ(peerStoreJournalRecords, 1);
+    CHECK_STR(peerList[1].attributes, "1001");
+    CHECK_STR(hostFsGet(PEERSTORE_BAD_FILE), truncated);
+
+    // Header illeggibile: niente generazione, niente journal
+    freshTable(3);
+    hostFsPut(PEERSTORE_SNAPSHOT_FILE, "DPS");
+    CHECK_EQ(reboot(), PEERSTORE_CORRUPT);
+    CHECK_EQ(peerCount, 0);
+    CHECK_STR(hostFsGet(PEERSTORE_BAD_FILE), "DPS");
+    peerStoreClear();
+}
+
+static void testMigrationFromJson() {
+    peerStoreClear();
+    LittleFS.remove(PEERSTORE_BAD_FILE);
+    hostFsPut(LEGACY_PEERS_FILE,
+              "{\"peers\":[{\"mac\":\"02:00:00:00:00:01\",\"nodeId\":\"NODE_1\",\"nodeType\":\"4_RELAY_CONTROLLER\","
+              "\"firmwareVersion\":\"1.0\",\"attributes\":\"0110\"}]}");
+    peerCount = 0;
+    loadPeersFromLittleFS();
+    CHECK_EQ(peerCount, 1);
+    CHECK(!LittleFS.exists(LEGACY_PEERS_FILE));
+    CHECK(LittleFS.exists(PEERSTORE_SNAPSHOT_FILE));
+
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerCount, 1);
+    CHECK_STR(peerList[0].nodeId, "NODE_1");
+    CHECK_STR(peerList[0].attributes, "0110");
+}
+
+// Byte di /peers.json riscritto per intero, come faceva savePeersToLittleFS()
+static size_t legacyPeersJsonSize() {
+    DynamicJsonDocument doc(2048);
+    JsonArray peers = doc.createNestedArray("peers");
+    for (int i = 0; i < peerCount; i++) {
+        JsonObject peer = peers.createNestedObject();
+        char macStr[18];
+        snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X", peerList[i].mac[0], peerList[i].mac[1],
+                 peerList[i].mac[2], peerList[i].mac[3], peerList[i].mac[4], peerList[i].mac[5]);
+        peer["mac"] = macStr;
+        peer["nodeId"] = peerList[i].nodeId;
+        peer["nodeType"] = peerList[i].nodeType;
+        peer["firmwareVersion"] = peerList[i].firmwareVersion;
+        peer["attributes"] = peerList[i].attributes;
+    }
+    String out;
+    serializeJson(doc, out);
+    return out.length();
+}
+
+static void testWriteAmplification() {
+    // Un'ora di rete domestica: 20 nodi, un cambio di stato ogni 3 s in media a raffiche
+    freshTable(20);
+    uint32_t bytesBefore = peerStoreBytes;
+    uint64_t legacyBytes = 0;
+    uint32_t changes = 0;
+    const unsigned long hour = 3600000UL;
+    for (unsigned long t = 0; t < hour; t += 100) {
+        hostAdvance(100);
+        if (hostRandom32() % 30 == 0) {
+            int burst = 1 + hostRandom32() % 4;
+            int i = hostRandom32() % peerCount;
+            for (int b = 0; b < burst; b++) {
+                char attributes[5] = "0000";
+                attributes[hostRandom32() % 4] = '1';
+                setAttributes(i, attributes);
+                changes++;
+                legacyBytes += legacyPeersJsonSize();
+            }
+        }
+        peerStoreLoop();
+    }
+    peerStoreFlush();
+
+    uint32_t bytes = hostFsBytesWritten();
+    printf("  %u cambi in un'ora: %u scritture, %u byte con journal (%.0f byte/cambio) | "
+           "%u scritture, %llu byte riscrivendo peers.json (-%.0f%%)\n",
+           (unsigned) changes, (unsigned) hostFsWriteCalls(), (unsigned) bytes, (double) bytes / changes,
+           (unsigned) changes, (unsigned long long) legacyBytes, 100.0 - bytes * 100.0 / legacyBytes);
+
+    // I contatori esposti corrispondono a quanto è arrivato davvero sul file system
+    CHECK_EQ(peerStoreBytes - bytesBefore, bytes);
+    CHECK(hostFsWriteCalls() < changes / 2);
+    CHECK(bytes * 4 < legacyBytes);
+
+    CHECK_EQ(reboot(), PEERSTORE_LOADED);
+    CHECK_EQ(peerCount, 20);
+}
+
+int main() {
+    hostSetMillis(1000);
+    RUN_TEST(testSnapshotRoundTrip);
+    RUN_TEST(testJournalReplay);
+    RUN_TEST(testTornJournalTail);
+    RUN_TEST(testCompaction);
+    RUN_TEST(testCorruptSnapshotKept);
+    RUN_TEST(testMigrationFromJson);
+    RUN_TEST(testWriteAmplification);
+    return hostTestResult();
+}
@@ -0,0 +1,616 @@
+// --- PROTOCOLLO COMPATTO --- //
+// Codec di DomoticaProtocol: andata e ritorno di tutti i campi, troncamento alle
+// dimensioni di struct_message, frame tagliati e fuzz del decoder, byte per tipo di
+// messaggio rispetto al formato legacy. Messaggi frammentati: codifica dei frammenti,
+// ricomposizione nella libreria (ordine, interleaving, scadenze) e invio da send().
+// Comandi di gruppo: maschera e azioni in andata e ritorno, input rifiutati.
+#include "HostTest.h"
+#include "DomoticaProtocol.h"
+#include "DomoticaEspNow.h"
+#include <algorithm>
+#include <chrono>
+
+// Messaggi tipici di ogni tipo, come li inviano gateway e nodi
+struct SampleMessage {
+    const char* node;
+    const char* topic;
+    const char* command;
+    const char* status;
+    const char* type;
+    const char* gateway_id;
+};
+
+static const SampleMessage samples[] = {
+    {"NODE_1", "relay_1", "ON", "", "COMMAND", "GW_TEST"},
+    {"NODE_1", "relay_1", "ON", "ON", "FEEDBACK", "GW_TEST"},
+    {"NODE_1", "STATUS", "HEARTBEAT", "ALIVE|1.1|0100", "STATUS", "GW_TEST"},
+    {"NODE_1", "DISCOVERY", "REQUEST", "GW_TEST", "DISCOVERY", ""},
+    {"NODE_1", "CONTROL", "REGISTER", "4_RELAY_CONTROLLER|1.1", "REGISTRATION", "GW_TEST"},
+    {"GATEWAY", "GATEWAY", "INFO", "GW_TEST|1.4.0", "GATEWAY_INFO", "GW_TEST"},
+    {"NODE_1", "CONTROL", "PONG", "OK", "RESPONSE", "GW_TEST"},
+    {"GATEWAY", "DISCOVERY", "RESPONSE", "GW_TEST|P2", "discovery_response", "GW_TEST"},
+    {"NODE_1", "ota", "OTA_UPDATE", "http://192.168.1.10/fw.bin", "OTA", "GW_TEST"},
+};
+static const int sampleCount = sizeof(samples) / sizeof(samples[0]);
+static const uint32_t sampleCaps = DOMOTICA_CAP_COMPACT | DOMOTICA_CAP_RELIABLE | DOMOTICA_CAP_FRAG;
+
+static bool fieldsTerminated(const struct_message& m) {
+    return memchr(m.node, 0, sizeof(m.node)) && memchr(m.topic, 0, sizeof(m.topic)) &&
+           memchr(m.command, 0, sizeof(m.command)) && memchr(m.status, 0, sizeof(m.status)) &&
+           memchr(m.type, 0, sizeof(m.type)) && memchr(m.gateway_id, 0, sizeof(m.gateway_id));
+}
+
+static void testRoundTrip() {
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    for (int s = 0; s < sampleCount; s++) {
+        const SampleMessage& m = samples[s];
+        int len = domoticaEncodeFrame(buf, sizeof(buf), m.node, m.topic, m.command, m.status, m.type,
+                                      m.gateway_id, 0x1234 + s, DOMOTICA_FLAG_ACK_REQ,
+                                      s == 4 ? sampleCaps : 0);
+        CHECK(len > DOMOTICA_HEADER_SIZE);
+        CHECK(len != (int) sizeof(struct_message));
+
+        struct_message out;
+        DomoticaFrameInfo info;
+        memset(&out, 'x', sizeof(out));
+        CHECK(domoticaDecodeFrame(buf, len, &out, &info));
+        CHECK(fieldsTerminated(out));
+        CHECK_STR(out.node, m.node);
+        CHECK_STR(out.topic, m.topic);
+        CHECK_STR(out.command, m.command);
+        CHECK_STR(out.status, m.status);
+        CHECK_STR(out.type, m.type);
+        CHECK_STR(out.gateway_id, m.gateway_id);
+        CHECK_EQ(info.version, DOMOTICA_PROTO_COMPACT);
+        CHECK_EQ(info.seq, 0x1234 + s);
+        CHECK_EQ(info.flags, DOMOTICA_FLAG_ACK_REQ);
+        CHECK_EQ(info.caps, s == 4 ? sampleCaps : 0);
+    }
+
+    // Campi NULL o vuoti non occupano spazio: resta il solo header
+    struct_message out;
+    DomoticaFrameInfo info;
+    int len = domoticaEncodeFrame(buf, sizeof(buf), NULL, "", NULL, "", "COMMAND", NULL, 7, 0, 0);
+    CHECK_EQ(len, DOMOTICA_HEADER_SIZE);
+    CHECK(domoticaDecodeFrame(buf, len, &out, &info));
+    CHECK_STR(out.node, "");
+    CHECK_STR(out.type, "COMMAND");
+    CHECK_EQ(info.msgType, DMT_COMMAND);
+
+    // ACK: solo header, nessun campo
+    len = domoticaEncodeAck(buf, sizeof(buf), 0xBEEF);
+    CHECK_EQ(len, DOMOTICA_HEADER_SIZE);
+    CHECK(domoticaDecodeFrame(buf, len, &out, &info));
+    CHECK_EQ(info.flags, DOMOTICA_FLAG_ACK);
+    CHECK_EQ(info.seq, 0xBEEF);
+}
+
+static void testLegacyFrames() {
+    // Struct legacy con campi non terminati: il decoder li chiude sull'ultimo byte
+    struct_message in;
+    memset(&in, 'A', sizeof(in));
+    struct_message out;
+    DomoticaFrameInfo info;
+    CHECK(domoticaDecodeFrame((const uint8_t*) &in, sizeof(in), &out, &info));
+    CHECK_EQ(info.version, DOMOTICA_PROTO_LEGACY);
+    CHECK(fieldsTerminated(out));
+    CHECK_EQ(strlen(out.node), sizeof(out.node) - 1);
+    CHECK_EQ(strlen(out.status), sizeof(out.status) - 1);
+
+    // Nessun frame compatto può avere la lunghezza di una struct legacy
+    char status[sizeof(in.status)];
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    int collisions = 0;
+    for (size_t n = 0; n < sizeof(status); n++) {
+        memset(status, 'S', n);
+        status[n] = '\0';
+        int len = domoticaEncodeFrame(buf, sizeof(buf), "NODE_NAME_LONG_1234", "relay_topic_1234567",
+                                      "COMMAND_NAME_123456", status, "CUSTOM_TYPE_1234567",
+                                      "GATEWAY_ID_12345678", 1, 0, 0);
+        if (len == 0) collisions++;
+        CHECK(len != (int) sizeof(struct_message));
+    }
+    CHECK_EQ(collisions, 1);
+}
+
+static void testTruncation() {
+    // Stringhe oltre i campi di struct_message: troncate come nel formato legacy
+    std::string longNode(40, 'n'), longTopic(40, 't'), longCommand(40, 'c');
+    std::string longStatus(150, 's'), longType(40, 'y'), longGateway(40, 'g');
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    int len = domoticaEncodeFrame(buf, sizeof(buf), longNode.c_str(), longTopic.c_str(), longCommand.c_str(),
+                                  longStatus.c_str(), longType.c_str(), longGateway.c_str(), 1, 0, 0);
+    CHECK(len > 0);
+
+    struct_message out;
+    CHECK(domoticaDecodeFrame(buf, len, &out, NULL));
+    CHECK_STR(out.node, longNode.substr(0, sizeof(out.node) - 1));
+    CHECK_STR(out.topic, longTopic.substr(0, sizeof(out.topic) - 1));
+    CHECK_STR(out.command, longCommand.substr(0, sizeof(out.command) - 1));
+    CHECK_STR(out.status, longStatus.substr(0, sizeof(out.status) - 1));
+    CHECK_STR(out.type, longType.substr(0, sizeof(out.type) - 1));
+    CHECK_STR(out.gateway_id, longGateway.substr(0, sizeof(out.gateway_id) - 1));
+
+    // Buffer di uscita insufficiente: 0, mai un frame parziale
+    for (int size = 0; size < len; size++) {
+        CHECK_EQ(domoticaEncodeFrame(buf, size, longNode.c_str(), longTopic.c_str(), longCommand.c_str(),
+                                     longStatus.c_str(), longType.c_str(), longGateway.c_str(), 1, 0, 0), 0);
+    }
+}
+
+// Posizioni in cui termina un TLV (più la fine dell'header)
+static std::vector<int> tlvBoundaries(const uint8_t* buf, int len) {
+    std::vector<int> ends = {DOMOTICA_HEADER_SIZE};
+    int pos = DOMOTICA_HEADER_SIZE;
+    while (pos < len) {
+        pos++;                                    // Tag
+        int fieldLen = 0, shift = 0;
+        while (buf[pos] & 0x80) fieldLen |= (buf[pos++] & 0x7F) << shift, shift += 7;
+        fieldLen |= buf[pos++] << shift;
+        pos += fieldLen;
+        ends.push_back(pos);
+    }
+    return ends;
+}
+
+static void testCutFrames() {
+    // Un frame tagliato è valido solo se il taglio cade tra due TLV
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    for (int s = 0; s < sampleCount; s++) {
+        const SampleMessage& m = samples[s];
+        int len = domoticaEncodeFrame(buf, sizeof(buf), m.node, m.topic, m.command, m.status, m.type,
+                                      m.gateway_id, 1, 0, sampleCaps);
+        std::vector<int> ends = tlvBoundaries(buf, len);
+        CHECK_EQ(ends.back(), len);
+
+        for (int cut = 0; cut < len; cut++) {
+            struct_message out;
+            bool boundary = std::find(ends.begin(), ends.end(), cut) != ends.end();
+            CHECK_EQ(domoticaDecodeFrame(buf, cut, &out, NULL), boundary);
+        }
+    }
+}
+
+static void testUnknownTagsAndTypes() {
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    int len = domoticaEncodeFrame(buf, sizeof(buf), "NODE_1", "relay_1", "ON", "ON", "FEEDBACK", "GW_TEST", 1, 0, 0);
+
+    // TLV di una versione futura in coda: ignorato
+    buf[len++] = 0x40;
+    buf[len++] = 3;
+    buf[len++] = 1;
+    buf[len++] = 2;
+    buf[len++] = 3;
+    struct_message out;
+    DomoticaFrameInfo info;
+    CHECK(domoticaDecodeFrame(buf, len, &out, &info));
+    CHECK_STR(out.topic, "relay_1");
+    CHECK_STR(out.type, "FEEDBACK");
+
+    // Tipo in header fuori tabella: trattato come DMT_OTHER
+    buf[2] = 200;
+    CHECK(domoticaDecodeFrame(buf, len, &out, &info));
+    CHECK_EQ(info.msgType, DMT_OTHER);
+    CHECK_STR(out.type, "");
+
+    // Magic o versione sbagliati, frame oltre il limite radio
+    buf[2] = DMT_FEEDBACK;
+    buf[0] ^= 0xFF;
+    CHECK(!domoticaDecodeFrame(buf, len, &out, &info));
+    buf[0] ^= 0xFF;
+    buf[1] = 3;
+    CHECK(!domoticaDecodeFrame(buf, len, &out, &info));
+    buf[1] = DOMOTICA_PROTO_COMPACT;
+    uint8_t big[DOMOTICA_MAX_FRAME + 1];
+    memcpy(big, buf, len);
+    memset(big + len, 0x40, sizeof(big) - len);
+    CHECK(!domoticaDecodeFrame(big, sizeof(big), &out, &info));
+}
+
+static void testFuzzDecode() {
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    uint8_t valid[sampleCount][DOMOTICA_MAX_FRAME];
+    int validLen[sampleCount];
+    for (int s = 0; s < sampleCount; s++) {
+        const SampleMessage& m = samples[s];
+        validLen[s] = domoticaEncodeFrame(valid[s], sizeof(valid[s]), m.node, m.topic, m.command, m.status,
+                                          m.type, m.gateway_id, s, 0, s & 1 ? sampleCaps : 0);
+    }
+
+    int accepted = 0;
+    for (int i = 0; i < 300000; i++) {
+        int len;
+        if (i & 1) {
+            // Buffer casuale con header valido: il corpo TLV è spazzatura
+            len = hostRandom32() % (DOMOTICA_MAX_FRAME + 1);
+            for (int b = 0; b < len; b++) buf[b] = hostRandom32();
+            if (len >= 2) {
+                buf[0] = DOMOTICA_FRAME_MAGIC;
+                buf[1] = DOMOTICA_PROTO_COMPACT;
+            }
+        } else {
+            // Frame valido con qualche byte alterato e lunghezza cambiata
+            int s = hostRandom32() % sampleCount;
+            memcpy(buf, valid[s], validLen[s]);
+            len = validLen[s];
+            int flips = 1 + hostRandom32() % 4;
+            for (int f = 0; f < flips; f++) buf[hostRandom32() % len] = hostRandom32();
+            len += (int) (hostRandom32() % 9) - 4;
+            if (len < 0) len = 0;
+        }
+
+        struct_message out;
+        DomoticaFrameInfo info;
+        memset(&out, 'x', sizeof(out));
+        if (!domoticaDecodeFrame(buf, len, &out, &info)) continue;
+        accepted++;
+        if (!(info.flags & DOMOTICA_FLAG_FRAG)) {
+            CHECK(fieldsTerminated(out));
+        } else {
+            CHECK(info.fragIndex < info.fragCount);
+            CHECK(info.fragData + info.fragLen == buf + len);
+        }
+    }
+    CHECK(accepted > 0);
+}
+
+// --- COMANDI DI GRUPPO --- //
+static void testGroupRoundTrip() {
+    struct { uint16_t mask; const char* actions; const char* command; const char* status; } cases[] = {
+        {0x0001, "1", "1", "1"},
+        {0x000F, "0000", "F", "0000"},
+        {0x0005, "2-0", "5", "2-0"},
+        {0x8000, "---------------1", "8000", "---------------1"},
+        {0xFFFF, "0120120120120120", "FFFF", "0120120120120120"},
+    };
+    for (const auto& c : cases) {
+        DomoticaGroupCommand group;
+        group.mask = c.mask;
+        memset(group.action, 'x', sizeof(group.action));
+        for (size_t k = 0; k < strlen(c.actions); k++) {
+            if (c.actions[k] != '-') group.action[k] = c.actions[k];
+        }
+
+        char command[8], status[DOMOTICA_GROUP_MAX_CHANNELS + 1];
+        CHECK(domoticaEncodeGroup(group, command, sizeof(command), status, sizeof(status)));
+        CHECK_STR(command, c.command);
+        CHECK_STR(status, c.status);
+
+        DomoticaGroupCommand out;
+        CHECK(domoticaDecodeGroup(command, status, &out));
+        CHECK_EQ(out.mask, c.mask);
+        for (int k = 0; k < DOMOTICA_GROUP_MAX_CHANNELS; k++) {
+            char expected = (c.mask & (1u << k)) ? group.action[k] : '-';
+            CHECK_EQ(out.action[k], expected);
+        }
+    }
+
+    // Buffer del chiamante troppo piccoli o maschera vuota: niente da inviare
+    DomoticaGroupCommand group;
+    group.mask = 0x0009;
+    memset(group.action, '1', sizeof(group.action));
+    char command[8], status[DOMOTICA_GROUP_MAX_CHANNELS + 1];
+    CHECK(!domoticaEncodeGroup(group, command, sizeof(command), status, 4));
+    CHECK(!domoticaEncodeGroup(group, command, 1, status, sizeof(status)));
+    group.mask = 0;
+    CHECK(!domoticaEncodeGroup(group, command, sizeof(command), status, sizeof(status)));
+}
+
+static void testGroupRejects() {
+    struct { const char* command; const char* status; const char* why; } cases[] = {
+        {"0", "1111", "maschera vuota"},
+        {"", "1111", "maschera mancante"},
+        {"10000", "11111111111111111", "17 canali"},
+        {"1FFFF", "11111111111111111", "17 canali"},
+        {"9", "1--", "status più corto del bit più alto"},
+        {"8000", "1", "status più corto del bit più alto"},
+        {"5", "1-3", "azione fuori da 0/1/2"},
+        {"3", "1-", "canale nella maschera senza azione"},
+        {"1", "A", "azione fuori da 0/1/2"},
+        {"Fz", "1111", "coda dopo la maschera"},
+        {"F ", "1111", "coda dopo la maschera"},
+        {"F-", "1111", "coda dopo la maschera"},
+    };
+    for (const auto& c : cases) {
+        DomoticaGroupCommand out;
+        bool decoded = domoticaDecodeGroup(c.command, c.status, &out);
+        if (decoded) printf("  accettato \"%s\"/\"%s\" (%s)\n", c.command, c.status, c.why);
+        CHECK(!decoded);
+    }
+
+    // Caratteri oltre il bit più alto della maschera non contano
+    DomoticaGroupCommand out;
+    CHECK(domoticaDecodeGroup("1", "0xyz", &out));
+    CHECK_EQ(out.mask, 1);
+    CHECK_EQ(out.action[0], '0');
+}
+
+// --- FRAMMENTAZIONE --- //
+static std::string repeatStatus(size_t len) {
+    std::string s;
+    for (size_t i = 0; i < len; i++) s += (char) ('a' + i % 26);
+    return s;
+}
+
+// Frammenti del messaggio, pronti per la radio
+static std::vector<std::vector<uint8_t>> fragmentMessage(const char* status, uint8_t msgId,
+                                                         const char* type = "FEEDBACK") {
+    uint8_t message[DOMOTICA_MAX_MESSAGE];
+    int len = domoticaEncodeMessage(message, sizeof(message), "NODE_1", "log", "DUMP", status, type, "GW_TEST");
+    std::vector<std::vector<uint8_t>> frames;
+    for (int f = 0; f < domoticaFragmentCount(len); f++) {
+        uint8_t frame[DOMOTICA_MAX_FRAME];
+        int n = domoticaEncodeFragment(frame, sizeof(frame), message, len, msgId, f, 100 + f, 0);
+        frames.push_back(std::vector<uint8_t>(frame, frame + n));
+    }
+    return frames;
+}
+
+static bool receive(const uint8_t* mac, const std::vector<uint8_t>& frame, struct_message* out) {
+    return DomoticaEspNow::decodeFrame(mac, frame.data(), frame.size(), out);
+}
+
+static void testFragmentEncoding() {
+    const size_t lengths[] = {100, 200, DOMOTICA_FRAG_CHUNK, 300, DOMOTICA_MAX_PAYLOAD, DOMOTICA_MAX_PAYLOAD + 50};
+    for (size_t statusLen : lengths) {
+        std::string status = repeatStatus(statusLen);
+        uint8_t message[DOMOTICA_MAX_MESSAGE];
+        int len = domoticaEncodeMessage(message, sizeof(message), "NODE_1", "log", "DUMP", status.c_str(),
+                                        "FEEDBACK", "GW_TEST");
+        CHECK(len > 0);
+        int count = domoticaFragmentCount(len);
+        CHECK(count >= 1 && count <= DOMOTICA_MAX_FRAGMENTS);
+
+        // I pezzi dei frammenti, in ordine, ricompongono esattamente il corpo TLV
+        std::vector<uint8_t> body;
+        for (int f = 0; f < count; f++) {
+            uint8_t frame[DOMOTICA_MAX_FRAME];
+            int n = domoticaEncodeFragment(frame, sizeof(frame), message, len, 9, f, 7, DOMOTICA_FLAG_ACK_REQ);
+            CHECK(n > DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER && n <= DOMOTICA_MAX_FRAME);
+
+            struct_message out;
+            DomoticaFrameInfo info;
+            CHECK(domoticaDecodeFrame(frame, n, &out, &info));
+            CHECK(info.flags & DOMOTICA_FLAG_FRAG);
+            CHECK(info.flags & DOMOTICA_FLAG_ACK_REQ);
+            CHECK_EQ(info.msgType, DMT_FEEDBACK);
+            CHECK_EQ(info.fragId, 9);
+            CHECK_EQ(info.fragIndex, f);
+            CHECK_EQ(info.fragCount, count);
+            CHECK_EQ(info.seq, 7);
+            if (f < count - 1) CHECK_EQ(info.fragLen, DOMOTICA_FRAG_CHUNK);
+            body.insert(body.end(), info.fragData, info.fragData + info.fragLen);
+        }
+        CHECK_EQ(body.size(), len - DOMOTICA_HEADER_SIZE);
+
+        struct_message out;
+        char full[DOMOTICA_MAX_PAYLOAD + 1];
+        CHECK(domoticaDecodeMessage(body.data(), body.size(), DMT_FEEDBACK, &out, full, sizeof(full)));
+        CHECK_STR(full, status.substr(0, DOMOTICA_MAX_PAYLOAD));
+        CHECK_STR(out.status, status.substr(0, sizeof(out.status) - 1));
+        CHECK_STR(out.topic, "log");
+
+        // Indice oltre l'ultimo o buffer di uscita troppo piccolo: nessun frammento
+        uint8_t frame[DOMOTICA_MAX_FRAME];
+        CHECK_EQ(domoticaEncodeFragment(frame, sizeof(frame), message, len, 9, count, 7, 0), 0);
+        CHECK_EQ(domoticaEncodeFragment(frame, DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER, message, len, 9, 0, 7, 0), 0);
+    }
+
+    // Tutti i campi pieni e tipo fuori tabella: il messaggio più lungo resta nei frammenti ammessi
+    std::string field(40, 'f'), status = repeatStatus(DOMOTICA_MAX_PAYLOAD);
+    uint8_t message[DOMOTICA_MAX_MESSAGE];
+    int len = domoticaEncodeMessage(message, sizeof(message), field.c_str(), field.c_str(), field.c_str(),
+                                    status.c_str(), field.c_str(), field.c_str());
+    CHECK(len > 0 && len <= DOMOTICA_MAX_MESSAGE);
+    CHECK_EQ(domoticaFragmentCount(len), DOMOTICA_MAX_FRAGMENTS);
+
+    // Nessun frammento può avere la lunghezza di una struct legacy (padding DTAG_PAD)
+    int padded = 0;
+    for (size_t n = sizeof(struct_message::status); n <= DOMOTICA_MAX_PAYLOAD; n++) {
+        std::string s = repeatStatus(n);
+        for (const std::vector<uint8_t>& f : fragmentMessage(s.c_str(), 1)) {
+            CHECK(f.size() != sizeof(struct_message));
+            if (f.size() == sizeof(struct_message) + 2) padded++;
+        }
+    }
+    CHECK(padded > 0);
+
+    // Header di frammento incoerenti: rifiutati dal decoder
+    std::vector<uint8_t> frame = fragmentMessage(status.c_str(), 1)[0];
+    struct_message out;
+    frame[8] = 0;
+    CHECK(!domoticaDecodeFrame(frame.data(), frame.size(), &out, NULL));
+    frame[8] = DOMOTICA_MAX_FRAGMENTS + 1;
+    CHECK(!domoticaDecodeFrame(frame.data(), frame.size(), &out, NULL));
+    frame[8] = 2;
+    frame[7] = 2;
+    CHECK(!domoticaDecodeFrame(frame.data(), frame.size(), &out, NULL));
+    CHECK(!domoticaDecodeFrame(frame.data(), DOMOTICA_HEADER_SIZE + 2, &out, NULL));
+}
+
+static void testReassemblyOrders() {
+    uint8_t macA[6], macB[6];
+    hostNodeMac(macA, 1);
+    hostNodeMac(macB, 2);
+    hostSetMillis(10000);
+    std::string longA = repeatStatus(DOMOTICA_MAX_PAYLOAD), longB = repeatStatus(250);
+    uint32_t before = DomoticaEspNow::getStats().messagesReassembled;
+    struct_message out;
+
+    // In ordine: consegnato solo all'ultimo frammento, con lo status completo in rxPayload
+    std::vector<std::vector<uint8_t>> a = fragmentMessage(longA.c_str(), 1);
+    CHECK_EQ(a.size(), 2);
+    CHECK(!receive(macA, a[0], &out));
+    CHECK(receive(macA, a[1], &out));
+    CHECK_STR(DomoticaEspNow::rxPayload(), longA);
+    CHECK_STR(out.status, longA.substr(0, sizeof(out.status) - 1));
+    CHECK_STR(out.type, "FEEDBACK");
+    CHECK_STR(out.command, "DUMP");
+
+    // Ordine inverso
+    a = fragmentMessage(longA.c_str(), 2);
+    CHECK(!receive(macA, a[1], &out));
+    CHECK(receive(macA, a[0], &out));
+    CHECK_STR(DomoticaEspNow::rxPayload(), longA);
+
+    // Due nodi con lo stesso msgId, frammenti alternati
+    a = fragmentMessage(longA.c_str(), 3);
+    std::vector<std::vector<uint8_t>> b = fragmentMessage(longB.c_str(), 3);
+    CHECK(!receive(macA, a[0], &out));
+    CHECK(!receive(macB, b[1], &out));
+    CHECK(receive(macA, a[1], &out));
+    CHECK_STR(DomoticaEspNow::rxPayload(), longA);
+    CHECK(receive(macB, b[0], &out));
+    CHECK_STR(DomoticaEspNow::rxPayload(), longB);
+
+    CHECK_EQ(DomoticaEspNow::getStats().messagesReassembled, before + 4);
+}
+
+static void testReassemblyDrops() {
+    uint8_t mac[6];
+    hostNodeMac(mac, 3);
+    hostSetMillis(20000);
+    std::string status = repeatStatus(300);
+    struct_message out;
+    const DomoticaStats& stats = DomoticaEspNow::getStats();
+
+    // Frammento perso: il messaggio scade e il buffer torna libero
+    uint32_t dropped = stats.reassemblyDropped;
+    CHECK(!receive(mac, fragmentMessage(status.c_str(), 10)[0], &out));
+    hostAdvance(DOMOTICA_REASM_TIMEOUT + 1);
+    std::vector<std::vector<uint8_t>> next = fragmentMessage(status.c_str(), 11);
+    CHECK(!receive(mac, next[0], &out));
+    CHECK_EQ(stats.reassemblyDropped, dropped + 1);
+    CHECK(receive(mac, next[1], &out));
+    CHECK_STR(DomoticaEspNow::rxPayload(), status);
+
+    // Più messaggi aperti dei buffer: si sacrifica il più vecchio
+    dropped = stats.reassemblyDropped;
+    std::vector<std::vector<uint8_t>> open[DOMOTICA_REASM_SLOTS + 1];
+    for (int m = 0; m <= DOMOTICA_REASM_SLOTS; m++) {
+        open[m] = fragmentMessage(status.c_str(), 20 + m);
+        CHECK(!receive(mac, open[m][0], &out));
+        hostAdvance(1);
+    }
+    CHECK_EQ(stats.reassemblyDropped, dropped + 1);
+    CHECK(!receive(mac, open[0][1], &out));                    // Riparte da capo: incompleto
+    CHECK(receive(mac, open[DOMOTICA_REASM_SLOTS][1], &out));
+    CHECK_STR(DomoticaEspNow::rxPayload(), status);
+    hostAdvance(DOMOTICA_REASM_TIMEOUT + 1);
+
+    // Frammento intermedio corto o con count diverso: messaggio scartato
+    dropped = stats.reassemblyDropped;
+    std::vector<std::vector<uint8_t>> bad = fragmentMessage(status.c_str(), 30);
+    CHECK(!receive(mac, bad[0], &out));
+    bad[1][8] = 3;
+    CHECK(!receive(mac, bad[1], &out));
+    CHECK(stats.reassemblyDropped > dropped);
+    bad = fragmentMessage(status.c_str(), 31);
+    bad[0].pop_back();
+    CHECK(!receive(mac, bad[0], &out));
+    CHECK(!receive(mac, bad[1], &out));
+
+    // TLV del messaggio ricomposto malformati: frame non valido
+    uint32_t invalid = stats.framesInvalid;
+    bad = fragmentMessage(status.c_str(), 32);
+    bad[0][DOMOTICA_HEADER_SIZE + DOMOTICA_FRAG_HEADER + 1] = 0xFF;   // Lunghezza del primo TLV
+    CHECK(!receive(mac, bad[0], &out));
+    CHECK(!receive(mac, bad[1], &out));
+    CHECK_EQ(stats.framesInvalid, invalid + 1);
+}
+
+static void testSendFragments() {
+    DomoticaEspNow espNow;
+    espNow.begin(true);
+    uint8_t fragPeer[6], plainPeer[6];
+    hostNodeMac(fragPeer, 4);
+    hostNodeMac(plainPeer, 5);
+    DomoticaEspNow::setPeerProtocol(fragPeer, DOMOTICA_PROTO_COMPACT, DOMOTICA_CAP_COMPACT | DOMOTICA_CAP_FRAG);
+    DomoticaEspNow::setPeerProtocol(plainPeer, DOMOTICA_PROTO_COMPACT, DOMOTICA_CAP_COMPACT);
+    std::string status = repeatStatus(DOMOTICA_MAX_PAYLOAD);
+    uint32_t fragmentsSent = DomoticaEspNow::getStats().fragmentsSent;
+
+    size_t from = hostEspNowSent().size();
+    CHECK(espNow.send(fragPeer, "GATEWAY", "log", "DUMP", status.c_str(), "FEEDBACK", "GW_TEST"));
+    CHECK(espNow.send(plainPeer, "GATEWAY", "log", "DUMP", status.c_str(), "FEEDBACK", "GW_TEST"));
+    for (int i = 0; i < 10; i++) {
+        hostAdvance(1);
+        espNow.loop();
+        hostRunScheduled();
+        hostEspNowDeliverSent();
+    }
+    CHECK_EQ(DomoticaEspNow::getStats().fragmentsSent, fragmentsSent + 2);
+
+    // I frame spediti, riletti come se arrivassero dal peer, ridanno il messaggio
+    int fragFrames = 0, plainFrames = 0, delivered = 0;
+    struct_message out;
+    for (size_t f = from; f < hostEspNowSent().size(); f++) {
+        const HostFrame& frame = hostEspNowSent()[f];
+        CHECK(frame.data.size() <= DOMOTICA_MAX_FRAME);
+        if (memcmp(frame.mac, fragPeer, 6) == 0) {
+            fragFrames++;
+            if (receive(fragPeer, frame.data, &out)) {
+                delivered++;
+                CHECK_STR(DomoticaEspNow::rxPayload(), status);
+            }
+        } else if (memcmp(frame.mac, plainPeer, 6) == 0) {
+            // Peer senza ricomposizione: un solo frame con lo status troncato
+            plainFrames++;
+            CHECK(receive(plainPeer, frame.data, &out));
+            CHECK_STR(out.status, status.substr(0, sizeof(out.status) - 1));
+        }
+    }
+    CHECK_EQ(fragFrames, 2);
+    CHECK_EQ(plainFrames, 1);
+    CHECK_EQ(delivered, 1);
+}
+
+static void benchmarkBytesPerType() {
+    printf("  %-20s %6s %8s %10s %10s\n", "tipo", "legacy", "compatto", "encode ns", "decode ns");
+    uint8_t buf[DOMOTICA_MAX_FRAME];
+    const int rounds = 100000;
+    volatile int sink = 0;
+    int totalCompact = 0;
+
+    for (int s = 0; s < sampleCount; s++) {
+        const SampleMessage& m = samples[s];
+        int len = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            len = domoticaEncodeFrame(buf, sizeof(buf), m.node, m.topic, m.command, m.status, m.type,
+                                      m.gateway_id, i, 0, 0);
+            sink += buf[len - 1];
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        struct_message out;
+        for (int i = 0; i < rounds; i++) {
+            sink += domoticaDecodeFrame(buf, len, &out, NULL);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        printf("  %-20s %6d %8d %10.0f %10.0f\n", m.type, (int) sizeof(struct_message), len,
+               std::chrono::duration<double, std::nano>(t1 - t0).count() / rounds,
+               std::chrono::duration<double, std::nano>(t2 - t1).count() / rounds);
+        CHECK(len * 2 < (int) sizeof(struct_message));
+        totalCompact += len;
+    }
+    printf("  media: %d byte contro %d (-%d%%)\n", totalCompact / sampleCount, (int) sizeof(struct_message),
+           100 - totalCompact * 100 / (sampleCount * (int) sizeof(struct_message)));
+}
+
+int main() {
+    RUN_TEST(testRoundTrip);
+    RUN_TEST(testLegacyFrames);
+    RUN_TEST(testTruncation);
+    RUN_TEST(testCutFrames);
+    RUN_TEST(testUnknownTagsAndTypes);
+    RUN_TEST(testFuzzDecode);
+    RUN_TEST(testGroupRoundTrip);
+    RUN_TEST(testGroupRejects);
+    RUN_TEST(testFragmentEncoding);
+    RUN_TEST(testReassemblyOrders);
+    RUN_TEST(testReassemblyDrops);
+    RUN_TEST(testSendFragments);
+    RUN_TEST(benchmarkBytesPerType);
+    return hostTestResult();
+}
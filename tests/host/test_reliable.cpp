@@ -0,0 +1,159 @@
+// --- CONSEGNA AFFIDABILE --- //
+// Simulazione di sendReliable() su un link ESP-NOW con perdite configurabili: la
+// libreria fa sia da mittente sia da ricevente (i frame per il nodo rientrano come
+// se li avesse spediti lui), quindi ACK, ritrasmissioni e finestra anti-duplicati
+// sono quelli reali. Per ogni tasso di perdita: comandi consegnati, latenza p50/p99
+// e confronto con l'invio singolo di send().
+#include "HostTest.h"
+#include "DomoticaEspNow.h"
+#include <algorithm>
+#include <map>
+
+#define SIM_NODES       4
+#define SIM_COMMANDS    400
+#define SIM_INTERVAL_MS 40     // Un comando ogni 40 ms, a rotazione sui nodi
+
+static DomoticaEspNow espNow;
+static double lossRate = 0;
+static std::vector<HostFrame> reached;      // Frame arrivati al nodo, da rileggere
+static int failedCallbacks = 0;
+
+// Perdita indipendente del frame e della conferma radio: un frame arrivato con la
+// conferma persa viene ritrasmesso e produce un duplicato al ricevente
+static bool lossyLink(const HostFrame& f) {
+    bool arrived = hostRandom32() % 10000 >= lossRate * 10000;
+    if (!arrived) return false;
+    reached.push_back(f);
+    return hostRandom32() % 10000 >= lossRate * 10000;
+}
+
+struct SimResult {
+    int sent;
+    int delivered;
+    int duplicatesDelivered;
+    std::vector<unsigned long> latencies;
+};
+
+// Un millisecondo di radio: loop della libreria, conferme, poi i frame arrivati
+// rientrano dal nodo (dati con ACK_REQ e ACK per i frame del gateway)
+static void step(const std::map<std::string, unsigned long>& sentAt, std::map<std::string, int>& deliveries,
+                 SimResult& r) {
+    hostAdvance(1);
+    espNow.loop();
+    hostRunScheduled();
+    hostEspNowDeliverSent();
+
+    std::vector<HostFrame> batch;
+    batch.swap(reached);
+    for (const HostFrame& f : batch) {
+        struct_message out;
+        if (!DomoticaEspNow::decodeFrame(f.mac, f.data.data(), f.data.size(), &out)) continue;
+        auto it = sentAt.find(out.status);
+        if (it == sentAt.end()) continue;
+        if (deliveries[out.status]++ == 0) {
+            r.delivered++;
+            r.latencies.push_back(millis() - it->second);
+        } else {
+            r.duplicatesDelivered++;
+        }
+    }
+}
+
+static SimResult simulate(double loss, bool reliable, int firstNode) {
+    lossRate = loss;
+    SimResult r = {0, 0, 0, {}};
+    std::map<std::string, unsigned long> sentAt;
+    std::map<std::string, int> deliveries;
+
+    uint8_t macs[SIM_NODES][6];
+    for (int n = 0; n < SIM_NODES; n++) {
+        hostNodeMac(macs[n], firstNode + n);
+        DomoticaEspNow::setPeerProtocol(macs[n], DOMOTICA_PROTO_COMPACT, DOMOTICA_CAP_COMPACT | DOMOTICA_CAP_RELIABLE);
+    }
+
+    for (int c = 0; c < SIM_COMMANDS; c++) {
+        char status[20];
+        snprintf(status, sizeof(status), "c%d", c);
+        sentAt[status] = millis();
+        // Toggle: un duplicato consegnato invertirebbe il relè due volte
+        if (reliable) {
+            espNow.sendReliable(macs[c % SIM_NODES], "GATEWAY", "relay_1", "2", status, "COMMAND", "GW_TEST");
+        } else {
+            espNow.send(macs[c % SIM_NODES], "GATEWAY", "relay_1", "2", status, "COMMAND", "GW_TEST");
+        }
+        r.sent++;
+        for (int t = 0; t < SIM_INTERVAL_MS; t++) step(sentAt, deliveries, r);
+    }
+    // Coda e ritrasmissioni esaurite (backoff massimo ben sotto i 2 s)
+    for (int t = 0; t < 2000; t++) step(sentAt, deliveries, r);
+    return r;
+}
+
+static unsigned long percentile(std::vector<unsigned long> v, int p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[(v.size() - 1) * p / 100];
+}
+
+static void onFailed(const uint8_t*, uint16_t) {
+    failedCallbacks++;
+}
+
+static void testLossRates() {
+    hostSetMillis(1000);
+    espNow.begin(true);
+    DomoticaEspNow::onDeliveryFailed(onFailed);
+    hostEspNowSetLink(lossyLink);
+
+    const double rates[] = {0.0, 0.05, 0.1, 0.2, 0.3, 0.5};
+    printf("  %-7s %12s %9s %9s %9s %12s\n", "perdita", "affidabile", "p50 ms", "p99 ms", "retry", "send()");
+    int firstNode = 10;
+    for (double loss : rates) {
+        SimResult plain = simulate(loss, false, firstNode);
+        firstNode += SIM_NODES;
+
+        int failedBefore = failedCallbacks;
+        SimResult rel = simulate(loss, true, firstNode);
+        uint32_t retries = 0, failed = 0, duplicates = 0;
+        for (int n = 0; n < SIM_NODES; n++) {
+            uint8_t mac[6];
+            DomoticaPeerStats ps;
+            hostNodeMac(mac, firstNode + n);
+            if (DomoticaEspNow::getPeerStats(mac, &ps)) {
+                retries += ps.retries;
+                failed += ps.failed;
+                duplicates += ps.duplicates;
+            }
+        }
+        firstNode += SIM_NODES;
+
+        double ratio = (double) rel.delivered / rel.sent;
+        double plainRatio = (double) plain.delivered / plain.sent;
+        unsigned long p99 = percentile(rel.latencies, 99);
+        printf("  %5.0f%% %11.1f%% %9lu %9lu %9u %11.1f%%\n", loss * 100, ratio * 100,
+               percentile(rel.latencies, 50), p99, (unsigned) retries, plainRatio * 100);
+
+        // Nessun comando eseguito due volte, anche con ritrasmissioni e ACK persi
+        CHECK_EQ(rel.duplicatesDelivered, 0);
+        CHECK_EQ(plain.duplicatesDelivered, 0);
+        CHECK_EQ(failedCallbacks - failedBefore, failed);
+        if (loss == 0) {
+            CHECK_EQ(rel.delivered, rel.sent);
+            CHECK_EQ(retries, 0);
+            CHECK_EQ(duplicates, 0);
+            CHECK(p99 <= 5);
+        }
+        if (loss > 0 && loss <= 0.2) {
+            CHECK(ratio >= 0.99);
+            CHECK(ratio > plainRatio);
+            CHECK(p99 < 1000);
+        }
+        if (loss >= 0.1) CHECK(duplicates > 0);   // Le ritrasmissioni da ACK perso sono state filtrate
+    }
+    hostEspNowSetLink(nullptr);
+}
+
+int main() {
+    RUN_TEST(testLossRates);
+    return hostTestResult();
+}
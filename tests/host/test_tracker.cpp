@@ -0,0 +1,392 @@
+// --- COMANDI IN ATTESA --- //
+// CommandTracker attraverso il gateway: comandi diretti e batch verso nodi emulati che
+// rispondono (o no) con il feedback. La rimozione di un peer chiude solo i suoi comandi
+// (command_failed ed esito "failed" del target di batch), quelli degli altri nodi
+// restano legati al MAC giusto anche se gli indici in peerList scorrono. Poi limiti del
+// documento JSON dei batch, scadenza con ritrasmissione, pool pieno, comandi di gruppo
+// (un frame e un comando in attesa con DOMOTICA_CAP_GROUP, uno per relè senza) e stima
+// RTT: SRTT/RTTVAR/RTO calcolati a mano, limiti dell'RTO, Karn, percentili e heartbeat.
+#include "HostTest.h"
+#include "CommandTracker.h"
+#include "CommandBatch.h"
+#include "PeerHandler.h"
+#include "PeerIndex.h"
+#include "MqttTopics.h"
+#include "MqttHandler.h"
+#include <ArduinoJson.h>
+#include <DomoticaEspNow.h>
+#include <set>
+
+static void nodeMacString(char* out, size_t size, int n) {
+    uint8_t mac[6];
+    hostNodeMac(mac, n);
+    snprintf(out, size, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void registerNode(int n, const char* node) {
+    uint8_t mac[6];
+    hostNodeMac(mac, n);
+    hostNodeRegister(mac, node, "4_RELAY_CONTROLLER");
+    hostLoopFor(20);
+}
+
+static void directCommand(const char* node, const char* entity) {
+    char topic[MQTT_TOPIC_MAX];
+    snprintf(topic, sizeof(topic), "domoriky/nodo/%s/%s/set", node, entity);
+    hostMqttInject(topic, "ON");
+    hostLoopFor(5);
+}
+
+static void feedback(int n, const char* node, const char* entity) {
+    uint8_t mac[6];
+    hostNodeMac(mac, n);
+    hostNodeSend(mac, node, entity, "1", "1000", "FEEDBACK");
+    hostLoopFor(5);
+}
+
+// Publish su topic da from in poi che contengono needle
+static int published(const char* topic, const char* needle, size_t from) {
+    int n = 0;
+    for (size_t p = from; p < hostMqttPublished().size(); p++) {
+        const HostPublish& pub = hostMqttPublished()[p];
+        if (pub.topic == topic && pub.payload.find(needle) != std::string::npos) n++;
+    }
+    return n;
+}
+
+static void testRemovePeerKeepsOthers() {
+    registerNode(0x100, "NODE_A");
+    registerNode(0x101, "NODE_B");
+    registerNode(0x102, "NODE_C");
+    CHECK_EQ(findPeerByNodeId("NODE_A"), 0);
+
+    uint32_t resolved = commandsResolved, failed = commandsFailed;
+    directCommand("NODE_A", "relay_1");
+    directCommand("NODE_B", "relay_1");
+    directCommand("NODE_C", "relay_2");
+    CHECK_EQ(commandTrackerPending(), 3);
+
+    // NODE_A esce da peerList: B e C scalano di un indice
+    size_t from = hostMqttPublished().size();
+    char mac[18];
+    nodeMacString(mac, sizeof(mac), 0x100);
+    removePeer(mac);
+    CHECK_EQ(findPeerByNodeId("NODE_B"), 0);
+    CHECK_EQ(commandTrackerPending(), 2);
+    CHECK_EQ(commandsFailed - failed, 1);
+    const char* status = mqttTopic(TOPIC_GATEWAY_STATUS);
+    CHECK_EQ(published(status, "command_failed", from), 1);
+    CHECK_EQ(published(status, "NODE_A/relay_1", from), 1);
+
+    // Le risposte di B e C chiudono i loro comandi, nessun altro fallimento
+    feedback(0x101, "NODE_B", "relay_1");
+    feedback(0x102, "NODE_C", "relay_2");
+    CHECK_EQ(commandsResolved - resolved, 2);
+    CHECK_EQ(commandTrackerPending(), 0);
+    hostLoopFor(3 * COMMAND_RTO_MAX_MS, 10);
+    CHECK_EQ(commandsFailed - failed, 1);
+    CHECK_EQ(published(status, "command_failed", from), 1);
+}
+
+static void testBatchOutcomeOfRemovedPeer() {
+    registerNode(0x200, "NODE_D");
+    registerNode(0x201, "NODE_E");
+
+    size_t from = hostMqttPublished().size();
+    std::string batch =
+        "{\"batch\":\"sera\",\"targets\":[[\"NODE_D\",\"relay_1\",\"ON\"],[\"NODE_E\",\"relay_1\",\"ON\"]]}";
+    hostMqttInject(mqttTopic(TOPIC_NODE_BATCH), batch);
+    hostLoopFor(4 * BATCH_PACE_MS);
+    CHECK(commandBatchActive());
+    CHECK_EQ(commandTrackerPending(), 2);
+
+    // NODE_D rimosso con il suo target in attesa, NODE_E risponde: batch chiuso subito
+    char mac[18];
+    nodeMacString(mac, sizeof(mac), 0x200);
+    removePeer(mac);
+    feedback(0x201, "NODE_E", "relay_1");
+    hostLoopFor(10);
+    CHECK(!commandBatchActive());
+
+    const char* result = mqttTopic(TOPIC_NODE_BATCH_RESULT);
+    CHECK_EQ(published(result, "\"batch\":\"sera\"", from), 1);
+    CHECK_EQ(published(result, "\"ok\":1,\"failed\":1", from), 1);
+    CHECK_EQ(published(result, "\"node\":\"NODE_D\",\"entity\":\"relay_1\",\"action\":\"ON\",\"result\":\"failed\"", from), 1);
+    CHECK_EQ(published(result, "\"node\":\"NODE_E\",\"entity\":\"relay_1\",\"action\":\"ON\",\"result\":\"ok\"", from), 1);
+}
+
+// Batch di count target verso nodi inesistenti (tutti "invalid": risultato immediato)
+static std::string batchOf(int count, bool compact) {
+    std::string json = "{\"batch\":\"max\",\"targets\":[";
+    for (int k = 0; k < count; k++) {
+        char target[80];
+        if (compact) {
+            snprintf(target, sizeof(target), "%s[\"NODE_X%d\",\"relay_1\",\"ON\"]", k ? "," : "", k);
+        } else {
+            snprintf(target, sizeof(target), "%s{\"node\":\"NODE_X%d\",\"entity\":\"relay_1\",\"action\":\"ON\"}",
+                     k ? "," : "", k);
+        }
+        json += target;
+    }
+    return json + "]}";
+}
+
+static void testBatchLimits() {
+    const char* result = mqttTopic(TOPIC_NODE_BATCH_RESULT);
+    char full[24];
+    snprintf(full, sizeof(full), "\"failed\":%d", BATCH_MAX_TARGETS);
+
+    // Il batch più grande entra nel documento in entrambe le forme
+    for (bool compact : {false, true}) {
+        size_t from = hostMqttPublished().size();
+        hostMqttInject(mqttTopic(TOPIC_NODE_BATCH), batchOf(BATCH_MAX_TARGETS, compact));
+        hostLoopFor(10);
+        CHECK_EQ(published(result, full, from), 1);
+        CHECK_EQ(published(result, "\"error\"", from), 0);
+    }
+
+    // Oltre il massimo, JSON troncato o non valido: sempre un risultato con l'errore
+    const std::string rejected[] = {
+        batchOf(BATCH_MAX_TARGETS + 1, false),
+        batchOf(BATCH_MAX_TARGETS + 1, true),
+        "{\"batch\":\"rotto\",\"targets\":[[\"NODE_X\",\"relay_1\"",
+        "batch",
+    };
+    for (const std::string& payload : rejected) {
+        size_t from = hostMqttPublished().size();
+        hostMqttInject(mqttTopic(TOPIC_NODE_BATCH), payload);
+        hostLoopFor(10);
+        CHECK_EQ(published(result, "\"error\":\"invalid_json\"", from), 1);
+    }
+
+    // Target a due campi: il documento li contiene, il conteggio li respinge
+    std::string shortTargets = "{\"batch\":\"corti\",\"targets\":[";
+    for (int k = 0; k <= BATCH_MAX_TARGETS; k++) shortTargets += std::string(k ? "," : "") + "[\"N\",\"relay_1\"]";
+    shortTargets += "]}";
+    size_t from = hostMqttPublished().size();
+    hostMqttInject(mqttTopic(TOPIC_NODE_BATCH), shortTargets);
+    hostLoopFor(10);
+    CHECK_EQ(published(result, "\"error\":\"too_many_targets\"", from), 1);
+}
+
+static void testExpiryAndRetries() {
+    registerNode(0x300, "NODE_F");
+    uint32_t timeouts = commandTimeouts, retries = commandRetries, failed = commandsFailed;
+    size_t from = hostMqttPublished().size();
+
+    // ON esplicito (idempotente) senza risposta: ritrasmesso, poi fallito
+    directCommand("NODE_F", "relay_3");
+    hostLoopFor(4 * COMMAND_RTO_MAX_MS, 10);
+    CHECK_EQ(commandTrackerPending(), 0);
+    CHECK_EQ(commandRetries - retries, COMMAND_MAX_RETRIES);
+    CHECK_EQ(commandTimeouts - timeouts, COMMAND_MAX_RETRIES + 1);
+    CHECK_EQ(commandsFailed - failed, 1);
+    CHECK_EQ(published(mqttTopic(TOPIC_GATEWAY_STATUS), "command_failed", from), 1);
+}
+
+// Comando di gruppo ricevuto dal broker sul topic CONTROL del nodo
+static void controlCommand(const char* node, const char* command) {
+    std::string payload = std::string("{\"Node\":\"") + node + "\",\"Topic\":\"CONTROL\",\"Command\":\"" +
+                          command + "\",\"Status\":\"\",\"Type\":\"COMMAND\"}";
+    hostMqttInject(mqttTopic(TOPIC_NODE_COMMAND), payload);
+    hostLoopFor(5);
+}
+
+// Frame distinti (per seq, le ritrasmissioni non contano) verso il nodo da from in poi
+static std::vector<struct_message> framesTo(int n, size_t from) {
+    uint8_t mac[6];
+    hostNodeMac(mac, n);
+    std::vector<struct_message> out;
+    std::set<uint16_t> seqs;
+    for (size_t f = from; f < hostEspNowSent().size(); f++) {
+        const HostFrame& frame = hostEspNowSent()[f];
+        struct_message msg;
+        DomoticaFrameInfo info;
+        if (memcmp(frame.mac, mac, 6) != 0) continue;
+        if (!domoticaDecodeFrame(frame.data.data(), frame.data.size(), &msg, &info)) continue;
+        if (seqs.insert(info.seq).second) out.push_back(msg);
+    }
+    return out;
+}
+
+static void testGroupCommand() {
+    const uint32_t caps = DOMOTICA_CAP_COMPACT | DOMOTICA_CAP_RELIABLE;
+    uint8_t mac[6];
+    registerNode(0x500, "NODE_H");
+    hostNodeMac(mac, 0x500);
+    DomoticaEspNow::setPeerProtocol(mac, DOMOTICA_PROTO_COMPACT, caps | DOMOTICA_CAP_GROUP);
+    registerNode(0x501, "NODE_I");
+    hostNodeMac(mac, 0x501);
+    DomoticaEspNow::setPeerProtocol(mac, DOMOTICA_PROTO_COMPACT, caps);
+
+    // Nodo con DOMOTICA_CAP_GROUP: un frame per i quattro relè, un comando in attesa
+    uint32_t resolved = commandsResolved, groups = groupCommandsSent;
+    size_t from = hostEspNowSent().size();
+    controlCommand("NODE_H", "ALL_OFF");
+    std::vector<struct_message> frames = framesTo(0x500, from);
+    CHECK_EQ(frames.size(), 1);
+    if (frames.size() == 1) {
+        CHECK_STR(frames[0].topic, DOMOTICA_GROUP_TOPIC);
+        CHECK_STR(frames[0].command, "F");
+        CHECK_STR(frames[0].status, "0000");
+    }
+    CHECK_EQ(commandTrackerPending(), 1);
+    CHECK_EQ(groupCommandsSent - groups, 1);
+
+    // Il FEEDBACK di gruppo chiude il comando e aggiorna lo stato dei relè
+    hostNodeMac(mac, 0x500);
+    hostNodeSend(mac, "NODE_H", DOMOTICA_GROUP_TOPIC, "F", "0000", "FEEDBACK");
+    hostLoopFor(5);
+    CHECK_EQ(commandTrackerPending(), 0);
+    CHECK_EQ(commandsResolved - resolved, 1);
+    CHECK_STR(peerList[findPeerByNodeId("NODE_H")].attributes, "0000");
+
+    // Senza la capability: un frame e un comando in attesa per relè
+    from = hostEspNowSent().size();
+    controlCommand("NODE_I", "ALL_OFF");
+    frames = framesTo(0x501, from);
+    CHECK_EQ(frames.size(), 4);
+    for (size_t k = 0; k < frames.size(); k++) {
+        char entity[20];
+        snprintf(entity, sizeof(entity), "relay_%d", (int) k + 1);
+        CHECK_STR(frames[k].topic, entity);
+        CHECK_STR(frames[k].command, "0");
+    }
+    CHECK_EQ(commandTrackerPending(), 4);
+    CHECK_EQ(groupCommandsSent - groups, 1);
+    commandTrackerClear();
+}
+
+// --- STIMA RTT --- //
+// Comando tracciato e risposta dopo delayMs (senza giri del loop: nessuna scadenza)
+static void roundTrip(int peer, unsigned long delayMs) {
+    commandTrackerAdd(peer, "relay_1", "1", "", true);
+    hostAdvance(delayMs);
+    CHECK(commandTrackerResolve(peer, "relay_1"));
+}
+
+static void checkRtt(int peer, unsigned srtt, unsigned rttvar, unsigned rto) {
+    const PeerRtt& rtt = peerList[peer].rtt;
+    CHECK_EQ(rtt.srtt8 >> 3, srtt);
+    CHECK_EQ(rtt.rttvar4 >> 2, rttvar);
+    CHECK_EQ(commandTrackerRto(peer), rto);
+}
+
+static void testRttEstimator() {
+    registerNode(0x600, "NODE_R");
+    int peer = findPeerByNodeId("NODE_R");
+    CHECK(peer >= 0);
+    if (peer < 0) return;
+    CHECK_EQ(commandTrackerRto(peer), COMMAND_RTO_INITIAL_MS);
+
+    // RTO = SRTT + max(tick della wheel, 4*RTTVAR)
+    roundTrip(peer, 100);   // SRTT = 100, RTTVAR = 50
+    checkRtt(peer, 100, 50, 300);
+    roundTrip(peer, 200);   // err 100: SRTT 112 (900/8), RTTVAR 62 (250/4)
+    checkRtt(peer, 112, 62, 362);
+    roundTrip(peer, 50);    // err -62: SRTT 104 (838/8), RTTVAR 62 (250/4)
+    checkRtt(peer, 104, 62, 354);
+    roundTrip(peer, 400);   // err 296: SRTT 141 (1134/8), RTTVAR 121 (484/4)
+    checkRtt(peer, 141, 121, 625);
+
+    // Percentili nearest-rank su 50, 100, 200, 400
+    uint16_t p50, p95;
+    commandTrackerPercentiles(peer, &p50, &p95);
+    CHECK_EQ(p50, 100);
+    CHECK_EQ(p95, 400);
+
+    // Oltre PEER_RTT_SAMPLES restano gli ultimi: 200 50 400 10 20 30 40 60
+    for (unsigned long ms : {10, 20, 30, 40, 60}) roundTrip(peer, ms);
+    CHECK_EQ(peerList[peer].rtt.sampleCount, PEER_RTT_SAMPLES);
+    commandTrackerPercentiles(peer, &p50, &p95);
+    CHECK_EQ(p50, 40);
+    CHECK_EQ(p95, 400);
+
+    // Heartbeat: una voce per il nodo con gli stessi valori
+    const PeerRtt rtt = peerList[peer].rtt;
+    size_t from = hostMqttPublished().size();
+    sendGatewayHeartbeat();
+    bool found = false;
+    for (size_t p = from; p < hostMqttPublished().size(); p++) {
+        DynamicJsonDocument doc(8192);
+        if (deserializeJson(doc, hostMqttPublished()[p].payload.c_str())) continue;
+        JsonArray entries = doc["rtt"].as<JsonArray>();
+        for (JsonVariant entry : entries) {
+            if (entry["node"].as<String>() != "NODE_R") continue;
+            found = true;
+            CHECK_EQ(entry["srtt"].as<unsigned>(), (unsigned) (rtt.srtt8 >> 3));
+            CHECK_EQ(entry["rttvar"].as<unsigned>(), (unsigned) (rtt.rttvar4 >> 2));
+            CHECK_EQ(entry["rto"].as<unsigned>(), (unsigned) commandTrackerRto(peer));
+            CHECK_EQ(entry["p50"].as<unsigned>(), 40);
+            CHECK_EQ(entry["p95"].as<unsigned>(), 400);
+            CHECK_EQ(entry["samples"].as<unsigned>(), PEER_RTT_SAMPLES);
+        }
+    }
+    CHECK(found);
+}
+
+static void testRttClampAndKarn() {
+    registerNode(0x601, "NODE_S");
+    registerNode(0x602, "NODE_T");
+    int fast = findPeerByNodeId("NODE_S");
+    int slow = findPeerByNodeId("NODE_T");
+    CHECK(fast >= 0 && slow >= 0);
+    if (fast < 0 || slow < 0) return;
+
+    // Risposte immediate: SRTT + tick sotto il minimo
+    for (int k = 0; k < 20; k++) roundTrip(fast, 1);
+    CHECK(peerList[fast].rtt.srtt8 >> 3 <= 2);
+    CHECK_EQ(commandTrackerRto(fast), COMMAND_RTO_MIN_MS);
+
+    // Risposta dopo 20 s: SRTT saturo a 0xFFFF/8, RTO fermo al massimo
+    roundTrip(slow, 20000);
+    CHECK_EQ(peerList[slow].rtt.srtt8, 0xFFFF);
+    CHECK_EQ(commandTrackerRto(slow), COMMAND_RTO_MAX_MS);
+
+    // Karn: la risposta a un comando ritrasmesso non produce campioni
+    const PeerRtt before = peerList[fast].rtt;
+    uint32_t retries = commandRetries;
+    commandTrackerAdd(fast, "relay_2", "1", "", true);
+    hostLoopFor(COMMAND_RTO_MIN_MS + 2 * COMMAND_WHEEL_TICK, 10);
+    CHECK_EQ(commandRetries - retries, 1);
+    CHECK(commandTrackerResolve(fast, "relay_2"));
+    CHECK_EQ(peerList[fast].rtt.srtt8, before.srtt8);
+    CHECK_EQ(peerList[fast].rtt.rttvar4, before.rttvar4);
+    CHECK_EQ(peerList[fast].rtt.sampleCount, before.sampleCount);
+    CHECK_EQ(peerList[fast].rtt.sampleNext, before.sampleNext);
+}
+
+static void testPoolExhaustion() {
+    registerNode(0x400, "NODE_G");
+    uint32_t exhausted = commandPoolExhausted;
+    int peer = findPeerByNodeId("NODE_G");
+    CHECK(peer >= 0);
+    if (peer < 0) return;
+
+    // Un'entità diversa per comando: il pool si riempie e l'eccedenza viene contata
+    for (int k = 0; k < COMMAND_POOL_SIZE + 3; k++) {
+        char entity[12];
+        snprintf(entity, sizeof(entity), "relay_%d", k + 1);
+        commandTrackerAdd(peer, entity, "1", "", false);
+    }
+    CHECK_EQ(commandTrackerPending(), COMMAND_POOL_SIZE);
+    CHECK_EQ(commandPoolHighWater, COMMAND_POOL_SIZE);
+    CHECK_EQ(commandPoolExhausted - exhausted, 3);
+
+    // La tabella svuotata chiude tutto
+    commandTrackerClear();
+    CHECK_EQ(commandTrackerPending(), 0);
+}
+
+int main() {
+    CHECK(hostBoot());
+    RUN_TEST(testRemovePeerKeepsOthers);
+    RUN_TEST(testBatchOutcomeOfRemovedPeer);
+    RUN_TEST(testBatchLimits);
+    RUN_TEST(testExpiryAndRetries);
+    RUN_TEST(testGroupCommand);
+    RUN_TEST(testRttEstimator);
+    RUN_TEST(testRttClampAndKarn);
+    RUN_TEST(testPoolExhaustion);
+    return hostTestResult();
+}